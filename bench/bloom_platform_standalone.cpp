@@ -0,0 +1,110 @@
+// bloom_platform.hpp for builds outside a backend: the C allocator, a port
+// of the server's hash_any (lookup3, as in common/hashfn.c) and a
+// table-driven CRC-32C. Both produce the server's values on little-endian
+// machines, so filters built here probe and serialize as they would there.
+
+#include "bloom_platform.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+void* bloom_platform_alloc(size_t bytes) {
+    void* ptr = malloc(bytes);
+    if (!ptr) {
+        fprintf(stderr, "out of memory allocating %zu bytes\n", bytes);
+        abort();
+    }
+    return ptr;
+}
+
+void bloom_platform_free(void* ptr) {
+    free(ptr);
+}
+
+static inline uint32_t rot(uint32_t x, int k) {
+    return (x << k) | (x >> (32 - k));
+}
+
+static inline void mix(uint32_t& a, uint32_t& b, uint32_t& c) {
+    a -= c; a ^= rot(c, 4);  c += b;
+    b -= a; b ^= rot(a, 6);  a += c;
+    c -= b; c ^= rot(b, 8);  b += a;
+    a -= c; a ^= rot(c, 16); c += b;
+    b -= a; b ^= rot(a, 19); a += c;
+    c -= b; c ^= rot(b, 4);  b += a;
+}
+
+static inline void final(uint32_t& a, uint32_t& b, uint32_t& c) {
+    c ^= b; c -= rot(b, 14);
+    a ^= c; a -= rot(c, 11);
+    b ^= a; b -= rot(a, 25);
+    c ^= b; c -= rot(b, 16);
+    a ^= c; a -= rot(c, 4);
+    b ^= a; b -= rot(a, 14);
+    c ^= b; c -= rot(b, 24);
+}
+
+static inline uint32_t load32(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint32_t bloom_platform_hash_any(const void* data, size_t length) {
+    const uint8_t* k = static_cast<const uint8_t*>(data);
+    uint32_t len = static_cast<uint32_t>(length);
+    uint32_t a, b, c;
+    a = b = c = 0x9e3779b9 + len + 3923095;
+
+    while (len >= 12) {
+        a += load32(k);
+        b += load32(k + 4);
+        c += load32(k + 8);
+        mix(a, b, c);
+        k += 12;
+        len -= 12;
+    }
+
+    // The lowest byte of c is reserved for the length
+    switch (len) {
+        case 11: c += static_cast<uint32_t>(k[10]) << 24; [[fallthrough]];
+        case 10: c += static_cast<uint32_t>(k[9]) << 16; [[fallthrough]];
+        case 9: c += static_cast<uint32_t>(k[8]) << 8; [[fallthrough]];
+        case 8: b += static_cast<uint32_t>(k[7]) << 24; [[fallthrough]];
+        case 7: b += static_cast<uint32_t>(k[6]) << 16; [[fallthrough]];
+        case 6: b += static_cast<uint32_t>(k[5]) << 8; [[fallthrough]];
+        case 5: b += k[4]; [[fallthrough]];
+        case 4: a += static_cast<uint32_t>(k[3]) << 24; [[fallthrough]];
+        case 3: a += static_cast<uint32_t>(k[2]) << 16; [[fallthrough]];
+        case 2: a += static_cast<uint32_t>(k[1]) << 8; [[fallthrough]];
+        case 1: a += k[0];
+    }
+
+    final(a, b, c);
+    return c;
+}
+
+struct Crc32cTable {
+    uint32_t entries[256];
+
+    constexpr Crc32cTable() : entries() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit) {
+                crc = (crc >> 1) ^ ((crc & 1) ? 0x82F63B78U : 0);  // Reflected Castagnoli
+            }
+            entries[i] = crc;
+        }
+    }
+};
+
+static constexpr Crc32cTable kCrc32cTable;
+
+uint32_t bloom_platform_crc32c(uint32_t crc, const void* data, size_t length) {
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < length; ++i) {
+        crc = kCrc32cTable.entries[(crc ^ p[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
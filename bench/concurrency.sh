@@ -0,0 +1,37 @@
+#!/bin/sh
+# Throughput scaling of concurrent filter reads and trigger-driven adds.
+#
+# Usage: bench/concurrency.sh [dbname] [seconds per step] [filter_type]
+#
+# Runs a 90% lookup / 10% insert pgbench mix at 1 to 64 clients and prints
+# tps per step. Requires octo_bloom in shared_preload_libraries so the
+# registry and striped locks live in the named LWLock tranche.
+
+set -e
+
+DB=${1:-postgres}
+DURATION=${2:-10}
+FILTER_TYPE=${3:-blocked}
+DIR=$(dirname "$0")/pgbench
+CPUS=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)
+
+psql -q -X -v ON_ERROR_STOP=1 -d "$DB" <<SQL
+CREATE EXTENSION IF NOT EXISTS octo_bloom;
+DROP TABLE IF EXISTS octo_bench_signup;
+CREATE TABLE octo_bench_signup (id bigserial PRIMARY KEY, email text NOT NULL);
+SELECT octo_bloom_init('octo_bench_signup', 'email', 20000000, 0.001, '$FILTER_TYPE');
+CREATE TRIGGER octo_bench_signup_bloom AFTER INSERT ON octo_bench_signup
+    FOR EACH ROW EXECUTE FUNCTION octo_bloom_insert_trigger();
+SQL
+
+printf "%8s %12s\n" clients tps
+for clients in 1 2 4 8 16 32 64; do
+    jobs=$clients
+    [ "$jobs" -gt "$CPUS" ] && jobs=$CPUS
+    tps=$(pgbench -n -M prepared -T "$DURATION" -c "$clients" -j "$jobs" \
+              -f "$DIR/lookup.sql@9" -f "$DIR/signup.sql@1" "$DB" |
+          awk '/^tps/ { print $3; exit }')
+    printf "%8d %12s\n" "$clients" "$tps"
+done
+
+psql -q -X -d "$DB" -c "DROP TABLE octo_bench_signup"
@@ -0,0 +1,139 @@
+// Benchmark of OctoBloomFilter outside the server, linked against
+// bloom_platform_standalone.cpp.
+//
+// Usage: octo_bloom_bench [max_size_bytes] [false_positive_rate]
+//
+// For each filter size (L1 to DRAM resident, up to max_size_bytes) and each
+// layout, fills a filter to its expected count and reports ns per add, ns
+// per lookup one key at a time and through mightContainBatch, and the false
+// positive rate measured on absent keys next to the one the sizing predicts
+// and the one estimateFill derives from the bits. Lookups are half hits and
+// half misses, as in kernel_bench.cpp.
+
+#include "bloom_filter.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+static inline uint64_t splitmix64(uint64_t x) {
+    uint64_t z = x + 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Keys inserted have the top bit clear, absent keys have it set, so a
+// probe for an absent key that succeeds is a false positive
+static inline uint64_t present_key(uint64_t i) {
+    return splitmix64(i) & ~(1ULL << 63);
+}
+
+static inline uint64_t absent_key(uint64_t i) {
+    return splitmix64(i ^ 0x5bd1e9955bd1e995ULL) | (1ULL << 63);
+}
+
+static double elapsed_ns(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+}
+
+static const char* layout_name(BloomLayout layout) {
+    switch (layout) {
+        case BloomLayout::Standard: return "standard";
+        case BloomLayout::Blocked: return "blocked";
+        case BloomLayout::Counting: return "counting";
+    }
+    return "?";
+}
+
+int main(int argc, char** argv) {
+    size_t max_size = argc > 1 ? strtoull(argv[1], nullptr, 10) : (size_t)256 << 20;
+    double fpr = argc > 2 ? atof(argv[2]) : 0.01;
+    if (fpr <= 0.0 || fpr >= 1.0) {
+        fprintf(stderr, "false_positive_rate must be between 0 and 1\n");
+        return 1;
+    }
+
+    const size_t sizes[] = {32 << 10, 1 << 20, 16 << 20, (size_t)256 << 20};
+    const BloomLayout layouts[] = {BloomLayout::Standard, BloomLayout::Blocked,
+                                   BloomLayout::Counting};
+    const size_t num_ops = 4 << 20;
+    const size_t batch = OctoBloomFilter::kProbeBatch;
+    // Bits per key at the requested rate, for sizing filters to a byte count
+    const double bits_per_key = -std::log(fpr) / (std::log(2.0) * std::log(2.0));
+
+    uint64_t* probes = static_cast<uint64_t*>(malloc(num_ops * sizeof(uint64_t)));
+    const void** pointers = static_cast<const void**>(malloc(num_ops * sizeof(void*)));
+    size_t* lengths = static_cast<size_t*>(malloc(num_ops * sizeof(size_t)));
+    bool* results = static_cast<bool*>(malloc(num_ops * sizeof(bool)));
+
+    printf("%-10s %-9s %10s %10s %12s %12s %10s %10s %10s\n", "size", "layout", "keys",
+           "ns/add", "ns/lookup", "ns/batched", "fpr", "predicted", "estimated");
+
+    for (size_t size : sizes) {
+        if (size > max_size) {
+            break;
+        }
+        for (BloomLayout layout : layouts) {
+            double bits = size * 8.0;
+            if (layout == BloomLayout::Counting) {
+                bits /= OctoBloomFilter::kCounterBits;
+            }
+            uint64_t expected = static_cast<uint64_t>(bits / bits_per_key);
+            OctoBloomFilter filter(expected, fpr, layout);
+
+            auto start = std::chrono::steady_clock::now();
+            for (uint64_t i = 0; i < expected; ++i) {
+                uint64_t key = present_key(i);
+                filter.add(&key, sizeof(key));
+            }
+            double add_ns = elapsed_ns(start) / expected;
+
+            // Even slots hit, odd slots miss
+            for (size_t i = 0; i < num_ops; ++i) {
+                probes[i] = (i & 1) ? absent_key(i) : present_key(splitmix64(i) % expected);
+                pointers[i] = &probes[i];
+                lengths[i] = sizeof(uint64_t);
+            }
+
+            size_t hits = 0;
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < num_ops; ++i) {
+                hits += filter.mightContain(&probes[i], sizeof(uint64_t));
+            }
+            double lookup_ns = elapsed_ns(start) / num_ops;
+
+            start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < num_ops; i += batch) {
+                filter.mightContainBatch(pointers + i, lengths + i, batch, results + i);
+            }
+            double batch_ns = elapsed_ns(start) / num_ops;
+
+            size_t false_positives = 0;
+            for (size_t i = 0; i < num_ops; ++i) {
+                if (!results[i] && !(i & 1)) {
+                    fprintf(stderr, "%s filter reported a false negative\n", layout_name(layout));
+                    return 1;
+                }
+                false_positives += results[i] && (i & 1);
+            }
+            if (hits != num_ops / 2 + false_positives) {
+                fprintf(stderr, "%s filter: batched and scalar lookups disagree\n",
+                        layout_name(layout));
+                return 1;
+            }
+
+            FilterFillEstimate fill = filter.estimateFill(1 << 16);
+            printf("%-10zu %-9s %10llu %10.2f %12.2f %12.2f %10.5f %10.5f %10.5f\n", size,
+                   layout_name(layout), (unsigned long long)expected, add_ns, lookup_ns,
+                   batch_ns, (double)false_positives / (num_ops / 2),
+                   filter.getEffectiveFalsePositiveRate(), fill.false_positive_rate);
+        }
+    }
+
+    free(results);
+    free(lengths);
+    free(pointers);
+    free(probes);
+    return 0;
+}
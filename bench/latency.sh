@@ -0,0 +1,41 @@
+#!/bin/sh
+# Latency of octo_bloom_might_contain and octo_bloom_exists under load.
+#
+# Usage: bench/latency.sh [dbname] [seconds per step] [filter_type]
+#
+# Runs each of the hit and miss probe scripts alone at 1 to 256 clients and
+# prints tps and average latency per step. Needs max_connections of at least
+# 260 and octo_bloom in shared_preload_libraries.
+
+set -e
+
+DB=${1:-postgres}
+DURATION=${2:-10}
+FILTER_TYPE=${3:-blocked}
+DIR=$(dirname "$0")/pgbench
+CPUS=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 4)
+
+psql -q -X -v ON_ERROR_STOP=1 -d "$DB" <<SQL
+CREATE EXTENSION IF NOT EXISTS octo_bloom;
+DROP TABLE IF EXISTS octo_bench_latency;
+CREATE TABLE octo_bench_latency (id bigint PRIMARY KEY);
+INSERT INTO octo_bench_latency SELECT g FROM generate_series(1, 1000000) g;
+SELECT octo_bloom_init('octo_bench_latency', 'id', 1000000, 0.01, '$FILTER_TYPE');
+SELECT octo_bloom_rebuild('octo_bench_latency', 'id');
+SQL
+
+printf "%-20s %8s %12s %12s\n" script clients tps latency_ms
+for script in might_contain_hit might_contain_miss exists_hit exists_miss; do
+    for clients in 1 2 4 8 16 32 64 128 256; do
+        jobs=$clients
+        [ "$jobs" -gt "$CPUS" ] && jobs=$CPUS
+        pgbench -n -M prepared -T "$DURATION" -c "$clients" -j "$jobs" \
+                -f "$DIR/$script.sql" "$DB" |
+            awk -v script="$script" -v clients="$clients" '
+                /^latency average/ { latency = $4 }
+                /^tps/ { tps = $3 }
+                END { printf "%-20s %8d %12s %12s\n", script, clients, tps, latency }'
+    done
+done
+
+psql -q -X -d "$DB" -c "DROP TABLE octo_bench_latency"
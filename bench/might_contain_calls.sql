@@ -0,0 +1,51 @@
+-- Per-row call throughput of octo_bloom_might_contain / octo_bloom_exists.
+--
+-- Run with: psql -d <db> -f bench/might_contain_calls.sql
+--
+-- Every scalar call site caches its resolved filter handle in fn_extra, so
+-- repeated calls in one scan skip get_attnum() and the registry lookup. The
+-- "uncached" rows alternate the column argument on every call, which forces
+-- the full resolution each time and approximates the previous behaviour.
+
+\set ON_ERROR_STOP on
+\set rows 1000000
+
+DROP TABLE IF EXISTS octo_bench_users;
+CREATE TABLE octo_bench_users (email text, alt_email text);
+INSERT INTO octo_bench_users
+SELECT 'user' || g || '@example.com', 'alt' || g || '@example.com'
+FROM generate_series(1, :rows) g;
+
+SELECT octo_bloom_init('octo_bench_users', 'email', :rows, 0.01);
+SELECT octo_bloom_init('octo_bench_users', 'alt_email', :rows, 0.01);
+
+CREATE OR REPLACE FUNCTION pg_temp.calls_per_sec(query text, calls bigint)
+RETURNS numeric LANGUAGE plpgsql AS $$
+DECLARE
+    started timestamptz := clock_timestamp();
+BEGIN
+    EXECUTE query;
+    RETURN round(calls / extract(epoch FROM clock_timestamp() - started));
+END $$;
+
+SELECT 'might_contain cached' AS variant,
+       pg_temp.calls_per_sec(
+           'SELECT count(*) FROM generate_series(1, ' || :rows || ') g
+            WHERE octo_bloom_might_contain(''octo_bench_users'', ''email'', ''probe'' || g)',
+           :rows) AS calls_per_sec
+UNION ALL
+SELECT 'might_contain uncached',
+       pg_temp.calls_per_sec(
+           'SELECT count(*) FROM generate_series(1, ' || :rows || ') g
+            WHERE octo_bloom_might_contain(''octo_bench_users'',
+                                           CASE WHEN g % 2 = 0 THEN ''email'' ELSE ''alt_email'' END,
+                                           ''probe'' || g)',
+           :rows)
+UNION ALL
+SELECT 'exists cached (negatives)',
+       pg_temp.calls_per_sec(
+           'SELECT count(*) FROM generate_series(1, ' || :rows || ') g
+            WHERE octo_bloom_exists(''octo_bench_users'', ''email'', ''probe'' || g)',
+           :rows);
+
+DROP TABLE octo_bench_users;
@@ -0,0 +1,3 @@
+-- Existence check falling through to the table for a key it holds
+\set id random(1, 1000000)
+SELECT octo_bloom_exists('octo_bench_latency', 'id', :id::bigint);
@@ -0,0 +1,3 @@
+-- Existence check the filter answers without touching the table
+\set id random(1000001, 2000000000)
+SELECT octo_bloom_exists('octo_bench_latency', 'id', :id::bigint);
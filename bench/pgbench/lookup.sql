@@ -0,0 +1,3 @@
+-- Reader: signup availability check against the bloom filter
+\set id random(1, 20000000)
+SELECT octo_bloom_might_contain('octo_bench_signup', 'email', 'user' || :id || '@example.com');
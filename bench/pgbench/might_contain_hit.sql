@@ -0,0 +1,3 @@
+-- Probe for a key the filter holds: every bit tested
+\set id random(1, 1000000)
+SELECT octo_bloom_might_contain('octo_bench_latency', 'id', :id::bigint);
@@ -0,0 +1,3 @@
+-- Probe for a key the filter doesn't hold: usually rejected by the first bits
+\set id random(1000001, 2000000000)
+SELECT octo_bloom_might_contain('octo_bench_latency', 'id', :id::bigint);
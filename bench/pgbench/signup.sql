@@ -0,0 +1,3 @@
+-- Writer: new signup, filter updated by the AFTER INSERT row trigger
+\set id random(1, 20000000)
+INSERT INTO octo_bench_signup (email) VALUES ('user' || :id || '@example.com');
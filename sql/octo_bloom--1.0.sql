@@ -5,7 +5,8 @@ CREATE OR REPLACE FUNCTION octo_bloom_init(
     table_oid regclass,
     column_name text,
     expected_count bigint DEFAULT 1000000,
-    false_positive_rate float DEFAULT 0.01
+    false_positive_rate float DEFAULT 0.01,
+    filter_type text DEFAULT 'standard'
 ) RETURNS void
 AS 'octo_bloom', 'octo_bloom_init'
 LANGUAGE C STRICT;
@@ -18,10 +19,480 @@ CREATE OR REPLACE FUNCTION octo_bloom_might_contain(
 AS 'octo_bloom', 'octo_bloom_might_contain'
 LANGUAGE C STRICT;
 
+-- Filters over several columns or expressions of a table, e.g.
+-- ARRAY['tenant_id', 'external_id'] or ARRAY['lower(email)']. Keys are
+-- SQL over the table's columns and may only call immutable functions.
+-- Partitioned tables are not supported; create them on the partitions.
+CREATE OR REPLACE FUNCTION octo_bloom_init(
+    table_oid regclass,
+    keys text[],
+    expected_count bigint DEFAULT 1000000,
+    false_positive_rate float DEFAULT 0.01,
+    filter_type text DEFAULT 'standard'
+) RETURNS void
+AS 'octo_bloom', 'octo_bloom_init_composite'
+LANGUAGE C STRICT;
+
+-- The key's parts in order, or a single row of them
+CREATE OR REPLACE FUNCTION octo_bloom_might_contain(
+    table_oid regclass,
+    keys text[],
+    VARIADIC "values" "any"
+) RETURNS boolean
+AS 'octo_bloom', 'octo_bloom_might_contain_composite'
+LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION octo_bloom_might_contain_array(
+    table_oid regclass,
+    column_name text,
+    "values" anyarray
+) RETURNS boolean[]
+AS 'octo_bloom', 'octo_bloom_might_contain_array'
+LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION octo_bloom_might_contain_set(
+    table_oid regclass,
+    column_name text,
+    "values" anyarray
+) RETURNS TABLE(value anyelement, might_contain boolean)
+AS 'octo_bloom', 'octo_bloom_might_contain_set'
+LANGUAGE C STRICT;
+
+-- Whether any non-null element might be present
+CREATE OR REPLACE FUNCTION octo_bloom_might_contain_any(
+    table_oid regclass,
+    column_name text,
+    "values" anyarray
+) RETURNS boolean
+AS 'octo_bloom', 'octo_bloom_might_contain_any'
+LANGUAGE C STRICT;
+
+-- The non-null elements that might be present, as a one-dimensional array
+CREATE OR REPLACE FUNCTION octo_bloom_filter_values(
+    table_oid regclass,
+    column_name text,
+    "values" anyarray
+) RETURNS anyarray
+AS 'octo_bloom', 'octo_bloom_filter_values'
+LANGUAGE C STRICT;
+
 CREATE OR REPLACE FUNCTION octo_bloom_exists(
     table_oid regclass,
     column_name text,
     value anyelement
 ) RETURNS boolean
 AS 'octo_bloom', 'octo_bloom_exists'
-LANGUAGE C;
\ No newline at end of file
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION octo_bloom_disable(
+    table_oid regclass,
+    column_name text
+) RETURNS void
+AS 'octo_bloom', 'octo_bloom_disable'
+LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION octo_bloom_disable(
+    table_oid regclass,
+    keys text[]
+) RETURNS void
+AS 'octo_bloom', 'octo_bloom_disable_composite'
+LANGUAGE C STRICT;
+
+-- Copy a filter into the WAL whole, for standbys that started after it was
+-- created or missed changes while octo_bloom.wal_log was off. Until the
+-- copy is in, probes on a standby answer true, as with no filter.
+CREATE OR REPLACE FUNCTION octo_bloom_replicate(
+    table_oid regclass,
+    column_name text
+) RETURNS void
+AS 'octo_bloom', 'octo_bloom_replicate'
+LANGUAGE C STRICT;
+
+-- Keep a copy of a read-mostly Bloom filter on every NUMA node, for the
+-- backends there to probe, or with enabled false drop them. The maintenance
+-- launcher refreshes them every octo_bloom.node_copy_refresh_ms after
+-- writes; until then probes read the filter itself. Not kept across a
+-- restart.
+CREATE OR REPLACE FUNCTION octo_bloom_copy_to_nodes(
+    table_oid regclass,
+    column_name text,
+    enabled boolean DEFAULT true
+) RETURNS void
+AS 'octo_bloom', 'octo_bloom_copy_to_nodes'
+LANGUAGE C STRICT;
+
+-- Populate a filter from the rows already in the table. Reads a B-tree on
+-- the column with an index-only scan when there is one, otherwise scans the
+-- heap with up to parallel_workers workers (-1 uses
+-- max_parallel_maintenance_workers).
+-- Returns the number of non-null values added.
+CREATE OR REPLACE FUNCTION octo_bloom_rebuild(
+    table_oid regclass,
+    column_name text,
+    parallel_workers integer DEFAULT -1
+) RETURNS bigint
+AS 'octo_bloom', 'octo_bloom_rebuild'
+LANGUAGE C STRICT;
+
+-- Composite filters are built from a heap scan by one process
+CREATE OR REPLACE FUNCTION octo_bloom_rebuild(
+    table_oid regclass,
+    keys text[],
+    parallel_workers integer DEFAULT -1
+) RETURNS bigint
+AS 'octo_bloom', 'octo_bloom_rebuild_composite'
+LANGUAGE C STRICT;
+
+-- Rebuild a bloom or cuckoo filter at a new size without blocking probes
+-- or writers: the old filter answers until the new one is filled and
+-- swapped in. expected_count 0 sizes it for twice the keys it holds.
+-- Returns the number of keys added.
+CREATE OR REPLACE FUNCTION octo_bloom_resize(
+    table_oid regclass,
+    column_name text,
+    expected_count bigint DEFAULT 0,
+    parallel_workers integer DEFAULT -1
+) RETURNS bigint
+AS 'octo_bloom', 'octo_bloom_resize'
+LANGUAGE C STRICT;
+
+-- Compact every scalable filter in the current database that has grown to
+-- at least min_stages stages into a single stage, as octo_bloom_rebuild
+-- does for one filter. Returns the number of filters compacted.
+CREATE OR REPLACE FUNCTION octo_bloom_compact(
+    min_stages integer DEFAULT 2
+) RETURNS integer
+AS 'octo_bloom', 'octo_bloom_compact'
+LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION octo_bloom_build_progress(
+    OUT pid integer,
+    OUT datid oid,
+    OUT relid oid,
+    OUT attnum smallint,
+    OUT index_relid oid,
+    OUT phase text,
+    OUT workers_planned integer,
+    OUT workers_launched integer,
+    OUT tuples_total bigint,
+    OUT tuples_done bigint,
+    OUT participants_done integer
+) RETURNS SETOF record
+AS 'octo_bloom', 'octo_bloom_build_progress'
+LANGUAGE C STRICT;
+
+-- Running octo_bloom_rebuild calls, in the style of pg_stat_progress_*
+CREATE OR REPLACE VIEW octo_bloom_progress AS
+SELECT p.pid,
+       p.datid,
+       d.datname,
+       p.relid,
+       a.attname AS column_name,
+       p.index_relid,
+       p.phase,
+       p.workers_planned,
+       p.workers_launched,
+       p.tuples_total,
+       p.tuples_done,
+       p.participants_done
+FROM octo_bloom_build_progress() p
+LEFT JOIN pg_database d ON d.oid = p.datid
+LEFT JOIN pg_attribute a ON a.attrelid = p.relid AND a.attnum = p.attnum
+    AND d.datname = current_database();
+
+-- Trigger functions that keep filters up to date. They work as row
+-- triggers or as statement triggers with transition tables
+CREATE OR REPLACE FUNCTION octo_bloom_insert_trigger()
+RETURNS trigger
+AS 'octo_bloom', 'octo_bloom_insert_trigger'
+LANGUAGE C;
+
+CREATE OR REPLACE FUNCTION octo_bloom_update_trigger()
+RETURNS trigger
+AS 'octo_bloom', 'octo_bloom_update_trigger'
+LANGUAGE C;
+
+-- Removes deleted values from counting and cuckoo filters; a no-op for others
+CREATE OR REPLACE FUNCTION octo_bloom_delete_trigger()
+RETURNS trigger
+AS 'octo_bloom', 'octo_bloom_delete_trigger'
+LANGUAGE C;
+
+-- Create the octo_bloom_insert, _update and _delete triggers on a table,
+-- replacing earlier ones. mode is 'statement', 'row' or 'auto' (statement
+-- triggers unless the table is a foreign table, a partitioned table or a
+-- partition). Returns the mode used.
+CREATE OR REPLACE FUNCTION octo_bloom_attach_triggers(
+    table_oid regclass,
+    mode text DEFAULT 'auto'
+) RETURNS text
+AS 'octo_bloom', 'octo_bloom_attach_triggers'
+LANGUAGE C STRICT;
+
+-- Filters requested on partitioned tables. Each leaf partition has its
+-- own filter of this size; the event triggers below create those of
+-- partitions created or attached later.
+CREATE TABLE octo_bloom_partitioned (
+    parent regclass NOT NULL,
+    column_name text NOT NULL,
+    expected_count bigint NOT NULL,
+    false_positive_rate float8 NOT NULL,
+    filter_type text NOT NULL,
+    PRIMARY KEY (parent, column_name)
+);
+
+SELECT pg_catalog.pg_extension_config_dump('octo_bloom_partitioned', '');
+GRANT SELECT ON octo_bloom_partitioned TO PUBLIC;
+
+-- Definitions of composite filters. Each is registered under an attnum
+-- from the sequence, below any column's. key_columns has a part's column,
+-- or 0 for the next of key_expressions, stored parsed like pg_index's;
+-- depends lists every column the parts read. Not dumped: the filters
+-- aren't either.
+CREATE SEQUENCE octo_bloom_composite_attnum AS smallint
+    INCREMENT BY -1 MINVALUE -32768 MAXVALUE -1000 START WITH -1000;
+
+CREATE TABLE octo_bloom_composite (
+    table_oid regclass NOT NULL,
+    attnum smallint NOT NULL DEFAULT nextval('octo_bloom_composite_attnum'),
+    keys text[] NOT NULL,
+    key_columns smallint[] NOT NULL,
+    key_types oid[] NOT NULL,
+    key_expressions text,
+    depends smallint[] NOT NULL,
+    PRIMARY KEY (table_oid, attnum)
+);
+
+-- Triggers read the definitions as whoever writes to the table
+GRANT SELECT ON octo_bloom_composite TO PUBLIC;
+
+CREATE OR REPLACE FUNCTION octo_bloom_filter_status(
+    OUT relid oid,
+    OUT attnum smallint,
+    OUT filter_type text,
+    OUT num_stages integer,
+    OUT resizing boolean,
+    OUT bytes bigint,
+    OUT num_hashes integer,
+    OUT expected_count bigint,
+    OUT target_fpr float8,
+    OUT key_count bigint,
+    OUT fill_ratio float8,
+    OUT estimated_count bigint,
+    OUT estimated_fpr float8,
+    OUT lookups bigint,
+    OUT negatives bigint,
+    OUT exists_confirmed bigint,
+    OUT exists_false_positives bigint,
+    OUT adds bigint,
+    OUT removes bigint,
+    OUT rebuilds bigint,
+    OUT last_rebuild timestamptz,
+    OUT last_rebuild_ms float8,
+    OUT total_rebuild_ms float8,
+    OUT node_copies integer
+) RETURNS SETOF record
+AS 'octo_bloom', 'octo_bloom_status'
+LANGUAGE C STRICT;
+
+-- The filters of this database, with their fill and activity since they
+-- were created. A composite filter is named by its keys
+CREATE OR REPLACE VIEW octo_bloom_status AS
+SELECT s.relid,
+       COALESCE(a.attname::text, array_to_string(k.keys, ', ')) AS column_name,
+       s.attnum,
+       s.filter_type,
+       s.num_stages,
+       s.resizing,
+       s.bytes,
+       s.num_hashes,
+       s.expected_count,
+       s.target_fpr,
+       s.key_count,
+       s.fill_ratio,
+       s.estimated_count,
+       s.estimated_fpr,
+       s.lookups,
+       s.negatives,
+       s.exists_confirmed,
+       s.exists_false_positives,
+       s.adds,
+       s.removes,
+       s.rebuilds,
+       s.last_rebuild,
+       s.last_rebuild_ms,
+       s.total_rebuild_ms,
+       s.node_copies
+FROM octo_bloom_filter_status() s
+LEFT JOIN pg_attribute a ON a.attrelid = s.relid AND a.attnum = s.attnum
+LEFT JOIN octo_bloom_composite k ON k.table_oid = s.relid AND k.attnum = s.attnum;
+
+-- The event trigger functions keep the templates current whoever runs the
+-- DDL, so they run as the extension's owner
+
+CREATE OR REPLACE FUNCTION octo_bloom_partition_ddl()
+RETURNS event_trigger
+AS 'octo_bloom', 'octo_bloom_partition_ddl'
+LANGUAGE C SECURITY DEFINER;
+
+CREATE EVENT TRIGGER octo_bloom_partition_ddl ON ddl_command_end
+    WHEN TAG IN ('CREATE TABLE', 'ALTER TABLE')
+    EXECUTE FUNCTION octo_bloom_partition_ddl();
+
+-- Drop the filters of a dropped table (attnum 0) or column when the
+-- transaction commits, with the composite filters that read the column
+CREATE OR REPLACE FUNCTION octo_bloom_drop_filters(
+    table_oid oid,
+    attnum smallint
+) RETURNS void
+AS 'octo_bloom', 'octo_bloom_drop_filters'
+LANGUAGE C STRICT;
+
+CREATE OR REPLACE FUNCTION octo_bloom_drop_ddl()
+RETURNS event_trigger
+LANGUAGE plpgsql SECURITY DEFINER SET search_path = pg_catalog AS $$
+DECLARE
+    obj record;
+BEGIN
+    FOR obj IN SELECT * FROM pg_event_trigger_dropped_objects()
+               WHERE object_type IN ('table', 'table column',
+                                     'foreign table', 'foreign table column')
+    LOOP
+        PERFORM @extschema@.octo_bloom_drop_filters(obj.objid, obj.objsubid::smallint);
+        DELETE FROM @extschema@.octo_bloom_partitioned
+        WHERE parent::oid = obj.objid
+          AND (obj.objsubid = 0 OR column_name = obj.address_names[3]);
+    END LOOP;
+END;
+$$;
+
+CREATE EVENT TRIGGER octo_bloom_drop_ddl ON sql_drop
+    EXECUTE FUNCTION octo_bloom_drop_ddl();
+-- A bloom filter as a value: the serialized format described in the
+-- README, which clients can fetch and probe themselves. Input and the
+-- cast from bytea check the checksum and store the current format version.
+CREATE TYPE octo_bloom;
+
+CREATE OR REPLACE FUNCTION octo_bloom_in(cstring)
+RETURNS octo_bloom
+AS 'octo_bloom', 'octo_bloom_in'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_out(octo_bloom)
+RETURNS cstring
+AS 'octo_bloom', 'octo_bloom_out'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_recv(internal)
+RETURNS octo_bloom
+AS 'octo_bloom', 'octo_bloom_recv'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_send(octo_bloom)
+RETURNS bytea
+AS 'octo_bloom', 'octo_bloom_send'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+-- Filters are large and already dense: kept out of line, uncompressed
+CREATE TYPE octo_bloom (
+    INPUT = octo_bloom_in,
+    OUTPUT = octo_bloom_out,
+    RECEIVE = octo_bloom_recv,
+    SEND = octo_bloom_send,
+    INTERNALLENGTH = VARIABLE,
+    ALIGNMENT = int4,
+    STORAGE = external
+);
+
+CREATE OR REPLACE FUNCTION octo_bloom(bytea)
+RETURNS octo_bloom
+AS 'octo_bloom', 'octo_bloom_from_bytea'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE CAST (bytea AS octo_bloom) WITH FUNCTION octo_bloom(bytea);
+CREATE CAST (octo_bloom AS bytea) WITHOUT FUNCTION;
+
+-- A copy of a column's filter, including the keys the current transaction
+-- has added. Cuckoo and scalable filters cannot be exported.
+CREATE OR REPLACE FUNCTION octo_bloom_export(
+    table_oid regclass,
+    column_name text
+) RETURNS octo_bloom
+AS 'octo_bloom', 'octo_bloom_export'
+LANGUAGE C STRICT;
+
+-- Build a standard-layout filter from a set of values, in parallel when
+-- the planner chooses to; parallel partial filters are ORed together.
+-- Nulls are skipped; no rows gives null. expected_count and
+-- false_positive_rate are read from the first row.
+CREATE OR REPLACE FUNCTION octo_bloom_agg_transfn(internal, anyelement, bigint)
+RETURNS internal
+AS 'octo_bloom', 'octo_bloom_agg_transfn'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_agg_transfn(internal, anyelement, bigint, float8)
+RETURNS internal
+AS 'octo_bloom', 'octo_bloom_agg_transfn'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_agg_combine(internal, internal)
+RETURNS internal
+AS 'octo_bloom', 'octo_bloom_agg_combine'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_agg_serialize(internal)
+RETURNS bytea
+AS 'octo_bloom', 'octo_bloom_agg_serialize'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_agg_deserialize(bytea, internal)
+RETURNS internal
+AS 'octo_bloom', 'octo_bloom_agg_deserialize'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_agg_final(internal)
+RETURNS octo_bloom
+AS 'octo_bloom', 'octo_bloom_agg_final'
+LANGUAGE C PARALLEL SAFE;
+
+CREATE AGGREGATE octo_bloom_agg(value anyelement, expected_count bigint) (
+    SFUNC = octo_bloom_agg_transfn,
+    STYPE = internal,
+    FINALFUNC = octo_bloom_agg_final,
+    COMBINEFUNC = octo_bloom_agg_combine,
+    SERIALFUNC = octo_bloom_agg_serialize,
+    DESERIALFUNC = octo_bloom_agg_deserialize,
+    PARALLEL = SAFE
+);
+
+CREATE AGGREGATE octo_bloom_agg(value anyelement, expected_count bigint,
+                                false_positive_rate float8) (
+    SFUNC = octo_bloom_agg_transfn,
+    STYPE = internal,
+    FINALFUNC = octo_bloom_agg_final,
+    COMBINEFUNC = octo_bloom_agg_combine,
+    SERIALFUNC = octo_bloom_agg_serialize,
+    DESERIALFUNC = octo_bloom_agg_deserialize,
+    PARALLEL = SAFE
+);
+
+-- Filters of the same layout, hash and size, e.g. built by octo_bloom_agg
+-- with the same arguments. A union holds every key of either; an
+-- intersection every key of both, with at least the false positives of a
+-- filter built from the common keys alone.
+CREATE OR REPLACE FUNCTION octo_bloom_union(a octo_bloom, b octo_bloom)
+RETURNS octo_bloom
+AS 'octo_bloom', 'octo_bloom_union'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_intersect(a octo_bloom, b octo_bloom)
+RETURNS octo_bloom
+AS 'octo_bloom', 'octo_bloom_intersect'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
+
+CREATE OR REPLACE FUNCTION octo_bloom_might_contain(
+    filter octo_bloom,
+    value anyelement
+) RETURNS boolean
+AS 'octo_bloom', 'octo_bloom_filter_might_contain'
+LANGUAGE C IMMUTABLE STRICT PARALLEL SAFE;
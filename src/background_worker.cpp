@@ -1,92 +1,424 @@
-#include "shared_memory.hpp"
-#include "bloom_filter.hpp"
+#include "background_worker.hpp"
+#include "cuckoo_filter.hpp"
+#include "filter_build.hpp"
+#include "filter_snapshot.hpp"
+#include "memory_placement.hpp"
 
 // Additional PostgreSQL headers needed
 extern "C" {
 #include <miscadmin.h>
+#include <access/xact.h>
+#include <access/xlog.h>
+#include <pgstat.h>
+#include <postmaster/bgworker.h>
+#include <postmaster/interrupt.h>
+#include <storage/ipc.h>
+#include <storage/latch.h>
 #include <storage/proc.h>
-#include <access/table.h>
-#include <access/heapam.h>
+#include <tcop/tcopprot.h>
+#include <utils/guc.h>
+#include <utils/lsyscache.h>
 #include <utils/snapmgr.h>
+#include <utils/timestamp.h>
 }
 
+// Maintenance runs in two kinds of worker, as autovacuum does. The launcher
+// starts with the postmaster and connects to no database. It sleeps on its
+// latch, which a committing backend sets once a filter's key count passes
+// a threshold, and wakes every octo_bloom.maintenance_naptime regardless.
+// For each database with work it starts a worker connected there, one at a
+// time. That worker resizes or compacts the filters that are due, through
+// the same online rebuilds the SQL functions run, then frees retired
+// filter storage and exits. On a timed wakeup the worker also measures
+// each filter's saturation, which takes a pass over its bits.
+//
+// The launcher also owns the snapshots (filter_snapshot.cpp): it loads them
+// when it first starts after shared memory was set up, writes them on the
+// first wakeup after each checkpoint, and writes them once more on the way
+// out, so a clean shutdown leaves every filter on disk.
+//
+// It keeps the NUMA node copies of filters too (octo_bloom_copy_to_nodes):
+// while any filter has them, it wakes every octo_bloom.node_copy_refresh_ms
+// and copies each filter written since over its copies, all of the writes
+// in between in one pass. A copy behind its filter isn't probed, so copies
+// only fall back to the filter meanwhile, as while a database worker runs.
+
+#define MAINTENANCE_LAUNCHER_RESTART_SECS 10
+
+// Handed to a database worker in bgw_extra
+typedef struct MaintenanceRequest {
+    Oid dboid;  // InvalidOid: connect nowhere, only free retired storage
+    bool poll;  // Timed wakeup: check every filter, not just the due ones
+} MaintenanceRequest;
+
+typedef struct MaintenanceTask {
+    Oid table_oid;
+    int16_t attnum;
+    BloomMaintenance action;  // NONE: due if saturated
+} MaintenanceTask;
+
 extern "C" {
 
+bool octo_bloom_maintenance_worker = true;
+int octo_bloom_maintenance_naptime = 300;
+double octo_bloom_resize_threshold = 1.0;
+double octo_bloom_saturation_threshold = 0.6;
+int octo_bloom_compact_stages = 4;
+
+void register_maintenance_worker() {
+    BackgroundWorker worker;
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker.bgw_restart_time = MAINTENANCE_LAUNCHER_RESTART_SECS;
+    snprintf(worker.bgw_library_name, sizeof(worker.bgw_library_name), "octo_bloom");
+    snprintf(worker.bgw_function_name, sizeof(worker.bgw_function_name), "octo_bloom_bgworker_main");
+    snprintf(worker.bgw_name, sizeof(worker.bgw_name), "octo_bloom maintenance launcher");
+    snprintf(worker.bgw_type, sizeof(worker.bgw_type), "octo_bloom maintenance launcher");
+    RegisterBackgroundWorker(&worker);
+}
+
+BloomMaintenance bloom_maintenance_due(BloomRegistryEntry* entry) {
+    if (!entry->is_valid || DsaPointerIsValid(entry->resize_bits)) {
+        return BLOOM_MAINTAIN_NONE;
+    }
+    if (entry->params.kind == FilterKind::Scalable) {
+        // A single stage is already compact
+        bool due = octo_bloom_compact_stages > 0 &&
+                   entry->num_stages >= Max(octo_bloom_compact_stages, 2);
+        return due ? BLOOM_MAINTAIN_COMPACT : BLOOM_MAINTAIN_NONE;
+    }
+    double count = (double)pg_atomic_read_u64(&entry->current_count);
+    bool due = octo_bloom_resize_threshold > 0 &&
+               count >= octo_bloom_resize_threshold * entry->params.expected_count;
+    return due ? BLOOM_MAINTAIN_RESIZE : BLOOM_MAINTAIN_NONE;
+}
+
+// Cuckoo filters are full at the load they were sized for; past it,
+// inserts start to fail
+static bool filter_saturated(const FilterBackend* filter) {
+    BloomFilterParams params = filter->getParams();
+    if (params.kind == FilterKind::Cuckoo) {
+        return filter->getSaturation() >= CuckooFilter::kLoadFactor;
+    }
+    return params.kind == FilterKind::Bloom && octo_bloom_saturation_threshold > 0 &&
+           filter->getSaturation() >= octo_bloom_saturation_threshold;
+}
+
+// Filters of this database to look at. Those due are marked as taken up,
+// so committing backends stop waking the launcher for them until they change
+static MaintenanceTask* collect_tasks(bool poll, int* count) {
+    MaintenanceTask* tasks = (MaintenanceTask*)palloc(sizeof(MaintenanceTask) *
+                                                      bloom_shared_state->max_filters);
+    int n = 0;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+    HASH_SEQ_STATUS status;
+    BloomRegistryEntry* entry;
+    hash_seq_init(&status, bloom_registry);
+    while ((entry = (BloomRegistryEntry*)hash_seq_search(&status)) != NULL) {
+        if (entry->key.dboid != MyDatabaseId || !entry->is_valid ||
+            n >= bloom_shared_state->max_filters) {
+            continue;
+        }
+        BloomMaintenance action = bloom_maintenance_due(entry);
+        if (!poll && (action == BLOOM_MAINTAIN_NONE ||
+                      entry->maintained_generation == entry->generation)) {
+            continue;
+        }
+        // Saturation doesn't apply to a chain, whose newest stage fills by design
+        if (action == BLOOM_MAINTAIN_NONE &&
+            (entry->params.kind == FilterKind::Scalable || DsaPointerIsValid(entry->resize_bits))) {
+            continue;
+        }
+        // A filter only checked for saturation can still be woken for
+        if (action != BLOOM_MAINTAIN_NONE) {
+            entry->maintained_generation = entry->generation;
+        }
+        tasks[n].table_oid = entry->key.table_oid;
+        tasks[n].attnum = entry->key.attnum;
+        tasks[n].action = action;
+        n++;
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    *count = n;
+    return tasks;
+}
+
+// One filter, in a transaction of its own. Rebuilds run without parallel
+// workers, leaving those to foreground queries
+static void run_task(const MaintenanceTask* task) {
+    StartTransactionCommand();
+    PushActiveSnapshot(GetTransactionSnapshot());
+
+    // Skip tables dropped since, rather than failing on them
+    const char* relname = get_rel_name(task->table_oid);
+    BloomMaintenance action = task->action;
+    if (relname && action == BLOOM_MAINTAIN_NONE) {
+        FilterBackend* filter = get_bloom_filter(task->table_oid, task->attnum, NULL);
+        if (filter && filter_saturated(filter)) {
+            action = BLOOM_MAINTAIN_RESIZE;
+        }
+    }
+
+    if (relname && action == BLOOM_MAINTAIN_RESIZE) {
+        pgstat_report_activity(STATE_RUNNING, "resizing bloom filter");
+        uint64_t added = resize_bloom_filter(task->table_oid, task->attnum, 0, 0);
+        ereport(LOG,
+                (errmsg("octo_bloom: resized bloom filter on \"%s\" column %d, " UINT64_FORMAT
+                        " keys", relname, task->attnum, added)));
+    } else if (relname && action == BLOOM_MAINTAIN_COMPACT) {
+        pgstat_report_activity(STATE_RUNNING, "compacting bloom filter");
+        uint64_t added = rebuild_bloom_filter(task->table_oid, task->attnum, 0);
+        ereport(LOG,
+                (errmsg("octo_bloom: compacted bloom filter on \"%s\" column %d, " UINT64_FORMAT
+                        " keys", relname, task->attnum, added)));
+    }
+
+    PopActiveSnapshot();
+    CommitTransactionCommand();
+    pgstat_report_activity(STATE_IDLE, NULL);
+}
+
+// Database worker, started by the launcher. An error ends it; the filter
+// it was working on is tried again at the next timed wakeup
+void octo_bloom_maintenance_main(Datum main_arg) {
+    MaintenanceRequest request;
+    memcpy(&request, MyBgworkerEntry->bgw_extra, sizeof(request));
+
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+    BackgroundWorkerInitializeConnectionByOid(request.dboid, InvalidOid, 0);
+
+    // Resizes and compactions wait out writers, then need a fresh snapshot
+    SetConfigOption("default_transaction_isolation", "read committed",
+                    PGC_SUSET, PGC_S_OVERRIDE);
+    ensure_shared_memory();
+
+    if (OidIsValid(request.dboid)) {
+        int count;
+        MaintenanceTask* tasks = collect_tasks(request.poll, &count);
+        for (int i = 0; i < count; ++i) {
+            CHECK_FOR_INTERRUPTS();
+            run_task(&tasks[i]);
+        }
+        pfree(tasks);
+    }
+
+    StartTransactionCommand();
+    int freed = reclaim_retired_storage(true);
+    CommitTransactionCommand();
+    if (freed > 0) {
+        elog(DEBUG1, "octo_bloom: freed %d retired filter allocations", freed);
+    }
+
+    proc_exit(0);
+}
+
+static void run_database_worker(Oid dboid, bool poll) {
+    BackgroundWorker worker;
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+    worker.bgw_start_time = BgWorkerStart_RecoveryFinished;
+    worker.bgw_restart_time = BGW_NEVER_RESTART;
+    snprintf(worker.bgw_library_name, sizeof(worker.bgw_library_name), "octo_bloom");
+    snprintf(worker.bgw_function_name, sizeof(worker.bgw_function_name),
+             "octo_bloom_maintenance_main");
+    snprintf(worker.bgw_name, sizeof(worker.bgw_name), "octo_bloom maintenance worker");
+    snprintf(worker.bgw_type, sizeof(worker.bgw_type), "octo_bloom maintenance worker");
+    worker.bgw_main_arg = ObjectIdGetDatum(dboid);
+    worker.bgw_notify_pid = MyProcPid;
+
+    MaintenanceRequest request;
+    memset(&request, 0, sizeof(request));
+    request.dboid = dboid;
+    request.poll = poll;
+    memcpy(worker.bgw_extra, &request, sizeof(request));
+
+    BackgroundWorkerHandle* handle;
+    if (!RegisterDynamicBackgroundWorker(&worker, &handle)) {
+        ereport(LOG,
+                (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+                 errmsg("octo_bloom: could not start a maintenance worker"),
+                 errhint("Increase max_worker_processes.")));
+        return;
+    }
+
+    pid_t pid;
+    if (WaitForBackgroundWorkerStartup(handle, &pid) == BGWH_STARTED) {
+        WaitForBackgroundWorkerShutdown(handle);
+    }
+    pfree(handle);
+}
+
+// One pass of the launcher. Returns whether any worker ran
+static bool run_maintenance(bool poll) {
+    Oid* dboids = (Oid*)palloc(sizeof(Oid) * bloom_shared_state->max_filters);
+    int count = 0;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    HASH_SEQ_STATUS status;
+    BloomRegistryEntry* entry;
+    hash_seq_init(&status, bloom_registry);
+    while ((entry = (BloomRegistryEntry*)hash_seq_search(&status)) != NULL) {
+        if (!entry->is_valid) {
+            continue;
+        }
+        if (!poll && (entry->maintained_generation == entry->generation ||
+                      bloom_maintenance_due(entry) == BLOOM_MAINTAIN_NONE)) {
+            continue;
+        }
+        bool seen = false;
+        for (int i = 0; i < count && !seen; ++i) {
+            seen = dboids[i] == entry->key.dboid;
+        }
+        if (!seen && count < bloom_shared_state->max_filters) {
+            dboids[count++] = entry->key.dboid;
+        }
+    }
+    bool retired = bloom_shared_state->num_retired > 0;
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    for (int i = 0; i < count && !ShutdownRequestPending; ++i) {
+        run_database_worker(dboids[i], poll);
+    }
+    // Storage can be retired with no database left to visit
+    if (count == 0 && poll && retired) {
+        run_database_worker(InvalidOid, poll);
+    }
+
+    pfree(dboids);
+    return count > 0;
+}
+
+// Only the launcher writes the latch pointer, so no lock is needed, and
+// none may be taken here if the launcher is exiting on an error
+static void launcher_detach(int code, Datum arg) {
+    if (bloom_shared_state && bloom_shared_state->maintenance_latch == MyLatch) {
+        bloom_shared_state->maintenance_latch = NULL;
+    }
+}
+
 void octo_bloom_bgworker_main(Datum main_arg) {
-    while (true) {
-        // Sleep for 5 minutes between checks
-        pg_usleep(300000000L); // 300 seconds
-        
-        // Check if we should exit
-        // if (got_sigterm) {
-        //     break;
-        // }
-        
-        // Perform maintenance tasks
-        // perform_bloom_filter_maintenance();
+    pqsignal(SIGHUP, SignalHandlerForConfigReload);
+    pqsignal(SIGTERM, SignalHandlerForShutdownRequest);
+    BackgroundWorkerUnblockSignals();
+
+    ensure_shared_memory();
+
+    // Once per shared memory lifetime, not again if only the launcher restarts
+    if (!bloom_shared_state->snapshots_loaded) {
+        int loaded = load_filter_snapshots(octo_bloom_snapshots);
+        bloom_shared_state->snapshots_loaded = true;
+        if (loaded > 0) {
+            ereport(LOG, (errmsg("octo_bloom: loaded %d bloom filter snapshots", loaded)));
+        }
     }
+    XLogRecPtr snapshot_redo = GetRedoRecPtr();
+
+    bloom_shared_state->maintenance_latch = MyLatch;
+    before_shmem_exit(launcher_detach, 0);
+
+    TimestampTz next_poll = TimestampTzPlusMilliseconds(
+        GetCurrentTimestamp(), (int64)octo_bloom_maintenance_naptime * 1000);
+    bool node_copies = refresh_node_copies();
+
+    while (!ShutdownRequestPending) {
+        long timeout = TimestampDifferenceMilliseconds(GetCurrentTimestamp(), next_poll);
+        if (node_copies) {
+            timeout = Min(timeout, (long)octo_bloom_node_copy_refresh_ms);
+        }
+        (void)WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_EXIT_ON_PM_DEATH,
+                        timeout, PG_WAIT_EXTENSION);
+        ResetLatch(MyLatch);
+        CHECK_FOR_INTERRUPTS();
+
+        if (ConfigReloadPending) {
+            ConfigReloadPending = false;
+            ProcessConfigFile(PGC_SIGHUP);
+        }
+        if (ShutdownRequestPending) {
+            break;
+        }
+
+        node_copies = refresh_node_copies();
+
+        if (octo_bloom_snapshots && GetRedoRecPtr() != snapshot_redo) {
+            snapshot_redo = GetRedoRecPtr();
+            write_filter_snapshots(snapshot_redo);
+        }
+
+        bool poll = GetCurrentTimestamp() >= next_poll;
+        if (poll) {
+            next_poll = TimestampTzPlusMilliseconds(
+                GetCurrentTimestamp(), (int64)octo_bloom_maintenance_naptime * 1000);
+        }
+        // Waiting for a worker consumes wakeups; look again in case one
+        // was for a filter this pass didn't cover
+        if (run_maintenance(poll)) {
+            SetLatch(MyLatch);
+        }
+    }
+
+    // Backends may still commit changes after this; each removes the
+    // snapshot it invalidates
+    if (octo_bloom_snapshots) {
+        write_filter_snapshots(GetRedoRecPtr());
+    }
+
+    proc_exit(0);
 }
 
-// void perform_bloom_filter_maintenance() {
-//     // LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
-//     
-//     // HASH_SEQ_STATUS status;
-//     // BloomRegistryEntry* entry;
-//     
-//     // hash_seq_init(&status, bloom_shared_state->bloom_registry);
-//     
-//     // while ((entry = (BloomRegistryEntry*) hash_seq_search(&status)) != NULL) {
-//     //     if (!entry->is_valid) {
-//     //         // Rebuild invalid filters
-//     //         rebuild_bloom_filter(entry);
-//     //     } else if (entry->current_count > entry->expected_count * 1.5) {
-//     //         // Resize filter if it's grown too much
-//     //         resize_bloom_filter(entry);
-//     //     }
-//     // }
-//     
-//     // LWLockRelease(bloom_shared_state->registry_lock);
-// }
-
-// void rebuild_bloom_filter(BloomRegistryEntry* entry) {
-//     // Relation rel = table_open(entry->table_oid, AccessShareLock);
-//     // TupleDesc tupdesc = RelationGetDescr(rel);
-//     
-//     // // Create new filter
-//     // OctoBloomFilter* new_filter = new OctoBloomFilter(
-//     //     entry->expected_count * 2, // Double expected size
-//     //     entry->false_positive_rate
-//     // );
-//     
-//     // // Scan table and populate filter
-//     // TableScanDesc scan = table_beginscan(rel, GetActiveSnapshot(), 0, NULL);
-//     // HeapTuple tuple;
-//     // uint64_t count = 0;
-//     
-//     // while ((tuple = heap_getnext(scan, ForwardScanDirection)) != NULL) {
-//     //     bool isnull;
-//     //     Datum value = heap_getattr(tuple, entry->attnum, tupdesc, &isnull);
-//     //     
-//     //     if (!isnull) {
-//     //         text* value_text = OidOutputFunctionCall(
-//     //             TupleDescAttr(tupdesc, entry->attnum - 1)->atttypid, 
-//     //             value
-//     //         );
-//     //         new_filter->add(VARDATA(value_text), VARSIZE(value_text) - VARHDRSZ);
-//     //         count++;
-//     //     }
-//     // }
-//     
-//     // table_endscan(scan);
-//     // table_close(rel, AccessShareLock);
-//     
-//     // // Replace old filter
-//     // LWLockAcquire(entry->lock, LW_EXCLUSIVE);
-//     // delete entry->filter;
-//     // entry->filter = new_filter;
-//     // entry->current_count = count;
-//     // entry->is_valid = true;
-//     // LWLockRelease(entry->lock);
-// }
+// Compact every scalable filter in this database that has grown to at
+// least min_stages stages, returning how many were compacted. Each
+// compaction is a rebuild, so this needs a transaction and may wait for
+// writers on the table.
+int compact_bloom_filters(int min_stages) {
+    ensure_shared_memory();
+
+    // Collect candidates first: compaction takes the registry lock itself
+    BloomRegistryKey* keys = (BloomRegistryKey*)palloc(sizeof(BloomRegistryKey) *
+                                                       bloom_shared_state->max_filters);
+    int count = 0;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    HASH_SEQ_STATUS status;
+    BloomRegistryEntry* entry;
+    hash_seq_init(&status, bloom_registry);
+    while ((entry = (BloomRegistryEntry*)hash_seq_search(&status)) != NULL) {
+        if (entry->key.dboid == MyDatabaseId && entry->is_valid &&
+            entry->params.kind == FilterKind::Scalable && entry->num_stages >= min_stages &&
+            count < bloom_shared_state->max_filters) {
+            keys[count++] = entry->key;
+        }
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    int compacted = 0;
+    for (int i = 0; i < count; ++i) {
+        // Skip tables dropped since, rather than failing on them
+        if (!get_rel_name(keys[i].table_oid)) {
+            continue;
+        }
+        rebuild_bloom_filter(keys[i].table_oid, keys[i].attnum, -1);
+        compacted++;
+    }
+
+    pfree(keys);
+    return compacted;
+}
+
+Datum octo_bloom_compact(PG_FUNCTION_ARGS) {
+    int min_stages = PG_GETARG_INT32(0);
+
+    if (min_stages < 1) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("min_stages must be at least 1")));
+    }
+
+    PG_RETURN_INT32(compact_bloom_filters(min_stages));
+}
 
 } // extern "C"
\ No newline at end of file
@@ -0,0 +1,34 @@
+#ifndef OCTO_BLOOM_BACKGROUND_WORKER_HPP
+#define OCTO_BLOOM_BACKGROUND_WORKER_HPP
+
+#include "shared_memory.hpp"
+
+// What the maintenance worker does with a filter
+typedef enum BloomMaintenance {
+    BLOOM_MAINTAIN_NONE = 0,
+    BLOOM_MAINTAIN_RESIZE,   // Bloom or cuckoo filter past its capacity
+    BLOOM_MAINTAIN_COMPACT,  // Scalable filter that has grown too many stages
+} BloomMaintenance;
+
+// GUCs, defined in _PG_init
+extern "C" {
+extern bool octo_bloom_maintenance_worker;
+extern int octo_bloom_maintenance_naptime;
+extern double octo_bloom_resize_threshold;
+extern double octo_bloom_saturation_threshold;
+extern int octo_bloom_compact_stages;
+}
+
+extern "C" {
+// Start the maintenance launcher with the postmaster; from _PG_init while
+// preloading
+void register_maintenance_worker();
+// What an entry's key count or stages call for. Registry lock held
+BloomMaintenance bloom_maintenance_due(BloomRegistryEntry* entry);
+int compact_bloom_filters(int min_stages);
+
+PGDLLEXPORT void octo_bloom_bgworker_main(Datum main_arg);
+PGDLLEXPORT void octo_bloom_maintenance_main(Datum main_arg);
+}
+
+#endif // OCTO_BLOOM_BACKGROUND_WORKER_HPP
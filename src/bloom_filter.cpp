@@ -1,89 +1,672 @@
 #include "bloom_filter.hpp"
-#include <openssl/sha.h>
+#include "bloom_kernels.hpp"
+#include "bloom_platform.hpp"
 #include <algorithm>
-#include <stdexcept>
 
-extern "C" {
-#include <postgres.h>
-#include <common/hashfn.h>
-#include <utils/fmgrprotos.h>
-#include <utils/palloc.h>
-}
+// The serialized hash-count field carries the layout id in its second byte
+// the hash id in its third and the index reduction in its fourth. Filters
+// written before these existed have zero there and load as Standard /
+// PgHashFnv / Modulo.
+static const uint32_t kHashCountMask = 0xff;
+static const uint32_t kHeaderByteMask = 0xff;
+static const int kLayoutShift = 8;
+static const int kHashShift = 16;
+static const int kReductionShift = 24;
 
-OctoBloomFilter::OctoBloomFilter(uint64_t expected_count, double false_positive_rate)
-    : expected_count_(expected_count),
-      false_positive_rate_(false_positive_rate) {
+OctoBloomFilter::OctoBloomFilter(uint64_t expected_count, double false_positive_rate,
+                                 BloomLayout layout, BloomHash hash,
+                                 BloomReduction reduction)
+    : bits_(nullptr),
+      storage_(nullptr) {
     
     // Parameters should be validated before calling constructor
+    applyParams(computeParams(expected_count, false_positive_rate, layout, hash, reduction));
+    allocateBits();
+}
+
+OctoBloomFilter::OctoBloomFilter(const BloomFilterParams& params, void* storage)
+    : bits_(nullptr),
+      storage_(nullptr) {
+    applyParams(params);
+    attachStorage(storage);
+}
+
+BloomFilterParams OctoBloomFilter::computeParams(uint64_t expected_count,
+                                                 double false_positive_rate,
+                                                 BloomLayout layout,
+                                                 BloomHash hash,
+                                                 BloomReduction reduction) {
+    // hash_any only fills the low 32 bits of h1, which fast-range would map
+    // onto the first 1/2^32 of the array
+    if (hash == BloomHash::PgHashFnv && reduction == BloomReduction::FastRange) {
+        reduction = BloomReduction::Modulo;
+    }
+
+    BloomFilterParams params;
+    params.kind = FilterKind::Bloom;
+    params.layout = layout;
+    params.hash = hash;
+    params.reduction = reduction;
+    params.expected_count = expected_count;
+    params.false_positive_rate = false_positive_rate;
+    params.bucket_slots = 0;
+    params.fingerprint_bits = 0;
+
+    if (layout == BloomLayout::Blocked) {
+        sizeBlocked(&params);
+    } else {
+        sizeStandard(&params);
+    }
+    if (reduction == BloomReduction::PowerOfTwo) {
+        roundToPowerOfTwo(&params);
+    }
+    return params;
+}
+
+void OctoBloomFilter::roundToPowerOfTwo(BloomFilterParams* params) {
+    // The bits only grow, so re-pick k for the density actually allocated
+    double keys = static_cast<double>(std::max<uint64_t>(params->expected_count, 1));
+
+    if (params->layout == BloomLayout::Blocked) {
+        size_t num_blocks = params->bit_array_size / kBlockBits;
+        size_t rounded = 1;
+        while (rounded < num_blocks) {
+            rounded <<= 1;
+        }
+        params->bit_array_size = rounded * kBlockBits;
+
+        double bits_per_key = std::min(params->bit_array_size / keys, 128.0);
+        uint32_t best_hashes = params->num_hashes;
+        double best_fpr = blockedFalsePositiveRate(bits_per_key, best_hashes);
+        for (uint32_t k = 1; k <= kMaxBlockedHashes; ++k) {
+            double fpr = blockedFalsePositiveRate(bits_per_key, k);
+            if (fpr < best_fpr) {
+                best_fpr = fpr;
+                best_hashes = k;
+            }
+        }
+        params->num_hashes = best_hashes;
+        return;
+    }
+
+    size_t rounded = 64;
+    while (rounded < params->bit_array_size) {
+        rounded <<= 1;
+    }
+    params->bit_array_size = rounded;
+
+    uint32_t num_hashes = static_cast<uint32_t>(std::round((rounded / keys) * std::log(2)));
+    num_hashes = std::max(num_hashes, 1u);
+    params->num_hashes = std::min(num_hashes, 50u);
+}
+
+double OctoBloomFilter::getEffectiveFalsePositiveRate() const {
+    double bits_per_key = static_cast<double>(bit_array_size_) /
+                          std::max<uint64_t>(expected_count_, 1);
+    if (layout_ == BloomLayout::Blocked) {
+        return blockedFalsePositiveRate(bits_per_key, num_hashes_);
+    }
+    return std::pow(1.0 - std::exp(-static_cast<double>(num_hashes_) / bits_per_key),
+                    static_cast<double>(num_hashes_));
+}
+
+double OctoBloomFilter::getSaturation() const {
+    return sampleSaturation(SIZE_MAX);
+}
+
+// Runs a sampled count is split into, spread evenly over the array
+static constexpr size_t kSaturationSampleRuns = 64;
+
+double OctoBloomFilter::sampleSaturation(size_t sample_words) const {
+    // Arrays are whole bytes; Standard bits past bit_array_size_ stay clear
+    const uint64_t* words = reinterpret_cast<const uint64_t*>(bits_);
+    size_t num_words = byte_array_size_ / sizeof(uint64_t);
+    bool counting = layout_ == BloomLayout::Counting;
+
+    if (num_words > sample_words && sample_words > 0) {
+        // Contiguous runs keep the hardware prefetcher busy
+        size_t run = std::max<size_t>(sample_words / kSaturationSampleRuns, 1);
+        size_t runs = std::min(sample_words / run, num_words / run);
+        size_t stride = num_words / runs;
+        uint64_t used = 0;
+        for (size_t r = 0; r < runs; ++r) {
+            used += bloom_popcount(words + r * stride, run, counting);
+        }
+        size_t cells = counting ? kCountersPerWord : 64;
+        return static_cast<double>(used) / (runs * run * cells);
+    }
+
+    uint64_t used = bloom_popcount(words, num_words, counting);
+    for (size_t i = num_words * sizeof(uint64_t); i < byte_array_size_; ++i) {
+        used += __builtin_popcount(__atomic_load_n(&bits_[i], __ATOMIC_RELAXED));
+    }
+    return static_cast<double>(used) / std::max<size_t>(bit_array_size_, 1);
+}
+
+FilterFillEstimate OctoBloomFilter::estimateFill(size_t sample_words) const {
+    FilterFillEstimate estimate;
+    double m = static_cast<double>(std::max<size_t>(bit_array_size_, 1));
+    double k = static_cast<double>(num_hashes_);
+    // A full sample would make the count infinite: cap it at one clear bit
+    double fill = std::min(sampleSaturation(sample_words), 1.0 - 1.0 / m);
+
+    // Swamidass and Baldi: n = -(m / k) ln(1 - X / m) for X bits set
+    estimate.saturation = fill;
+    estimate.cardinality = -(m / k) * std::log1p(-fill);
+    if (layout_ == BloomLayout::Blocked && estimate.cardinality >= 1.0) {
+        // Keys crowd some blocks more than others, which a global fill hides
+        estimate.false_positive_rate =
+            blockedFalsePositiveRate(m / estimate.cardinality, num_hashes_);
+    } else {
+        estimate.false_positive_rate = std::pow(fill, k);
+    }
+    return estimate;
+}
+
+inline size_t OctoBloomFilter::reduce(uint64_t hash, size_t range) const {
+    switch (reduction_) {
+        case BloomReduction::FastRange:
+            return static_cast<size_t>((static_cast<__uint128_t>(hash) * range) >> 64);
+        case BloomReduction::PowerOfTwo:
+            return hash & (range - 1);
+        case BloomReduction::Modulo:
+        default:
+            return hash % range;
+    }
+}
+
+size_t OctoBloomFilter::storageSize(const BloomFilterParams& params) {
+    return byteArraySize(params.layout, params.bit_array_size) + kBlockBytes - 1;
+}
+
+size_t OctoBloomFilter::byteArraySize(BloomLayout layout, size_t bit_array_size) {
+    if (layout == BloomLayout::Counting) {
+        // Whole words, so every counter update is a single-word CAS
+        return (bit_array_size + kCountersPerWord - 1) / kCountersPerWord * sizeof(uint64_t);
+    }
+    return (bit_array_size + 7) / 8;
+}
+
+BloomFilterParams OctoBloomFilter::getParams() const {
+    BloomFilterParams params;
+    params.kind = FilterKind::Bloom;
+    params.layout = layout_;
+    params.hash = hash_;
+    params.reduction = reduction_;
+    params.num_hashes = num_hashes_;
+    params.expected_count = expected_count_;
+    params.false_positive_rate = false_positive_rate_;
+    params.bit_array_size = bit_array_size_;
+    params.bucket_slots = 0;
+    params.fingerprint_bits = 0;
+    return params;
+}
+
+void OctoBloomFilter::applyParams(const BloomFilterParams& params) {
+    layout_ = params.layout;
+    hash_ = params.hash;
+    reduction_ = params.reduction;
+    num_hashes_ = params.num_hashes;
+    expected_count_ = params.expected_count;
+    false_positive_rate_ = params.false_positive_rate;
+    bit_array_size_ = params.bit_array_size;
+    byte_array_size_ = byteArraySize(layout_, bit_array_size_);
+    num_blocks_ = layout_ == BloomLayout::Blocked ? bit_array_size_ / kBlockBits : 0;
+}
+
+void OctoBloomFilter::sizeStandard(BloomFilterParams* params) {
+    uint64_t expected_count = params->expected_count;
+    double false_positive_rate = params->false_positive_rate;
 
     // Calculate optimal parameters
-    bit_array_size_ = static_cast<size_t>(
+    size_t bit_array_size = static_cast<size_t>(
         - (expected_count * std::log(false_positive_rate)) / std::pow(std::log(2), 2)
     );
     
-    num_hashes_ = static_cast<uint32_t>(
-        std::round((static_cast<double>(bit_array_size_) / expected_count) * std::log(2))
+    uint32_t num_hashes = static_cast<uint32_t>(
+        std::round((static_cast<double>(bit_array_size) / expected_count) * std::log(2))
     );
 
     // Ensure minimum values
-    bit_array_size_ = std::max(bit_array_size_, static_cast<size_t>(64));
-    num_hashes_ = std::max(num_hashes_, 1u);
-    num_hashes_ = std::min(num_hashes_, 50u); // Reasonable upper limit
+    bit_array_size = std::max(bit_array_size, static_cast<size_t>(64));
+    num_hashes = std::max(num_hashes, 1u);
+    num_hashes = std::min(num_hashes, 50u); // Reasonable upper limit
+
+    params->bit_array_size = bit_array_size;
+    params->num_hashes = num_hashes;
+}
 
-    // Calculate byte array size and allocate memory
-    byte_array_size_ = (bit_array_size_ + 7) / 8; // Round up to bytes
-    bits_ = (uint8_t*)palloc(byte_array_size_);
+void OctoBloomFilter::sizeBlocked(BloomFilterParams* params) {
+    // Blocked filters overfill some blocks (keys per block is Poisson
+    // distributed), so the classic formula underestimates their FPR. Search
+    // for the (k, bits per key) pair that meets the target with the fewest bits.
+    double false_positive_rate = params->false_positive_rate;
+    double best_bits_per_key = 0;
+    uint32_t best_hashes = 0;
+
+    for (uint32_t k = 1; k <= kMaxBlockedHashes; ++k) {
+        double lo = 1.0;
+        double hi = 128.0;
+        if (blockedFalsePositiveRate(hi, k) > false_positive_rate) {
+            continue;
+        }
+        for (int iter = 0; iter < 40; ++iter) {
+            double mid = (lo + hi) / 2;
+            if (blockedFalsePositiveRate(mid, k) > false_positive_rate) {
+                lo = mid;
+            } else {
+                hi = mid;
+            }
+        }
+        if (best_hashes == 0 || hi < best_bits_per_key) {
+            best_bits_per_key = hi;
+            best_hashes = k;
+        }
+    }
+
+    // Target below what a single block can deliver: use the densest setting
+    if (best_hashes == 0) {
+        best_bits_per_key = 128.0;
+        best_hashes = kMaxBlockedHashes;
+    }
+
+    size_t num_blocks = static_cast<size_t>(
+        std::ceil(params->expected_count * best_bits_per_key / kBlockBits));
+    num_blocks = std::max(num_blocks, static_cast<size_t>(1));
+
+    params->num_hashes = best_hashes;
+    params->bit_array_size = num_blocks * kBlockBits;
+}
+
+double OctoBloomFilter::blockedFalsePositiveRate(double bits_per_key, uint32_t num_hashes) {
+    // Mean number of keys per block
+    double lambda = kBlockBits / bits_per_key;
+
+    // Bits per key that land in each word of the block (bit i goes to word i % 8)
+    uint32_t per_word[kBlockWords];
+    for (size_t w = 0; w < kBlockWords; ++w) {
+        per_word[w] = num_hashes / kBlockWords + (w < num_hashes % kBlockWords ? 1 : 0);
+    }
+
+    // Sum over the Poisson distribution of block loads
+    double fpr = 0;
+    size_t max_load = static_cast<size_t>(lambda + 12 * std::sqrt(lambda) + 16);
+    for (size_t j = 0; j <= max_load; ++j) {
+        double p_load = std::exp(-lambda + j * std::log(lambda) - std::lgamma(j + 1.0));
+        double p_hit = 1.0;
+        for (size_t w = 0; w < kBlockWords && per_word[w] > 0; ++w) {
+            double fill = 1.0 - std::pow(1.0 - 1.0 / 64, static_cast<double>(j * per_word[w]));
+            p_hit *= std::pow(fill, per_word[w]);
+        }
+        fpr += p_load * p_hit;
+    }
+    return fpr;
+}
+
+OctoBloomFilter::~OctoBloomFilter() {
+    if (storage_) {
+        bloom_platform_free(storage_);
+    }
+}
+
+void OctoBloomFilter::attachStorage(void* storage) {
+    // Bits start at the first cache-line boundary inside the storage
+    uintptr_t address = reinterpret_cast<uintptr_t>(storage);
+    bits_ = reinterpret_cast<uint8_t*>((address + kBlockBytes - 1) & ~(kBlockBytes - 1));
+}
+
+void OctoBloomFilter::allocateBits() {
+    if (storage_) {
+        bloom_platform_free(storage_);
+    }
+    storage_ = (uint8_t*)bloom_platform_alloc(storageSize(getParams()));
+    attachStorage(storage_);
     memset(bits_, 0, byte_array_size_);
 }
 
+const uint64_t* OctoBloomFilter::blockFor(uint64_t h1) const {
+    return reinterpret_cast<const uint64_t*>(bits_) + reduce(h1, num_blocks_) * kBlockWords;
+}
+
+uint32_t OctoBloomFilter::blockKey(uint64_t h2) {
+    return static_cast<uint32_t>(h2 ^ (h2 >> 32));
+}
+
+uint64_t* OctoBloomFilter::counterWord(size_t index) const {
+    return reinterpret_cast<uint64_t*>(bits_) + index / kCountersPerWord;
+}
+
+uint32_t OctoBloomFilter::counterShift(size_t index) {
+    return static_cast<uint32_t>(index % kCountersPerWord) * kCounterBits;
+}
+
 void OctoBloomFilter::add(const void* data, size_t length) {
     auto hashes = doubleHash(data, length);
-    uint64_t h1 = hashes.first;
-    uint64_t h2 = hashes.second;
+    addHashes(hashes.first, hashes.second);
+}
+
+bool OctoBloomFilter::mightContain(const void* data, size_t length) const {
+    auto hashes = doubleHash(data, length);
+    return mightContainHashes(hashes.first, hashes.second);
+}
+
+// Bits are only ever set while a filter is live, so adds from concurrent
+// backends use relaxed atomic OR and readers use relaxed loads: a reader
+// racing an add either sees the new bits or behaves as if it ran first.
+// Counters are updated with a relaxed CAS on their word, with the same
+// guarantee for a reader racing an add or a remove.
+void OctoBloomFilter::addHashes(uint64_t h1, uint64_t h2) {
+    if (layout_ == BloomLayout::Blocked) {
+        uint64_t* block = const_cast<uint64_t*>(blockFor(h1));
+        uint32_t key = blockKey(h2);
+
+        // Skip the writes (and the cache-line ownership transfer) entirely
+        // when the key is already present
+        if (bloom_block_kernel->test(block, key, num_hashes_)) {
+            return;
+        }
+
+        uint64_t mask[kBlockWords];
+        bloom_block_mask(key, num_hashes_, mask);
+        for (size_t w = 0; w < kBlockWords; ++w) {
+            if (mask[w] && (__atomic_load_n(&block[w], __ATOMIC_RELAXED) & mask[w]) != mask[w]) {
+                __atomic_fetch_or(&block[w], mask[w], __ATOMIC_RELAXED);
+            }
+        }
+        return;
+    }
+
+    if (layout_ == BloomLayout::Counting) {
+        for (uint32_t i = 0; i < num_hashes_; ++i) {
+            size_t index = reduce(h1 + i * h2, bit_array_size_);
+            uint64_t* word = counterWord(index);
+            uint32_t shift = counterShift(index);
+            uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+            do {
+                if (((old >> shift) & kCounterMax) == kCounterMax) {
+                    break;
+                }
+            } while (!__atomic_compare_exchange_n(word, &old, old + (1ULL << shift), true,
+                                                  __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+        }
+        return;
+    }
 
     for (uint32_t i = 0; i < num_hashes_; ++i) {
         uint64_t hash = h1 + i * h2;
-        size_t index = hash % bit_array_size_;
+        size_t index = reduce(hash, bit_array_size_);
         size_t byte_index = index / 8;
         uint8_t bit_mask = 1 << (index % 8);
-        bits_[byte_index] |= bit_mask;
+        if (!(__atomic_load_n(&bits_[byte_index], __ATOMIC_RELAXED) & bit_mask)) {
+            __atomic_fetch_or(&bits_[byte_index], bit_mask, __ATOMIC_RELAXED);
+        }
     }
 }
 
-bool OctoBloomFilter::mightContain(const void* data, size_t length) const {
-    auto hashes = doubleHash(data, length);
-    uint64_t h1 = hashes.first;
-    uint64_t h2 = hashes.second;
+void OctoBloomFilter::addHashesUnshared(uint64_t h1, uint64_t h2) {
+    if (layout_ == BloomLayout::Blocked) {
+        uint64_t* block = const_cast<uint64_t*>(blockFor(h1));
+        bloom_block_kernel->set(block, blockKey(h2), num_hashes_);
+        return;
+    }
+
+    if (layout_ == BloomLayout::Counting) {
+        for (uint32_t i = 0; i < num_hashes_; ++i) {
+            size_t index = reduce(h1 + i * h2, bit_array_size_);
+            uint64_t* word = counterWord(index);
+            uint32_t shift = counterShift(index);
+            if (((*word >> shift) & kCounterMax) != kCounterMax) {
+                *word += 1ULL << shift;
+            }
+        }
+        return;
+    }
 
     for (uint32_t i = 0; i < num_hashes_; ++i) {
         uint64_t hash = h1 + i * h2;
-        size_t index = hash % bit_array_size_;
+        size_t index = reduce(hash, bit_array_size_);
+        bits_[index / 8] |= 1 << (index % 8);
+    }
+}
+
+bool OctoBloomFilter::mightContainHashes(uint64_t h1, uint64_t h2) const {
+    if (layout_ == BloomLayout::Blocked) {
+        // Vector load of the block; word-level tearing against a concurrent
+        // add only hides bits that are still being set
+        return bloom_block_kernel->test(blockFor(h1), blockKey(h2), num_hashes_);
+    }
+
+    if (layout_ == BloomLayout::Counting) {
+        for (uint32_t i = 0; i < num_hashes_; ++i) {
+            size_t index = reduce(h1 + i * h2, bit_array_size_);
+            uint64_t word = __atomic_load_n(counterWord(index), __ATOMIC_RELAXED);
+            if (((word >> counterShift(index)) & kCounterMax) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    for (uint32_t i = 0; i < num_hashes_; ++i) {
+        uint64_t hash = h1 + i * h2;
+        size_t index = reduce(hash, bit_array_size_);
         size_t byte_index = index / 8;
         uint8_t bit_mask = 1 << (index % 8);
-        if (!(bits_[byte_index] & bit_mask)) {
+        if (!(__atomic_load_n(&bits_[byte_index], __ATOMIC_RELAXED) & bit_mask)) {
             return false;
         }
     }
     return true;
 }
 
+void OctoBloomFilter::prefetch(uint64_t h1, uint64_t h2) const {
+    if (layout_ == BloomLayout::Blocked) {
+        __builtin_prefetch(blockFor(h1), 0, 3);
+        return;
+    }
+
+    for (uint32_t i = 0; i < num_hashes_; ++i) {
+        uint64_t hash = h1 + i * h2;
+        size_t index = reduce(hash, bit_array_size_);
+        if (layout_ == BloomLayout::Counting) {
+            __builtin_prefetch(counterWord(index), 0, 3);
+        } else {
+            __builtin_prefetch(&bits_[index / 8], 0, 3);
+        }
+    }
+}
+
+void OctoBloomFilter::mightContainBatch(const void* const* data, const size_t* lengths,
+                                        size_t count, bool* results) const {
+    uint64_t h1[kProbeBatch];
+    uint64_t h2[kProbeBatch];
+
+    for (size_t base = 0; base < count; base += kProbeBatch) {
+        size_t n = std::min(count - base, kProbeBatch);
+
+        // Hash the whole batch first so probes don't wait on hashing
+        for (size_t i = 0; i < n; ++i) {
+            auto hashes = doubleHash(data[base + i], lengths[base + i]);
+            h1[i] = hashes.first;
+            h2[i] = hashes.second;
+        }
+
+        // Software pipeline: keep kPrefetchDistance keys' cache lines in
+        // flight while probing the current one
+        size_t warmup = std::min(n, kPrefetchDistance);
+        for (size_t i = 0; i < warmup; ++i) {
+            prefetch(h1[i], h2[i]);
+        }
+        for (size_t i = 0; i < n; ++i) {
+            if (i + kPrefetchDistance < n) {
+                prefetch(h1[i + kPrefetchDistance], h2[i + kPrefetchDistance]);
+            }
+            results[base + i] = mightContainHashes(h1[i], h2[i]);
+        }
+    }
+}
+
+void OctoBloomFilter::addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) {
+    // Same pipeline as mightContainBatch, on hashes the caller computed
+    size_t warmup = std::min(count, kPrefetchDistance);
+    for (size_t i = 0; i < warmup; ++i) {
+        prefetch(h1[i], h2[i]);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (i + kPrefetchDistance < count) {
+            prefetch(h1[i + kPrefetchDistance], h2[i + kPrefetchDistance]);
+        }
+        addHashes(h1[i], h2[i]);
+    }
+}
+
 void OctoBloomFilter::remove(const void* data, size_t length) {
-    // For counting Bloom filter implementation
-    // This is a placeholder - actual implementation would require counting bits
-    // For simplicity, we're using a regular Bloom filter in this example
-    ereport(WARNING,
-            (errmsg("Remove operation not supported for regular Bloom filter")));
+    if (!supportsRemove()) {
+        return;
+    }
+    auto hashes = doubleHash(data, length);
+    removeHashes(hashes.first, hashes.second);
+}
+
+void OctoBloomFilter::removeHashes(uint64_t h1, uint64_t h2) {
+    if (!supportsRemove()) {
+        return;
+    }
+
+    // A saturated counter has lost its true count, so it is never lowered;
+    // a zero one means the key was never added and is left alone
+    for (uint32_t i = 0; i < num_hashes_; ++i) {
+        size_t index = reduce(h1 + i * h2, bit_array_size_);
+        uint64_t* word = counterWord(index);
+        uint32_t shift = counterShift(index);
+        uint64_t old = __atomic_load_n(word, __ATOMIC_RELAXED);
+        do {
+            uint64_t count = (old >> shift) & kCounterMax;
+            if (count == 0 || count == kCounterMax) {
+                break;
+            }
+        } while (!__atomic_compare_exchange_n(word, &old, old - (1ULL << shift), true,
+                                              __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+    }
+}
+
+// Nibble-wise saturating a + b: even and odd nibbles are summed in 8-bit
+// lanes, where any sum above kCounterMax has bit 4 set
+static inline uint64_t saturating_add_counters(uint64_t a, uint64_t b) {
+    const uint64_t low = 0x0f0f0f0f0f0f0f0fULL;
+    const uint64_t carry = 0x1010101010101010ULL;
+    uint64_t even = (a & low) + (b & low);
+    uint64_t odd = ((a >> 4) & low) + ((b >> 4) & low);
+    even = (even | ((even & carry) >> 4) * 0xf) & low;
+    odd = (odd | ((odd & carry) >> 4) * 0xf) & low;
+    return even | (odd << 4);
 }
 
 void OctoBloomFilter::clear() {
     memset(bits_, 0, byte_array_size_);
 }
 
+bool OctoBloomFilter::isCompatible(const FilterBackend& other_backend) const {
+    if (other_backend.getParams().kind != FilterKind::Bloom) {
+        return false;
+    }
+    const OctoBloomFilter& other = static_cast<const OctoBloomFilter&>(other_backend);
+    return layout_ == other.layout_ &&
+           hash_ == other.hash_ &&
+           reduction_ == other.reduction_ &&
+           num_hashes_ == other.num_hashes_ &&
+           bit_array_size_ == other.bit_array_size_;
+}
+
+bool OctoBloomFilter::mergeFrom(const FilterBackend& other_backend) {
+    if (!isCompatible(other_backend)) {
+        return false;
+    }
+    const OctoBloomFilter& other = static_cast<const OctoBloomFilter&>(other_backend);
+
+    // Both arrays start on a cache-line boundary, so whole words line up
+    size_t num_words = byte_array_size_ / sizeof(uint64_t);
+    uint64_t* dst = reinterpret_cast<uint64_t*>(bits_);
+    const uint64_t* src = reinterpret_cast<const uint64_t*>(other.bits_);
+
+    if (layout_ == BloomLayout::Counting) {
+        for (size_t w = 0; w < num_words; ++w) {
+            uint64_t word = src[w];
+            if (!word) {
+                continue;
+            }
+            uint64_t old = __atomic_load_n(&dst[w], __ATOMIC_RELAXED);
+            while (!__atomic_compare_exchange_n(&dst[w], &old, saturating_add_counters(old, word),
+                                                true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            }
+        }
+        return true;
+    }
+
+    for (size_t w = 0; w < num_words; ++w) {
+        uint64_t word = src[w];
+        if (word && (__atomic_load_n(&dst[w], __ATOMIC_RELAXED) & word) != word) {
+            __atomic_fetch_or(&dst[w], word, __ATOMIC_RELAXED);
+        }
+    }
+    for (size_t i = num_words * sizeof(uint64_t); i < byte_array_size_; ++i) {
+        if (other.bits_[i]) {
+            __atomic_fetch_or(&bits_[i], other.bits_[i], __ATOMIC_RELAXED);
+        }
+    }
+    return true;
+}
+
+// Nibble-wise min(a, b): in 8-bit lanes, (a | 16) - b keeps bit 4 exactly
+// where a >= b, without borrowing from the next lane
+static inline uint64_t min_counters(uint64_t a, uint64_t b) {
+    const uint64_t low = 0x0f0f0f0f0f0f0f0fULL;
+    const uint64_t carry = 0x1010101010101010ULL;
+    uint64_t result = 0;
+    for (int shift = 0; shift <= 4; shift += 4) {
+        uint64_t x = (a >> shift) & low;
+        uint64_t y = (b >> shift) & low;
+        uint64_t take_y = (((x | carry) - y) & carry) >> 4;
+        take_y *= 0xf;
+        result |= ((y & take_y) | (x & ~take_y)) << shift;
+    }
+    return result;
+}
+
+bool OctoBloomFilter::intersectWith(const OctoBloomFilter& other) {
+    if (!isCompatible(other)) {
+        return false;
+    }
+
+    size_t num_words = byte_array_size_ / sizeof(uint64_t);
+    uint64_t* dst = reinterpret_cast<uint64_t*>(bits_);
+    const uint64_t* src = reinterpret_cast<const uint64_t*>(other.bits_);
+    if (layout_ == BloomLayout::Counting) {
+        for (size_t w = 0; w < num_words; ++w) {
+            dst[w] = min_counters(dst[w], src[w]);
+        }
+        return true;
+    }
+    for (size_t w = 0; w < num_words; ++w) {
+        dst[w] &= src[w];
+    }
+    for (size_t i = num_words * sizeof(uint64_t); i < byte_array_size_; ++i) {
+        bits_[i] &= other.bits_[i];
+    }
+    return true;
+}
+
 size_t OctoBloomFilter::getMemoryUsage() const {
-    return (bit_array_size_ + 7) / 8; // Return size in bytes
+    return byte_array_size_;
 }
 
 std::pair<uint64_t, uint64_t> OctoBloomFilter::doubleHash(const void* data, size_t length) const {
+    if (hash_ == BloomHash::Wy128) {
+        uint64_t h1, h2;
+        bloom_hash128(data, length, &h1, &h2);
+        return {h1, h2};
+    }
+
     uint64_t h1 = hash1(data, length);
     uint64_t h2 = hash2(data, length);
     return {h1, h2};
@@ -94,12 +677,12 @@ uint64_t OctoBloomFilter::hash1(const void* data, size_t length) const {
     if (!data || length == 0) {
         return 0;
     }
-    Datum hash_datum = hash_any((const unsigned char*)data, length);
-    if (hash_datum == 0) {
+    uint32_t hash = bloom_platform_hash_any(data, length);
+    if (hash == 0) {
         // Fallback to simple hash if PostgreSQL hash fails
         return simple_hash(data, length);
     }
-    return DatumGetUInt64(hash_datum);
+    return hash;
 }
 
 uint64_t OctoBloomFilter::simple_hash(const void* data, size_t length) const {
@@ -128,47 +711,181 @@ uint64_t OctoBloomFilter::hash2(const void* data, size_t length) const {
     return hash;
 }
 
+// Serialized form, version 2: a 64-byte header, then the bit array at
+// offset 64, so bits that land on a cache line in memory can back a view
+// where they are. Fields are in the server's byte order (little-endian on
+// every platform built for); the CRC-32C covers the header, with crc
+// zeroed, then the bits.
+//
+// Version 1 had a 28-byte header of expected_count, bit_array_size and the
+// rate, then the hash count with ids packed into its upper bytes (see
+// kLayoutShift). It is still read, by copying.
+struct SerializedHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;  // Offset of the bits
+    uint8_t kind;
+    uint8_t layout;
+    uint8_t hash;
+    uint8_t reduction;
+    uint32_t num_hashes;
+    uint64_t expected_count;
+    double false_positive_rate;
+    uint64_t bit_array_size;
+    uint64_t payload_bytes;
+    uint32_t bucket_slots;  // Zero: kept for kinds with buckets
+    uint32_t fingerprint_bits;
+    uint32_t crc;  // CRC-32C
+    uint32_t key_type;  // Caller's tag, e.g. the SQL type's key type OID
+};
+static_assert(sizeof(SerializedHeader) == OctoBloomFilter::kSerializedHeaderBytes,
+              "serialized header must fill one cache line");
+
+static const uint32_t kSerializedMagic = 0x4d4c424f;  // "OBLM"
+static const uint16_t kSerializedVersion = 2;
+static const size_t kV1HeaderBytes = sizeof(uint64_t) * 3 + sizeof(uint32_t);
+
 size_t OctoBloomFilter::getSerializedSize() const {
-    return sizeof(uint64_t) * 3 + sizeof(uint32_t) + (bit_array_size_ + 7) / 8;
+    return kSerializedHeaderBytes + byte_array_size_;
 }
 
-void OctoBloomFilter::serialize(uint8_t* buffer) const {
-    uint64_t* u64_ptr = reinterpret_cast<uint64_t*>(buffer);
-    u64_ptr[0] = expected_count_;
-    u64_ptr[1] = bit_array_size_;
-    u64_ptr[2] = *reinterpret_cast<const uint64_t*>(&false_positive_rate_);
-    
-    uint32_t* u32_ptr = reinterpret_cast<uint32_t*>(buffer + sizeof(uint64_t) * 3);
-    u32_ptr[0] = num_hashes_;
-    
-    uint8_t* bits_buffer = buffer + sizeof(uint64_t) * 3 + sizeof(uint32_t);
-    memcpy(bits_buffer, bits_, byte_array_size_);
+void OctoBloomFilter::serialize(uint8_t* buffer, uint32_t key_type) const {
+    SerializedHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = kSerializedMagic;
+    header.version = kSerializedVersion;
+    header.header_size = kSerializedHeaderBytes;
+    header.kind = static_cast<uint8_t>(FilterKind::Bloom);
+    header.layout = static_cast<uint8_t>(layout_);
+    header.hash = static_cast<uint8_t>(hash_);
+    header.reduction = static_cast<uint8_t>(reduction_);
+    header.num_hashes = num_hashes_;
+    header.expected_count = expected_count_;
+    header.false_positive_rate = false_positive_rate_;
+    header.bit_array_size = bit_array_size_;
+    header.payload_bytes = byte_array_size_;
+    header.key_type = key_type;
+
+    // Shared bits change under concurrent adds: CRC the copy, not the source
+    uint8_t* payload = buffer + kSerializedHeaderBytes;
+    memcpy(payload, bits_, byte_array_size_);
+    uint32_t crc = bloom_platform_crc32c(kBloomCrc32cInit, &header, sizeof(header));
+    crc = bloom_platform_crc32c(crc, payload, byte_array_size_);
+    header.crc = bloom_crc32c_finish(crc);
+    memcpy(buffer, &header, sizeof(header));
 }
 
-bool OctoBloomFilter::deserialize(const uint8_t* buffer, size_t size) {
-    if (size < sizeof(uint64_t) * 3 + sizeof(uint32_t)) {
+// Parameters a filter of this layout can run with
+bool OctoBloomFilter::validParams(const BloomFilterParams& params) {
+    if (params.layout > BloomLayout::Counting || params.hash > BloomHash::Wy128 ||
+        params.reduction > BloomReduction::PowerOfTwo || params.bit_array_size == 0 ||
+        params.num_hashes == 0) {
         return false;
     }
-    
-    const uint64_t* u64_ptr = reinterpret_cast<const uint64_t*>(buffer);
-    expected_count_ = u64_ptr[0];
-    bit_array_size_ = u64_ptr[1];
-    false_positive_rate_ = *reinterpret_cast<const double*>(&u64_ptr[2]);
-    
-    const uint32_t* u32_ptr = reinterpret_cast<const uint32_t*>(buffer + sizeof(uint64_t) * 3);
-    num_hashes_ = u32_ptr[0];
-    
-    size_t expected_size = sizeof(uint64_t) * 3 + sizeof(uint32_t) + (bit_array_size_ + 7) / 8;
-    if (size < expected_size) {
+    if (params.layout == BloomLayout::Blocked &&
+        (params.bit_array_size % kBlockBits != 0 || params.num_hashes > kMaxBlockedHashes)) {
         return false;
     }
+    if (params.reduction == BloomReduction::PowerOfTwo) {
+        size_t range = params.layout == BloomLayout::Blocked ? params.bit_array_size / kBlockBits
+                                                             : params.bit_array_size;
+        if ((range & (range - 1)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    // Allocate memory for bits array
-    byte_array_size_ = (bit_array_size_ + 7) / 8;
-    bits_ = (uint8_t*)palloc(byte_array_size_);
+static bool parseV1(const uint8_t* buffer, size_t size, BloomFilterParams* params) {
+    uint64_t fields[3];
+    uint32_t packed;
+    memcpy(fields, buffer, sizeof(fields));
+    memcpy(&packed, buffer + sizeof(fields), sizeof(packed));
 
-    const uint8_t* bits_buffer = buffer + sizeof(uint64_t) * 3 + sizeof(uint32_t);
-    memcpy(bits_, bits_buffer, byte_array_size_);
-    
+    memset(params, 0, sizeof(*params));
+    params->kind = FilterKind::Bloom;
+    params->expected_count = fields[0];
+    params->bit_array_size = fields[1];
+    memcpy(&params->false_positive_rate, &fields[2], sizeof(double));
+    params->num_hashes = packed & kHashCountMask;
+    uint32_t layout_id = (packed >> kLayoutShift) & kHeaderByteMask;
+    uint32_t hash_id = (packed >> kHashShift) & kHeaderByteMask;
+    uint32_t reduction_id = (packed >> kReductionShift) & kHeaderByteMask;
+    if (layout_id > static_cast<uint32_t>(BloomLayout::Counting) ||
+        hash_id > static_cast<uint32_t>(BloomHash::Wy128) ||
+        reduction_id > static_cast<uint32_t>(BloomReduction::PowerOfTwo)) {
+        return false;
+    }
+    params->layout = static_cast<BloomLayout>(layout_id);
+    params->hash = static_cast<BloomHash>(hash_id);
+    params->reduction = static_cast<BloomReduction>(reduction_id);
+    return true;
+}
+
+bool OctoBloomFilter::parseSerialized(const uint8_t* buffer, size_t size,
+                                      BloomFilterParams* params, const uint8_t** bits,
+                                      uint32_t* key_type) {
+    SerializedHeader header;
+    if (size >= sizeof(header)) {
+        memcpy(&header, buffer, sizeof(header));
+    }
+    if (size < sizeof(header) || header.magic != kSerializedMagic) {
+        if (size < kV1HeaderBytes || !parseV1(buffer, size, params) || !validParams(*params) ||
+            size < kV1HeaderBytes + byteArraySize(params->layout, params->bit_array_size)) {
+            return false;
+        }
+        *bits = buffer + kV1HeaderBytes;
+        if (key_type) {
+            *key_type = 0;
+        }
+        return true;
+    }
+
+    if (header.version != kSerializedVersion || header.header_size != kSerializedHeaderBytes ||
+        header.kind != static_cast<uint8_t>(FilterKind::Bloom) ||
+        header.layout > static_cast<uint8_t>(BloomLayout::Counting) ||
+        header.hash > static_cast<uint8_t>(BloomHash::Wy128) ||
+        header.reduction > static_cast<uint8_t>(BloomReduction::PowerOfTwo)) {
+        return false;
+    }
+    memset(params, 0, sizeof(*params));
+    params->kind = FilterKind::Bloom;
+    params->layout = static_cast<BloomLayout>(header.layout);
+    params->hash = static_cast<BloomHash>(header.hash);
+    params->reduction = static_cast<BloomReduction>(header.reduction);
+    params->num_hashes = header.num_hashes;
+    params->expected_count = header.expected_count;
+    params->false_positive_rate = header.false_positive_rate;
+    params->bit_array_size = header.bit_array_size;
+    if (!validParams(*params) ||
+        header.payload_bytes != byteArraySize(params->layout, params->bit_array_size) ||
+        size - kSerializedHeaderBytes < header.payload_bytes) {
+        return false;
+    }
+
+    uint32_t expected = header.crc;
+    header.crc = 0;
+    uint32_t crc = bloom_platform_crc32c(kBloomCrc32cInit, &header, sizeof(header));
+    crc = bloom_platform_crc32c(crc, buffer + kSerializedHeaderBytes, header.payload_bytes);
+    if (bloom_crc32c_finish(crc) != expected) {
+        return false;
+    }
+
+    *bits = buffer + kSerializedHeaderBytes;
+    if (key_type) {
+        *key_type = header.key_type;
+    }
+    return true;
+}
+
+bool OctoBloomFilter::deserialize(const uint8_t* buffer, size_t size, uint32_t* key_type) {
+    BloomFilterParams params;
+    const uint8_t* bits;
+    if (!parseSerialized(buffer, size, &params, &bits, key_type)) {
+        return false;
+    }
+    applyParams(params);
+    allocateBits();
+    memcpy(bits_, bits, byte_array_size_);
     return true;
 }
\ No newline at end of file
@@ -7,41 +7,147 @@
 #include <functional>
 #include <cstring>
 
-class OctoBloomFilter {
+#include "bloom_hash.hpp"
+#include "bloom_kernels.hpp"
+#include "filter_backend.hpp"
+
+class OctoBloomFilter final : public FilterBackend {
 public:
-    OctoBloomFilter(uint64_t expected_count, double false_positive_rate);
-    ~OctoBloomFilter() = default;
+    static constexpr size_t kBlockBytes = 64;  // One cache line
+    static constexpr size_t kBlockWords = kBloomBlockWords;
+    static constexpr size_t kBlockBits = kBlockBytes * 8;
+    static constexpr uint32_t kMaxBlockedHashes = kBloomMaxBlockHashes;
+    static constexpr size_t kProbeBatch = 256;  // Keys hashed ahead per batch
+    static constexpr size_t kPrefetchDistance = 8;  // Keys kept in flight
+    static constexpr uint32_t kCounterBits = 4;  // Counting layout
+    static constexpr uint32_t kCountersPerWord = 64 / kCounterBits;
+    static constexpr uint64_t kCounterMax = (1u << kCounterBits) - 1;  // Sticky once reached
+
+    OctoBloomFilter(uint64_t expected_count, double false_positive_rate,
+                    BloomLayout layout = BloomLayout::Standard,
+                    BloomHash hash = BloomHash::Wy128,
+                    BloomReduction reduction = BloomReduction::FastRange);
+    // View over caller-owned memory of storageSize(params) bytes, e.g. in
+    // a shared memory area; the contents are used as they are
+    OctoBloomFilter(const BloomFilterParams& params, void* storage);
+    ~OctoBloomFilter() override;  // Frees the bits if the filter owns them
+
+    static BloomFilterParams computeParams(uint64_t expected_count, double false_positive_rate,
+                                           BloomLayout layout,
+                                           BloomHash hash = BloomHash::Wy128,
+                                           BloomReduction reduction = BloomReduction::FastRange);
+    // Bytes to allocate for a filter's bits, including alignment slack
+    static size_t storageSize(const BloomFilterParams& params);
 
     // Disallow copying
     OctoBloomFilter(const OctoBloomFilter&) = delete;
     OctoBloomFilter& operator=(const OctoBloomFilter&) = delete;
 
-    void add(const void* data, size_t length);
-    bool mightContain(const void* data, size_t length) const;
-    void remove(const void* data, size_t length); // For counting Bloom filter
-    void clear();
+    void add(const void* data, size_t length) override;
+    bool mightContain(const void* data, size_t length) const override;
+    // Counting layout only; a no-op for the others, whose bits can't be
+    // cleared. The key must have been added, or other keys' counters drop
+    void remove(const void* data, size_t length) override;
+    bool supportsRemove() const override { return layout_ == BloomLayout::Counting; }
+
+    // Probe many keys at once, overlapping the cache misses of different keys
+    void mightContainBatch(const void* const* data, const size_t* lengths,
+                           size_t count, bool* results) const override;
+
+    // Operations on precomputed doubleHash() results
+    std::pair<uint64_t, uint64_t> doubleHash(const void* data, size_t length) const override;
+    void addHashes(uint64_t h1, uint64_t h2);  // Safe against concurrent adds/reads
+    void addHashesUnshared(uint64_t h1, uint64_t h2) override;  // Single writer, no readers
+    void addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) override;
+    bool mightContainHashes(uint64_t h1, uint64_t h2) const override;
+    void removeHashes(uint64_t h1, uint64_t h2) override;  // Safe against concurrent adds/reads
+    void prefetch(uint64_t h1, uint64_t h2) const;
+    void prefetchHashes(uint64_t h1, uint64_t h2) const override { prefetch(h1, h2); }
+    void clear() override;
+
+    // Same layout, hash count and size, so bit arrays can be combined
+    bool isCompatible(const FilterBackend& other) const override;
+    // OR other's bits (add its counters, saturating, for the Counting
+    // layout) into this filter; safe against concurrent adds/reads.
+    // Returns false, changing nothing, if the filters aren't compatible
+    bool mergeFrom(const FilterBackend& other) override;
+    // Keep only the bits set in both filters (the lower of each pair of
+    // counters, for the Counting layout). Every key added to both still
+    // probes true; the result has at least the false positives of a filter
+    // built from the common keys alone. Single writer, no readers
+    bool intersectWith(const OctoBloomFilter& other);
     
-    size_t getMemoryUsage() const;
+    // Bytes of bit or counter array
+    size_t getMemoryUsage() const override;
     uint64_t getExpectedCount() const { return expected_count_; }
     double getFalsePositiveRate() const { return false_positive_rate_; }
+    // Predicted FPR at expected_count keys for the size actually allocated,
+    // which power-of-two rounding can push well below the requested rate
+    double getEffectiveFalsePositiveRate() const override;
+    double getSaturation() const override;
+    // Fraction of bits set (or counters nonzero) in at most sample_words
+    // words; all of them if the array is no larger
+    double sampleSaturation(size_t sample_words) const;
+    FilterFillEstimate estimateFill(size_t sample_words) const override;
     size_t getBitArraySize() const { return bit_array_size_; }
     uint32_t getNumHashes() const { return num_hashes_; }
+    BloomLayout getLayout() const { return layout_; }
+    BloomHash getHash() const { return hash_; }
+    BloomReduction getReduction() const { return reduction_; }
+    BloomFilterParams getParams() const override;
 
-    // Serialization methods
-    size_t getSerializedSize() const;
-    void serialize(uint8_t* buffer) const;
-    bool deserialize(const uint8_t* buffer, size_t size);
+    // Serialized form: a kSerializedHeaderBytes header, then the bits (see
+    // bloom_filter.cpp). serialize() writes getSerializedSize() bytes,
+    // recording key_type, the caller's tag for how keys were encoded
+    static constexpr size_t kSerializedHeaderBytes = 64;
+    size_t getSerializedSize() const override;
+    void serialize(uint8_t* buffer, uint32_t key_type) const override;
+    // Copy a serialized filter, of either format version, into memory of
+    // this filter's own
+    bool deserialize(const uint8_t* buffer, size_t size, uint32_t* key_type = nullptr);
+    // Check a serialized filter, its CRC included, without copying it: its
+    // parameters, and where its bits start in buffer. Bits on a 64-byte
+    // boundary can back a view through the storage constructor as they are
+    // key_type, if not null, receives the recorded tag (0 for version 1)
+    static bool parseSerialized(const uint8_t* buffer, size_t size,
+                                BloomFilterParams* params, const uint8_t** bits,
+                                uint32_t* key_type = nullptr);
 
 private:
-    uint8_t* bits_;  // Bit array stored as bytes
+    uint8_t* bits_;  // Bit array stored as bytes, 64-byte aligned
+    uint8_t* storage_;  // Unaligned allocation backing bits_
+    BloomLayout layout_;
+    BloomHash hash_;
+    BloomReduction reduction_;
     uint32_t num_hashes_;
     uint64_t expected_count_;
     double false_positive_rate_;
-    size_t bit_array_size_;
+    size_t bit_array_size_;  // Bits, or counters for the Counting layout
     size_t byte_array_size_;  // Size in bytes
+    size_t num_blocks_;  // Number of 64-byte blocks (Blocked layout only)
+
+    void applyParams(const BloomFilterParams& params);
+    static bool validParams(const BloomFilterParams& params);
+    void attachStorage(void* storage);
+    void allocateBits();
+    static void sizeStandard(BloomFilterParams* params);
+    static void sizeBlocked(BloomFilterParams* params);
+    static double blockedFalsePositiveRate(double bits_per_key, uint32_t num_hashes);
+    static void roundToPowerOfTwo(BloomFilterParams* params);
+    static size_t byteArraySize(BloomLayout layout, size_t bit_array_size);
+
+    // Index in [0, range) for a hash, per reduction_
+    size_t reduce(uint64_t hash, size_t range) const;
+
+    // Blocked layout: block selection and the 32-bit key fed to the kernels
+    const uint64_t* blockFor(uint64_t h1) const;
+    static uint32_t blockKey(uint64_t h2);
+
+    // Counting layout: counter index is split into a word and a nibble
+    uint64_t* counterWord(size_t index) const;
+    static uint32_t counterShift(size_t index);
 
-    // Double hashing implementation
-    std::pair<uint64_t, uint64_t> doubleHash(const void* data, size_t length) const;
+    // BloomHash::PgHashFnv, kept so filters created with it still probe correctly
     uint64_t hash1(const void* data, size_t length) const;
     uint64_t hash2(const void* data, size_t length) const;
     
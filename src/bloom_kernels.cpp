@@ -0,0 +1,283 @@
+#include "bloom_kernels.hpp"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define OCTO_BLOOM_X86 1
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define OCTO_BLOOM_NEON 1
+#include <arm_neon.h>
+#endif
+
+const uint32_t bloom_block_salts[kBloomMaxBlockHashes] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U,
+    0x9e3779b1U, 0x85ebca6bU, 0xc2b2ae35U, 0x27d4eb2fU,
+    0x165667b1U, 0xd3a2646dU, 0xfd7046c5U, 0xb55a4f09U,
+};
+
+// Scalar reference kernel
+
+static inline void scalar_mask(uint32_t key, uint32_t num_hashes, uint64_t mask[kBloomBlockWords]) {
+    for (size_t w = 0; w < kBloomBlockWords; ++w) {
+        mask[w] = 0;
+    }
+    for (uint32_t i = 0; i < num_hashes; ++i) {
+        uint32_t bit = (key * bloom_block_salts[i]) >> 26;
+        mask[i % kBloomBlockWords] |= static_cast<uint64_t>(1) << bit;
+    }
+}
+
+static bool scalar_test(const uint64_t* block, uint32_t key, uint32_t num_hashes) {
+    uint64_t mask[kBloomBlockWords];
+    scalar_mask(key, num_hashes, mask);
+    for (size_t w = 0; w < kBloomBlockWords; ++w) {
+        if ((block[w] & mask[w]) != mask[w]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void scalar_set(uint64_t* block, uint32_t key, uint32_t num_hashes) {
+    uint64_t mask[kBloomBlockWords];
+    scalar_mask(key, num_hashes, mask);
+    for (size_t w = 0; w < kBloomBlockWords; ++w) {
+        block[w] |= mask[w];
+    }
+}
+
+static const BloomBlockKernel scalar_kernel = {"scalar", scalar_test, scalar_set};
+
+void bloom_block_mask(uint32_t key, uint32_t num_hashes, uint64_t mask[kBloomBlockWords]) {
+    scalar_mask(key, num_hashes, mask);
+}
+
+#ifdef OCTO_BLOOM_X86
+
+// AVX2: the 16 salted multiplies run as two 8-lane 32-bit multiplies, then
+// each bit index is widened to a 64-bit lane and turned into a mask by a
+// variable shift. The block is tested as two 256-bit halves.
+
+__attribute__((target("avx2")))
+static inline void avx2_mask(uint32_t key, uint32_t num_hashes, __m256i* lo, __m256i* hi) {
+    const __m256i iota = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i ones = _mm256_set1_epi64x(1);
+    __m256i keys = _mm256_set1_epi32(static_cast<int>(key));
+    __m256i k = _mm256_set1_epi32(static_cast<int>(num_hashes));
+
+    __m256i words_lo = _mm256_setzero_si256();
+    __m256i words_hi = _mm256_setzero_si256();
+
+    for (uint32_t round = 0; round < kBloomMaxBlockHashes / kBloomBlockWords; ++round) {
+        __m256i salts = _mm256_loadu_si256(
+            reinterpret_cast<const __m256i*>(bloom_block_salts + round * kBloomBlockWords));
+        __m256i bits = _mm256_srli_epi32(_mm256_mullo_epi32(keys, salts), 26);
+
+        // Lanes whose hash index i = round * 8 + lane is below num_hashes
+        __m256i index = _mm256_add_epi32(iota, _mm256_set1_epi32(static_cast<int>(round * kBloomBlockWords)));
+        __m256i active = _mm256_cmpgt_epi32(k, index);
+
+        __m256i bits_lo = _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bits));
+        __m256i bits_hi = _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bits, 1));
+        __m256i active_lo = _mm256_cvtepi32_epi64(_mm256_castsi256_si128(active));
+        __m256i active_hi = _mm256_cvtepi32_epi64(_mm256_extracti128_si256(active, 1));
+
+        words_lo = _mm256_or_si256(words_lo,
+                                   _mm256_and_si256(_mm256_sllv_epi64(ones, bits_lo), active_lo));
+        words_hi = _mm256_or_si256(words_hi,
+                                   _mm256_and_si256(_mm256_sllv_epi64(ones, bits_hi), active_hi));
+    }
+
+    *lo = words_lo;
+    *hi = words_hi;
+}
+
+__attribute__((target("avx2")))
+static bool avx2_test(const uint64_t* block, uint32_t key, uint32_t num_hashes) {
+    __m256i mask_lo, mask_hi;
+    avx2_mask(key, num_hashes, &mask_lo, &mask_hi);
+    __m256i block_lo = _mm256_load_si256(reinterpret_cast<const __m256i*>(block));
+    __m256i block_hi = _mm256_load_si256(reinterpret_cast<const __m256i*>(block + 4));
+    // testc returns 1 when every mask bit is also set in the block
+    return _mm256_testc_si256(block_lo, mask_lo) & _mm256_testc_si256(block_hi, mask_hi);
+}
+
+__attribute__((target("avx2")))
+static void avx2_set(uint64_t* block, uint32_t key, uint32_t num_hashes) {
+    __m256i mask_lo, mask_hi;
+    avx2_mask(key, num_hashes, &mask_lo, &mask_hi);
+    __m256i* lo = reinterpret_cast<__m256i*>(block);
+    __m256i* hi = reinterpret_cast<__m256i*>(block + 4);
+    _mm256_store_si256(lo, _mm256_or_si256(_mm256_load_si256(lo), mask_lo));
+    _mm256_store_si256(hi, _mm256_or_si256(_mm256_load_si256(hi), mask_hi));
+}
+
+static const BloomBlockKernel avx2_kernel = {"avx2", avx2_test, avx2_set};
+
+// AVX-512: all 16 multiplies in one instruction, the whole block in one
+// register, and lane masks instead of blend/and for inactive hashes.
+
+// GCC 12's AVX-512 headers trip -Wuninitialized on _mm512_undefined_*()
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+
+__attribute__((target("avx512f")))
+static inline __m512i avx512_mask(uint32_t key, uint32_t num_hashes) {
+    const __m512i ones = _mm512_set1_epi64(1);
+    __m512i salts = _mm512_loadu_si512(bloom_block_salts);
+    __m512i bits = _mm512_srli_epi32(
+        _mm512_mullo_epi32(_mm512_set1_epi32(static_cast<int>(key)), salts), 26);
+
+    __mmask16 active = static_cast<__mmask16>((1u << num_hashes) - 1);
+    __m512i bits_lo = _mm512_cvtepu32_epi64(_mm512_castsi512_si256(bits));
+    __m512i bits_hi = _mm512_cvtepu32_epi64(_mm512_extracti64x4_epi64(bits, 1));
+
+    __m512i mask = _mm512_maskz_sllv_epi64(static_cast<__mmask8>(active), ones, bits_lo);
+    return _mm512_mask_or_epi64(mask, static_cast<__mmask8>(active >> 8), mask,
+                                _mm512_sllv_epi64(ones, bits_hi));
+}
+
+__attribute__((target("avx512f")))
+static bool avx512_test(const uint64_t* block, uint32_t key, uint32_t num_hashes) {
+    __m512i mask = avx512_mask(key, num_hashes);
+    __m512i data = _mm512_load_si512(block);
+    return _mm512_cmpneq_epi64_mask(_mm512_and_si512(data, mask), mask) == 0;
+}
+
+__attribute__((target("avx512f")))
+static void avx512_set(uint64_t* block, uint32_t key, uint32_t num_hashes) {
+    __m512i mask = avx512_mask(key, num_hashes);
+    _mm512_store_si512(block, _mm512_or_si512(_mm512_load_si512(block), mask));
+}
+
+static const BloomBlockKernel avx512_kernel = {"avx512", avx512_test, avx512_set};
+
+#pragma GCC diagnostic pop
+
+#endif // OCTO_BLOOM_X86
+
+#ifdef OCTO_BLOOM_NEON
+
+// NEON: four 32-bit multiplies per instruction, widened to pairs of 64-bit
+// lanes; the block is handled as four 128-bit quarters.
+
+static inline void neon_mask(uint32_t key, uint32_t num_hashes, uint64x2_t mask[4]) {
+    static const uint32_t iota[4] = {0, 1, 2, 3};
+    const uint64x2_t ones = vdupq_n_u64(1);
+    uint32x4_t keys = vdupq_n_u32(key);
+    uint32x4_t k = vdupq_n_u32(num_hashes);
+
+    for (int q = 0; q < 4; ++q) {
+        mask[q] = vdupq_n_u64(0);
+    }
+
+    for (uint32_t group = 0; group < kBloomMaxBlockHashes / 4; ++group) {
+        uint32x4_t salts = vld1q_u32(bloom_block_salts + group * 4);
+        uint32x4_t bits = vshrq_n_u32(vmulq_u32(keys, salts), 26);
+        uint32x4_t index = vaddq_u32(vld1q_u32(iota), vdupq_n_u32(group * 4));
+        uint32x4_t active = vcltq_u32(index, k);
+
+        uint64x2_t lo = vandq_u64(vshlq_u64(ones, vreinterpretq_s64_u64(vmovl_u32(vget_low_u32(bits)))),
+                                  vreinterpretq_u64_s64(vmovl_s32(vreinterpret_s32_u32(vget_low_u32(active)))));
+        uint64x2_t hi = vandq_u64(vshlq_u64(ones, vreinterpretq_s64_u64(vmovl_u32(vget_high_u32(bits)))),
+                                  vreinterpretq_u64_s64(vmovl_s32(vreinterpret_s32_u32(vget_high_u32(active)))));
+
+        // Hash i goes to word i % 8: groups 0/2 fill words 0-3, groups 1/3 words 4-7
+        int quarter = (group % 2) * 2;
+        mask[quarter] = vorrq_u64(mask[quarter], lo);
+        mask[quarter + 1] = vorrq_u64(mask[quarter + 1], hi);
+    }
+}
+
+static bool neon_test(const uint64_t* block, uint32_t key, uint32_t num_hashes) {
+    uint64x2_t mask[4];
+    neon_mask(key, num_hashes, mask);
+    uint64x2_t missing = vdupq_n_u64(0);
+    for (int q = 0; q < 4; ++q) {
+        missing = vorrq_u64(missing, vbicq_u64(mask[q], vld1q_u64(block + q * 2)));
+    }
+    return (vgetq_lane_u64(missing, 0) | vgetq_lane_u64(missing, 1)) == 0;
+}
+
+static void neon_set(uint64_t* block, uint32_t key, uint32_t num_hashes) {
+    uint64x2_t mask[4];
+    neon_mask(key, num_hashes, mask);
+    for (int q = 0; q < 4; ++q) {
+        vst1q_u64(block + q * 2, vorrq_u64(vld1q_u64(block + q * 2), mask[q]));
+    }
+}
+
+static const BloomBlockKernel neon_kernel = {"neon", neon_test, neon_set};
+
+#endif // OCTO_BLOOM_NEON
+
+const BloomBlockKernel* bloom_block_kernel = &scalar_kernel;
+
+// Population counts. Without -mpopcnt the builtin is a bit-twiddling
+// sequence; the x86 variant is compiled for the POPCNT instruction
+
+// One bit per nonzero 4-bit counter
+static inline uint64_t fold_nibbles(uint64_t word) {
+    return (word | (word >> 1) | (word >> 2) | (word >> 3)) & 0x1111111111111111ULL;
+}
+
+static uint64_t scalar_popcount(const uint64_t* words, size_t count, bool nibbles) {
+    uint64_t used = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t word = __atomic_load_n(&words[i], __ATOMIC_RELAXED);
+        used += __builtin_popcountll(nibbles ? fold_nibbles(word) : word);
+    }
+    return used;
+}
+
+#ifdef OCTO_BLOOM_X86
+
+__attribute__((target("popcnt")))
+static uint64_t popcnt_popcount(const uint64_t* words, size_t count, bool nibbles) {
+    uint64_t used = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t word = __atomic_load_n(&words[i], __ATOMIC_RELAXED);
+        used += __builtin_popcountll(nibbles ? fold_nibbles(word) : word);
+    }
+    return used;
+}
+
+#endif // OCTO_BLOOM_X86
+
+PopcountFn bloom_popcount = scalar_popcount;
+
+size_t bloom_available_block_kernels(const BloomBlockKernel** out, size_t max) {
+    size_t n = 0;
+    if (n < max) {
+        out[n++] = &scalar_kernel;
+    }
+#ifdef OCTO_BLOOM_X86
+    __builtin_cpu_init();
+    if (n < max && __builtin_cpu_supports("avx2")) {
+        out[n++] = &avx2_kernel;
+    }
+    if (n < max && __builtin_cpu_supports("avx512f")) {
+        out[n++] = &avx512_kernel;
+    }
+#endif
+#ifdef OCTO_BLOOM_NEON
+    // Advanced SIMD is mandatory on AArch64
+    if (n < max) {
+        out[n++] = &neon_kernel;
+    }
+#endif
+    return n;
+}
+
+void bloom_select_block_kernel() {
+    const BloomBlockKernel* kernels[4];
+    size_t n = bloom_available_block_kernels(kernels, 4);
+    // Kernels are listed from slowest to fastest
+    bloom_block_kernel = kernels[n - 1];
+
+#ifdef OCTO_BLOOM_X86
+    if (__builtin_cpu_supports("popcnt")) {
+        bloom_popcount = popcnt_popcount;
+    }
+#endif
+}
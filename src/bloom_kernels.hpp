@@ -0,0 +1,48 @@
+#ifndef OCTO_BLOOM_BLOOM_KERNELS_HPP
+#define OCTO_BLOOM_BLOOM_KERNELS_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+// Probe kernels for the blocked layout. A block is 8 x 64-bit words (one
+// cache line); bit i of a key lands in word i % 8 at the position given by
+// the top 6 bits of (key * salt[i]). Every kernel must produce exactly the
+// same bits, so filters stay portable between hosts with different CPUs.
+//
+// This file has no PostgreSQL dependencies so the kernels can be
+// benchmarked standalone.
+
+static constexpr size_t kBloomBlockWords = 8;
+static constexpr uint32_t kBloomMaxBlockHashes = 16;
+
+extern const uint32_t bloom_block_salts[kBloomMaxBlockHashes];
+
+typedef bool (*BlockTestFn)(const uint64_t* block, uint32_t key, uint32_t num_hashes);
+typedef void (*BlockSetFn)(uint64_t* block, uint32_t key, uint32_t num_hashes);
+
+struct BloomBlockKernel {
+    const char* name;
+    BlockTestFn test;  // True when all bits of key are set in block
+    BlockSetFn set;    // OR the bits of key into block
+};
+
+// Word-by-word bit mask of key, for callers that OR it in atomically
+void bloom_block_mask(uint32_t key, uint32_t num_hashes, uint64_t mask[kBloomBlockWords]);
+
+// Kernel used by OctoBloomFilter; scalar until bloom_select_block_kernel runs
+extern const BloomBlockKernel* bloom_block_kernel;
+
+// Pick the fastest kernels supported by the running CPU
+void bloom_select_block_kernel();
+
+// All kernels usable on this CPU, scalar first, for benchmarking
+size_t bloom_available_block_kernels(const BloomBlockKernel** out, size_t max);
+
+// Bits set in count words, read with relaxed loads so adds can go on
+// meanwhile. With nibbles set, each nonzero 4-bit counter counts once
+typedef uint64_t (*PopcountFn)(const uint64_t* words, size_t count, bool nibbles);
+
+// Uses POPCNT where bloom_select_block_kernel found it
+extern PopcountFn bloom_popcount;
+
+#endif // OCTO_BLOOM_BLOOM_KERNELS_HPP
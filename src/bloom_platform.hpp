@@ -0,0 +1,28 @@
+#ifndef OCTO_BLOOM_BLOOM_PLATFORM_HPP
+#define OCTO_BLOOM_BLOOM_PLATFORM_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+// What the filter core (OctoBloomFilter, the block kernels and bloom_hash)
+// needs from its host: memory for filters that own their bits, the 32-bit
+// hash_any of BloomHash::PgHashFnv filters, and CRC-32C for the serialized
+// format. The extension links bloom_platform_pg.cpp, which forwards to the
+// server; standalone builds such as the benchmarks link
+// bench/bloom_platform_standalone.cpp instead, so the core can be exercised
+// outside a backend.
+
+// Never returns NULL: fails the way the host fails out of memory
+void* bloom_platform_alloc(size_t bytes);
+void bloom_platform_free(void* ptr);
+
+uint32_t bloom_platform_hash_any(const void* data, size_t length);
+
+// CRC-32C (Castagnoli), computed as pg_crc32c's INIT/COMP/FIN_CRC32C are
+static constexpr uint32_t kBloomCrc32cInit = 0xFFFFFFFFU;
+uint32_t bloom_platform_crc32c(uint32_t crc, const void* data, size_t length);
+static inline uint32_t bloom_crc32c_finish(uint32_t crc) {
+    return crc ^ 0xFFFFFFFFU;
+}
+
+#endif // OCTO_BLOOM_BLOOM_PLATFORM_HPP
@@ -0,0 +1,28 @@
+#include "bloom_platform.hpp"
+
+extern "C" {
+#include <postgres.h>
+#include <common/hashfn.h>
+#include <port/pg_crc32c.h>
+#include <utils/palloc.h>
+}
+
+// The filter core inside a backend: memory from CurrentMemoryContext, so
+// an owned filter goes with its context if never destroyed
+
+void* bloom_platform_alloc(size_t bytes) {
+    return palloc(bytes);
+}
+
+void bloom_platform_free(void* ptr) {
+    pfree(ptr);
+}
+
+uint32_t bloom_platform_hash_any(const void* data, size_t length) {
+    return DatumGetUInt32(hash_any((const unsigned char*)data, (int)length));
+}
+
+uint32_t bloom_platform_crc32c(uint32_t crc, const void* data, size_t length) {
+    COMP_CRC32C(crc, data, length);
+    return crc;
+}
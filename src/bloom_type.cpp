@@ -0,0 +1,388 @@
+#include "bloom_type.hpp"
+#include "bloom_filter.hpp"
+#include "datum_key.hpp"
+#include "shared_memory.hpp"
+#include "trigger_manager.hpp"
+#include <new>
+
+extern "C" {
+#include <access/detoast.h>
+#include <fmgr.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/memutils.h>
+}
+
+// Values are bytea-like varlenas holding a version 2 serialized filter.
+// Input, receive and the cast from bytea accept either format version and
+// store the current one, so everything past them can assume it. A value
+// is never used in place: its bits follow a 4-byte varlena header, off the
+// cache-line boundary a view needs, so each use copies it into a private
+// filter first. Probes in a query keep that copy for as long as the value
+// doesn't change.
+
+extern "C" {
+
+// A value for filter in CurrentMemoryContext
+static bytea* filter_to_value(const FilterBackend* filter, uint32_t key_type) {
+    size_t size = filter->getSerializedSize();
+    if (size > MaxAllocSize - VARHDRSZ) {
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("bloom filter of %zu bytes is too large for an octo_bloom value", size)));
+    }
+    bytea* value = (bytea*)palloc(VARHDRSZ + size);
+    SET_VARSIZE(value, VARHDRSZ + size);
+    filter->serialize(reinterpret_cast<uint8_t*>(VARDATA(value)), key_type);
+    return value;
+}
+
+// Private copy of a value's filter in CurrentMemoryContext. ERRORs with
+// sqlstate if the value isn't an intact serialized filter
+static OctoBloomFilter* value_to_filter(const bytea* value, uint32_t* key_type, int sqlstate) {
+    OctoBloomFilter* filter = new (palloc(sizeof(OctoBloomFilter))) OctoBloomFilter(1, 0.5);
+    if (!filter->deserialize(reinterpret_cast<const uint8_t*>(VARDATA_ANY(value)),
+                             VARSIZE_ANY_EXHDR(value), key_type)) {
+        ereport(ERROR,
+                (errcode(sqlstate),
+                 errmsg("invalid octo_bloom value"),
+                 errdetail("The value is not a serialized bloom filter, or its checksum "
+                           "does not match its contents.")));
+    }
+    return filter;
+}
+
+// The value in the current format, after checking it
+static bytea* normalize_value(const bytea* value, int sqlstate) {
+    uint32_t key_type;
+    OctoBloomFilter* filter = value_to_filter(value, &key_type, sqlstate);
+    return filter_to_value(filter, key_type);
+}
+
+Datum octo_bloom_in(PG_FUNCTION_ARGS) {
+    bytea* raw = DatumGetByteaPP(DirectFunctionCall1(byteain, PG_GETARG_DATUM(0)));
+    PG_RETURN_BYTEA_P(normalize_value(raw, ERRCODE_INVALID_TEXT_REPRESENTATION));
+}
+
+Datum octo_bloom_out(PG_FUNCTION_ARGS) {
+    return DirectFunctionCall1(byteaout, PG_GETARG_DATUM(0));
+}
+
+Datum octo_bloom_recv(PG_FUNCTION_ARGS) {
+    bytea* raw = DatumGetByteaPP(DirectFunctionCall1(bytearecv, PG_GETARG_DATUM(0)));
+    PG_RETURN_BYTEA_P(normalize_value(raw, ERRCODE_INVALID_BINARY_REPRESENTATION));
+}
+
+Datum octo_bloom_send(PG_FUNCTION_ARGS) {
+    return DirectFunctionCall1(byteasend, PG_GETARG_DATUM(0));
+}
+
+Datum octo_bloom_from_bytea(PG_FUNCTION_ARGS) {
+    bytea* raw = PG_GETARG_BYTEA_PP(0);
+    PG_RETURN_BYTEA_P(normalize_value(raw, ERRCODE_INVALID_BINARY_REPRESENTATION));
+}
+
+// A registry filter as a value, with the keys this transaction has
+// deferred. Concurrent adds may or may not be in it
+Datum octo_bloom_export(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_PP(1);
+
+    char* col_name = text_to_cstring(column_name);
+    int16_t attnum = get_attnum(table_oid, col_name);
+
+    if (attnum == InvalidAttrNumber) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_COLUMN),
+                 errmsg("column \"%s\" does not exist", col_name)));
+    }
+
+    apply_deferred_adds(table_oid, attnum);
+    BloomKeyType key_type;
+    FilterBackend* filter = get_bloom_filter(table_oid, attnum, &key_type);
+    if (!filter) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                 errmsg("no bloom filter on column \"%s\"", col_name),
+                 errhint("Create one with octo_bloom_init() first.")));
+    }
+    if (filter->getSerializedSize() == 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("the filter on column \"%s\" cannot be exported", col_name),
+                 errdetail("Only standard, blocked and counting bloom filters have a "
+                           "serialized form.")));
+    }
+
+    PG_RETURN_BYTEA_P(filter_to_value(filter, key_type.typid));
+}
+
+// Transition state of octo_bloom_agg. Serialized partial states are values
+// of the type, so they carry the key type with them
+typedef struct BloomAggState {
+    OctoBloomFilter* filter;
+    BloomKeyType key_type;  // Only typid is set in deserialized states
+} BloomAggState;
+
+static BloomAggState* agg_state_create(const BloomFilterParams& params) {
+    void* storage = palloc0(OctoBloomFilter::storageSize(params));
+    BloomAggState* state = (BloomAggState*)palloc0(sizeof(BloomAggState));
+    state->filter = new (palloc(sizeof(OctoBloomFilter))) OctoBloomFilter(params, storage);
+    return state;
+}
+
+// First row: size the filter from its arguments, which later rows repeat
+static BloomAggState* agg_state_first(FunctionCallInfo fcinfo) {
+    if (PG_ARGISNULL(2) || (PG_NARGS() > 3 && PG_ARGISNULL(3))) {
+        ereport(ERROR,
+                (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                 errmsg("expected_count and false_positive_rate must not be null")));
+    }
+    int64 expected_count = PG_GETARG_INT64(2);
+    double false_positive_rate = PG_NARGS() > 3 ? PG_GETARG_FLOAT8(3) : 0.01;
+
+    if (expected_count <= 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("expected_count must be greater than zero")));
+    }
+    if (false_positive_rate <= 0 || false_positive_rate >= 1) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("false_positive_rate must be between 0 and 1")));
+    }
+
+    // The standard layout: the simplest for clients to probe
+    BloomFilterParams params = OctoBloomFilter::computeParams(
+        expected_count, false_positive_rate, BloomLayout::Standard,
+        static_cast<BloomHash>(octo_bloom_hash_algorithm),
+        static_cast<BloomReduction>(octo_bloom_index_reduction));
+    if (OctoBloomFilter::storageSize(params) > MaxAllocSize - VARHDRSZ -
+                                               OctoBloomFilter::kSerializedHeaderBytes) {
+        ereport(ERROR,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("bloom filter for %lld keys at a false positive rate of %g is too "
+                        "large for an octo_bloom value",
+                        (long long)expected_count, false_positive_rate)));
+    }
+
+    BloomAggState* state = agg_state_create(params);
+    bloom_key_type_for_column(get_fn_expr_argtype(fcinfo->flinfo, 1), PG_GET_COLLATION(),
+                              &state->key_type);
+    return state;
+}
+
+static void agg_check_compatible(const OctoBloomFilter* a, const OctoBloomFilter* b) {
+    if (!a->isCompatible(*b)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("bloom filters built with different parameters cannot be combined"),
+                 errhint("Pass the same expected_count and false_positive_rate on every row.")));
+    }
+}
+
+Datum octo_bloom_agg_transfn(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "octo_bloom_agg_transfn called in non-aggregate context");
+    }
+
+    BloomAggState* state = PG_ARGISNULL(0) ? NULL : (BloomAggState*)PG_GETARG_POINTER(0);
+    if (!state) {
+        MemoryContext oldcontext = MemoryContextSwitchTo(aggcontext);
+        state = agg_state_first(fcinfo);
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    // Nulls are skipped, like the triggers skip them
+    if (!PG_ARGISNULL(1)) {
+        BloomKey key;
+        bloom_key_from_datum(&state->key_type, PG_GETARG_DATUM(1), &key);
+        auto hashes = state->filter->doubleHash(key.data, key.length);
+        state->filter->addHashesUnshared(hashes.first, hashes.second);
+        bloom_key_release(&key);
+    }
+
+    PG_RETURN_POINTER(state);
+}
+
+// OR partial filters together. Not strict: a first partial state has to be
+// copied into the aggregate's context, which a strict combine can't do
+Datum octo_bloom_agg_combine(PG_FUNCTION_ARGS) {
+    MemoryContext aggcontext;
+    if (!AggCheckCallContext(fcinfo, &aggcontext)) {
+        elog(ERROR, "octo_bloom_agg_combine called in non-aggregate context");
+    }
+
+    BloomAggState* state1 = PG_ARGISNULL(0) ? NULL : (BloomAggState*)PG_GETARG_POINTER(0);
+    BloomAggState* state2 = PG_ARGISNULL(1) ? NULL : (BloomAggState*)PG_GETARG_POINTER(1);
+    if (!state2) {
+        if (!state1) {
+            PG_RETURN_NULL();
+        }
+        PG_RETURN_POINTER(state1);
+    }
+
+    if (!state1) {
+        MemoryContext oldcontext = MemoryContextSwitchTo(aggcontext);
+        state1 = agg_state_create(state2->filter->getParams());
+        state1->key_type = state2->key_type;
+        MemoryContextSwitchTo(oldcontext);
+    }
+    agg_check_compatible(state1->filter, state2->filter);
+    state1->filter->mergeFrom(*state2->filter);
+
+    PG_RETURN_POINTER(state1);
+}
+
+Datum octo_bloom_agg_serialize(PG_FUNCTION_ARGS) {
+    BloomAggState* state = (BloomAggState*)PG_GETARG_POINTER(0);
+    PG_RETURN_BYTEA_P(filter_to_value(state->filter, state->key_type.typid));
+}
+
+Datum octo_bloom_agg_deserialize(PG_FUNCTION_ARGS) {
+    bytea* value = PG_GETARG_BYTEA_PP(0);
+    BloomAggState* state = (BloomAggState*)palloc0(sizeof(BloomAggState));
+    uint32_t key_type;
+    state->filter = value_to_filter(value, &key_type, ERRCODE_DATA_CORRUPTED);
+    state->key_type.typid = key_type;
+    PG_RETURN_POINTER(state);
+}
+
+Datum octo_bloom_agg_final(PG_FUNCTION_ARGS) {
+    if (PG_ARGISNULL(0)) {
+        PG_RETURN_NULL();  // No rows
+    }
+    BloomAggState* state = (BloomAggState*)PG_GETARG_POINTER(0);
+    PG_RETURN_BYTEA_P(filter_to_value(state->filter, state->key_type.typid));
+}
+
+// Key type of a filter combined from two, which must agree where recorded
+static uint32_t combined_key_type(uint32_t a, uint32_t b) {
+    if (a != 0 && b != 0 && a != b) {
+        ereport(ERROR,
+                (errcode(ERRCODE_DATATYPE_MISMATCH),
+                 errmsg("cannot combine bloom filters on types %s and %s",
+                        format_type_be(a), format_type_be(b))));
+    }
+    return a != 0 ? a : b;
+}
+
+// Parameters both filters must share, for the errors below
+#define COMBINE_DETAIL \
+    "Both filters need the same layout, hash, number of hash functions and size."
+
+Datum octo_bloom_union(PG_FUNCTION_ARGS) {
+    uint32_t key_type_a;
+    uint32_t key_type_b;
+    OctoBloomFilter* a = value_to_filter(PG_GETARG_BYTEA_PP(0), &key_type_a,
+                                         ERRCODE_DATA_CORRUPTED);
+    OctoBloomFilter* b = value_to_filter(PG_GETARG_BYTEA_PP(1), &key_type_b,
+                                         ERRCODE_DATA_CORRUPTED);
+    uint32_t key_type = combined_key_type(key_type_a, key_type_b);
+
+    if (!a->mergeFrom(*b)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("bloom filters with different parameters cannot be united"),
+                 errdetail(COMBINE_DETAIL)));
+    }
+    PG_RETURN_BYTEA_P(filter_to_value(a, key_type));
+}
+
+Datum octo_bloom_intersect(PG_FUNCTION_ARGS) {
+    uint32_t key_type_a;
+    uint32_t key_type_b;
+    OctoBloomFilter* a = value_to_filter(PG_GETARG_BYTEA_PP(0), &key_type_a,
+                                         ERRCODE_DATA_CORRUPTED);
+    OctoBloomFilter* b = value_to_filter(PG_GETARG_BYTEA_PP(1), &key_type_b,
+                                         ERRCODE_DATA_CORRUPTED);
+    uint32_t key_type = combined_key_type(key_type_a, key_type_b);
+
+    if (!a->intersectWith(*b)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("bloom filters with different parameters cannot be intersected"),
+                 errdetail(COMBINE_DETAIL)));
+    }
+    PG_RETURN_BYTEA_P(filter_to_value(a, key_type));
+}
+
+// Filter of the value a call site last probed, kept in fn_extra. The
+// header's CRC covers the bits, so a value with the same header and size
+// is taken to be the same filter; only that much is detoasted per call
+typedef struct FilterValueCache {
+    bool valid;
+    uint8_t header[OctoBloomFilter::kSerializedHeaderBytes];
+    Size size;
+    Oid value_type;
+    OctoBloomFilter* filter;
+    BloomKeyType key_type;  // For hashing values of value_type
+    MemoryContext context;  // Holds filter; reset when the value changes
+} FilterValueCache;
+
+static FilterValueCache* value_cache(FunctionCallInfo fcinfo) {
+    FilterValueCache* cache = (FilterValueCache*)fcinfo->flinfo->fn_extra;
+    if (!cache) {
+        cache = (FilterValueCache*)MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+                                                          sizeof(FilterValueCache));
+        cache->context = AllocSetContextCreate(fcinfo->flinfo->fn_mcxt,
+                                               "octo_bloom value filter",
+                                               ALLOCSET_DEFAULT_SIZES);
+        fcinfo->flinfo->fn_extra = cache;
+    }
+    return cache;
+}
+
+static OctoBloomFilter* value_filter(FunctionCallInfo fcinfo, FilterValueCache* cache,
+                                     Datum datum, Oid value_type) {
+    const size_t header_bytes = OctoBloomFilter::kSerializedHeaderBytes;
+    Size size = toast_raw_datum_size(datum);
+    bytea* head = (bytea*)PG_DETOAST_DATUM_SLICE(datum, 0, header_bytes);
+    bool has_header = VARSIZE_ANY_EXHDR(head) == header_bytes;
+
+    if (cache->valid && has_header && cache->size == size && cache->value_type == value_type &&
+        memcmp(cache->header, VARDATA_ANY(head), header_bytes) == 0) {
+        return cache->filter;
+    }
+
+    bytea* value = DatumGetByteaPP(datum);
+    cache->valid = false;
+    MemoryContextReset(cache->context);
+    MemoryContext oldcontext = MemoryContextSwitchTo(cache->context);
+    uint32_t key_type;
+    cache->filter = value_to_filter(value, &key_type, ERRCODE_DATA_CORRUPTED);
+    MemoryContextSwitchTo(oldcontext);
+
+    // Unrecorded key types are taken to be the probe's own
+    if (key_type != 0) {
+        BloomKeyType filter_key_type;
+        bloom_key_type_for_column(key_type, PG_GET_COLLATION(), &filter_key_type);
+        bloom_key_type_for_probe(value_type, &filter_key_type, &cache->key_type);
+    } else {
+        bloom_key_type_for_column(value_type, PG_GET_COLLATION(), &cache->key_type);
+    }
+
+    if (has_header) {
+        memcpy(cache->header, VARDATA_ANY(head), header_bytes);
+        cache->size = size;
+        cache->value_type = value_type;
+        cache->valid = true;
+    }
+    return cache->filter;
+}
+
+Datum octo_bloom_filter_might_contain(PG_FUNCTION_ARGS) {
+    FilterValueCache* cache = value_cache(fcinfo);
+    OctoBloomFilter* filter = value_filter(fcinfo, cache, PG_GETARG_DATUM(0),
+                                           get_fn_expr_argtype(fcinfo->flinfo, 1));
+
+    BloomKey key;
+    bloom_key_from_datum(&cache->key_type, PG_GETARG_DATUM(1), &key);
+    bool might_contain = filter->mightContain(key.data, key.length);
+    bloom_key_release(&key);
+
+    PG_RETURN_BOOL(might_contain);
+}
+
+} // extern "C"
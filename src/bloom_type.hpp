@@ -0,0 +1,17 @@
+#ifndef OCTO_BLOOM_BLOOM_TYPE_HPP
+#define OCTO_BLOOM_BLOOM_TYPE_HPP
+
+// The octo_bloom SQL type: a Bloom filter held as a value, in the
+// serialized form of OctoBloomFilter::serialize. Built by the octo_bloom_agg
+// aggregate or exported from the registry, combined with octo_bloom_union
+// and octo_bloom_intersect, and probed in SQL or by clients that fetch the
+// bytes. The key type recorded in the header is the OID of the values'
+// base type, so probes hash values the way the filter was built.
+
+// GUCs, defined in _PG_init: filters built by octo_bloom_agg use them too
+extern "C" {
+extern int octo_bloom_hash_algorithm;
+extern int octo_bloom_index_reduction;
+}
+
+#endif // OCTO_BLOOM_BLOOM_TYPE_HPP
@@ -0,0 +1,626 @@
+#include "composite_key.hpp"
+#include "partition_filters.hpp"
+#include "planner_hook.hpp"
+
+extern "C" {
+#include <access/htup_details.h>
+#include <catalog/pg_attribute.h>
+#include <executor/executor.h>
+#include <nodes/bitmapset.h>
+#include <nodes/nodeFuncs.h>
+#include <optimizer/optimizer.h>
+#include <parser/parse_collate.h>
+#include <parser/parse_expr.h>
+#include <parser/parse_node.h>
+#include <parser/parse_relation.h>
+#include <parser/parser.h>
+#include <utils/memutils.h>
+#include <utils/syscache.h>
+}
+
+extern "C" {
+
+// Definitions are loaded on first use and kept until a relcache
+// invalidation of their table, which any change to the table's columns
+// sends and octo_bloom_init and octo_bloom_disable send themselves
+typedef struct CompositeKeyId {
+    Oid table_oid;
+    int16_t attnum;
+} CompositeKeyId;
+
+typedef struct CompositeKeyEntry {
+    CompositeKeyId id;
+    bool valid;
+    MemoryContext mcxt;  // Holds key
+    CompositeKey* key;  // NULL: no usable definition
+} CompositeKeyEntry;
+
+static HTAB* composite_keys = NULL;
+static uint64_t composite_epoch = 0;
+
+static void composite_keys_invalidate(Datum arg, Oid relid) {
+    HASH_SEQ_STATUS status;
+    CompositeKeyEntry* entry;
+
+    hash_seq_init(&status, composite_keys);
+    while ((entry = (CompositeKeyEntry*)hash_seq_search(&status)) != NULL) {
+        if (relid == InvalidOid || entry->id.table_oid == relid) {
+            entry->valid = false;
+            composite_epoch++;
+        }
+    }
+}
+
+uint64_t composite_key_epoch() {
+    return composite_epoch;
+}
+
+static const char* composite_table_name() {
+    Oid schema = octo_bloom_schema();
+    if (!OidIsValid(schema)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                 errmsg("extension \"octo_bloom\" is not installed in this database")));
+    }
+    return quote_qualified_identifier(get_namespace_name(schema), "octo_bloom_composite");
+}
+
+// Type and collation of a column, false if it has been dropped
+static bool column_type(Oid table_oid, AttrNumber attnum, Oid* type, Oid* collation) {
+    HeapTuple tuple = SearchSysCache2(ATTNUM, ObjectIdGetDatum(table_oid),
+                                      Int16GetDatum(attnum));
+    if (!HeapTupleIsValid(tuple)) {
+        return false;
+    }
+    Form_pg_attribute attr = (Form_pg_attribute)GETSTRUCT(tuple);
+    bool live = !attr->attisdropped;
+    *type = attr->atttypid;
+    *collation = attr->attcollation;
+    ReleaseSysCache(tuple);
+    return live;
+}
+
+// Check a row of octo_bloom_composite against the table as it is now and
+// fill in key from it, in the current memory context
+static bool compile_composite_key(CompositeKey* key, ArrayType* columns, ArrayType* types,
+                                  const char* expressions) {
+    Datum* column_datums;
+    Datum* type_datums;
+    int num_columns;
+    int num_types;
+    deconstruct_array(columns, INT2OID, sizeof(int16), true, TYPALIGN_SHORT, &column_datums,
+                      NULL, &num_columns);
+    deconstruct_array(types, OIDOID, sizeof(Oid), true, TYPALIGN_INT, &type_datums, NULL,
+                      &num_types);
+    if (num_columns != num_types || num_columns < 1 || num_columns > OCTO_BLOOM_MAX_KEY_PARTS) {
+        return false;
+    }
+
+    key->num_parts = num_columns;
+    key->expressions = expressions ? (List*)stringToNode(expressions) : NIL;
+    ListCell* next = list_head(key->expressions);
+
+    for (int i = 0; i < key->num_parts; ++i) {
+        key->columns[i] = DatumGetInt16(column_datums[i]);
+        Oid type;
+        Oid collation;
+        if (key->columns[i] != 0) {
+            if (!column_type(key->table_oid, key->columns[i], &type, &collation)) {
+                return false;
+            }
+        } else {
+            if (!next) {
+                return false;
+            }
+            Node* expr = (Node*)lfirst(next);
+            next = lnext(key->expressions, next);
+            type = exprType(expr);
+            collation = exprCollation(expr);
+        }
+        if (type != DatumGetObjectId(type_datums[i])) {
+            return false;
+        }
+        bloom_key_type_for_column(type, collation, &key->part_types[i]);
+    }
+    if (next) {
+        return false;
+    }
+
+    // The columns expressions read must still have the types they were
+    // parsed with, or evaluating them would misread the values
+    List* vars = pull_var_clause((Node*)key->expressions, 0);
+    ListCell* lc;
+    foreach (lc, vars) {
+        Var* var = (Var*)lfirst(lc);
+        Oid type;
+        Oid collation;
+        if (!column_type(key->table_oid, var->varattno, &type, &collation) ||
+            type != var->vartype) {
+            return false;
+        }
+    }
+
+    key->planned = key->expressions ? (List*)expression_planner((Expr*)key->expressions) : NIL;
+    return true;
+}
+
+static CompositeKey* load_composite_key(Oid table_oid, int16_t attnum, MemoryContext mcxt) {
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query,
+                     "SELECT key_columns, key_types, key_expressions FROM %s "
+                     "WHERE table_oid = $1 AND attnum = $2",
+                     composite_table_name());
+    Oid arg_types[2] = {REGCLASSOID, INT2OID};
+    Datum args[2] = {ObjectIdGetDatum(table_oid), Int16GetDatum(attnum)};
+    // Not read-only, so the definition octo_bloom_init just recorded is seen
+    if (SPI_execute_with_args(query.data, 2, arg_types, args, NULL, false, 1) != SPI_OK_SELECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not read octo_bloom_composite")));
+    }
+    pfree(query.data);
+
+    CompositeKey* key = NULL;
+    if (SPI_processed == 1) {
+        HeapTuple tuple = SPI_tuptable->vals[0];
+        TupleDesc tupdesc = SPI_tuptable->tupdesc;
+        bool isnull;
+        ArrayType* columns = DatumGetArrayTypeP(SPI_getbinval(tuple, tupdesc, 1, &isnull));
+        ArrayType* types = DatumGetArrayTypeP(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+        char* expressions = SPI_getvalue(tuple, tupdesc, 3);
+
+        MemoryContext old = MemoryContextSwitchTo(mcxt);
+        key = (CompositeKey*)palloc0(sizeof(CompositeKey));
+        key->table_oid = table_oid;
+        key->attnum = attnum;
+        bool usable = compile_composite_key(key, columns, types, expressions);
+        MemoryContextSwitchTo(old);
+
+        if (!usable) {
+            ereport(WARNING,
+                    (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                     errmsg("composite bloom filter %d on \"%s\" is out of date", attnum,
+                            get_rel_name(table_oid)),
+                     errdetail("A column its keys read has been dropped or has changed type."),
+                     errhint("Drop it with octo_bloom_disable and create it again.")));
+            key = NULL;
+        }
+    }
+    SPI_finish();
+
+    return key;
+}
+
+const CompositeKey* get_composite_key(Oid table_oid, int16_t attnum) {
+    if (!composite_keys) {
+        HASHCTL info;
+        memset(&info, 0, sizeof(info));
+        info.keysize = sizeof(CompositeKeyId);
+        info.entrysize = sizeof(CompositeKeyEntry);
+        composite_keys = hash_create("octo_bloom composite keys", 16, &info,
+                                     HASH_ELEM | HASH_BLOBS);
+        CacheRegisterRelcacheCallback(composite_keys_invalidate, (Datum)0);
+    }
+
+    CompositeKeyId id;
+    memset(&id, 0, sizeof(id));
+    id.table_oid = table_oid;
+    id.attnum = attnum;
+
+    bool found;
+    CompositeKeyEntry* entry = (CompositeKeyEntry*)hash_search(composite_keys, &id, HASH_ENTER,
+                                                               &found);
+    if (found && entry->valid) {
+        return entry->key;
+    }
+    if (!found) {
+        entry->mcxt = NULL;
+    }
+    if (entry->mcxt) {
+        MemoryContextDelete(entry->mcxt);
+    }
+    entry->valid = false;
+    entry->key = NULL;
+    entry->mcxt = AllocSetContextCreate(CacheMemoryContext, "octo_bloom composite key",
+                                        ALLOCSET_SMALL_SIZES);
+
+    // An invalidation while loading leaves the entry to be loaded again
+    uint64_t epoch = composite_epoch;
+    entry->key = load_composite_key(table_oid, attnum, entry->mcxt);
+    entry->valid = composite_epoch == epoch;
+    return entry->key;
+}
+
+// Keys as given, parsed against their table
+typedef struct ParsedKey {
+    int num_parts;
+    AttrNumber columns[OCTO_BLOOM_MAX_KEY_PARTS];
+    Oid types[OCTO_BLOOM_MAX_KEY_PARTS];
+    List* expressions;
+    Bitmapset* depends;  // Every column the parts read
+} ParsedKey;
+
+// The one target of a bare SELECT, or NULL
+static ResTarget* plain_select_target(List* raw) {
+    if (list_length(raw) != 1 || !IsA(((RawStmt*)linitial(raw))->stmt, SelectStmt)) {
+        return NULL;
+    }
+    SelectStmt* select = (SelectStmt*)((RawStmt*)linitial(raw))->stmt;
+    if (select->op != SETOP_NONE || list_length(select->targetList) != 1 ||
+        select->distinctClause || select->intoClause || select->fromClause ||
+        select->whereClause || select->groupClause || select->havingClause ||
+        select->windowClause || select->valuesLists || select->sortClause ||
+        select->limitOffset || select->limitCount || select->lockingClause ||
+        select->withClause) {
+        return NULL;
+    }
+    ResTarget* target = (ResTarget*)linitial(select->targetList);
+    return target->name ? NULL : target;
+}
+
+static Node* parse_key_part(ParseState* pstate, const char* part) {
+    StringInfoData sql;
+    initStringInfo(&sql);
+    appendStringInfo(&sql, "SELECT %s", part);
+
+    ResTarget* target = plain_select_target(raw_parser(sql.data, RAW_PARSE_DEFAULT));
+    if (!target) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("invalid filter key \"%s\"", part),
+                 errhint("Keys are column names or expressions over the table's columns.")));
+    }
+
+    pstate->p_sourcetext = sql.data;
+    Node* expr = transformExpr(pstate, target->val, EXPR_KIND_INDEX_EXPRESSION);
+    assign_expr_collations(pstate, expr);
+    return expr;
+}
+
+static void parse_keys(Relation rel, ArrayType* keys, ParsedKey* parsed) {
+    Datum* elems;
+    bool* nulls;
+    int count;
+    deconstruct_array(keys, TEXTOID, -1, false, TYPALIGN_INT, &elems, &nulls, &count);
+    if (count < 1 || count > OCTO_BLOOM_MAX_KEY_PARTS) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("a filter key must have between 1 and %d parts",
+                        OCTO_BLOOM_MAX_KEY_PARTS)));
+    }
+
+    ParseState* pstate = make_parsestate(NULL);
+    ParseNamespaceItem* nsitem = addRangeTableEntryForRelation(pstate, rel, AccessShareLock,
+                                                               NULL, false, true);
+    addNSItemToQuery(pstate, nsitem, false, true, true);
+
+    memset(parsed, 0, sizeof(*parsed));
+    parsed->num_parts = count;
+    for (int i = 0; i < count; ++i) {
+        if (nulls[i]) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+                     errmsg("filter keys must not be null")));
+        }
+        Node* expr = parse_key_part(pstate, TextDatumGetCString(elems[i]));
+
+        if (contain_mutable_functions(expr)) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+                     errmsg("functions in filter key expressions must be marked IMMUTABLE")));
+        }
+        List* vars = pull_var_clause(expr, 0);
+        ListCell* lc;
+        foreach (lc, vars) {
+            Var* var = (Var*)lfirst(lc);
+            if (var->varattno <= 0) {
+                ereport(ERROR,
+                        (errcode(ERRCODE_INVALID_OBJECT_DEFINITION),
+                         errmsg("filter keys cannot use system columns or whole-row references")));
+            }
+            parsed->depends = bms_add_member(parsed->depends, var->varattno);
+        }
+
+        // Fails for types no filter can hash
+        BloomKeyType key_type;
+        parsed->types[i] = exprType(expr);
+        bloom_key_type_for_column(parsed->types[i], exprCollation(expr), &key_type);
+
+        if (IsA(expr, Var)) {
+            parsed->columns[i] = ((Var*)expr)->varattno;
+        } else {
+            parsed->expressions = lappend(parsed->expressions, expr);
+        }
+    }
+
+    if (count == 1 && parsed->columns[0] != 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("a filter key of one column is that column's filter"),
+                 errhint("Use octo_bloom_init(table_oid, column_name).")));
+    }
+    free_parsestate(pstate);
+}
+
+static bool same_key(const ParsedKey* parsed, const CompositeKey* key) {
+    if (parsed->num_parts != key->num_parts) {
+        return false;
+    }
+    for (int i = 0; i < parsed->num_parts; ++i) {
+        if (parsed->columns[i] != key->columns[i]) {
+            return false;
+        }
+    }
+    // Locations are ignored: spacing in the text doesn't matter
+    return equal(parsed->expressions, key->expressions);
+}
+
+// Attnums of the composite filters defined on a table. Returns how many
+static int composite_attnums(Oid table_oid, int16_t** attnums) {
+    MemoryContext caller = CurrentMemoryContext;
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query, "SELECT attnum FROM %s WHERE table_oid = $1",
+                     composite_table_name());
+    Oid arg_types[1] = {REGCLASSOID};
+    Datum args[1] = {ObjectIdGetDatum(table_oid)};
+    if (SPI_execute_with_args(query.data, 1, arg_types, args, NULL, false, 0) != SPI_OK_SELECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not read octo_bloom_composite")));
+    }
+
+    int count = (int)SPI_processed;
+    int16_t* result = (int16_t*)MemoryContextAlloc(caller, sizeof(int16_t) * Max(count, 1));
+    for (int i = 0; i < count; ++i) {
+        bool isnull;
+        result[i] = DatumGetInt16(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1,
+                                                &isnull));
+    }
+    pfree(query.data);
+    SPI_finish();
+
+    *attnums = result;
+    return count;
+}
+
+static int16_t find_parsed_key(Oid table_oid, const ParsedKey* parsed) {
+    int16_t* attnums;
+    int count = composite_attnums(table_oid, &attnums);
+    int16_t found = InvalidAttrNumber;
+    for (int i = 0; i < count && found == InvalidAttrNumber; ++i) {
+        const CompositeKey* key = get_composite_key(table_oid, attnums[i]);
+        if (key && same_key(parsed, key)) {
+            found = attnums[i];
+        }
+    }
+    pfree(attnums);
+    return found;
+}
+
+int16_t find_composite_key(Relation rel, ArrayType* keys) {
+    ParsedKey parsed;
+    parse_keys(rel, keys, &parsed);
+    return find_parsed_key(RelationGetRelid(rel), &parsed);
+}
+
+int16_t define_composite_key(Relation rel, ArrayType* keys) {
+    Oid table_oid = RelationGetRelid(rel);
+    ParsedKey parsed;
+    parse_keys(rel, keys, &parsed);
+
+    int16_t attnum = find_parsed_key(table_oid, &parsed);
+    if (attnum != InvalidAttrNumber) {
+        return attnum;
+    }
+
+    Datum columns[OCTO_BLOOM_MAX_KEY_PARTS];
+    Datum types[OCTO_BLOOM_MAX_KEY_PARTS];
+    for (int i = 0; i < parsed.num_parts; ++i) {
+        columns[i] = Int16GetDatum(parsed.columns[i]);
+        types[i] = ObjectIdGetDatum(parsed.types[i]);
+    }
+    int num_depends = bms_num_members(parsed.depends);
+    Datum* depends = (Datum*)palloc(sizeof(Datum) * Max(num_depends, 1));
+    int member = -1;
+    for (int i = 0; (member = bms_next_member(parsed.depends, member)) >= 0; ++i) {
+        depends[i] = Int16GetDatum(member);
+    }
+
+    const char* table_name = composite_table_name();
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query,
+                     "INSERT INTO %s (table_oid, keys, key_columns, key_types, key_expressions, "
+                     "depends) VALUES ($1, $2, $3, $4, $5, $6) RETURNING attnum",
+                     table_name);
+    Oid arg_types[6] = {REGCLASSOID, TEXTARRAYOID, INT2ARRAYOID, OIDARRAYOID, TEXTOID,
+                        INT2ARRAYOID};
+    Datum args[6] = {
+        ObjectIdGetDatum(table_oid),
+        PointerGetDatum(keys),
+        PointerGetDatum(construct_array(columns, parsed.num_parts, INT2OID, sizeof(int16), true,
+                                        TYPALIGN_SHORT)),
+        PointerGetDatum(construct_array(types, parsed.num_parts, OIDOID, sizeof(Oid), true,
+                                        TYPALIGN_INT)),
+        parsed.expressions ? CStringGetTextDatum(nodeToString(parsed.expressions)) : (Datum)0,
+        PointerGetDatum(construct_array(depends, num_depends, INT2OID, sizeof(int16), true,
+                                        TYPALIGN_SHORT)),
+    };
+    const char nulls[6] = {' ', ' ', ' ', ' ', parsed.expressions ? ' ' : 'n', ' '};
+    if (SPI_execute_with_args(query.data, 6, arg_types, args, nulls, false, 0) !=
+            SPI_OK_INSERT_RETURNING ||
+        SPI_processed != 1) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not record the filter key of \"%s\"",
+                        RelationGetRelationName(rel))));
+    }
+    bool isnull;
+    attnum = DatumGetInt16(SPI_getbinval(SPI_tuptable->vals[0], SPI_tuptable->tupdesc, 1,
+                                         &isnull));
+    pfree(query.data);
+    SPI_finish();
+
+    // Backends that cached the table's definitions, this one included,
+    // read them again once this commits
+    CacheInvalidateRelcacheByRelid(table_oid);
+    return attnum;
+}
+
+void forget_composite_key(Oid table_oid, int16_t attnum) {
+    const char* table_name = composite_table_name();
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query, "DELETE FROM %s WHERE table_oid = $1 AND attnum = $2", table_name);
+    Oid arg_types[2] = {REGCLASSOID, INT2OID};
+    Datum args[2] = {ObjectIdGetDatum(table_oid), Int16GetDatum(attnum)};
+    // A row left behind would go on defining a filter that is gone
+    if (SPI_execute_with_args(query.data, 2, arg_types, args, NULL, false, 0) !=
+        SPI_OK_DELETE) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not remove the filter key of \"%s\"", get_rel_name(table_oid))));
+    }
+    pfree(query.data);
+    SPI_finish();
+
+    CacheInvalidateRelcacheByRelid(table_oid);
+}
+
+void drop_composite_keys(Oid table_oid, AttrNumber attnum) {
+    const char* table_name = composite_table_name();
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query,
+                     "DELETE FROM %s WHERE table_oid = $1 AND ($2 = 0 OR $2 = ANY (depends)) "
+                     "RETURNING attnum",
+                     table_name);
+    Oid arg_types[2] = {REGCLASSOID, INT2OID};
+    Datum args[2] = {ObjectIdGetDatum(table_oid), Int16GetDatum(attnum)};
+    if (SPI_execute_with_args(query.data, 2, arg_types, args, NULL, false, 0) !=
+        SPI_OK_DELETE_RETURNING) {
+        // The table may be the one being dropped, whose name is gone
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not remove the filter keys of table %u", table_oid)));
+    }
+    // A dropped table's filters go with it already
+    for (uint64 i = 0; attnum != 0 && i < SPI_processed; ++i) {
+        bool isnull;
+        drop_bloom_filters_at_commit(
+            table_oid,
+            DatumGetInt16(SPI_getbinval(SPI_tuptable->vals[i], SPI_tuptable->tupdesc, 1,
+                                        &isnull)));
+    }
+    pfree(query.data);
+    SPI_finish();
+
+    CacheInvalidateRelcacheByRelid(table_oid);
+}
+
+CompositeKeyState* composite_key_begin(const CompositeKey* key, TupleDesc tupdesc) {
+    CompositeKeyState* state = (CompositeKeyState*)palloc0(sizeof(CompositeKeyState));
+    state->num_parts = key->num_parts;
+    memcpy(state->columns, key->columns, sizeof(AttrNumber) * key->num_parts);
+    memcpy(state->part_types, key->part_types, sizeof(BloomKeyType) * key->num_parts);
+
+    // A copy, so the state doesn't depend on the cached definition
+    List* planned = copyObject(key->planned);
+    ListCell* next = list_head(planned);
+    for (int i = 0; i < state->num_parts; ++i) {
+        if (state->columns[i] == 0) {
+            // Vars read the scan tuple, as in index expressions
+            state->parts[i] = ExecInitExpr((Expr*)lfirst(next), NULL);
+            next = lnext(planned, next);
+        }
+    }
+    if (planned) {
+        state->econtext = CreateStandaloneExprContext();
+    }
+    if (tupdesc) {
+        // A copy too: the relcache's can be rebuilt while this state lives
+        state->heap_slot = MakeSingleTupleTableSlot(CreateTupleDescCopy(tupdesc),
+                                                    &TTSOpsHeapTuple);
+    }
+    return state;
+}
+
+void composite_key_end(CompositeKeyState* state) {
+    if (state->econtext) {
+        FreeExprContext(state->econtext, true);
+    }
+    if (state->heap_slot) {
+        ExecDropSingleTupleTableSlot(state->heap_slot);
+    }
+    pfree(state);
+}
+
+bool composite_key_from_slot(CompositeKeyState* state, TupleTableSlot* slot, BloomKey* key) {
+    uint64_t digest = bloom_key_digest_start();
+    bool complete = true;
+    if (state->econtext) {
+        state->econtext->ecxt_scantuple = slot;
+    }
+
+    for (int i = 0; i < state->num_parts && complete; ++i) {
+        bool isnull;
+        Datum value;
+        if (state->parts[i]) {
+            value = ExecEvalExprSwitchContext(state->parts[i], state->econtext, &isnull);
+        } else {
+            value = slot_getattr(slot, state->columns[i], &isnull);
+        }
+        if (isnull) {
+            complete = false;
+        } else {
+            digest = bloom_key_digest_fold(digest, &state->part_types[i], value);
+        }
+    }
+
+    if (state->econtext) {
+        ResetExprContext(state->econtext);
+    }
+    if (complete) {
+        bloom_key_from_digest(digest, key);
+    }
+    return complete;
+}
+
+bool composite_key_from_tuple(CompositeKeyState* state, HeapTuple tuple, BloomKey* key) {
+    ExecStoreHeapTuple(tuple, state->heap_slot, false);
+    bool complete = composite_key_from_slot(state, state->heap_slot, key);
+    ExecClearTuple(state->heap_slot);
+    return complete;
+}
+
+} // extern "C"
@@ -0,0 +1,76 @@
+#ifndef OCTO_BLOOM_COMPOSITE_KEY_HPP
+#define OCTO_BLOOM_COMPOSITE_KEY_HPP
+
+#include "shared_memory.hpp"
+
+extern "C" {
+#include <access/htup.h>
+#include <executor/tuptable.h>
+#include <nodes/execnodes.h>
+#include <utils/array.h>
+}
+
+// Filters over an ordered list of columns and expressions of a table, such
+// as (tenant_id, external_id) or lower(email). Their keys are given as SQL
+// text and recorded, parsed, in octo_bloom_composite; the filter is
+// registered under an attnum no column has, OCTO_BLOOM_COMPOSITE_ATTNUM or
+// below. A row's key is a digest its parts are folded into one at a time
+// (datum_key.hpp). Rows with a null part have no key.
+#define OCTO_BLOOM_COMPOSITE_ATTNUM (-1000)
+#define OCTO_BLOOM_MAX_KEY_PARTS INDEX_MAX_KEYS
+
+static inline bool bloom_attnum_is_composite(int16_t attnum) {
+    return attnum <= OCTO_BLOOM_COMPOSITE_ATTNUM;
+}
+
+// A definition as loaded from octo_bloom_composite, cached per backend
+typedef struct CompositeKey {
+    Oid table_oid;
+    int16_t attnum;
+    int num_parts;
+    AttrNumber columns[OCTO_BLOOM_MAX_KEY_PARTS];  // 0: the next of expressions
+    BloomKeyType part_types[OCTO_BLOOM_MAX_KEY_PARTS];
+    List* expressions;  // As parsed, to match call sites against
+    List* planned;  // Ready for the executor
+} CompositeKey;
+
+// Evaluates a definition's parts against rows of its table. Self-contained,
+// so it outlives invalidation of the definition it was made from
+typedef struct CompositeKeyState {
+    int num_parts;
+    AttrNumber columns[OCTO_BLOOM_MAX_KEY_PARTS];
+    BloomKeyType part_types[OCTO_BLOOM_MAX_KEY_PARTS];
+    ExprState* parts[OCTO_BLOOM_MAX_KEY_PARTS];  // NULL for columns
+    ExprContext* econtext;  // NULL without expressions
+    TupleTableSlot* heap_slot;  // For composite_key_from_tuple
+} CompositeKeyState;
+
+extern "C" {
+// The definition of a composite filter, or NULL if it has none or the
+// columns it reads have changed type since. Valid until the next call
+const CompositeKey* get_composite_key(Oid table_oid, int16_t attnum);
+// Bumped whenever cached definitions are invalidated, so callers holding
+// state made from them know to look again
+uint64_t composite_key_epoch();
+
+// Parse keys, a text[] of column names and expressions over rel, and return
+// the attnum of the composite filter defined over them, or 0 if none is
+int16_t find_composite_key(Relation rel, ArrayType* keys);
+// Record a definition for keys and return its attnum; one already defined
+// over the same keys is reused
+int16_t define_composite_key(Relation rel, ArrayType* keys);
+// Forget a definition
+void forget_composite_key(Oid table_oid, int16_t attnum);
+// Forget the definitions whose keys read a column (attnum 0: every one on
+// the table) and drop their filters at commit
+void drop_composite_keys(Oid table_oid, AttrNumber attnum);
+
+// Evaluation state in CurrentMemoryContext; tupdesc is for heap tuples
+CompositeKeyState* composite_key_begin(const CompositeKey* key, TupleDesc tupdesc);
+void composite_key_end(CompositeKeyState* state);
+// A row's key, false if a part is null
+bool composite_key_from_slot(CompositeKeyState* state, TupleTableSlot* slot, BloomKey* key);
+bool composite_key_from_tuple(CompositeKeyState* state, HeapTuple tuple, BloomKey* key);
+}
+
+#endif // OCTO_BLOOM_COMPOSITE_KEY_HPP
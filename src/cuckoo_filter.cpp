@@ -0,0 +1,452 @@
+#include "cuckoo_filter.hpp"
+#include "bloom_hash.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+extern "C" {
+#include <postgres.h>
+#include <storage/s_lock.h>
+}
+
+// Chance that a probe for an absent key matches one of the fingerprints in
+// its two buckets at the given load
+static double cuckoo_false_positive_rate(uint32_t slots, uint32_t fingerprint_bits, double load) {
+    return 1.0 - std::pow(1.0 - std::ldexp(1.0, -static_cast<int>(fingerprint_bits)),
+                          2.0 * slots * load);
+}
+
+CuckooFilter::CuckooFilter(const BloomFilterParams& params, void* storage) {
+    slots_ = params.bucket_slots;
+    fingerprint_bits_ = params.fingerprint_bits;
+    bucket_bits_ = slots_ * fingerprint_bits_;
+    num_buckets_ = params.bit_array_size / bucket_bits_;
+    fingerprint_mask_ = (1ULL << fingerprint_bits_) - 1;
+    bucket_mask_ = (static_cast<__uint128_t>(1) << bucket_bits_) - 1;
+    expected_count_ = params.expected_count;
+    false_positive_rate_ = params.false_positive_rate;
+
+    uint8_t* base = (uint8_t*)TYPEALIGN(kHeaderBytes, storage);
+    header_ = reinterpret_cast<Header*>(base);
+    table_ = base + kHeaderBytes;
+}
+
+BloomFilterParams CuckooFilter::computeParams(uint64_t expected_count, double false_positive_rate) {
+    uint32_t fingerprint_bits = kMinFingerprintBits;
+    while (fingerprint_bits < kMaxFingerprintBits &&
+           cuckoo_false_positive_rate(kBucketSlots, fingerprint_bits, kLoadFactor) >
+               false_positive_rate) {
+        ++fingerprint_bits;
+    }
+
+    uint64_t num_buckets = static_cast<uint64_t>(
+        std::ceil(expected_count / (kBucketSlots * kLoadFactor)));
+    num_buckets = std::max<uint64_t>(num_buckets, 1);
+
+    BloomFilterParams params;
+    params.kind = FilterKind::Cuckoo;
+    params.layout = BloomLayout::Standard;
+    params.hash = BloomHash::Wy128;
+    params.reduction = BloomReduction::FastRange;
+    params.num_hashes = 0;
+    params.expected_count = expected_count;
+    params.false_positive_rate = false_positive_rate;
+    params.bit_array_size = num_buckets * kBucketSlots * fingerprint_bits;
+    params.bucket_slots = kBucketSlots;
+    params.fingerprint_bits = fingerprint_bits;
+    return params;
+}
+
+size_t CuckooFilter::storageSize(const BloomFilterParams& params) {
+    // The last bucket's 16-byte load may run past the table
+    return kHeaderBytes + (params.bit_array_size + 7) / 8 + sizeof(__uint128_t) +
+           kHeaderBytes - 1;
+}
+
+BloomFilterParams CuckooFilter::getParams() const {
+    BloomFilterParams params;
+    params.kind = FilterKind::Cuckoo;
+    params.layout = BloomLayout::Standard;
+    params.hash = BloomHash::Wy128;
+    params.reduction = BloomReduction::FastRange;
+    params.num_hashes = 0;
+    params.expected_count = expected_count_;
+    params.false_positive_rate = false_positive_rate_;
+    params.bit_array_size = num_buckets_ * bucket_bits_;
+    params.bucket_slots = slots_;
+    params.fingerprint_bits = fingerprint_bits_;
+    return params;
+}
+
+size_t CuckooFilter::getMemoryUsage() const {
+    return kHeaderBytes + (num_buckets_ * bucket_bits_ + 7) / 8;
+}
+
+double CuckooFilter::getEffectiveFalsePositiveRate() const {
+    double load = std::min(1.0, static_cast<double>(expected_count_) / (num_buckets_ * slots_));
+    return cuckoo_false_positive_rate(slots_, fingerprint_bits_, load);
+}
+
+double CuckooFilter::getSaturation() const {
+    if (hasOverflowed()) {
+        return 1.0;
+    }
+    return std::min(1.0, static_cast<double>(getCount()) / (num_buckets_ * slots_));
+}
+
+FilterFillEstimate CuckooFilter::estimateFill(size_t sample_words) const {
+    // The header counts the fingerprints, so nothing needs sampling
+    FilterFillEstimate estimate;
+    uint64_t count = getCount();
+    estimate.saturation = getSaturation();
+    estimate.cardinality = static_cast<double>(count);
+    estimate.false_positive_rate = cuckoo_false_positive_rate(
+        slots_, fingerprint_bits_,
+        std::min(1.0, static_cast<double>(count) / (num_buckets_ * slots_)));
+    return estimate;
+}
+
+uint64_t CuckooFilter::getCount() const {
+    return __atomic_load_n(&header_->count, __ATOMIC_RELAXED);
+}
+
+bool CuckooFilter::hasOverflowed() const {
+    return __atomic_load_n(&header_->overflowed, __ATOMIC_RELAXED) != 0;
+}
+
+std::pair<uint64_t, uint64_t> CuckooFilter::doubleHash(const void* data, size_t length) const {
+    uint64_t h1, h2;
+    bloom_hash128(data, length, &h1, &h2);
+    return {h1, h2};
+}
+
+uint32_t CuckooFilter::fingerprintOf(uint64_t h2) const {
+    // Bit 0 of h2 is always set; zero marks an empty slot
+    uint32_t fp = static_cast<uint32_t>((h2 >> 1) & fingerprint_mask_);
+    return fp ? fp : 1;
+}
+
+size_t CuckooFilter::bucketOf(uint64_t h1) const {
+    return static_cast<size_t>((static_cast<__uint128_t>(h1) * num_buckets_) >> 64);
+}
+
+size_t CuckooFilter::altBucket(size_t bucket, uint32_t fp) const {
+    // (hash(fp) - bucket) mod n is its own inverse for any n, so the bucket
+    // count needn't be a power of two
+    uint64_t mixed = fp * 0x9e3779b97f4a7c15ULL;
+    size_t target = static_cast<size_t>((static_cast<__uint128_t>(mixed) * num_buckets_) >> 64);
+    return bucket <= target ? target - bucket : target + num_buckets_ - bucket;
+}
+
+__uint128_t CuckooFilter::loadBucket(size_t bucket) const {
+    uint64_t bit = static_cast<uint64_t>(bucket) * bucket_bits_;
+    __uint128_t bits;
+    memcpy(&bits, table_ + bit / 8, sizeof(bits));
+    return (bits >> (bit % 8)) & bucket_mask_;
+}
+
+void CuckooFilter::storeBucket(size_t bucket, __uint128_t value) {
+    uint64_t bit = static_cast<uint64_t>(bucket) * bucket_bits_;
+    uint32_t shift = bit % 8;
+    __uint128_t bits;
+    memcpy(&bits, table_ + bit / 8, sizeof(bits));
+    bits = (bits & ~(bucket_mask_ << shift)) | (value << shift);
+    memcpy(table_ + bit / 8, &bits, sizeof(bits));
+}
+
+uint32_t CuckooFilter::slotOf(__uint128_t bucket, uint32_t slot) const {
+    return static_cast<uint32_t>(bucket >> (slot * fingerprint_bits_)) & fingerprint_mask_;
+}
+
+bool CuckooFilter::bucketHas(__uint128_t bucket, uint32_t fp) const {
+    for (uint32_t s = 0; s < slots_; ++s) {
+        if (slotOf(bucket, s) == fp) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void CuckooFilter::beginWrite() const {
+    if (__atomic_exchange_n(&header_->lock, 1, __ATOMIC_ACQUIRE)) {
+        SpinDelayStatus delay;
+        init_local_spin_delay(&delay);
+        while (__atomic_exchange_n(&header_->lock, 1, __ATOMIC_ACQUIRE)) {
+            perform_spin_delay(&delay);
+        }
+        finish_spin_delay(&delay);
+    }
+    // Odd count is visible before any of the table changes
+    __atomic_store_n(&header_->seq, header_->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void CuckooFilter::endWrite() const {
+    __atomic_store_n(&header_->seq, header_->seq + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&header_->lock, 0, __ATOMIC_RELEASE);
+}
+
+// Callers are inside beginWrite/endWrite or own the filter
+bool CuckooFilter::tryPlace(size_t bucket, uint32_t fp) {
+    __uint128_t value = loadBucket(bucket);
+    for (uint32_t s = 0; s < slots_; ++s) {
+        if (slotOf(value, s) == 0) {
+            storeBucket(bucket, value | (static_cast<__uint128_t>(fp) << (s * fingerprint_bits_)));
+            return true;
+        }
+    }
+    return false;
+}
+
+bool CuckooFilter::insertFingerprint(size_t bucket, uint32_t fp) {
+    size_t other = altBucket(bucket, fp);
+    if (tryPlace(bucket, fp) || tryPlace(other, fp)) {
+        header_->count++;
+        return true;
+    }
+
+    // A chain could end with a fingerprint and nowhere to put it
+    if (header_->victim_fp != 0) {
+        return false;
+    }
+
+    uint64_t rng = ((bucket * 0x9e3779b97f4a7c15ULL) ^ fp) | 1;
+    size_t current = (rng & 1) ? bucket : other;
+    for (uint32_t kick = 0; kick < kMaxKicks; ++kick) {
+        // xorshift64: which slot of the bucket to evict
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        uint32_t slot = static_cast<uint32_t>(((rng >> 32) * slots_) >> 32);
+        uint32_t shift = slot * fingerprint_bits_;
+
+        __uint128_t value = loadBucket(current);
+        uint32_t evicted = slotOf(value, slot);
+        value = (value & ~(static_cast<__uint128_t>(fingerprint_mask_) << shift)) |
+                (static_cast<__uint128_t>(fp) << shift);
+        storeBucket(current, value);
+
+        fp = evicted;
+        current = altBucket(current, fp);
+        if (tryPlace(current, fp)) {
+            header_->count++;
+            return true;
+        }
+    }
+
+    // Readers check the victim too, so the key stays visible
+    header_->victim_bucket = current;
+    header_->victim_fp = fp;
+    header_->count++;
+    return true;
+}
+
+bool CuckooFilter::removeFingerprint(size_t bucket, uint32_t fp) {
+    size_t buckets[2] = {bucket, altBucket(bucket, fp)};
+    for (size_t b = 0; b < 2; ++b) {
+        __uint128_t value = loadBucket(buckets[b]);
+        for (uint32_t s = 0; s < slots_; ++s) {
+            if (slotOf(value, s) == fp) {
+                uint32_t shift = s * fingerprint_bits_;
+                storeBucket(buckets[b],
+                            value & ~(static_cast<__uint128_t>(fingerprint_mask_) << shift));
+                return true;
+            }
+        }
+    }
+
+    if (header_->victim_fp == fp &&
+        (header_->victim_bucket == buckets[0] || header_->victim_bucket == buckets[1])) {
+        header_->victim_fp = 0;
+        return true;
+    }
+    return false;
+}
+
+void CuckooFilter::add(const void* data, size_t length) {
+    auto hashes = doubleHash(data, length);
+    addHashes(hashes.first, hashes.second);
+}
+
+void CuckooFilter::addHashes(uint64_t h1, uint64_t h2) {
+    beginWrite();
+    if (!insertFingerprint(bucketOf(h1), fingerprintOf(h2))) {
+        __atomic_store_n(&header_->overflowed, 1u, __ATOMIC_RELAXED);
+    }
+    endWrite();
+}
+
+void CuckooFilter::addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) {
+    // One lock hold per kMergeLockBuckets keys, as in mergeFrom
+    for (size_t base = 0; base < count; base += kMergeLockBuckets) {
+        size_t end = std::min(count, base + kMergeLockBuckets);
+        beginWrite();
+        for (size_t i = base; i < end; ++i) {
+            if (!insertFingerprint(bucketOf(h1[i]), fingerprintOf(h2[i]))) {
+                __atomic_store_n(&header_->overflowed, 1u, __ATOMIC_RELAXED);
+            }
+        }
+        endWrite();
+    }
+}
+
+void CuckooFilter::addHashesUnshared(uint64_t h1, uint64_t h2) {
+    if (!insertFingerprint(bucketOf(h1), fingerprintOf(h2))) {
+        header_->overflowed = 1;
+    }
+}
+
+bool CuckooFilter::mightContain(const void* data, size_t length) const {
+    auto hashes = doubleHash(data, length);
+    return mightContainHashes(hashes.first, hashes.second);
+}
+
+bool CuckooFilter::mightContainHashes(uint64_t h1, uint64_t h2) const {
+    if (hasOverflowed()) {
+        return true;
+    }
+
+    uint32_t fp = fingerprintOf(h2);
+    size_t first = bucketOf(h1);
+    size_t second = altBucket(first, fp);
+
+    // A match is always a valid answer (at worst a false positive from a
+    // torn read); only a miss that overlapped a write has to be repeated
+    for (;;) {
+        uint64_t seq = __atomic_load_n(&header_->seq, __ATOMIC_ACQUIRE);
+        if (seq & 1) {
+            SPIN_DELAY();
+            continue;
+        }
+        if (bucketHas(loadBucket(first), fp) || bucketHas(loadBucket(second), fp)) {
+            return true;
+        }
+        if (__atomic_load_n(&header_->victim_fp, __ATOMIC_RELAXED) == fp) {
+            size_t victim_bucket = __atomic_load_n(&header_->victim_bucket, __ATOMIC_RELAXED);
+            if (victim_bucket == first || victim_bucket == second) {
+                return true;
+            }
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&header_->seq, __ATOMIC_RELAXED) == seq) {
+            return false;
+        }
+    }
+}
+
+void CuckooFilter::prefetchHashes(uint64_t h1, uint64_t h2) const {
+    size_t bucket = bucketOf(h1);
+    size_t other = altBucket(bucket, fingerprintOf(h2));
+    __builtin_prefetch(table_ + static_cast<uint64_t>(bucket) * bucket_bits_ / 8, 0, 3);
+    __builtin_prefetch(table_ + static_cast<uint64_t>(other) * bucket_bits_ / 8, 0, 3);
+}
+
+void CuckooFilter::mightContainBatch(const void* const* data, const size_t* lengths,
+                                     size_t count, bool* results) const {
+    constexpr size_t kBatch = 256;
+    constexpr size_t kPrefetchDistance = 8;
+    uint64_t h1[kBatch];
+    uint64_t h2[kBatch];
+
+    for (size_t base = 0; base < count; base += kBatch) {
+        size_t n = std::min(count - base, kBatch);
+        for (size_t i = 0; i < n; ++i) {
+            auto hashes = doubleHash(data[base + i], lengths[base + i]);
+            h1[i] = hashes.first;
+            h2[i] = hashes.second;
+        }
+
+        // Both buckets of a key are independent cache misses; keep several
+        // keys' worth in flight
+        for (size_t i = 0; i < n; ++i) {
+            if (i + kPrefetchDistance < n) {
+                prefetchHashes(h1[i + kPrefetchDistance], h2[i + kPrefetchDistance]);
+            }
+            results[base + i] = mightContainHashes(h1[i], h2[i]);
+        }
+    }
+}
+
+void CuckooFilter::remove(const void* data, size_t length) {
+    auto hashes = doubleHash(data, length);
+    removeHashes(hashes.first, hashes.second);
+}
+
+void CuckooFilter::removeHashes(uint64_t h1, uint64_t h2) {
+    beginWrite();
+    if (removeFingerprint(bucketOf(h1), fingerprintOf(h2))) {
+        header_->count--;
+
+        // A slot may have opened up for the victim; it is placed before
+        // the stash is cleared so it never disappears from view
+        uint32_t victim = header_->victim_fp;
+        if (victim != 0) {
+            size_t bucket = header_->victim_bucket;
+            if (tryPlace(bucket, victim) || tryPlace(altBucket(bucket, victim), victim)) {
+                header_->victim_fp = 0;
+            }
+        }
+    }
+    endWrite();
+}
+
+void CuckooFilter::clear() {
+    memset(table_, 0, (num_buckets_ * bucket_bits_ + 7) / 8);
+    header_->overflowed = 0;
+    header_->count = 0;
+    header_->victim_bucket = 0;
+    header_->victim_fp = 0;
+}
+
+bool CuckooFilter::isCompatible(const FilterBackend& other_backend) const {
+    BloomFilterParams other = other_backend.getParams();
+    return other.kind == FilterKind::Cuckoo &&
+           other.bit_array_size == num_buckets_ * bucket_bits_ &&
+           other.bucket_slots == slots_ &&
+           other.fingerprint_bits == fingerprint_bits_;
+}
+
+bool CuckooFilter::mergeFrom(const FilterBackend& other_backend) {
+    if (!isCompatible(other_backend)) {
+        return false;
+    }
+    const CuckooFilter& other = static_cast<const CuckooFilter&>(other_backend);
+
+    // Reinsert other's fingerprints from the bucket they sit in; the lock
+    // is dropped every few buckets so trigger inserts aren't held up
+    bool overflowed = other.header_->overflowed != 0;
+    for (size_t start = 0; start < num_buckets_; start += kMergeLockBuckets) {
+        size_t end = std::min<size_t>(start + kMergeLockBuckets, num_buckets_);
+        bool writing = false;
+        for (size_t b = start; b < end; ++b) {
+            __uint128_t value = other.loadBucket(b);
+            if (value == 0) {
+                continue;
+            }
+            if (!writing) {
+                beginWrite();
+                writing = true;
+            }
+            for (uint32_t s = 0; s < slots_; ++s) {
+                uint32_t fp = other.slotOf(value, s);
+                if (fp != 0 && !insertFingerprint(b, fp)) {
+                    overflowed = true;
+                }
+            }
+        }
+        if (writing) {
+            endWrite();
+        }
+    }
+
+    beginWrite();
+    if (other.header_->victim_fp != 0 &&
+        !insertFingerprint(other.header_->victim_bucket, other.header_->victim_fp)) {
+        overflowed = true;
+    }
+    if (overflowed) {
+        __atomic_store_n(&header_->overflowed, 1u, __ATOMIC_RELAXED);
+    }
+    endWrite();
+    return true;
+}
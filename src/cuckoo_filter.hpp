@@ -0,0 +1,112 @@
+#ifndef OCTO_BLOOM_CUCKOO_FILTER_HPP
+#define OCTO_BLOOM_CUCKOO_FILTER_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#include "filter_backend.hpp"
+
+// Partial-key cuckoo filter. Buckets of bucket_slots fingerprints, each
+// fingerprint_bits wide, are packed back to back in the table; a key lives
+// in one of two buckets, the second derived from the first and the
+// fingerprint alone, so entries can be moved without the key. Deleting a
+// key removes one copy of its fingerprint, which makes the filter a
+// multiset: a value stored more than 2 * bucket_slots times doesn't fit.
+//
+// Concurrency: writers take a spinlock in the table header and bump a
+// sequence counter to odd for the duration of the change, as
+// PgBackendStatus does with st_changecount. Readers that find no match
+// repeat the probe if the counter was odd or moved, so a key that is being
+// moved is never reported absent; a match is always a valid answer. If an
+// insert finds no room at all the filter is marked overflowed and answers
+// true for every key until it is cleared.
+class CuckooFilter final : public FilterBackend {
+public:
+    static constexpr size_t kHeaderBytes = 64;  // One cache line before the buckets
+    static constexpr uint32_t kBucketSlots = 4;
+    static constexpr uint32_t kMinFingerprintBits = 4;
+    static constexpr uint32_t kMaxFingerprintBits = 30;  // A bucket fits one 16-byte load
+    static constexpr double kLoadFactor = 0.94;  // Sized for; inserts reach about 0.96
+    static constexpr uint32_t kMaxKicks = 500;
+    static constexpr size_t kMergeLockBuckets = 64;  // Source buckets merged per lock hold
+
+    // View over caller-owned memory of storageSize(params) bytes
+    CuckooFilter(const BloomFilterParams& params, void* storage);
+    ~CuckooFilter() override = default;
+
+    CuckooFilter(const CuckooFilter&) = delete;
+    CuckooFilter& operator=(const CuckooFilter&) = delete;
+
+    // Narrowest fingerprint that meets the rate at kLoadFactor
+    static BloomFilterParams computeParams(uint64_t expected_count, double false_positive_rate);
+    static size_t storageSize(const BloomFilterParams& params);
+
+    void add(const void* data, size_t length) override;
+    bool mightContain(const void* data, size_t length) const override;
+    void mightContainBatch(const void* const* data, const size_t* lengths,
+                           size_t count, bool* results) const override;
+
+    bool supportsRemove() const override { return true; }
+    void remove(const void* data, size_t length) override;
+
+    std::pair<uint64_t, uint64_t> doubleHash(const void* data, size_t length) const override;
+    void addHashes(uint64_t h1, uint64_t h2);  // Safe against concurrent adds/reads
+    void addHashesUnshared(uint64_t h1, uint64_t h2) override;
+    void addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) override;
+    bool mightContainHashes(uint64_t h1, uint64_t h2) const override;
+    void prefetchHashes(uint64_t h1, uint64_t h2) const override;
+    void removeHashes(uint64_t h1, uint64_t h2) override;
+
+    void clear() override;
+    bool isCompatible(const FilterBackend& other) const override;
+    bool mergeFrom(const FilterBackend& other) override;
+
+    BloomFilterParams getParams() const override;
+    size_t getMemoryUsage() const override;
+    double getEffectiveFalsePositiveRate() const override;
+    double getSaturation() const override;  // 1 once overflowed
+    FilterFillEstimate estimateFill(size_t sample_words) const override;
+    uint64_t getCount() const;
+    bool hasOverflowed() const;
+
+private:
+    struct Header {
+        uint32_t lock;  // Writers' spinlock, 0 when free
+        uint32_t overflowed;  // An insert found no room
+        uint64_t seq;  // Odd while a writer is changing the table
+        uint64_t count;  // Fingerprints stored, including the victim
+        uint64_t victim_bucket;  // Fingerprint displaced by a chain that ran out of kicks
+        uint32_t victim_fp;  // 0 when the victim slot is empty
+    };
+
+    Header* header_;
+    uint8_t* table_;
+    uint64_t num_buckets_;
+    uint32_t slots_;
+    uint32_t fingerprint_bits_;
+    uint32_t bucket_bits_;
+    uint64_t fingerprint_mask_;
+    __uint128_t bucket_mask_;
+    uint64_t expected_count_;
+    double false_positive_rate_;
+
+    uint32_t fingerprintOf(uint64_t h2) const;
+    size_t bucketOf(uint64_t h1) const;
+    // The other bucket of a fingerprint; altBucket(altBucket(i, fp), fp) == i
+    size_t altBucket(size_t bucket, uint32_t fp) const;
+    // Buckets start on a 4-bit boundary: read and written as 16 bytes from
+    // the byte they start in, shifted by 0 or 4 bits
+    __uint128_t loadBucket(size_t bucket) const;
+    void storeBucket(size_t bucket, __uint128_t value);
+    uint32_t slotOf(__uint128_t bucket, uint32_t slot) const;
+    bool bucketHas(__uint128_t bucket, uint32_t fp) const;
+    bool tryPlace(size_t bucket, uint32_t fp);
+    bool insertFingerprint(size_t bucket, uint32_t fp);
+    bool removeFingerprint(size_t bucket, uint32_t fp);
+
+    // Spinlock plus sequence counter around every change to shared storage
+    void beginWrite() const;
+    void endWrite() const;
+};
+
+#endif // OCTO_BLOOM_CUCKOO_FILTER_HPP
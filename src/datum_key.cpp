@@ -0,0 +1,109 @@
+#include "datum_key.hpp"
+
+extern "C" {
+#include <catalog/pg_collation.h>
+#include <catalog/pg_type.h>
+#include <parser/parse_coerce.h>
+#include <utils/builtins.h>
+#include <utils/lsyscache.h>
+#include <utils/typcache.h>
+}
+
+extern "C" {
+
+static bool is_integer_type(Oid typid) {
+    return typid == INT2OID || typid == INT4OID || typid == INT8OID;
+}
+
+// By-value types whose equal values always have equal bytes
+static bool is_bitwise_by_value(Oid typid) {
+    switch (typid) {
+        case BOOLOID:
+        case CHAROID:
+        case OIDOID:
+        case DATEOID:
+        case TIMEOID:
+        case TIMESTAMPOID:
+        case TIMESTAMPTZOID:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void bloom_key_type_for_column(Oid typid, Oid collation, BloomKeyType* key_type) {
+    Oid base_type = getBaseType(typid);
+    int16 typlen;
+    bool typbyval;
+    get_typlenbyval(base_type, &typlen, &typbyval);
+
+    key_type->typid = base_type;
+    key_type->typlen = typlen;
+    key_type->collation = collation;
+
+    if (is_integer_type(base_type)) {
+        key_type->kind = BloomKeyKind::Integer;
+    } else if (typbyval && is_bitwise_by_value(base_type)) {
+        key_type->kind = BloomKeyKind::ByValue;
+    } else if (base_type == UUIDOID) {
+        key_type->kind = BloomKeyKind::FixedRef;
+    } else if ((base_type == TEXTOID || base_type == VARCHAROID) &&
+               (!OidIsValid(collation) || get_collation_isdeterministic(collation))) {
+        key_type->kind = BloomKeyKind::Varlena;
+    } else if (base_type == BYTEAOID) {
+        key_type->kind = BloomKeyKind::Varlena;
+    } else {
+        TypeCacheEntry* typentry = lookup_type_cache(base_type, TYPECACHE_HASH_EXTENDED_PROC);
+        if (!OidIsValid(typentry->hash_extended_proc)) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("bloom filters are not supported on type %s",
+                            format_type_be(typid)),
+                     errdetail("The type has no extended hash function.")));
+        }
+        key_type->kind = BloomKeyKind::HashProc;
+    }
+}
+
+bool bloom_key_probe_compatible(Oid value_type, const BloomKeyType* column) {
+    if (column->kind == BloomKeyKind::Composite) {
+        return false;
+    }
+    Oid base_type = getBaseType(value_type);
+    return base_type == column->typid || IsBinaryCoercible(base_type, column->typid) ||
+           (column->kind == BloomKeyKind::Integer && is_integer_type(base_type));
+}
+
+void bloom_key_type_for_probe(Oid value_type, const BloomKeyType* column,
+                              BloomKeyType* key_type) {
+    Oid base_type = getBaseType(value_type);
+
+    if (column->kind != BloomKeyKind::Composite &&
+        (base_type == column->typid || IsBinaryCoercible(base_type, column->typid))) {
+        *key_type = *column;
+        return;
+    }
+
+    // Mixed integer widths compare equal, and all hash as int8
+    if (bloom_key_probe_compatible(value_type, column)) {
+        *key_type = *column;
+        key_type->typid = base_type;
+        key_type->typlen = get_typlen(base_type);
+        return;
+    }
+
+    ereport(ERROR,
+            (errcode(ERRCODE_DATATYPE_MISMATCH),
+             errmsg("value of type %s cannot be checked against a bloom filter on type %s",
+                    format_type_be(value_type), format_type_be(column->typid)),
+             errhint("Cast the value to %s.", format_type_be(column->typid))));
+}
+
+uint64_t bloom_key_hash_proc(const BloomKeyType* key_type, Datum value) {
+    TypeCacheEntry* typentry = lookup_type_cache(key_type->typid,
+                                                 TYPECACHE_HASH_EXTENDED_PROC_FINFO);
+    return DatumGetUInt64(FunctionCall2Coll(&typentry->hash_extended_proc_finfo,
+                                            key_type->collation, value, Int64GetDatum(0)));
+}
+
+} // extern "C"
@@ -0,0 +1,144 @@
+#ifndef OCTO_BLOOM_DATUM_KEY_HPP
+#define OCTO_BLOOM_DATUM_KEY_HPP
+
+extern "C" {
+#include <postgres.h>
+#include <fmgr.h>
+#include <access/tupmacs.h>
+}
+
+#include <cstdint>
+#include <cstring>
+
+#include "bloom_hash.hpp"
+
+// How the datums of a filtered column become the bytes a filter hashes.
+// The kind is resolved from the column type once, when the filter is
+// registered, and stored with it.
+enum class BloomKeyKind : uint8_t {
+    Integer = 0,   // int2/int4/int8, widened to int8 so they hash alike
+    ByValue = 1,   // Other by-value types whose equality is bitwise
+    FixedRef = 2,  // Fixed-width by-reference types, e.g. uuid
+    Varlena = 3,   // Variable-length, hashed in place from the payload
+    HashProc = 4,  // Types where equal values can differ in bytes (numeric,
+                   // float, nondeterministic collations): the type's
+                   // extended hash function provides the key
+    Composite = 5,  // A digest of several values (composite_key.hpp); typlen
+                    // is the number of them. Never built from one datum
+};
+
+typedef struct BloomKeyType {
+    Oid typid;
+    int16 typlen;
+    Oid collation;
+    BloomKeyKind kind;
+} BloomKeyType;
+
+// Bytes of one datum as hashed by a filter. Widened integers, by-value
+// copies and hash-function results live in scratch; a detoasted copy of a
+// compressed or external value is kept in copy for bloom_key_release().
+typedef struct BloomKey {
+    const void* data;
+    size_t length;
+    uint64_t scratch;
+    Pointer copy;
+} BloomKey;
+
+extern "C" {
+// Key kind for a column of type typid with the given collation
+void bloom_key_type_for_column(Oid typid, Oid collation, BloomKeyType* key_type);
+
+// Key type to use for probe values of value_type against a filter keyed by
+// column. ERRORs unless value_type is binary-coercible to the column type
+// or both are integer types.
+void bloom_key_type_for_probe(Oid value_type, const BloomKeyType* column,
+                              BloomKeyType* key_type);
+// Whether bloom_key_type_for_probe accepts value_type for column
+bool bloom_key_probe_compatible(Oid value_type, const BloomKeyType* column);
+
+uint64_t bloom_key_hash_proc(const BloomKeyType* key_type, Datum value);
+}
+
+static inline void bloom_key_from_datum(const BloomKeyType* key_type, Datum value, BloomKey* key) {
+    key->copy = NULL;
+
+    switch (key_type->kind) {
+        case BloomKeyKind::Integer: {
+            int64 widened;
+            if (key_type->typlen == sizeof(int16)) {
+                widened = DatumGetInt16(value);
+            } else if (key_type->typlen == sizeof(int32)) {
+                widened = DatumGetInt32(value);
+            } else {
+                widened = DatumGetInt64(value);
+            }
+            memcpy(&key->scratch, &widened, sizeof(widened));
+            key->data = &key->scratch;
+            key->length = sizeof(widened);
+            break;
+        }
+        case BloomKeyKind::ByValue:
+            store_att_byval(&key->scratch, value, key_type->typlen);
+            key->data = &key->scratch;
+            key->length = key_type->typlen;
+            break;
+        case BloomKeyKind::FixedRef:
+            key->data = DatumGetPointer(value);
+            key->length = key_type->typlen;
+            break;
+        case BloomKeyKind::Varlena: {
+            struct varlena* v = (struct varlena*)DatumGetPointer(value);
+            // Plain and short-header values are read where they are
+            if (VARATT_IS_COMPRESSED(v) || VARATT_IS_EXTERNAL(v)) {
+                v = pg_detoast_datum_packed(v);
+                key->copy = (Pointer)v;
+            }
+            key->data = VARDATA_ANY(v);
+            key->length = VARSIZE_ANY_EXHDR(v);
+            break;
+        }
+        case BloomKeyKind::HashProc:
+            key->scratch = bloom_key_hash_proc(key_type, value);
+            key->data = &key->scratch;
+            key->length = sizeof(key->scratch);
+            break;
+        case BloomKeyKind::Composite:
+            elog(ERROR, "composite key hashed as a single value");
+            break;
+    }
+}
+
+static inline void bloom_key_release(BloomKey* key) {
+    if (key->copy) {
+        pfree(key->copy);
+        key->copy = NULL;
+    }
+}
+
+// Composite keys are hashed as a 64-bit digest of their parts: each part's
+// key bytes are hashed where they lie and folded in, in order, so the key
+// is never assembled in memory. The filter then hashes the digest
+static inline uint64_t bloom_key_digest_start() {
+    return kBloomWySecret[2];
+}
+
+static inline uint64_t bloom_key_digest_fold(uint64_t digest, const BloomKeyType* key_type,
+                                             Datum value) {
+    BloomKey part;
+    bloom_key_from_datum(key_type, value, &part);
+    uint64_t h1;
+    uint64_t h2;
+    bloom_hash128(part.data, part.length, &h1, &h2);
+    bloom_key_release(&part);
+    // Not commutative: (a, b) and (b, a) are different keys
+    return bloom_wymix(digest ^ h1, h2 ^ kBloomWySecret[3]);
+}
+
+static inline void bloom_key_from_digest(uint64_t digest, BloomKey* key) {
+    key->copy = NULL;
+    key->scratch = digest;
+    key->data = &key->scratch;
+    key->length = sizeof(key->scratch);
+}
+
+#endif // OCTO_BLOOM_DATUM_KEY_HPP
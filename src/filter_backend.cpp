@@ -0,0 +1,138 @@
+#include "filter_backend.hpp"
+#include "bloom_filter.hpp"
+#include "cuckoo_filter.hpp"
+#include "scalable_filter.hpp"
+#include <new>
+
+extern "C" {
+#include <postgres.h>
+#include <utils/palloc.h>
+}
+
+size_t filter_storage_size(const BloomFilterParams& params) {
+    if (params.kind == FilterKind::Cuckoo) {
+        return CuckooFilter::storageSize(params);
+    }
+    if (params.kind == FilterKind::Scalable) {
+        return ScalableFilter::stageStorageSize(
+            ScalableFilter::firstStageParams(params, params.expected_count));
+    }
+    return OctoBloomFilter::storageSize(params);
+}
+
+FilterBackend* filter_create_view(const BloomFilterParams& params, void* storage) {
+    if (params.kind == FilterKind::Cuckoo) {
+        return new (palloc(sizeof(CuckooFilter))) CuckooFilter(params, storage);
+    }
+    if (params.kind == FilterKind::Scalable) {
+        BloomFilterParams stage = ScalableFilter::firstStageParams(params, params.expected_count);
+        return filter_create_chain_view(params, &stage, &storage, 1);
+    }
+    return new (palloc(sizeof(OctoBloomFilter))) OctoBloomFilter(params, storage);
+}
+
+FilterBackend* filter_create_chain_view(const BloomFilterParams& params,
+                                        const BloomFilterParams* stage_params,
+                                        void* const* stages, int num_stages) {
+    if (params.kind != FilterKind::Scalable) {
+        return filter_create_view(params, stages[0]);
+    }
+    return new (palloc(sizeof(ScalableFilter)))
+        ScalableFilter(params, stage_params, stages, num_stages);
+}
+
+namespace {
+
+// See filter_create_resizing_view. current holds every key until the
+// resize is done, so it answers probes; next only misses keys it hasn't
+// been filled with yet. Removes skip next, which may not hold the key: a
+// key left behind there is a false positive, not a lost key
+class ResizingFilter final : public FilterBackend {
+public:
+    ResizingFilter(FilterBackend* current, FilterBackend* next)
+        : current_(current), next_(next) {}
+    ~ResizingFilter() override {
+        filter_destroy(current_);
+        filter_destroy(next_);
+    }
+
+    void add(const void* data, size_t length) override {
+        current_->add(data, length);
+        next_->add(data, length);
+    }
+    bool mightContain(const void* data, size_t length) const override {
+        return current_->mightContain(data, length);
+    }
+    void mightContainBatch(const void* const* data, const size_t* lengths,
+                           size_t count, bool* results) const override {
+        current_->mightContainBatch(data, lengths, count, results);
+    }
+
+    bool supportsRemove() const override { return current_->supportsRemove(); }
+    void remove(const void* data, size_t length) override { current_->remove(data, length); }
+
+    // Both sides hash alike: a resize keeps the kind and the hash
+    std::pair<uint64_t, uint64_t> doubleHash(const void* data, size_t length) const override {
+        return current_->doubleHash(data, length);
+    }
+    void addHashesUnshared(uint64_t h1, uint64_t h2) override {
+        current_->addHashesUnshared(h1, h2);
+        next_->addHashesUnshared(h1, h2);
+    }
+    void addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) override {
+        current_->addHashBatch(h1, h2, count);
+        next_->addHashBatch(h1, h2, count);
+    }
+    void removeHashes(uint64_t h1, uint64_t h2) override { current_->removeHashes(h1, h2); }
+    bool mightContainHashes(uint64_t h1, uint64_t h2) const override {
+        return current_->mightContainHashes(h1, h2);
+    }
+    void prefetchHashes(uint64_t h1, uint64_t h2) const override {
+        current_->prefetchHashes(h1, h2);
+    }
+
+    void clear() override {
+        current_->clear();
+        next_->clear();
+    }
+    bool isCompatible(const FilterBackend& other) const override {
+        return next_->isCompatible(other) || current_->isCompatible(other);
+    }
+    bool mergeFrom(const FilterBackend& other) override {
+        if (next_->isCompatible(other)) {
+            return next_->mergeFrom(other);
+        }
+        return current_->mergeFrom(other);
+    }
+
+    BloomFilterParams getParams() const override { return current_->getParams(); }
+    size_t getMemoryUsage() const override {
+        return current_->getMemoryUsage() + next_->getMemoryUsage();
+    }
+    double getEffectiveFalsePositiveRate() const override {
+        return current_->getEffectiveFalsePositiveRate();
+    }
+    double getSaturation() const override { return current_->getSaturation(); }
+    FilterFillEstimate estimateFill(size_t sample_words) const override {
+        return current_->estimateFill(sample_words);
+    }
+    size_t getSerializedSize() const override { return current_->getSerializedSize(); }
+    void serialize(uint8_t* buffer, uint32_t key_type) const override {
+        current_->serialize(buffer, key_type);
+    }
+
+private:
+    FilterBackend* current_;
+    FilterBackend* next_;
+};
+
+} // namespace
+
+FilterBackend* filter_create_resizing_view(FilterBackend* current, FilterBackend* next) {
+    return new (palloc(sizeof(ResizingFilter))) ResizingFilter(current, next);
+}
+
+void filter_destroy(FilterBackend* filter) {
+    filter->~FilterBackend();
+    pfree(filter);
+}
@@ -0,0 +1,142 @@
+#ifndef OCTO_BLOOM_FILTER_BACKEND_HPP
+#define OCTO_BLOOM_FILTER_BACKEND_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+
+// Filter data structure behind a registry entry, chosen at octo_bloom_init time
+enum class FilterKind : uint8_t {
+    Bloom = 0,     // OctoBloomFilter, in one of the BloomLayouts
+    Cuckoo = 1,    // CuckooFilter: fingerprints in packed buckets
+    Scalable = 2,  // ScalableFilter: a growing chain of Bloom stages
+};
+
+// Most stages a scalable filter can grow to. Compaction appends one more,
+// so a full chain can still be compacted
+#define OCTO_BLOOM_MAX_STAGES 16
+#define OCTO_BLOOM_STAGE_SLOTS (OCTO_BLOOM_MAX_STAGES + 1)
+
+// Bit layout of a Bloom filter
+enum class BloomLayout : uint8_t {
+    Standard = 0,  // Flat bit array, k independent probes
+    Blocked = 1,   // All k bits of a key inside one 64-byte block
+    Counting = 2,  // Standard probing over 4-bit saturating counters, so
+                   // keys can be removed
+};
+
+// Key hash that produces h1 and h2, recorded with the filter
+enum class BloomHash : uint8_t {
+    PgHashFnv = 0,  // hash_any for h1 plus a byte-wise FNV pass for h2
+    Wy128 = 1,      // Single-pass 128-bit bloom_hash128
+};
+
+// Mapping of a 64-bit hash onto a bit (Standard) or block (Blocked) index
+enum class BloomReduction : uint8_t {
+    Modulo = 0,      // hash % n, a 64-bit division per probe
+    FastRange = 1,   // (hash * n) >> 64 (Lemire); needs full 64-bit hashes
+    PowerOfTwo = 2,  // hash & (n - 1); n is rounded up to a power of two
+};
+
+// Sizing of a filter: everything needed to attach to an existing array
+struct BloomFilterParams {
+    FilterKind kind;
+    BloomLayout layout;  // Bloom only
+    BloomHash hash;
+    BloomReduction reduction;
+    uint32_t num_hashes;  // Bloom only
+    uint64_t expected_count;
+    double false_positive_rate;
+    uint64_t bit_array_size;  // Bits (or counters) for Bloom, table bits for Cuckoo
+    uint32_t bucket_slots;  // Cuckoo only: fingerprints per 64-bit bucket
+    uint32_t fingerprint_bits;  // Cuckoo only
+};
+
+// How full a filter looks from its storage, for octo_bloom_status
+struct FilterFillEstimate {
+    double saturation;  // As getSaturation, but possibly from a sample
+    double cardinality;  // Distinct keys the fill suggests it holds
+    double false_positive_rate;  // Of a probe against it as it is now
+};
+
+// Operations the registry, triggers, probes and rebuilds use on a filter.
+// Implementations work as views over caller-owned storage (see
+// filter_create_view) and must tolerate adds and probes from concurrent
+// backends on the same storage.
+class FilterBackend {
+public:
+    virtual ~FilterBackend() = default;
+
+    virtual void add(const void* data, size_t length) = 0;
+    virtual bool mightContain(const void* data, size_t length) const = 0;
+    // Probe many keys at once, overlapping the cache misses of different keys
+    virtual void mightContainBatch(const void* const* data, const size_t* lengths,
+                                   size_t count, bool* results) const = 0;
+
+    // False if remove() can't forget keys and is a no-op
+    virtual bool supportsRemove() const = 0;
+    // The key must have been added, or other keys may be lost
+    virtual void remove(const void* data, size_t length) = 0;
+
+    // Bulk loading into a private filter that no other backend can see
+    virtual std::pair<uint64_t, uint64_t> doubleHash(const void* data, size_t length) const = 0;
+    virtual void addHashesUnshared(uint64_t h1, uint64_t h2) = 0;
+
+    // Shared adds and removes of doubleHash() results, safe against
+    // concurrent adds/reads. A batch overlaps the cache misses of its keys
+    virtual void addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) = 0;
+    virtual void removeHashes(uint64_t h1, uint64_t h2) = 0;  // No-op without supportsRemove
+    // Probe a doubleHash() result. Prefetching it first lets a caller that
+    // probes one key in many filters overlap their cache misses
+    virtual bool mightContainHashes(uint64_t h1, uint64_t h2) const = 0;
+    virtual void prefetchHashes(uint64_t h1, uint64_t h2) const {}
+
+    virtual void clear() = 0;
+    // Same kind and parameters, so mergeFrom can combine them
+    virtual bool isCompatible(const FilterBackend& other) const = 0;
+    // Add every key of other to this filter; safe against concurrent
+    // adds/reads. Returns false, changing nothing, if not compatible
+    virtual bool mergeFrom(const FilterBackend& other) = 0;
+
+    virtual BloomFilterParams getParams() const = 0;
+    // Bytes of bit array or table
+    virtual size_t getMemoryUsage() const = 0;
+    // Predicted FPR at expected_count keys for the size actually allocated
+    virtual double getEffectiveFalsePositiveRate() const = 0;
+    // Fraction of the filter in use: bits set, nonzero counters or
+    // occupied slots. Read without locks; Bloom filters scan every word
+    virtual double getSaturation() const = 0;
+    // Read without locks. Bloom filters popcount at most sample_words words
+    // of their arrays, in runs spread over the whole of them
+    virtual FilterFillEstimate estimateFill(size_t sample_words) const = 0;
+
+    // Scalable filters: the newest stage is full and grow_bloom_filter
+    // should append another
+    virtual bool needsGrowth() const { return false; }
+    virtual int getNumStages() const { return 1; }
+
+    // Bloom filters: the self-describing form of OctoBloomFilter::serialize.
+    // Other kinds have none, and their size is 0
+    virtual size_t getSerializedSize() const { return 0; }
+    virtual void serialize(uint8_t* buffer, uint32_t key_type) const {}
+};
+
+// Bytes to allocate for a filter's storage, including alignment slack. For
+// a scalable filter, the storage of its first stage
+size_t filter_storage_size(const BloomFilterParams& params);
+
+// New filter object in CurrentMemoryContext over storage of
+// filter_storage_size(params) bytes. Zeroed storage is an empty filter;
+// otherwise the contents are used as they are. Free with filter_destroy.
+FilterBackend* filter_create_view(const BloomFilterParams& params, void* storage);
+// The same for a filter whose storage is split over stages, oldest first
+FilterBackend* filter_create_chain_view(const BloomFilterParams& params,
+                                        const BloomFilterParams* stage_params,
+                                        void* const* stages, int num_stages);
+// A filter being resized: probes and removes go to current, adds to both,
+// and keys merged in bulk to whichever is compatible, next first. Takes
+// ownership of both views
+FilterBackend* filter_create_resizing_view(FilterBackend* current, FilterBackend* next);
+void filter_destroy(FilterBackend* filter);
+
+#endif // OCTO_BLOOM_FILTER_BACKEND_HPP
@@ -0,0 +1,854 @@
+#include "filter_build.hpp"
+#include "bloom_filter.hpp"
+#include "composite_key.hpp"
+#include "cuckoo_filter.hpp"
+#include "filter_backend.hpp"
+#include "partition_filters.hpp"
+#include "scalable_filter.hpp"
+
+extern "C" {
+#include <access/genam.h>
+#include <access/htup_details.h>
+#include <access/parallel.h>
+#include <access/relscan.h>
+#include <access/table.h>
+#include <access/tableam.h>
+#include <access/visibilitymap.h>
+#include <access/xact.h>
+#include <catalog/pg_am.h>
+#include <catalog/pg_class.h>
+#include <catalog/pg_index.h>
+#include <executor/tuptable.h>
+#include <funcapi.h>
+#include <miscadmin.h>
+#include <storage/bufmgr.h>
+#include <storage/lmgr.h>
+#include <storage/shm_toc.h>
+#include <utils/memutils.h>
+#include <utils/snapmgr.h>
+#include <utils/timestamp.h>
+}
+
+// Populating a filter from the rows already in its table. The leader and
+// any parallel workers claim disjoint block ranges through a parallel
+// table scan, fill private bit arrays without atomics, and OR them into
+// the shared filter when their part of the scan is done. Only bits are
+// set, so lookups and trigger adds continue against the filter throughout.
+//
+// When the column is stored in a B-tree, the leader reads the index with an
+// index-only scan instead, which touches far less data than the heap.
+//
+// A scalable filter is compacted rather than filled in place, in the manner
+// of CREATE INDEX CONCURRENTLY: a stage sized for every row is appended, so
+// trigger adds go there from then on; writers still holding the old chain
+// are waited out, so their rows are visible to the scan; the scan fills the
+// new stage, and the stages before it are dropped.
+//
+// Bloom and cuckoo filters are resized the same way: storage of the new
+// size is installed beside the filter, which adds to both from then on;
+// writers still holding the old filter are waited out; the scan fills the
+// new storage, which then replaces the old. Probes read the old filter
+// until the swap, so nobody waits and nothing goes missing.
+
+extern "C" {
+
+PGDLLEXPORT void octo_bloom_build_worker(dsm_segment* seg, shm_toc* toc);
+
+#define BUILD_KEY_SHARED UINT64CONST(0x0c70b100f0000001)
+#define BUILD_KEY_SCAN UINT64CONST(0x0c70b100f0000002)
+
+// Tuples a participant scans between progress updates
+#define BUILD_PROGRESS_INTERVAL 4096
+
+// Capacity per key held when resize_bloom_filter picks the size itself
+#define RESIZE_HEADROOM 2.0
+
+typedef struct BloomBuildShared {
+    Oid table_oid;
+    int16_t attnum;
+    BloomFilterParams params;  // Shape of the filter the build targets
+    BloomKeyType key_type;
+    int progress_slot;
+    pg_atomic_uint64 values_added;
+} BloomBuildShared;
+
+static BloomBuildProgress* progress_for(int slot) {
+    return &bloom_shared_state->builds[slot];
+}
+
+static int start_build_progress(Oid table_oid, int16_t attnum, Oid index_oid,
+                                double tuples_total, int workers_planned) {
+    int slot = -1;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+    for (int i = 0; i < OCTO_BLOOM_MAX_BUILDS; ++i) {
+        if (bloom_shared_state->builds[i].pid == 0) {
+            slot = i;
+            break;
+        }
+    }
+    if (slot >= 0) {
+        BloomBuildProgress* progress = progress_for(slot);
+        progress->pid = MyProcPid;
+        progress->dboid = MyDatabaseId;
+        progress->table_oid = table_oid;
+        progress->attnum = attnum;
+        progress->index_oid = index_oid;
+        progress->phase = BLOOM_BUILD_INITIALIZING;
+        progress->workers_planned = workers_planned;
+        progress->workers_launched = 0;
+        progress->tuples_total = tuples_total;
+        pg_atomic_write_u64(&progress->tuples_done, 0);
+        pg_atomic_write_u32(&progress->participants_done, 0);
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    if (slot < 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+                 errmsg("too many concurrent bloom filter rebuilds"),
+                 errdetail("At most %d rebuilds can run at once.", OCTO_BLOOM_MAX_BUILDS)));
+    }
+    return slot;
+}
+
+static void finish_build_progress(int slot) {
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+    progress_for(slot)->pid = 0;
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+// Add one key to a private filter
+static inline void add_build_key(FilterBackend* local, const BloomKey* key) {
+    auto hashes = local->doubleHash(key->data, key->length);
+    local->addHashesUnshared(hashes.first, hashes.second);
+}
+
+static inline void add_build_value(FilterBackend* local, const BloomKeyType* key_type,
+                                   Datum value) {
+    BloomKey key;
+    bloom_key_from_datum(key_type, value, &key);
+    add_build_key(local, &key);
+    bloom_key_release(&key);
+}
+
+// One participant's share of the scan, run by the leader and every worker.
+// composite is the leader's definition of a composite filter's key; those
+// are built by the leader alone
+static void build_participant(BloomBuildShared* shared, ParallelTableScanDesc pscan,
+                              Relation rel, const CompositeKey* composite) {
+    BloomBuildProgress* progress = progress_for(shared->progress_slot);
+
+    // Private filter with the shared filter's shape; may exceed 1 GB
+    void* storage = palloc_extended(filter_storage_size(shared->params),
+                                    MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    FilterBackend* local = filter_create_view(shared->params, storage);
+
+    FilterBackend* target = get_bloom_filter(shared->table_oid, shared->attnum, NULL);
+    if (!target || !target->isCompatible(*local)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter was replaced or dropped during rebuild")));
+    }
+
+    const BloomKeyType* key_type = &shared->key_type;
+    CompositeKeyState* key_state = composite ? composite_key_begin(composite, NULL) : NULL;
+    TableScanDesc scan = table_beginscan_parallel(rel, pscan);
+    TupleTableSlot* slot = table_slot_create(rel, NULL);
+    uint64_t added = 0;
+    uint64_t pending = 0;
+
+    while (table_scan_getnextslot(scan, ForwardScanDirection, slot)) {
+        CHECK_FOR_INTERRUPTS();
+
+        if (key_state) {
+            BloomKey key;
+            if (composite_key_from_slot(key_state, slot, &key)) {
+                add_build_key(local, &key);
+                added++;
+            }
+        } else {
+            bool isnull;
+            Datum value = slot_getattr(slot, shared->attnum, &isnull);
+            if (!isnull) {
+                add_build_value(local, key_type, value);
+                added++;
+            }
+        }
+
+        if (++pending == BUILD_PROGRESS_INTERVAL) {
+            pg_atomic_fetch_add_u64(&progress->tuples_done, pending);
+            pending = 0;
+        }
+    }
+    pg_atomic_fetch_add_u64(&progress->tuples_done, pending);
+
+    ExecDropSingleTupleTableSlot(slot);
+    table_endscan(scan);
+    if (key_state) {
+        composite_key_end(key_state);
+    }
+
+    if (!target->mergeFrom(*local)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter was replaced or dropped during rebuild")));
+    }
+    filter_destroy(local);
+    pfree(storage);
+
+    pg_atomic_fetch_add_u64(&shared->values_added, added);
+    pg_atomic_fetch_add_u32(&progress->participants_done, 1);
+}
+
+void octo_bloom_build_worker(dsm_segment* seg, shm_toc* toc) {
+    BloomBuildShared* shared = (BloomBuildShared*)shm_toc_lookup(toc, BUILD_KEY_SHARED, false);
+    ParallelTableScanDesc pscan = (ParallelTableScanDesc)shm_toc_lookup(toc, BUILD_KEY_SCAN, false);
+
+    ensure_shared_memory();
+
+    Relation rel = table_open(shared->table_oid, AccessShareLock);
+    build_participant(shared, pscan, rel, NULL);
+    table_close(rel, AccessShareLock);
+}
+
+static uint64_t run_build(Relation rel, int16_t attnum, const BloomFilterParams& params,
+                          const BloomKeyType* key_type, const CompositeKey* composite,
+                          int nworkers, int progress_slot) {
+    BloomBuildProgress* progress = progress_for(progress_slot);
+    Snapshot snapshot = RegisterSnapshot(GetTransactionSnapshot());
+
+    EnterParallelMode();
+    ParallelContext* pcxt = CreateParallelContext("octo_bloom", "octo_bloom_build_worker",
+                                                  nworkers);
+
+    Size scan_size = table_parallelscan_estimate(rel, snapshot);
+    shm_toc_estimate_chunk(&pcxt->estimator, sizeof(BloomBuildShared));
+    shm_toc_estimate_chunk(&pcxt->estimator, scan_size);
+    shm_toc_estimate_keys(&pcxt->estimator, 2);
+    InitializeParallelDSM(pcxt);
+
+    BloomBuildShared* shared = (BloomBuildShared*)shm_toc_allocate(pcxt->toc,
+                                                                   sizeof(BloomBuildShared));
+    shared->table_oid = RelationGetRelid(rel);
+    shared->attnum = attnum;
+    shared->params = params;
+    shared->key_type = *key_type;
+    shared->progress_slot = progress_slot;
+    pg_atomic_init_u64(&shared->values_added, 0);
+    shm_toc_insert(pcxt->toc, BUILD_KEY_SHARED, shared);
+
+    ParallelTableScanDesc pscan = (ParallelTableScanDesc)shm_toc_allocate(pcxt->toc, scan_size);
+    table_parallelscan_initialize(rel, pscan, snapshot);
+    shm_toc_insert(pcxt->toc, BUILD_KEY_SCAN, pscan);
+
+    LaunchParallelWorkers(pcxt);
+    progress->workers_launched = pcxt->nworkers_launched;
+    progress->phase = BLOOM_BUILD_SCANNING;
+
+    // The leader scans too, so the build completes even if no worker started
+    build_participant(shared, pscan, rel, composite);
+
+    progress->phase = BLOOM_BUILD_WAITING_FOR_WORKERS;
+    WaitForParallelWorkersToFinish(pcxt);
+
+    uint64_t added = pg_atomic_read_u64(&shared->values_added);
+
+    DestroyParallelContext(pcxt);
+    ExitParallelMode();
+    UnregisterSnapshot(snapshot);
+
+    return added;
+}
+
+// The smallest valid, non-partial B-tree index that can return attnum from
+// an index-only scan, or InvalidOid. *index_column is its position there
+// and *index_tuples its pg_class.reltuples estimate.
+static Oid find_build_index(Relation rel, int16_t attnum, int* index_column,
+                            double* index_tuples) {
+    Oid atttype = TupleDescAttr(RelationGetDescr(rel), attnum - 1)->atttypid;
+    List* indexes = RelationGetIndexList(rel);
+    Oid best = InvalidOid;
+    BlockNumber best_pages = InvalidBlockNumber;
+    ListCell* lc;
+
+    foreach(lc, indexes) {
+        Relation index = index_open(lfirst_oid(lc), AccessShareLock);
+        Form_pg_index form = index->rd_index;
+
+        // Like the planner, skip indexes our snapshot may not be able to use
+        bool usable = index->rd_rel->relam == BTREE_AM_OID &&
+                      form->indisvalid &&
+                      heap_attisnull(index->rd_indextuple, Anum_pg_index_indpred, NULL) &&
+                      !(form->indcheckxmin &&
+                        !TransactionIdPrecedes(HeapTupleHeaderGetXmin(index->rd_indextuple->t_data),
+                                               TransactionXmin));
+
+        for (int i = 0; usable && i < form->indnatts; ++i) {
+            if (form->indkey.values[i] != attnum ||
+                TupleDescAttr(RelationGetDescr(index), i)->atttypid != atttype ||
+                !index_can_return(index, i + 1)) {
+                continue;
+            }
+            BlockNumber pages = RelationGetNumberOfBlocks(index);
+            if (pages < best_pages) {
+                best = RelationGetRelid(index);
+                best_pages = pages;
+                *index_column = i + 1;
+                *index_tuples = index->rd_rel->reltuples;
+            }
+            break;
+        }
+
+        index_close(index, AccessShareLock);
+    }
+
+    list_free(indexes);
+    return best;
+}
+
+// Fill the filter from an index-only scan. As in an Index Only Scan node,
+// entries on all-visible heap pages are trusted and the rest are checked
+// against the heap tuple.
+static uint64_t run_index_build(Relation rel, Oid index_oid, int index_column,
+                                const BloomFilterParams& params, FilterBackend* target,
+                                const BloomKeyType* key_type, int progress_slot) {
+    BloomBuildProgress* progress = progress_for(progress_slot);
+    Relation index = index_open(index_oid, AccessShareLock);
+    Snapshot snapshot = RegisterSnapshot(GetTransactionSnapshot());
+
+    void* storage = palloc_extended(filter_storage_size(params),
+                                    MCXT_ALLOC_HUGE | MCXT_ALLOC_ZERO);
+    FilterBackend* local = filter_create_view(params, storage);
+    if (!target->isCompatible(*local)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter was replaced or dropped during rebuild")));
+    }
+
+#if PG_VERSION_NUM >= 180000
+    IndexScanDesc scan = index_beginscan(rel, index, snapshot, NULL, 0, 0);
+#else
+    IndexScanDesc scan = index_beginscan(rel, index, snapshot, 0, 0);
+#endif
+    scan->xs_want_itup = true;
+    index_rescan(scan, NULL, 0, NULL, 0);
+
+    TupleTableSlot* slot = table_slot_create(rel, NULL);
+    Buffer vmbuffer = InvalidBuffer;
+    uint64_t added = 0;
+    uint64_t pending = 0;
+    uint64_t heap_fetches = 0;
+    ItemPointer tid;
+
+    progress->phase = BLOOM_BUILD_SCANNING_INDEX;
+
+    while ((tid = index_getnext_tid(scan, ForwardScanDirection)) != NULL) {
+        CHECK_FOR_INTERRUPTS();
+
+        if (!VM_ALL_VISIBLE(rel, ItemPointerGetBlockNumber(tid), &vmbuffer)) {
+            heap_fetches++;
+            if (!index_fetch_heap(scan, slot)) {
+                continue;  // No version visible to our snapshot
+            }
+        }
+
+        bool isnull;
+        Datum value = index_getattr(scan->xs_itup, index_column, scan->xs_itupdesc, &isnull);
+        if (!isnull) {
+            add_build_value(local, key_type, value);
+            added++;
+        }
+
+        if (++pending == BUILD_PROGRESS_INTERVAL) {
+            pg_atomic_fetch_add_u64(&progress->tuples_done, pending);
+            pending = 0;
+        }
+    }
+    pg_atomic_fetch_add_u64(&progress->tuples_done, pending);
+
+    if (vmbuffer != InvalidBuffer) {
+        ReleaseBuffer(vmbuffer);
+    }
+    ExecDropSingleTupleTableSlot(slot);
+    index_endscan(scan);
+
+    // A build that can't be merged would leave the filter without its keys
+    if (!target->mergeFrom(*local)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter was replaced or dropped during rebuild")));
+    }
+    filter_destroy(local);
+    pfree(storage);
+    pg_atomic_fetch_add_u32(&progress->participants_done, 1);
+
+    UnregisterSnapshot(snapshot);
+    index_close(index, AccessShareLock);
+
+    elog(DEBUG1, "octo_bloom: rebuilt from index \"%s\" with " UINT64_FORMAT " heap fetches",
+         get_rel_name(index_oid), heap_fetches);
+
+    return added;
+}
+
+// Rows committed while we wait for writers must be visible to the scan's
+// snapshot, so the transaction takes a new one per statement
+static void require_read_committed(const char* what) {
+    if (IsolationUsesXactSnapshot()) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("%s requires READ COMMITTED isolation", what)));
+    }
+}
+
+// Inserting backends hold RowExclusiveLock from fetching a filter until
+// their transaction ends, so once they are gone every writer sees the
+// filter as it is now
+static void wait_for_writers(Oid table_oid) {
+    LOCKTAG tag;
+    SET_LOCKTAG_RELATION(tag, MyDatabaseId, table_oid);
+    WaitForLockers(tag, ShareLock, false);
+}
+
+// Append the stage a scalable filter is compacted into and wait for
+// writers that may still add to the older stages. Returns the new stage
+// and its parameters in *stage_params.
+static dsa_pointer start_compaction(Relation rel, int16_t attnum, ScalableFilter* chain,
+                                    BloomFilterParams* stage_params) {
+    Oid table_oid = RelationGetRelid(rel);
+
+    require_read_committed("compacting a scalable bloom filter");
+
+    // Room for every key the chain holds, with some to spare before it grows
+    BloomFilterParams params = chain->getParams();
+    uint64_t rows = Max(chain->getCount(), (uint64_t)Max(rel->rd_rel->reltuples, 0));
+    uint64_t capacity = (uint64_t)(rows * ScalableFilter::kCompactionHeadroom);
+    *stage_params = ScalableFilter::firstStageParams(params, Max(params.expected_count, capacity));
+    dsa_pointer stage = append_bloom_filter_stage(table_oid, attnum, stage_params);
+
+    wait_for_writers(table_oid);
+
+    return stage;
+}
+
+// Negative means "as many as maintenance commands may use"
+static int build_workers(int nworkers) {
+    if (nworkers < 0) {
+        nworkers = max_parallel_maintenance_workers;
+    }
+    return Min(nworkers, max_worker_processes);
+}
+
+// Scan the table, or a B-tree on the column, for values of attnum and add
+// them to target, whose storage of params' shape takes bulk merges.
+// Returns the values added
+static uint64_t fill_filter(Relation rel, int16_t attnum, const BloomFilterParams& params,
+                            FilterBackend* target, const BloomKeyType* key_type, int nworkers) {
+    Oid table_oid = RelationGetRelid(rel);
+
+    // A composite key is evaluated from whole rows, and only the leader has
+    // its definition: the heap is scanned without workers
+    const CompositeKey* composite = NULL;
+    if (bloom_attnum_is_composite(attnum)) {
+        composite = get_composite_key(table_oid, attnum);
+        if (!composite) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                     errmsg("composite bloom filter %d on \"%s\" has no usable definition",
+                            attnum, RelationGetRelationName(rel)),
+                     errhint("Drop it with octo_bloom_disable and create it again.")));
+        }
+        nworkers = 0;
+    }
+
+    // Every participant fills a private filter of the full size, so only
+    // as many take part as maintenance_work_mem holds, down to the leader
+    Size participant_bytes = Max(filter_storage_size(params), (Size)1);
+    Size participants = (Size)maintenance_work_mem * 1024 / participant_bytes;
+    nworkers = (int)Min((Size)nworkers, participants > 0 ? participants - 1 : 0);
+
+    // Prefer reading the column from an index over scanning the heap
+    int index_column = 0;
+    double index_tuples = 0;
+    Oid index_oid = composite ? InvalidOid
+                              : find_build_index(rel, attnum, &index_column, &index_tuples);
+    int slot;
+    if (OidIsValid(index_oid)) {
+        slot = start_build_progress(table_oid, attnum, index_oid, index_tuples, 0);
+    } else {
+        slot = start_build_progress(table_oid, attnum, InvalidOid,
+                                    rel->rd_rel->reltuples, nworkers);
+    }
+    uint64_t added = 0;
+
+    PG_TRY();
+    {
+        // A build adds keys that committed long ago, which no snapshot
+        // taken before it finishes may be trusted to hold
+        note_bloom_filter_changed(table_oid, attnum);
+        if (OidIsValid(index_oid)) {
+            added = run_index_build(rel, index_oid, index_column, params, target,
+                                    key_type, slot);
+        } else {
+            added = run_build(rel, attnum, params, key_type, composite, nworkers, slot);
+        }
+    }
+    PG_CATCH();
+    {
+        finish_build_progress(slot);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    finish_build_progress(slot);
+    return added;
+}
+
+static FilterBackend* require_filter(Oid table_oid, int16_t attnum, BloomKeyType* key_type) {
+    FilterBackend* filter = get_bloom_filter(table_oid, attnum, key_type);
+    if (!filter) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                 errmsg("no bloom filter on column %d of \"%s\"", attnum,
+                        get_rel_name(table_oid)),
+                 errhint("Create one with octo_bloom_init() first.")));
+    }
+    return filter;
+}
+
+// Scan the table into fresh storage of the given shape and swap it in for
+// the filter, which keeps serving probes meanwhile. Returns the values added
+static uint64_t refill_bloom_filter(Relation rel, Oid table_oid, int16_t attnum,
+                                    const BloomFilterParams& params, BloomKeyType* key_type,
+                                    int nworkers, TimestampTz start) {
+    void* storage;
+    dsa_pointer bits = begin_bloom_filter_resize(table_oid, attnum, &params, &storage);
+    uint64_t added = 0;
+
+    PG_TRY();
+    {
+        wait_for_writers(table_oid);
+        // The resizing view: scans merge into the new storage, and trigger
+        // adds meanwhile go to both
+        FilterBackend* filter = get_bloom_filter(table_oid, attnum, NULL);
+        if (!filter) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                     errmsg("bloom filter was replaced or dropped during resize")));
+        }
+        added = fill_filter(rel, attnum, params, filter, key_type, nworkers);
+        log_bloom_filter_image(table_oid, attnum, bits, 0);
+    }
+    PG_CATCH();
+    {
+        cancel_bloom_filter_resize(table_oid, attnum, bits);
+        PG_RE_THROW();
+    }
+    PG_END_TRY();
+
+    table_close(rel, AccessShareLock);
+
+    if (!finish_bloom_filter_resize(table_oid, attnum, bits, added)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter was replaced or dropped during resize")));
+    }
+    note_bloom_filter_rebuilt(table_oid, attnum, start);
+    reclaim_retired_storage(false);
+
+    return added;
+}
+
+uint64_t rebuild_bloom_filter(Oid table_oid, int16_t attnum, int nworkers) {
+    TimestampTz start = GetCurrentTimestamp();
+    BloomKeyType key_type;
+    FilterBackend* filter = require_filter(table_oid, attnum, &key_type);
+    nworkers = build_workers(nworkers);
+
+    Relation rel = table_open(table_oid, AccessShareLock);
+
+    BloomFilterParams params = filter->getParams();
+    // Scanned keys are merged in, which for bits is a no-op on keys the
+    // filter holds; cuckoo fingerprints and counters would take them twice
+    if (params.kind == FilterKind::Cuckoo ||
+        (params.kind == FilterKind::Bloom && params.layout == BloomLayout::Counting)) {
+        require_read_committed("rebuilding a cuckoo or counting bloom filter");
+        return refill_bloom_filter(rel, table_oid, attnum, params, &key_type, nworkers, start);
+    }
+    dsa_pointer stage = InvalidDsaPointer;
+    if (params.kind == FilterKind::Scalable) {
+        stage = start_compaction(rel, attnum, static_cast<ScalableFilter*>(filter), &params);
+        // The chain changed, and with it this backend's view
+        filter = get_bloom_filter(table_oid, attnum, NULL);
+        if (!filter) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                     errmsg("bloom filter was replaced or dropped during rebuild")));
+        }
+    }
+
+    uint64_t added = fill_filter(rel, attnum, params, filter, &key_type, nworkers);
+    table_close(rel, AccessShareLock);
+
+    // Standbys get the scanned keys as an image, before the stages it
+    // replaces are dropped
+    log_bloom_filter_image(table_oid, attnum, stage, 0);
+
+    // The new stage holds every key now. Its trigger adds were counted as
+    // they happened; count the scanned ones too, so it grows on time
+    if (DsaPointerIsValid(stage) && drop_bloom_filter_stages_before(table_oid, attnum, stage)) {
+        filter = get_bloom_filter(table_oid, attnum, NULL);
+        if (filter && filter->getParams().kind == FilterKind::Scalable) {
+            static_cast<ScalableFilter*>(filter)->addStageCount(0, added);
+            log_bloom_filter_image(table_oid, attnum, stage, ScalableFilter::kStageHeaderBytes);
+        }
+        reclaim_retired_storage(false);
+    }
+
+    set_bloom_filter_count(table_oid, attnum, added);
+    note_bloom_filter_rebuilt(table_oid, attnum, start);
+
+    return added;
+}
+
+uint64_t resize_bloom_filter(Oid table_oid, int16_t attnum, uint64_t expected_count,
+                             int nworkers) {
+    BloomKeyType key_type;
+    FilterBackend* filter = require_filter(table_oid, attnum, &key_type);
+    BloomFilterParams params = filter->getParams();
+
+    // Compaction already sizes the chain's new stage for the table
+    if (params.kind == FilterKind::Scalable) {
+        return rebuild_bloom_filter(table_oid, attnum, nworkers);
+    }
+    require_read_committed("resizing a bloom filter");
+    nworkers = build_workers(nworkers);
+    TimestampTz start = GetCurrentTimestamp();
+
+    Relation rel = table_open(table_oid, AccessShareLock);
+
+    // Never smaller than asked for at creation: reltuples may be stale
+    if (expected_count == 0) {
+        uint64_t rows = Max(get_bloom_filter_count(table_oid, attnum),
+                            (uint64_t)Max(rel->rd_rel->reltuples, 0));
+        expected_count = Max(params.expected_count, (uint64_t)(rows * RESIZE_HEADROOM));
+    }
+    BloomFilterParams resized;
+    if (params.kind == FilterKind::Cuckoo) {
+        resized = CuckooFilter::computeParams(expected_count, params.false_positive_rate);
+    } else {
+        resized = OctoBloomFilter::computeParams(expected_count, params.false_positive_rate,
+                                                 params.layout, params.hash, params.reduction);
+    }
+
+    return refill_bloom_filter(rel, table_oid, attnum, resized, &key_type, nworkers, start);
+}
+
+Datum octo_bloom_rebuild(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_PP(1);
+    int nworkers = PG_GETARG_INT32(2);
+
+    char* col_name = text_to_cstring(column_name);
+    int16_t attnum = get_attnum(table_oid, col_name);
+
+    if (attnum == InvalidAttrNumber) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_COLUMN),
+                 errmsg("column \"%s\" does not exist", col_name)));
+    }
+
+    // A partitioned table's keys are in its leaves' filters
+    if (get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE &&
+        !get_bloom_filter(table_oid, attnum, NULL)) {
+        Oid* leaves;
+        int16_t* attnums;
+        int count = get_partition_leaves(table_oid, col_name, &leaves, &attnums);
+        uint64_t added = 0;
+        for (int i = 0; i < count; ++i) {
+            if (get_bloom_filter(leaves[i], attnums[i], NULL)) {
+                added += rebuild_bloom_filter(leaves[i], attnums[i], nworkers);
+            }
+        }
+        PG_RETURN_INT64(added);
+    }
+
+    if (!get_bloom_filter(table_oid, attnum, NULL)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                 errmsg("no bloom filter on column \"%s\"", col_name),
+                 errhint("Create one with octo_bloom_init() first.")));
+    }
+
+    PG_RETURN_INT64(rebuild_bloom_filter(table_oid, attnum, nworkers));
+}
+
+// octo_bloom_rebuild of a composite filter, named by its keys
+Datum octo_bloom_rebuild_composite(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    ArrayType* keys = PG_GETARG_ARRAYTYPE_P(1);
+    int nworkers = PG_GETARG_INT32(2);
+
+    Relation rel = table_open(table_oid, AccessShareLock);
+    int16_t attnum = find_composite_key(rel, keys);
+    table_close(rel, AccessShareLock);
+
+    if (attnum == InvalidAttrNumber || !get_bloom_filter(table_oid, attnum, NULL)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                 errmsg("no composite bloom filter on those keys of \"%s\"",
+                        get_rel_name(table_oid)),
+                 errhint("Create one with octo_bloom_init() first.")));
+    }
+
+    PG_RETURN_INT64(rebuild_bloom_filter(table_oid, attnum, nworkers));
+}
+
+Datum octo_bloom_resize(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_PP(1);
+    int64 expected_count = PG_GETARG_INT64(2);
+    int nworkers = PG_GETARG_INT32(3);
+
+    if (expected_count < 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("expected_count must not be negative")));
+    }
+
+    char* col_name = text_to_cstring(column_name);
+    int16_t attnum = get_attnum(table_oid, col_name);
+
+    if (attnum == InvalidAttrNumber) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_COLUMN),
+                 errmsg("column \"%s\" does not exist", col_name)));
+    }
+
+    // Each leaf is resized on its own; expected_count is per partition
+    if (get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE &&
+        !get_bloom_filter(table_oid, attnum, NULL)) {
+        Oid* leaves;
+        int16_t* attnums;
+        int count = get_partition_leaves(table_oid, col_name, &leaves, &attnums);
+        uint64_t added = 0;
+        for (int i = 0; i < count; ++i) {
+            if (get_bloom_filter(leaves[i], attnums[i], NULL)) {
+                added += resize_bloom_filter(leaves[i], attnums[i], (uint64_t)expected_count,
+                                             nworkers);
+            }
+        }
+        PG_RETURN_INT64(added);
+    }
+
+    PG_RETURN_INT64(resize_bloom_filter(table_oid, attnum, (uint64_t)expected_count, nworkers));
+}
+
+static const char* build_phase_name(BloomBuildPhase phase) {
+    switch (phase) {
+        case BLOOM_BUILD_INITIALIZING:
+            return "initializing";
+        case BLOOM_BUILD_SCANNING:
+            return "scanning table";
+        case BLOOM_BUILD_SCANNING_INDEX:
+            return "scanning index";
+        case BLOOM_BUILD_WAITING_FOR_WORKERS:
+            return "waiting for workers";
+    }
+    return "unknown";
+}
+
+// Copy of a progress slot taken under the registry lock
+typedef struct BuildProgressRow {
+    int pid;
+    Oid dboid;
+    Oid table_oid;
+    int16_t attnum;
+    Oid index_oid;
+    BloomBuildPhase phase;
+    int workers_planned;
+    int workers_launched;
+    double tuples_total;
+    uint64_t tuples_done;
+    uint32_t participants_done;
+} BuildProgressRow;
+
+// Running rebuilds across all databases, one row per build
+Datum octo_bloom_build_progress(PG_FUNCTION_ARGS) {
+    FuncCallContext* funcctx;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context "
+                            "that cannot accept type record")));
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        // Copy the active slots so the rows are consistent with each other
+        ensure_shared_memory();
+        BuildProgressRow* rows = (BuildProgressRow*)palloc(sizeof(BuildProgressRow) *
+                                                           OCTO_BLOOM_MAX_BUILDS);
+        int count = 0;
+        LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+        for (int i = 0; i < OCTO_BLOOM_MAX_BUILDS; ++i) {
+            BloomBuildProgress* progress = progress_for(i);
+            if (progress->pid == 0) {
+                continue;
+            }
+            BuildProgressRow* row = &rows[count++];
+            row->pid = progress->pid;
+            row->dboid = progress->dboid;
+            row->table_oid = progress->table_oid;
+            row->attnum = progress->attnum;
+            row->index_oid = progress->index_oid;
+            row->phase = progress->phase;
+            row->workers_planned = progress->workers_planned;
+            row->workers_launched = progress->workers_launched;
+            row->tuples_total = progress->tuples_total;
+            row->tuples_done = pg_atomic_read_u64(&progress->tuples_done);
+            row->participants_done = pg_atomic_read_u32(&progress->participants_done);
+        }
+        LWLockRelease(bloom_shared_state->registry_lock);
+
+        funcctx->max_calls = count;
+        funcctx->user_fctx = rows;
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    BuildProgressRow* rows = (BuildProgressRow*)funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        BuildProgressRow* build = &rows[funcctx->call_cntr];
+        Datum values[11];
+        bool isnull[11];
+        memset(isnull, 0, sizeof(isnull));
+
+        values[0] = Int32GetDatum(build->pid);
+        values[1] = ObjectIdGetDatum(build->dboid);
+        values[2] = ObjectIdGetDatum(build->table_oid);
+        values[3] = Int16GetDatum(build->attnum);
+        values[4] = ObjectIdGetDatum(build->index_oid);
+        isnull[4] = !OidIsValid(build->index_oid);
+        values[5] = CStringGetTextDatum(build_phase_name(build->phase));
+        values[6] = Int32GetDatum(build->workers_planned);
+        values[7] = Int32GetDatum(build->workers_launched);
+        values[8] = Int64GetDatum((int64)Max(build->tuples_total, 0));
+        values[9] = Int64GetDatum((int64)build->tuples_done);
+        values[10] = Int32GetDatum((int32)build->participants_done);
+
+        HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+} // extern "C"
@@ -0,0 +1,18 @@
+#ifndef OCTO_BLOOM_FILTER_BUILD_HPP
+#define OCTO_BLOOM_FILTER_BUILD_HPP
+
+#include "shared_memory.hpp"
+
+extern "C" {
+// Populate a column's filter from the rows in its table, using up to
+// nworkers parallel workers (negative: max_parallel_maintenance_workers).
+// A scalable filter is compacted into one stage. Returns the values added.
+uint64_t rebuild_bloom_filter(Oid table_oid, int16_t attnum, int nworkers);
+// Replace a Bloom or cuckoo filter with one sized for expected_count keys
+// (0: twice the keys it holds, at least its current size), filled online
+// from the table. Scalable filters are compacted instead.
+uint64_t resize_bloom_filter(Oid table_oid, int16_t attnum, uint64_t expected_count,
+                             int nworkers);
+}
+
+#endif // OCTO_BLOOM_FILTER_BUILD_HPP
@@ -0,0 +1,440 @@
+#include "filter_snapshot.hpp"
+#include "scalable_filter.hpp"
+#include <cstring>
+
+extern "C" {
+#include <fcntl.h>
+#include <unistd.h>
+#include <miscadmin.h>
+#include <port/pg_crc32c.h>
+#include <storage/fd.h>
+}
+
+// Snapshots let a restart skip rebuilding every filter from its table.
+// Each file is a header and then the filter's storage, stage by stage, each
+// starting on a page boundary. A CRC covers both. Loading reads the stages
+// straight into freshly allocated filter memory, with no copy in between.
+//
+// A snapshot may only be loaded if it holds every key committed to its
+// filter. Unless octo_bloom.wal_resource_manager has them replayed after
+// it (filter_wal.cpp), filter changes aren't replayed on the primary, so
+// there is no delta to replay after it. Instead, the first change to a filter after its snapshot
+// removes the file before the change can commit (mark_filter_changed in
+// shared_memory.cpp), and a snapshot copied while the filter changed is
+// discarded. So a loaded filter is exactly as it was when it stopped
+// changing. The launcher writes snapshots after checkpoints and again when
+// it shuts down, so after a clean shutdown every filter comes back.
+
+#define SNAPSHOT_MAGIC UINT64CONST(0x50414e534f54434f)  // "OCTOSNAP"
+#define SNAPSHOT_VERSION 2  // 1 had no applied_lsn
+#define SNAPSHOT_ALIGN 4096
+// Copied out of shared memory a chunk at a time, each under the registry lock
+#define SNAPSHOT_CHUNK (1024 * 1024)
+
+typedef struct FilterSnapshotHeader {
+    uint64_t magic;
+    uint32_t version;
+    uint32_t header_size;  // sizeof(FilterSnapshotHeader), as a check on its layout
+    pg_crc32c crc;  // Of the header with crc zeroed, then of the stages
+    BloomRegistryKey key;
+    BloomFilterParams params;
+    BloomKeyType key_type;
+    int32_t num_stages;
+    BloomFilterParams stage_params[OCTO_BLOOM_STAGE_SLOTS];
+    uint64_t stage_bytes[OCTO_BLOOM_STAGE_SLOTS];
+    uint64_t count;
+    XLogRecPtr redo;  // Of the checkpoint the snapshot was written after
+    // The filter's applied_lsn when it was copied: replay after a crash
+    // skips the logged changes the snapshot already holds
+    XLogRecPtr applied_lsn;
+} FilterSnapshotHeader;
+
+#define SNAPSHOT_V1_HEADER_SIZE offsetof(FilterSnapshotHeader, applied_lsn)
+
+typedef struct SnapshotTask {
+    BloomRegistryKey key;
+    uint64_t generation;
+} SnapshotTask;
+
+extern "C" {
+
+bool octo_bloom_snapshots = true;
+
+static void snapshot_path(char* path, const BloomRegistryKey* key) {
+    snprintf(path, MAXPGPATH, "%s/%u_%u_%d.snap", OCTO_BLOOM_SNAPSHOT_DIR,
+             key->dboid, key->table_oid, key->attnum);
+}
+
+static off_t first_stage_offset() {
+    return TYPEALIGN(SNAPSHOT_ALIGN, sizeof(FilterSnapshotHeader));
+}
+
+void remove_filter_snapshot(const BloomRegistryKey* key) {
+    char path[MAXPGPATH];
+    snapshot_path(path, key);
+    if (unlink(path) < 0) {
+        if (errno == ENOENT) {
+            return;
+        }
+        ereport(ERROR,
+                (errcode_for_file_access(),
+                 errmsg("could not remove file \"%s\": %m", path)));
+    }
+    fsync_fname(OCTO_BLOOM_SNAPSHOT_DIR, true);
+}
+
+static bool write_all(int fd, const void* data, size_t length, off_t offset,
+                      const char* path) {
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+        ssize_t written = pg_pwrite(fd, p, length, offset);
+        if (written <= 0) {
+            if (written == 0) {
+                errno = ENOSPC;
+            }
+            ereport(LOG,
+                    (errcode_for_file_access(),
+                     errmsg("could not write file \"%s\": %m", path)));
+            return false;
+        }
+        p += written;
+        offset += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void* data, size_t length, off_t offset, const char* path) {
+    char* p = static_cast<char*>(data);
+    while (length > 0) {
+        ssize_t nread = pg_pread(fd, p, length, offset);
+        if (nread <= 0) {
+            if (nread < 0) {
+                ereport(LOG,
+                        (errcode_for_file_access(),
+                         errmsg("could not read file \"%s\": %m", path)));
+            }
+            return false;
+        }
+        p += nread;
+        offset += nread;
+        length -= nread;
+    }
+    return true;
+}
+
+// The entry for key if it still has the storage it had at generation.
+// Registry lock held
+static BloomRegistryEntry* find_entry(const BloomRegistryKey* key, uint64_t generation) {
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, key, HASH_FIND, NULL);
+    if (!entry || !entry->is_valid || entry->generation != generation) {
+        return NULL;
+    }
+    return entry;
+}
+
+// A rebuild is filling the filter with keys it may not hold yet. Registry
+// lock held
+static bool build_running(const BloomRegistryKey* key) {
+    for (int i = 0; i < OCTO_BLOOM_MAX_BUILDS; ++i) {
+        const BloomBuildProgress* build = &bloom_shared_state->builds[i];
+        if (build->pid != 0 && build->dboid == key->dboid &&
+            build->table_oid == key->table_oid && build->attnum == key->attnum) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Write one filter's snapshot to a temporary file and rename it into place
+// if the filter didn't change meanwhile. buffer holds SNAPSHOT_CHUNK bytes
+static bool write_snapshot(const SnapshotTask* task, XLogRecPtr redo, char* buffer) {
+    FilterSnapshotHeader header;
+    memset(&header, 0, sizeof(header));
+    uint64_t changes;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    BloomRegistryEntry* entry = find_entry(&task->key, task->generation);
+    if (!entry || DsaPointerIsValid(entry->resize_bits) || build_running(&task->key)) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return false;
+    }
+    changes = pg_atomic_read_u64(&entry->changes);
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.header_size = sizeof(FilterSnapshotHeader);
+    header.key = entry->key;
+    header.params = entry->params;
+    header.key_type = entry->key_type;
+    header.num_stages = entry->num_stages;
+    for (int i = 0; i < entry->num_stages; ++i) {
+        header.stage_params[i] = entry->stage_params[i];
+        header.stage_bytes[i] = bloom_stage_bytes(entry, i);
+    }
+    header.count = pg_atomic_read_u64(&entry->current_count);
+    header.redo = redo;
+    header.applied_lsn = pg_atomic_read_u64(&entry->applied_lsn);
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    char path[MAXPGPATH];
+    char tmppath[MAXPGPATH];
+    snapshot_path(path, &task->key);
+    snprintf(tmppath, sizeof(tmppath), "%s.tmp", path);
+
+    int fd = OpenTransientFile(tmppath, O_CREAT | O_TRUNC | O_WRONLY | PG_BINARY);
+    if (fd < 0) {
+        ereport(LOG,
+                (errcode_for_file_access(),
+                 errmsg("could not create file \"%s\": %m", tmppath)));
+        return false;
+    }
+
+    dsa_area* area = attach_bloom_area(false);
+    pg_crc32c crc;
+    INIT_CRC32C(crc);
+    COMP_CRC32C(crc, &header, sizeof(header));
+
+    // Copy each chunk out under the lock, so the storage can't be retired
+    // and freed under us, and CRC the copy that is written
+    bool ok = area != NULL;
+    off_t offset = first_stage_offset();
+    for (int s = 0; ok && s < header.num_stages; ++s) {
+        for (uint64_t done = 0; ok && done < header.stage_bytes[s]; done += SNAPSHOT_CHUNK) {
+            size_t n = Min((uint64_t)SNAPSHOT_CHUNK, header.stage_bytes[s] - done);
+            LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+            entry = find_entry(&task->key, task->generation);
+            if (entry) {
+                const char* stage = (const char*)dsa_get_address(area, entry->stage_bits[s]);
+                memcpy(buffer, stage + done, n);
+            }
+            LWLockRelease(bloom_shared_state->registry_lock);
+
+            ok = entry && write_all(fd, buffer, n, offset + done, tmppath);
+            COMP_CRC32C(crc, buffer, n);
+        }
+        offset += TYPEALIGN(SNAPSHOT_ALIGN, header.stage_bytes[s]);
+    }
+    FIN_CRC32C(crc);
+    header.crc = crc;
+    ok = ok && write_all(fd, &header, sizeof(header), 0, tmppath);
+
+    if (CloseTransientFile(fd) != 0) {
+        ereport(LOG,
+                (errcode_for_file_access(),
+                 errmsg("could not close file \"%s\": %m", tmppath)));
+        ok = false;
+    }
+
+    // Publish only if no change raced with the copy. Changes are counted
+    // under the entry lock in shared mode, so none can slip in between
+    // this check and the file going live
+    bool live = false;
+    if (ok) {
+        LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+        entry = find_entry(&task->key, task->generation);
+        if (entry) {
+            LWLockAcquire(entry->lock, LW_EXCLUSIVE);
+            if (pg_atomic_read_u64(&entry->changes) == changes && !build_running(&task->key)) {
+                if (durable_rename(tmppath, path, LOG) == 0) {
+                    entry->snapshot_live = true;
+                    entry->snapshot_generation = task->generation;
+                    live = true;
+                } else {
+                    // It may have been renamed without being made durable
+                    (void)unlink(path);
+                }
+            }
+            LWLockRelease(entry->lock);
+        }
+        LWLockRelease(bloom_shared_state->registry_lock);
+    }
+
+    if (!live) {
+        (void)unlink(tmppath);
+    }
+    return live;
+}
+
+int write_filter_snapshots(XLogRecPtr redo) {
+    ensure_shared_memory();
+
+    if (MakePGDirectory(OCTO_BLOOM_SNAPSHOT_DIR) < 0 && errno != EEXIST) {
+        ereport(LOG,
+                (errcode_for_file_access(),
+                 errmsg("could not create directory \"%s\": %m", OCTO_BLOOM_SNAPSHOT_DIR)));
+        return 0;
+    }
+
+    SnapshotTask* tasks = (SnapshotTask*)palloc(sizeof(SnapshotTask) *
+                                                bloom_shared_state->max_filters);
+    int count = 0;
+
+    // snapshot_live is only a hint here; write_snapshot checks under the lock
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    HASH_SEQ_STATUS status;
+    BloomRegistryEntry* entry;
+    hash_seq_init(&status, bloom_registry);
+    while ((entry = (BloomRegistryEntry*)hash_seq_search(&status)) != NULL) {
+        if (!entry->is_valid || count >= bloom_shared_state->max_filters ||
+            (entry->snapshot_live && entry->snapshot_generation == entry->generation)) {
+            continue;
+        }
+        tasks[count].key = entry->key;
+        tasks[count].generation = entry->generation;
+        count++;
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    int written = 0;
+    if (count > 0) {
+        char* buffer = (char*)palloc(SNAPSHOT_CHUNK);
+        for (int i = 0; i < count; ++i) {
+            if (write_snapshot(&tasks[i], redo, buffer)) {
+                written++;
+            }
+        }
+        pfree(buffer);
+    }
+
+    pfree(tasks);
+    return written;
+}
+
+// Bytes a stage of this filter takes, from its parameters
+static Size expected_stage_bytes(const FilterSnapshotHeader* header, int stage) {
+    if (header->params.kind == FilterKind::Scalable) {
+        return ScalableFilter::stageStorageSize(header->stage_params[stage]);
+    }
+    return filter_storage_size(header->params);
+}
+
+// Read one snapshot into newly allocated filter storage and install it.
+// The caller removes the file if this fails
+static bool load_snapshot(const char* path) {
+    int fd = OpenTransientFile(path, O_RDONLY | PG_BINARY);
+    if (fd < 0) {
+        ereport(LOG,
+                (errcode_for_file_access(),
+                 errmsg("could not open file \"%s\": %m", path)));
+        return false;
+    }
+
+    // A version 1 header is followed by zeroes up to the first stage, which
+    // read as an applied_lsn of 0
+    FilterSnapshotHeader header;
+    bool ok = read_all(fd, &header, sizeof(header), 0, path) &&
+              header.magic == SNAPSHOT_MAGIC &&
+              ((header.version == SNAPSHOT_VERSION &&
+                header.header_size == sizeof(FilterSnapshotHeader)) ||
+               (header.version == 1 && header.header_size == SNAPSHOT_V1_HEADER_SIZE &&
+                header.applied_lsn == InvalidXLogRecPtr)) &&
+              header.num_stages >= 1 && header.num_stages <= OCTO_BLOOM_STAGE_SLOTS &&
+              (header.num_stages == 1 || header.params.kind == FilterKind::Scalable);
+    for (int i = 0; ok && i < header.num_stages; ++i) {
+        ok = header.stage_bytes[i] == expected_stage_bytes(&header, i);
+    }
+    if (!ok) {
+        CloseTransientFile(fd);
+        ereport(LOG,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                 errmsg("invalid bloom filter snapshot \"%s\"", path)));
+        return false;
+    }
+
+    pg_crc32c expected_crc = header.crc;
+    header.crc = 0;
+    pg_crc32c crc;
+    INIT_CRC32C(crc);
+    COMP_CRC32C(crc, &header, header.header_size);
+
+    dsa_pointer bits[OCTO_BLOOM_STAGE_SLOTS];
+    int allocated = 0;
+    off_t offset = first_stage_offset();
+    for (int s = 0; ok && s < header.num_stages; ++s) {
+        bits[s] = allocate_bloom_storage(header.stage_bytes[s]);
+        if (!DsaPointerIsValid(bits[s])) {
+            ereport(LOG,
+                    (errcode(ERRCODE_OUT_OF_MEMORY),
+                     errmsg("not enough bloom filter memory to load snapshot \"%s\"", path),
+                     errhint("Increase octo_bloom.shared_memory_mb.")));
+            ok = false;
+            break;
+        }
+        allocated++;
+        // Unpublished, so nothing else reads it: fill it in place
+        char* stage = (char*)dsa_get_address(attach_bloom_area(false), bits[s]);
+        ok = read_all(fd, stage, header.stage_bytes[s], offset, path);
+        if (ok) {
+            COMP_CRC32C(crc, stage, header.stage_bytes[s]);
+        }
+        offset += TYPEALIGN(SNAPSHOT_ALIGN, header.stage_bytes[s]);
+    }
+    FIN_CRC32C(crc);
+    CloseTransientFile(fd);
+
+    if (ok && !EQ_CRC32C(crc, expected_crc)) {
+        ereport(LOG,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                 errmsg("bloom filter snapshot \"%s\" has an incorrect checksum", path)));
+        ok = false;
+    }
+
+    // A filter created since startup is newer than its snapshot
+    ok = ok && install_bloom_filter(&header.key, &header.params, &header.key_type,
+                                    header.num_stages, header.stage_params, bits, header.count,
+                                    header.applied_lsn);
+    if (!ok) {
+        for (int s = 0; s < allocated; ++s) {
+            free_bloom_storage(bits[s], header.stage_bytes[s]);
+        }
+    }
+    return ok;
+}
+
+static bool has_suffix(const char* name, const char* suffix) {
+    size_t length = strlen(name);
+    size_t suffix_length = strlen(suffix);
+    return length > suffix_length && strcmp(name + length - suffix_length, suffix) == 0;
+}
+
+int load_filter_snapshots(bool install) {
+    ensure_shared_memory();
+
+    DIR* dir = AllocateDir(OCTO_BLOOM_SNAPSHOT_DIR);
+    if (!dir && errno == ENOENT) {
+        return 0;
+    }
+
+    int loaded = 0;
+    bool removed = false;
+    struct dirent* de;
+    while ((de = ReadDirExtended(dir, OCTO_BLOOM_SNAPSHOT_DIR, LOG)) != NULL) {
+        char path[MAXPGPATH];
+        snprintf(path, sizeof(path), "%s/%s", OCTO_BLOOM_SNAPSHOT_DIR, de->d_name);
+
+        if (has_suffix(de->d_name, ".snap") && install && load_snapshot(path)) {
+            loaded++;
+            continue;
+        }
+        // Unusable, unwanted, or a write cut short
+        if (has_suffix(de->d_name, ".snap") || has_suffix(de->d_name, ".snap.tmp")) {
+            if (unlink(path) < 0) {
+                ereport(LOG,
+                        (errcode_for_file_access(),
+                         errmsg("could not remove file \"%s\": %m", path)));
+            }
+            removed = true;
+        }
+    }
+    if (dir) {
+        FreeDir(dir);
+    }
+    if (removed) {
+        fsync_fname(OCTO_BLOOM_SNAPSHOT_DIR, true);
+    }
+
+    return loaded;
+}
+
+} // extern "C"
@@ -0,0 +1,32 @@
+#ifndef OCTO_BLOOM_FILTER_SNAPSHOT_HPP
+#define OCTO_BLOOM_FILTER_SNAPSHOT_HPP
+
+#include "shared_memory.hpp"
+
+extern "C" {
+#include <access/xlogdefs.h>
+}
+
+// Snapshot files, one per filter, relative to the data directory
+#define OCTO_BLOOM_SNAPSHOT_DIR "octo_bloom"
+
+// GUC, defined in _PG_init
+extern "C" {
+extern bool octo_bloom_snapshots;
+}
+
+extern "C" {
+// Write a snapshot of every filter whose file is missing or out of date,
+// after the checkpoint at redo. Needs no database connection. Returns how
+// many were written
+int write_filter_snapshots(XLogRecPtr redo);
+// Install the snapshot files into the registry, or with install unset only
+// remove them. Files that can't be installed are removed too: one left
+// behind could later be mistaken for a filter created since. Returns how
+// many were loaded
+int load_filter_snapshots(bool install);
+// Remove a filter's snapshot file durably, raising an error on failure
+void remove_filter_snapshot(const BloomRegistryKey* key);
+}
+
+#endif // OCTO_BLOOM_FILTER_SNAPSHOT_HPP
@@ -0,0 +1,473 @@
+#include "filter_wal.hpp"
+#include "filter_snapshot.hpp"
+#include <cstring>
+
+extern "C" {
+#include <access/xlog.h>
+#include <access/xlog_internal.h>
+#include <access/xloginsert.h>
+#include <access/xlogreader.h>
+#include <miscadmin.h>
+#include <postmaster/bgworker.h>
+#include <storage/ipc.h>
+#include <access/xlogutils.h>
+#include <replication/message.h>
+#include <tcop/tcopprot.h>
+#if PG_VERSION_NUM >= 150000
+#include <access/xlogrecovery.h>
+#endif
+}
+
+// Standbys get no trigger calls and share no memory with the primary, so a
+// filter there would never see a key the primary added. With
+// octo_bloom.wal_log on, the primary logs every change it makes to a
+// filter's storage, and a standby replays the changes into a filter of its
+// own, which answers probes as the primary's does.
+//
+// Adds and removes are logged as the hashes they apply, in batches, before
+// the transaction that made them commits, so a row visible on a standby is
+// never missing from its filter there. Structural changes (a new filter, a
+// stage appended or dropped, a resize begun or finished) are logged as
+// they happen. Bits a rebuild fills in bulk are logged as an image of the
+// filled storage once it is full, before it replaces the old one. Images of
+// the bit layouts are ORed in, so they may be cut into chunks that adds log
+// around; counting and cuckoo images overwrite and are logged whole, with
+// the filter's writers held off (a standby puts a cuckoo image together
+// beside the live table and swaps it in). A change that can't be applied,
+// e.g. for want of memory on the standby, drops the filter there rather
+// than failing replay, and probes fall back to true.
+//
+// The changes are logical messages, which the startup process skips; a
+// worker on the standby reads them back from the log as it is replayed. It
+// trails the startup process, so a row can be visible a moment before its
+// key reaches the standby's filter. On PostgreSQL 15+,
+// octo_bloom.wal_resource_manager makes them records of a custom resource
+// manager instead, replayed by the startup process. That also covers crash
+// recovery: the snapshots are loaded before the first record, and replay
+// picks up after them. Its ID is RM_EXPERIMENTAL_ID, which PostgreSQL sets
+// aside for development: another extension using it stops the server from
+// starting, and the records will need another ID once one is reserved, so
+// it stays off by default.
+
+#if PG_VERSION_NUM >= 150000
+// RM_EXPERIMENTAL_ID until an ID is reserved on the PostgreSQL wiki's
+// CustomWALResourceManagers page. Must be the same across a cluster
+#define OCTO_BLOOM_RMGR_ID RM_EXPERIMENTAL_ID
+#define OCTO_BLOOM_RMGR_NAME "octo_bloom"
+#endif
+
+// Seconds before the replay worker starts over after an error
+#define WAL_REPLAY_RESTART_SECS 10
+
+extern "C" {
+
+bool octo_bloom_wal_log = false;
+bool octo_bloom_wal_resource_manager = false;
+
+// Set in _PG_init while preloading: records of ours can be replayed
+static bool wal_registered = false;
+// Changes are records of our resource manager rather than logical messages
+static bool wal_rmgr = false;
+
+static const char* const type_names[] = {
+    NULL, "CREATE", "DROP", "ADD", "REMOVE", "APPEND_STAGE", "DROP_STAGES",
+    "RESIZE_BEGIN", "RESIZE_FINISH", "RESIZE_CANCEL", "IMAGE", "COUNT", "READY",
+};
+
+static const char* type_name(uint32_t type) {
+    return type >= 1 && type <= BLOOM_WAL_MAX_TYPE ? type_names[type] : NULL;
+}
+
+bool filter_wal_enabled() {
+    if (!octo_bloom_wal_log || !wal_registered || !XLogInsertAllowed()) {
+        return false;
+    }
+    if (wal_rmgr) {
+        return true;
+    }
+    // Without a standby to read them the messages are of no use
+    return XLogStandbyInfoActive();
+}
+
+XLogRecPtr log_filter_change(BloomWalType type, const BloomRegistryKey* key,
+                             const void* body, size_t body_size,
+                             const void* data, size_t data_size,
+                             const void* more, size_t more_size) {
+    BloomWalHeader header;
+    memset(&header, 0, sizeof(header));
+    header.type = type;
+    header.key = *key;
+
+#if PG_VERSION_NUM >= 150000
+    if (wal_rmgr) {
+        XLogBeginInsert();
+        XLogRegisterData((char*)&header, sizeof(header));
+        if (body_size > 0) {
+            XLogRegisterData((char*)body, body_size);
+        }
+        if (data_size > 0) {
+            XLogRegisterData((char*)data, data_size);
+        }
+        if (more_size > 0) {
+            XLogRegisterData((char*)more, more_size);
+        }
+        return XLogInsert(OCTO_BLOOM_RMGR_ID, (uint8)(type << 4));
+    }
+#endif
+    size_t size = sizeof(header) + body_size + data_size + more_size;
+    char* payload = (char*)palloc(size);
+    char* p = payload;
+    memcpy(p, &header, sizeof(header));
+    p += sizeof(header);
+    if (body_size > 0) {
+        memcpy(p, body, body_size);
+        p += body_size;
+    }
+    if (data_size > 0) {
+        memcpy(p, data, data_size);
+        p += data_size;
+    }
+    if (more_size > 0) {
+        memcpy(p, more, more_size);
+    }
+#if PG_VERSION_NUM >= 170000
+    XLogRecPtr lsn = LogLogicalMessage(OCTO_BLOOM_WAL_PREFIX, payload, size, false, false);
+#else
+    XLogRecPtr lsn = LogLogicalMessage(OCTO_BLOOM_WAL_PREFIX, payload, size, false);
+#endif
+    pfree(payload);
+    return lsn;
+}
+
+// Copy a fixed-size body out of a record, which needn't be aligned
+static bool read_body(void* body, size_t body_size, const char* data, size_t size) {
+    if (size < body_size) {
+        return false;
+    }
+    memcpy(body, data, body_size);
+    return true;
+}
+
+// Decode one record and apply it. False if it is malformed
+static bool replay_record(const BloomWalHeader* header, const char* data, size_t size,
+                          XLogRecPtr end_lsn) {
+    const BloomRegistryKey* key = &header->key;
+
+    switch (header->type) {
+    case BLOOM_WAL_CREATE: {
+        BloomWalCreate create;
+        if (!read_body(&create, sizeof(create), data, size) || create.num_stages < 1 ||
+            create.num_stages > OCTO_BLOOM_STAGE_SLOTS) {
+            return false;
+        }
+        redo_bloom_filter_create(key, end_lsn, &create);
+        return true;
+    }
+    case BLOOM_WAL_DROP:
+        redo_bloom_filter_drop(key, end_lsn);
+        return true;
+    case BLOOM_WAL_ADD:
+    case BLOOM_WAL_REMOVE: {
+        BloomWalHashes hashes;
+        if (!read_body(&hashes, sizeof(hashes), data, size) ||
+            hashes.count > OCTO_BLOOM_WAL_MAX_HASHES ||
+            size != sizeof(hashes) + 2 * hashes.count * sizeof(uint64_t)) {
+            return false;
+        }
+        uint64_t h1[OCTO_BLOOM_WAL_MAX_HASHES];
+        uint64_t h2[OCTO_BLOOM_WAL_MAX_HASHES];
+        size_t bytes = hashes.count * sizeof(uint64_t);
+        memcpy(h1, data + sizeof(hashes), bytes);
+        memcpy(h2, data + sizeof(hashes) + bytes, bytes);
+        redo_bloom_filter_hashes(key, end_lsn, h1, h2, hashes.count,
+                                 header->type == BLOOM_WAL_REMOVE);
+        return true;
+    }
+    case BLOOM_WAL_APPEND_STAGE:
+    case BLOOM_WAL_DROP_STAGES:
+    case BLOOM_WAL_RESIZE_BEGIN: {
+        BloomWalStage stage;
+        if (!read_body(&stage, sizeof(stage), data, size)) {
+            return false;
+        }
+        redo_bloom_filter_stage(key, end_lsn, (BloomWalType)header->type, &stage);
+        return true;
+    }
+    case BLOOM_WAL_RESIZE_FINISH:
+    case BLOOM_WAL_RESIZE_CANCEL: {
+        BloomWalCount count;
+        memset(&count, 0, sizeof(count));
+        if (header->type == BLOOM_WAL_RESIZE_FINISH &&
+            !read_body(&count, sizeof(count), data, size)) {
+            return false;
+        }
+        redo_bloom_filter_resize_end(key, end_lsn, header->type == BLOOM_WAL_RESIZE_FINISH,
+                                     count.count);
+        return true;
+    }
+    case BLOOM_WAL_IMAGE: {
+        BloomWalImage image;
+        if (!read_body(&image, sizeof(image), data, size) ||
+            size != sizeof(image) + image.length) {
+            return false;
+        }
+        redo_bloom_filter_image(key, end_lsn, &image, data + sizeof(image));
+        return true;
+    }
+    case BLOOM_WAL_COUNT:
+    case BLOOM_WAL_READY: {
+        BloomWalCount count;
+        if (!read_body(&count, sizeof(count), data, size)) {
+            return false;
+        }
+        redo_bloom_filter_count(key, end_lsn, count.count, header->type == BLOOM_WAL_READY);
+        return true;
+    }
+    default:
+        return false;
+    }
+}
+
+void replay_filter_change(const char* payload, size_t size, XLogRecPtr end_lsn) {
+    BloomWalHeader header;
+    if (!read_body(&header, sizeof(header), payload, size)) {
+        ereport(LOG,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                 errmsg("octo_bloom: invalid log record at %X/%X", LSN_FORMAT_ARGS(end_lsn))));
+        return;
+    }
+    if (!replay_record(&header, payload + sizeof(header), size - sizeof(header), end_lsn)) {
+        ereport(LOG,
+                (errcode(ERRCODE_DATA_CORRUPTED),
+                 errmsg("octo_bloom: invalid %s log record at %X/%X",
+                        type_name(header.type) ? type_name(header.type) : "unknown",
+                        LSN_FORMAT_ARGS(end_lsn))));
+        // Whatever it said, the filter may no longer match the primary's
+        redo_bloom_filter_drop(&header.key, end_lsn);
+    }
+}
+
+#if PG_VERSION_NUM >= 150000
+
+static void filter_wal_redo(XLogReaderState* record) {
+    replay_filter_change(XLogRecGetData(record), XLogRecGetDataLen(record), record->EndRecPtr);
+}
+
+static void filter_wal_desc(StringInfo buf, XLogReaderState* record) {
+    const char* data = XLogRecGetData(record);
+    size_t size = XLogRecGetDataLen(record);
+    BloomWalHeader header;
+    if (!read_body(&header, sizeof(header), data, size)) {
+        return;
+    }
+    appendStringInfo(buf, "db %u table %u attnum %d", header.key.dboid, header.key.table_oid,
+                     header.key.attnum);
+    data += sizeof(header);
+    size -= sizeof(header);
+
+    BloomWalHashes hashes;
+    BloomWalStage stage;
+    BloomWalImage image;
+    BloomWalCount count;
+    switch (header.type) {
+    case BLOOM_WAL_ADD:
+    case BLOOM_WAL_REMOVE:
+        if (read_body(&hashes, sizeof(hashes), data, size)) {
+            appendStringInfo(buf, "; %u hashes", hashes.count);
+        }
+        break;
+    case BLOOM_WAL_APPEND_STAGE:
+    case BLOOM_WAL_DROP_STAGES:
+        if (read_body(&stage, sizeof(stage), data, size)) {
+            appendStringInfo(buf, "; stage %d", stage.stage);
+        }
+        break;
+    case BLOOM_WAL_IMAGE:
+        if (read_body(&image, sizeof(image), data, size)) {
+            appendStringInfo(buf, "; slot %d offset " UINT64_FORMAT " length %u", image.slot,
+                             image.offset, image.length);
+        }
+        break;
+    case BLOOM_WAL_RESIZE_FINISH:
+    case BLOOM_WAL_COUNT:
+    case BLOOM_WAL_READY:
+        if (read_body(&count, sizeof(count), data, size)) {
+            appendStringInfo(buf, "; count " UINT64_FORMAT, count.count);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static const char* filter_wal_identify(uint8 info) {
+    return type_name((info & ~XLR_INFO_MASK) >> 4);
+}
+
+// Runs in the startup process before the first record is replayed. Crash
+// recovery replays changes on top of the snapshots, so they are loaded now
+// rather than by the launcher. Archive recovery starts from a base backup,
+// whose snapshots were copied with it but miss the changes since: they go.
+static void filter_wal_startup(void) {
+    ensure_shared_memory();
+    if (bloom_shared_state->snapshots_loaded) {
+        return;
+    }
+    int loaded = load_filter_snapshots(octo_bloom_snapshots && !ArchiveRecoveryRequested);
+    bloom_shared_state->snapshots_loaded = true;
+    if (loaded > 0) {
+        ereport(LOG, (errmsg("octo_bloom: loaded %d bloom filter snapshots", loaded)));
+    }
+}
+
+static const RmgrData filter_rmgr = {
+    .rm_name = OCTO_BLOOM_RMGR_NAME,
+    .rm_redo = filter_wal_redo,
+    .rm_desc = filter_wal_desc,
+    .rm_identify = filter_wal_identify,
+    .rm_startup = filter_wal_startup,
+    .rm_cleanup = NULL,
+    .rm_mask = NULL,
+    .rm_decode = NULL,
+};
+
+#endif
+
+// The resource manager is registered whether or not octo_bloom.wal_log is
+// on: records written while it was must replay however it is set now. The
+// startup process skips the messages whatever the setting, so the worker
+// only runs with octo_bloom.wal_log on
+void register_filter_wal() {
+    wal_registered = true;
+#if PG_VERSION_NUM >= 150000
+    if (octo_bloom_wal_resource_manager) {
+        RegisterCustomRmgr(OCTO_BLOOM_RMGR_ID, &filter_rmgr);
+        wal_rmgr = true;
+        return;
+    }
+#endif
+    if (!octo_bloom_wal_log) {
+        return;
+    }
+    BackgroundWorker worker;
+    memset(&worker, 0, sizeof(worker));
+    worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+    // Hot standby: probes are allowed, so the filters must keep up
+    worker.bgw_start_time = BgWorkerStart_ConsistentState;
+    worker.bgw_restart_time = WAL_REPLAY_RESTART_SECS;
+    snprintf(worker.bgw_library_name, sizeof(worker.bgw_library_name), "octo_bloom");
+    snprintf(worker.bgw_function_name, sizeof(worker.bgw_function_name),
+             "octo_bloom_wal_replay_main");
+    snprintf(worker.bgw_name, sizeof(worker.bgw_name), "octo_bloom wal replay");
+    snprintf(worker.bgw_type, sizeof(worker.bgw_type), "octo_bloom wal replay");
+    RegisterBackgroundWorker(&worker);
+}
+
+// The registry can't be kept current: drop every filter, so probes fall
+// back to true until the primary replicates them again
+static void drop_all_filters(XLogRecPtr end_lsn) {
+    BloomRegistryKey* keys = (BloomRegistryKey*)palloc(sizeof(BloomRegistryKey) *
+                                                       bloom_shared_state->max_filters);
+    int count = 0;
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    HASH_SEQ_STATUS status;
+    BloomRegistryEntry* entry;
+    hash_seq_init(&status, bloom_registry);
+    while ((entry = (BloomRegistryEntry*)hash_seq_search(&status)) != NULL) {
+        if (count < bloom_shared_state->max_filters) {
+            keys[count++] = entry->key;
+        }
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    for (int i = 0; i < count; ++i) {
+        redo_bloom_filter_drop(&keys[i], end_lsn);
+    }
+    pfree(keys);
+}
+
+// Follows the startup process through the log, replaying our messages as
+// they are replayed. read_local_xlog_page waits for replay to pass each
+// page. After a promotion the log goes on with the records this server
+// writes itself, which are already applied: the worker stops at the end
+// of recovery.
+void octo_bloom_wal_replay_main(Datum main_arg) {
+    pqsignal(SIGTERM, die);
+    BackgroundWorkerUnblockSignals();
+
+    // Not a standby, or no longer one
+    if (!RecoveryInProgress()) {
+        proc_exit(0);
+    }
+
+    ensure_shared_memory();
+
+    // A standby's snapshots came with its base backup and miss the
+    // changes since; the primary's filters arrive through the log
+    if (!bloom_shared_state->snapshots_loaded) {
+        (void)load_filter_snapshots(false);
+        bloom_shared_state->snapshots_loaded = true;
+    }
+
+    XLogReaderState* reader = XLogReaderAllocate(
+        wal_segment_size, NULL,
+        XL_ROUTINE(.page_read = &read_local_xlog_page, .segment_open = &wal_segment_open,
+                   .segment_close = &wal_segment_close),
+        NULL);
+    if (!reader) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("out of memory"),
+                 errdetail("Failed while allocating a WAL reading processor.")));
+    }
+
+    // Messages replayed before we started were missed. A filter they
+    // changed would miss them for good, so every filter goes
+    XLogRecPtr start = GetXLogReplayRecPtr(NULL);
+    drop_all_filters(start);
+    XLogRecPtr first = XLogFindNextRecord(reader, start);
+    if (XLogRecPtrIsInvalid(first)) {
+        ereport(ERROR,
+                (errmsg("octo_bloom: could not find a valid record after %X/%X",
+                        LSN_FORMAT_ARGS(start))));
+    }
+    XLogBeginRead(reader, first);
+    ereport(LOG, (errmsg("octo_bloom: replaying bloom filter changes from %X/%X",
+                         LSN_FORMAT_ARGS(first))));
+
+    for (;;) {
+        CHECK_FOR_INTERRUPTS();
+
+        char* errormsg = NULL;
+        XLogRecord* record = XLogReadRecord(reader, &errormsg);
+        if (!record) {
+            // Read again from where replay is after a restart
+            ereport(ERROR,
+                    (errmsg("octo_bloom: could not read WAL at %X/%X: %s",
+                            LSN_FORMAT_ARGS(reader->EndRecPtr),
+                            errormsg ? errormsg : "unknown error")));
+        }
+
+        if (!RecoveryInProgress() && reader->EndRecPtr > GetXLogReplayRecPtr(NULL)) {
+            break;
+        }
+
+        if (XLogRecGetRmid(reader) != RM_LOGICALMSG_ID ||
+            (XLogRecGetInfo(reader) & ~XLR_INFO_MASK) != XLOG_LOGICAL_MESSAGE) {
+            continue;
+        }
+        xl_logical_message* message = (xl_logical_message*)XLogRecGetData(reader);
+        if (message->transactional || message->prefix_size != sizeof(OCTO_BLOOM_WAL_PREFIX) ||
+            strcmp(message->message, OCTO_BLOOM_WAL_PREFIX) != 0) {
+            continue;
+        }
+        replay_filter_change(message->message + message->prefix_size, message->message_size,
+                             reader->EndRecPtr);
+    }
+
+    XLogReaderFree(reader);
+    ereport(LOG, (errmsg("octo_bloom: recovery has ended, stopping bloom filter replay")));
+    proc_exit(0);
+}
+
+} // extern "C"
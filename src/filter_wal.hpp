@@ -0,0 +1,120 @@
+#ifndef OCTO_BLOOM_FILTER_WAL_HPP
+#define OCTO_BLOOM_FILTER_WAL_HPP
+
+#include "shared_memory.hpp"
+
+extern "C" {
+#include <access/xlogdefs.h>
+}
+
+// Filter changes logged for standbys (octo_bloom.wal_log). They are
+// non-transactional logical messages under OCTO_BLOOM_WAL_PREFIX, replayed
+// on a standby by a background worker, or on PostgreSQL 15+ with
+// octo_bloom.wal_resource_manager, records of a custom resource manager
+// replayed by the startup process
+#define OCTO_BLOOM_WAL_PREFIX "octo_bloom"
+// Adds and removes go into the log this many hashes at a time at most
+#define OCTO_BLOOM_WAL_MAX_HASHES 256
+// A filter image is logged in chunks of this size
+#define OCTO_BLOOM_WAL_IMAGE_CHUNK (1024 * 1024)
+// Image slot of the storage an online resize is filling
+#define OCTO_BLOOM_WAL_RESIZE_SLOT (-1)
+
+// Record types, in the high bits of the record info on PostgreSQL 15+
+typedef enum BloomWalType {
+    BLOOM_WAL_CREATE = 1,     // BloomWalCreate: replaces any filter under the key
+    BLOOM_WAL_DROP,           // No body
+    BLOOM_WAL_ADD,            // BloomWalHashes, then count h1 and count h2 values
+    BLOOM_WAL_REMOVE,         // Likewise
+    BLOOM_WAL_APPEND_STAGE,   // BloomWalStage
+    BLOOM_WAL_DROP_STAGES,    // BloomWalStage: every stage before stage goes
+    BLOOM_WAL_RESIZE_BEGIN,   // BloomWalStage with the new params
+    BLOOM_WAL_RESIZE_FINISH,  // BloomWalCount
+    BLOOM_WAL_RESIZE_CANCEL,  // No body
+    BLOOM_WAL_IMAGE,          // BloomWalImage, then length bytes of storage
+    BLOOM_WAL_COUNT,          // BloomWalCount
+    BLOOM_WAL_READY,          // BloomWalCount: a replicated filter is complete
+} BloomWalType;
+
+#define BLOOM_WAL_MAX_TYPE BLOOM_WAL_READY
+
+typedef struct BloomWalHeader {
+    uint32_t type;  // BloomWalType
+    BloomRegistryKey key;
+} BloomWalHeader;
+
+// A new filter's layout. An empty one from octo_bloom_init is complete;
+// one being replicated by octo_bloom_replicate isn't used on the standby
+// until BLOOM_WAL_READY, once its images are in
+typedef struct BloomWalCreate {
+    BloomFilterParams params;
+    BloomKeyType key_type;
+    int32_t num_stages;
+    int32_t complete;
+    BloomFilterParams stage_params[OCTO_BLOOM_STAGE_SLOTS];
+} BloomWalCreate;
+
+typedef struct BloomWalHashes {
+    uint32_t count;
+} BloomWalHashes;
+
+typedef struct BloomWalStage {
+    int32_t stage;
+    BloomFilterParams params;
+} BloomWalStage;
+
+typedef struct BloomWalCount {
+    uint64_t count;
+} BloomWalCount;
+
+// Storage of a stage, or of the resize in progress, from offset on
+typedef struct BloomWalImage {
+    int32_t slot;  // Stage index or OCTO_BLOOM_WAL_RESIZE_SLOT
+    uint32_t length;
+    uint64_t offset;
+} BloomWalImage;
+
+// GUC, defined in _PG_init
+extern "C" {
+extern bool octo_bloom_wal_log;
+extern bool octo_bloom_wal_resource_manager;
+}
+
+extern "C" {
+// Register the resource manager (octo_bloom.wal_resource_manager) or the
+// standby's replay worker; from _PG_init while preloading
+void register_filter_wal();
+// Whether this backend logs the filter changes it makes
+bool filter_wal_enabled();
+// Log a change to the filter under key: a body, then up to two more parts
+// of data. Returns the end of the record
+XLogRecPtr log_filter_change(BloomWalType type, const BloomRegistryKey* key,
+                             const void* body, size_t body_size,
+                             const void* data, size_t data_size,
+                             const void* more, size_t more_size);
+// Apply a record read from the log, which ends at end_lsn. A change that
+// can't be applied drops the filter instead of failing replay
+void replay_filter_change(const char* payload, size_t size, XLogRecPtr end_lsn);
+
+PGDLLEXPORT void octo_bloom_wal_replay_main(Datum main_arg);
+
+// Replay into the registry, by key (shared_memory.cpp). A change is skipped
+// if the filter under its key has already seen one ending at or after
+// end_lsn, e.g. when it came from a snapshot written later
+void redo_bloom_filter_create(const BloomRegistryKey* key, XLogRecPtr end_lsn,
+                              const BloomWalCreate* create);
+void redo_bloom_filter_drop(const BloomRegistryKey* key, XLogRecPtr end_lsn);
+void redo_bloom_filter_hashes(const BloomRegistryKey* key, XLogRecPtr end_lsn,
+                              const uint64_t* h1, const uint64_t* h2, int count, bool remove);
+// BLOOM_WAL_APPEND_STAGE, BLOOM_WAL_DROP_STAGES or BLOOM_WAL_RESIZE_BEGIN
+void redo_bloom_filter_stage(const BloomRegistryKey* key, XLogRecPtr end_lsn, BloomWalType type,
+                             const BloomWalStage* stage);
+void redo_bloom_filter_resize_end(const BloomRegistryKey* key, XLogRecPtr end_lsn, bool finish,
+                                  uint64_t count);
+void redo_bloom_filter_image(const BloomRegistryKey* key, XLogRecPtr end_lsn,
+                             const BloomWalImage* image, const char* data);
+void redo_bloom_filter_count(const BloomRegistryKey* key, XLogRecPtr end_lsn, uint64_t count,
+                             bool ready);
+}
+
+#endif // OCTO_BLOOM_FILTER_WAL_HPP
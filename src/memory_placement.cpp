@@ -0,0 +1,216 @@
+#include "memory_placement.hpp"
+#include <new>
+
+extern "C" {
+#include <storage/pg_shmem.h>
+#include <utils/palloc.h>
+}
+
+#ifdef __linux__
+#include <cstdio>
+#include <cstdlib>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+extern "C" {
+
+int octo_bloom_node_copy_refresh_ms = 1000;
+
+void bloom_advise_huge_pages(void* start, Size bytes) {
+#if defined(__linux__) && defined(MADV_HUGEPAGE)
+    // Main shared memory is already on huge pages if the server got them;
+    // this covers 4kB mappings, where THP can still back the range
+    if (huge_pages == HUGE_PAGES_OFF) {
+        return;
+    }
+    uintptr_t begin = TYPEALIGN(OCTO_BLOOM_HUGE_PAGE_SIZE, (uintptr_t)start);
+    uintptr_t end = TYPEALIGN_DOWN(OCTO_BLOOM_HUGE_PAGE_SIZE, (uintptr_t)start + bytes);
+    if (end > begin) {
+        // Only advice: a kernel without THP for shared memory refuses it
+        (void)madvise((void*)begin, end - begin, MADV_HUGEPAGE);
+    }
+#endif
+}
+
+int bloom_numa_nodes(uint32_t* online) {
+    // Read once: nodes don't come and go while the server runs
+    static int num_nodes = 0;
+    static uint32_t online_nodes = 0;
+
+#ifdef __linux__
+    if (num_nodes == 0) {
+        // A list of ranges such as "0-1,3"
+        char list[256] = "";
+        FILE* file = fopen("/sys/devices/system/node/online", "r");
+        if (file) {
+            if (!fgets(list, sizeof(list), file)) {
+                list[0] = '\0';
+            }
+            fclose(file);
+        }
+        char* p = list;
+        while (*p >= '0' && *p <= '9') {
+            long first = strtol(p, &p, 10);
+            long last = first;
+            if (*p == '-') {
+                last = strtol(p + 1, &p, 10);
+            }
+            for (long node = first; node <= last && node < OCTO_BLOOM_MAX_NUMA_NODES; ++node) {
+                online_nodes |= 1U << node;
+                num_nodes = Max(num_nodes, (int)node + 1);
+            }
+            if (*p == ',') {
+                p++;
+            }
+        }
+    }
+#endif
+    if (num_nodes == 0) {
+        num_nodes = 1;
+        online_nodes = 1;
+    }
+
+    if (online) {
+        *online = online_nodes;
+    }
+    return num_nodes;
+}
+
+int bloom_current_numa_node() {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu;
+    unsigned node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0 && node < OCTO_BLOOM_MAX_NUMA_NODES) {
+        return (int)node;
+    }
+#endif
+    return 0;
+}
+
+void bloom_prefer_numa_node(void* start, Size bytes, int node) {
+#if defined(__linux__) && defined(SYS_mbind)
+    // Huge page mappings take policies in whole huge pages only
+    uintptr_t begin = TYPEALIGN(OCTO_BLOOM_HUGE_PAGE_SIZE, (uintptr_t)start);
+    uintptr_t end = TYPEALIGN_DOWN(OCTO_BLOOM_HUGE_PAGE_SIZE, (uintptr_t)start + bytes);
+    if (end <= begin) {
+        Size page = (Size)sysconf(_SC_PAGESIZE);
+        begin = TYPEALIGN(page, (uintptr_t)start);
+        end = TYPEALIGN_DOWN(page, (uintptr_t)start + bytes);
+    }
+    if (end <= begin) {
+        return;
+    }
+    // Preferred rather than bound, so a full node spills over instead of failing
+    unsigned long mask = 1UL << node;
+    (void)syscall(SYS_mbind, (void*)begin, (unsigned long)(end - begin), MPOL_PREFERRED,
+                  &mask, (unsigned long)(sizeof(mask) * 8 + 1), MPOL_MF_MOVE);
+#endif
+}
+
+}  // extern "C"
+
+namespace {
+
+// See filter_create_node_copy_view. The copy may be some writes behind the
+// filter, and a key probed there before its add is copied over would be
+// missed, so it is only used while no write has been made since it was
+// copied. Every write made through this view counts; the registry also
+// counts the changes it makes to the storage directly
+class NodeCopyFilter final : public FilterBackend {
+public:
+    NodeCopyFilter(FilterBackend* filter, FilterBackend* copy, pg_atomic_uint64* writes,
+                   pg_atomic_uint64* synced)
+        : filter_(filter), copy_(copy), writes_(writes), synced_(synced) {}
+    ~NodeCopyFilter() override {
+        filter_destroy(filter_);
+        filter_destroy(copy_);
+    }
+
+    void add(const void* data, size_t length) override {
+        filter_->add(data, length);
+        wrote();
+    }
+    bool mightContain(const void* data, size_t length) const override {
+        return probed()->mightContain(data, length);
+    }
+    void mightContainBatch(const void* const* data, const size_t* lengths,
+                           size_t count, bool* results) const override {
+        probed()->mightContainBatch(data, lengths, count, results);
+    }
+
+    bool supportsRemove() const override { return filter_->supportsRemove(); }
+    // A key still in the copy is only a false positive
+    void remove(const void* data, size_t length) override { filter_->remove(data, length); }
+
+    std::pair<uint64_t, uint64_t> doubleHash(const void* data, size_t length) const override {
+        return filter_->doubleHash(data, length);
+    }
+    void addHashesUnshared(uint64_t h1, uint64_t h2) override {
+        filter_->addHashesUnshared(h1, h2);
+        wrote();
+    }
+    void addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) override {
+        filter_->addHashBatch(h1, h2, count);
+        wrote();
+    }
+    void removeHashes(uint64_t h1, uint64_t h2) override { filter_->removeHashes(h1, h2); }
+    bool mightContainHashes(uint64_t h1, uint64_t h2) const override {
+        return probed()->mightContainHashes(h1, h2);
+    }
+    void prefetchHashes(uint64_t h1, uint64_t h2) const override {
+        probed()->prefetchHashes(h1, h2);
+    }
+
+    void clear() override {
+        filter_->clear();
+        wrote();
+    }
+    bool isCompatible(const FilterBackend& other) const override {
+        return filter_->isCompatible(other);
+    }
+    bool mergeFrom(const FilterBackend& other) override {
+        bool merged = filter_->mergeFrom(other);
+        wrote();
+        return merged;
+    }
+
+    BloomFilterParams getParams() const override { return filter_->getParams(); }
+    size_t getMemoryUsage() const override { return filter_->getMemoryUsage(); }
+    double getEffectiveFalsePositiveRate() const override {
+        return filter_->getEffectiveFalsePositiveRate();
+    }
+    double getSaturation() const override { return filter_->getSaturation(); }
+    FilterFillEstimate estimateFill(size_t sample_words) const override {
+        return filter_->estimateFill(sample_words);
+    }
+    size_t getSerializedSize() const override { return filter_->getSerializedSize(); }
+    void serialize(uint8_t* buffer, uint32_t key_type) const override {
+        filter_->serialize(buffer, key_type);
+    }
+
+private:
+    FilterBackend* filter_;
+    FilterBackend* copy_;
+    pg_atomic_uint64* writes_;
+    pg_atomic_uint64* synced_;
+
+    // The bump follows the write, so a probe that sees the count it was
+    // copied at can't be missing a write that has finished
+    void wrote() { pg_atomic_fetch_add_u64(writes_, 1); }
+
+    const FilterBackend* probed() const {
+        uint64 synced = pg_atomic_read_u64(synced_);
+        pg_read_barrier();
+        return synced == pg_atomic_read_u64(writes_) ? copy_ : filter_;
+    }
+};
+
+} // namespace
+
+FilterBackend* filter_create_node_copy_view(FilterBackend* filter, FilterBackend* copy,
+                                            pg_atomic_uint64* writes, pg_atomic_uint64* synced) {
+    return new (palloc(sizeof(NodeCopyFilter))) NodeCopyFilter(filter, copy, writes, synced);
+}
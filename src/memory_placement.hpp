@@ -0,0 +1,43 @@
+#ifndef OCTO_BLOOM_MEMORY_PLACEMENT_HPP
+#define OCTO_BLOOM_MEMORY_PLACEMENT_HPP
+
+#include "shared_memory.hpp"
+
+// Where filter memory lives. Probes are random reads over the whole array,
+// so a multi-GB filter on 4kB pages misses the TLB on nearly every one, and
+// on a multi-socket host half of them cross to the other node's memory.
+// Filters are backed by huge pages where the server uses them, and a
+// read-mostly filter can keep a copy of its bits on every NUMA node for the
+// backends there to probe (octo_bloom_copy_to_nodes). Linux only; elsewhere
+// the advice is skipped and the host looks like a single node.
+
+#define OCTO_BLOOM_HUGE_PAGE_SIZE ((Size)2 * 1024 * 1024)
+
+// GUC, defined in _PG_init
+extern "C" {
+extern int octo_bloom_node_copy_refresh_ms;
+}
+
+extern "C" {
+// Ask for transparent huge pages over the whole huge pages inside a range,
+// unless huge_pages is off. Pages already faulted in keep their size
+void bloom_advise_huge_pages(void* start, Size bytes);
+
+// Nodes this host has, counted to the highest online one and at most
+// OCTO_BLOOM_MAX_NUMA_NODES; *online, if not null, receives a bit per node
+int bloom_numa_nodes(uint32_t* online);
+// Node of the CPU this process is running on, 0 if unknown
+int bloom_current_numa_node();
+// Prefer node for the pages of a range, moving those only this process has
+// mapped. Pages others have faulted in stay where they are
+void bloom_prefer_numa_node(void* start, Size bytes, int node);
+}
+
+// A view whose probes go to copy, a node copy of filter's first stage,
+// while the copy is in step: *synced, the writes count it was copied at,
+// equals *writes. Writes go to filter and then bump *writes. Takes
+// ownership of both views
+FilterBackend* filter_create_node_copy_view(FilterBackend* filter, FilterBackend* copy,
+                                            pg_atomic_uint64* writes, pg_atomic_uint64* synced);
+
+#endif // OCTO_BLOOM_MEMORY_PLACEMENT_HPP
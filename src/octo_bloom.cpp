@@ -1,5 +1,32 @@
 #include "shared_memory.hpp"
+#include "background_worker.hpp"
 #include "bloom_filter.hpp"
+#include "bloom_type.hpp"
+#include "bloom_kernels.hpp"
+#include "composite_key.hpp"
+#include "cuckoo_filter.hpp"
+#include "datum_key.hpp"
+#include "filter_snapshot.hpp"
+#include "filter_wal.hpp"
+#include "memory_placement.hpp"
+#include "partition_filters.hpp"
+#include "planner_hook.hpp"
+#include "scalable_filter.hpp"
+#include "trigger_manager.hpp"
+
+extern "C" {
+#include <access/htup_details.h>
+#include <access/table.h>
+#include <catalog/pg_class.h>
+#include <funcapi.h>
+#include <miscadmin.h>
+#include <storage/ipc.h>
+#include <utils/array.h>
+#include <utils/guc.h>
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+#include <utils/typcache.h>
+}
 
 extern "C" {
 
@@ -9,12 +36,43 @@ PG_MODULE_MAGIC;
 
 // Function declarations
 PG_FUNCTION_INFO_V1(octo_bloom_init);
+PG_FUNCTION_INFO_V1(octo_bloom_init_composite);
 PG_FUNCTION_INFO_V1(octo_bloom_might_contain);
+PG_FUNCTION_INFO_V1(octo_bloom_might_contain_composite);
+PG_FUNCTION_INFO_V1(octo_bloom_might_contain_array);
+PG_FUNCTION_INFO_V1(octo_bloom_might_contain_set);
+PG_FUNCTION_INFO_V1(octo_bloom_might_contain_any);
+PG_FUNCTION_INFO_V1(octo_bloom_filter_values);
 PG_FUNCTION_INFO_V1(octo_bloom_exists);
 PG_FUNCTION_INFO_V1(octo_bloom_attach_triggers);
 PG_FUNCTION_INFO_V1(octo_bloom_status);
 PG_FUNCTION_INFO_V1(octo_bloom_rebuild);
+PG_FUNCTION_INFO_V1(octo_bloom_rebuild_composite);
+PG_FUNCTION_INFO_V1(octo_bloom_resize);
+PG_FUNCTION_INFO_V1(octo_bloom_compact);
+PG_FUNCTION_INFO_V1(octo_bloom_build_progress);
 PG_FUNCTION_INFO_V1(octo_bloom_disable);
+PG_FUNCTION_INFO_V1(octo_bloom_disable_composite);
+PG_FUNCTION_INFO_V1(octo_bloom_replicate);
+PG_FUNCTION_INFO_V1(octo_bloom_copy_to_nodes);
+PG_FUNCTION_INFO_V1(octo_bloom_partition_ddl);
+PG_FUNCTION_INFO_V1(octo_bloom_drop_filters);
+
+// The octo_bloom type
+PG_FUNCTION_INFO_V1(octo_bloom_in);
+PG_FUNCTION_INFO_V1(octo_bloom_out);
+PG_FUNCTION_INFO_V1(octo_bloom_recv);
+PG_FUNCTION_INFO_V1(octo_bloom_send);
+PG_FUNCTION_INFO_V1(octo_bloom_from_bytea);
+PG_FUNCTION_INFO_V1(octo_bloom_export);
+PG_FUNCTION_INFO_V1(octo_bloom_agg_transfn);
+PG_FUNCTION_INFO_V1(octo_bloom_agg_combine);
+PG_FUNCTION_INFO_V1(octo_bloom_agg_serialize);
+PG_FUNCTION_INFO_V1(octo_bloom_agg_deserialize);
+PG_FUNCTION_INFO_V1(octo_bloom_agg_final);
+PG_FUNCTION_INFO_V1(octo_bloom_union);
+PG_FUNCTION_INFO_V1(octo_bloom_intersect);
+PG_FUNCTION_INFO_V1(octo_bloom_filter_might_contain);
 
 // Trigger functions
 PG_FUNCTION_INFO_V1(octo_bloom_insert_trigger);
@@ -22,18 +80,31 @@ PG_FUNCTION_INFO_V1(octo_bloom_update_trigger);
 PG_FUNCTION_INFO_V1(octo_bloom_delete_trigger);
 
 void _PG_init(void);
-void _PG_fini(void);
 
-// Shared memory initialization is now in shared_memory.cpp
+// Key hash for filters created from now on; existing filters keep theirs
+int octo_bloom_hash_algorithm = static_cast<int>(BloomHash::Wy128);
 
-Datum octo_bloom_init(PG_FUNCTION_ARGS) {
-    Oid table_oid = PG_GETARG_OID(0);
-    text* column_name = PG_GETARG_TEXT_P(1);
-    uint64_t expected_count = PG_GETARG_INT64(2);
-    double false_positive_rate = PG_GETARG_FLOAT8(3);
-    
+static const struct config_enum_entry hash_algorithm_options[] = {
+    {"wyhash128", static_cast<int>(BloomHash::Wy128), false},
+    {"pg_hash_fnv", static_cast<int>(BloomHash::PgHashFnv), false},
+    {NULL, 0, false}
+};
+
+// Hash-to-index mapping for filters created from now on
+int octo_bloom_index_reduction = static_cast<int>(BloomReduction::FastRange);
+
+static const struct config_enum_entry index_reduction_options[] = {
+    {"fastrange", static_cast<int>(BloomReduction::FastRange), false},
+    {"pow2", static_cast<int>(BloomReduction::PowerOfTwo), false},
+    {"modulo", static_cast<int>(BloomReduction::Modulo), false},
+    {NULL, 0, false}
+};
+
+// Validated parameters of a filter as octo_bloom_init describes it
+static BloomFilterParams filter_params_for(int64_t expected_count, double false_positive_rate,
+                                           const char* filter_type) {
     // Validate parameters
-    if (expected_count == 0) {
+    if (expected_count <= 0) {
         ereport(ERROR,
                 (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                  errmsg("expected_count must be greater than zero")));
@@ -44,7 +115,76 @@ Datum octo_bloom_init(PG_FUNCTION_ARGS) {
                 (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
                  errmsg("false_positive_rate must be between 0 and 1")));
     }
+
+    FilterKind kind = FilterKind::Bloom;
+    BloomLayout layout = BloomLayout::Standard;
+    if (pg_strcasecmp(filter_type, "standard") == 0) {
+        layout = BloomLayout::Standard;
+    } else if (pg_strcasecmp(filter_type, "blocked") == 0) {
+        layout = BloomLayout::Blocked;
+    } else if (pg_strcasecmp(filter_type, "counting") == 0) {
+        layout = BloomLayout::Counting;
+    } else if (pg_strcasecmp(filter_type, "cuckoo") == 0) {
+        kind = FilterKind::Cuckoo;
+    } else if (pg_strcasecmp(filter_type, "scalable") == 0) {
+        kind = FilterKind::Scalable;
+    } else {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("unknown filter_type \"%s\"", filter_type),
+                 errhint("Valid filter types are \"standard\", \"blocked\", \"counting\", \"cuckoo\" and \"scalable\".")));
+    }
     
+    BloomFilterParams params;
+    if (kind == FilterKind::Cuckoo) {
+        params = CuckooFilter::computeParams(expected_count, false_positive_rate);
+    } else if (kind == FilterKind::Scalable) {
+        params = ScalableFilter::computeParams(
+            expected_count, false_positive_rate,
+            static_cast<BloomHash>(octo_bloom_hash_algorithm),
+            static_cast<BloomReduction>(octo_bloom_index_reduction));
+    } else {
+        params = OctoBloomFilter::computeParams(
+            expected_count, false_positive_rate, layout,
+            static_cast<BloomHash>(octo_bloom_hash_algorithm),
+            static_cast<BloomReduction>(octo_bloom_index_reduction));
+    }
+    return params;
+}
+
+void create_bloom_filter(Oid table_oid, int16_t attnum, int64_t expected_count,
+                         double false_positive_rate, const char* filter_type,
+                         const BloomKeyType* key_type) {
+    BloomFilterParams params = filter_params_for(expected_count, false_positive_rate,
+                                                 filter_type);
+
+    // Resolve how the column's values are hashed, once for the filter's lifetime
+    BloomKeyType column_key_type;
+    if (!key_type) {
+        Oid atttype;
+        int32 atttypmod;
+        Oid attcollation;
+        get_atttypetypmodcoll(table_oid, attnum, &atttype, &atttypmod, &attcollation);
+        bloom_key_type_for_column(atttype, attcollation, &column_key_type);
+        key_type = &column_key_type;
+    }
+
+    // Register bloom filter in shared memory
+    if (!register_bloom_filter(table_oid, attnum, &params, key_type)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("failed to allocate shared memory for bloom filter"),
+                 errhint("Increase octo_bloom.shared_memory_mb or lower expected_count.")));
+    }
+}
+
+Datum octo_bloom_init(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_P(1);
+    int64_t expected_count = PG_GETARG_INT64(2);
+    double false_positive_rate = PG_GETARG_FLOAT8(3);
+    char* filter_type = text_to_cstring(PG_GETARG_TEXT_PP(4));
+
     // Get attribute number from column name
     char* col_name = text_to_cstring(column_name);
     int16_t attnum = get_attnum(table_oid, col_name);
@@ -54,23 +194,107 @@ Datum octo_bloom_init(PG_FUNCTION_ARGS) {
                 (errcode(ERRCODE_UNDEFINED_COLUMN),
                  errmsg("column \"%s\" does not exist", col_name)));
     }
-    
-    // Register bloom filter in shared memory
-    if (!register_bloom_filter(table_oid, attnum, expected_count, false_positive_rate)) {
-        ereport(ERROR,
-                (errcode(ERRCODE_OUT_OF_MEMORY),
-                 errmsg("failed to register bloom filter: out of shared memory or filter already exists")));
+
+    // A partitioned table has no rows of its own: its leaves get the filters
+    if (get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE) {
+        filter_params_for(expected_count, false_positive_rate, filter_type);
+        init_partitioned_filter(table_oid, col_name, get_func_namespace(fcinfo->flinfo->fn_oid),
+                                expected_count, false_positive_rate, filter_type);
+        PG_RETURN_VOID();
     }
+
+    create_bloom_filter(table_oid, attnum, expected_count, false_positive_rate, filter_type,
+                        NULL);
     
     PG_RETURN_VOID();
 }
 
-Datum octo_bloom_might_contain(PG_FUNCTION_ARGS) {
+// octo_bloom_init over several columns or expressions of the table
+Datum octo_bloom_init_composite(PG_FUNCTION_ARGS) {
     Oid table_oid = PG_GETARG_OID(0);
-    text* column_name = PG_GETARG_TEXT_P(1);
-    Datum value = PG_GETARG_DATUM(2);
-    Oid value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
-    
+    ArrayType* keys = PG_GETARG_ARRAYTYPE_P(1);
+    int64_t expected_count = PG_GETARG_INT64(2);
+    double false_positive_rate = PG_GETARG_FLOAT8(3);
+    char* filter_type = text_to_cstring(PG_GETARG_TEXT_PP(4));
+
+    // Leaf filters come from templates by column name, which keys aren't
+    if (get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("composite bloom filters are not supported on partitioned table \"%s\"",
+                        get_rel_name(table_oid)),
+                 errhint("Create them on its partitions.")));
+    }
+    // Nothing is recorded for invalid arguments
+    filter_params_for(expected_count, false_positive_rate, filter_type);
+
+    Relation rel = table_open(table_oid, AccessShareLock);
+    int16_t attnum = define_composite_key(rel, keys);
+    const CompositeKey* key = get_composite_key(table_oid, attnum);
+    if (!key) {
+        elog(ERROR, "composite key %d of \"%s\" not found", attnum,
+             RelationGetRelationName(rel));
+    }
+    BloomKeyType key_type;
+    key_type.typid = RECORDOID;
+    key_type.typlen = (int16)key->num_parts;
+    key_type.collation = InvalidOid;
+    key_type.kind = BloomKeyKind::Composite;
+    create_bloom_filter(table_oid, attnum, expected_count, false_positive_rate, filter_type,
+                        &key_type);
+    table_close(rel, AccessShareLock);
+
+    PG_RETURN_VOID();
+}
+
+// Filter handle resolved by a call site, kept in fn_extra. It stays valid
+// while the registry generation is unchanged; fn_extra lives for a single
+// execution of the calling expression, so column renames can't go unseen.
+typedef struct FilterCallCache {
+    bool valid;
+    Oid table_oid;
+    char column_name[NAMEDATALEN];
+    int16_t attnum;
+    Oid value_type;
+    uint64_t generation;
+    FilterBackend* filter;
+    BloomFilterCounters* counters;  // The filter's, for this backend
+    BloomKeyType key_type;  // For hashing values of value_type
+    // A partitioned table without a filter of its own is probed through
+    // its leaves' filters; num_partitions is 0 otherwise
+    PartitionFilterSet partitions;
+} FilterCallCache;
+
+static FilterCallCache* fn_extra_cache(FunctionCallInfo fcinfo) {
+    FilterCallCache* cache = (FilterCallCache*)fcinfo->flinfo->fn_extra;
+    if (!cache) {
+        cache = (FilterCallCache*)MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+                                                         sizeof(FilterCallCache));
+        fcinfo->flinfo->fn_extra = cache;
+    }
+    return cache;
+}
+
+// Resolve the filter for a table column, or nullptr if none is usable. On
+// success cache->key_type says how to hash probe values of value_type. For
+// a partitioned table, nullptr is returned and cache->partitions is set.
+static FilterBackend* lookup_filter(FilterCallCache* cache, Oid table_oid, text* column_name,
+                                      Oid value_type) {
+    const char* name = VARDATA_ANY(column_name);
+    size_t name_len = VARSIZE_ANY_EXHDR(column_name);
+
+    // A probe sees the keys its own transaction's triggers have deferred.
+    // Applying them can grow the filter, so the generation is read after
+    if (cache->valid && cache->table_oid == table_oid && cache->value_type == value_type &&
+        strlen(cache->column_name) == name_len &&
+        memcmp(cache->column_name, name, name_len) == 0) {
+        apply_deferred_adds(table_oid, cache->attnum);
+        apply_partition_deferred_adds(&cache->partitions);
+        if (cache->generation == get_bloom_registry_generation()) {
+            return cache->filter;
+        }
+    }
+
     char* col_name = text_to_cstring(column_name);
     int16_t attnum = get_attnum(table_oid, col_name);
     
@@ -80,89 +304,1084 @@ Datum octo_bloom_might_contain(PG_FUNCTION_ARGS) {
                  errmsg("column \"%s\" does not exist", col_name)));
     }
     
-    OctoBloomFilter* filter = get_bloom_filter(table_oid, attnum);
-    if (!filter) {
-        PG_RETURN_BOOL(true); // If no filter, assume might contain
-    }
+    apply_deferred_adds(table_oid, attnum);
+    uint64_t generation = get_bloom_registry_generation();
+    BloomKeyType column_key_type;
+    FilterBackend* filter = get_bloom_filter(table_oid, attnum, &column_key_type);
 
     // Check if filter is valid (basic validation)
-    if (filter->getBitArraySize() == 0) {
-        PG_RETURN_BOOL(true); // Invalid filter
+    if (filter && filter->getMemoryUsage() == 0) {
+        filter = nullptr;
+    }
+    if (filter) {
+        bloom_key_type_for_probe(value_type, &column_key_type, &cache->key_type);
     }
 
-    // Convert value to text for hashing
-    text* value_text = DatumGetTextP(value);
-    if (!value_text) {
-        PG_RETURN_BOOL(true);
+    if (cache->partitions.partitions) {
+        pfree(cache->partitions.partitions);
+        pfree(cache->partitions.h1);
+        pfree(cache->partitions.h2);
+        memset(&cache->partitions, 0, sizeof(cache->partitions));
+    }
+    if (!filter && get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE) {
+        resolve_partition_filters(table_oid, col_name, value_type, GetMemoryChunkContext(cache),
+                                  &cache->partitions, &generation);
     }
 
-    bool might_contain = filter->mightContain(VARDATA(value_text), VARSIZE(value_text) - VARHDRSZ);
+    // Column names longer than NAMEDATALEN can't exist, so they never get here
+    cache->valid = true;
+    cache->table_oid = table_oid;
+    strlcpy(cache->column_name, col_name, NAMEDATALEN);
+    cache->attnum = attnum;
+    cache->value_type = value_type;
+    cache->generation = generation;
+    cache->filter = filter;
+    cache->counters = filter ? get_bloom_filter_counters(table_oid, attnum) : NULL;
+    pfree(col_name);
 
-    PG_RETURN_BOOL(might_contain);
+    return filter;
 }
 
-Datum octo_bloom_exists(PG_FUNCTION_ARGS) {
+Datum octo_bloom_might_contain(PG_FUNCTION_ARGS) {
     Oid table_oid = PG_GETARG_OID(0);
-    text* column_name = PG_GETARG_TEXT_P(1);
+    text* column_name = PG_GETARG_TEXT_PP(1);
     Datum value = PG_GETARG_DATUM(2);
-    Oid value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
-    
-    // First check with bloom filter
-    bool might_contain = DatumGetBool(octo_bloom_might_contain(fcinfo));
     
-    if (!might_contain) {
-        PG_RETURN_BOOL(false);
+    FilterCallCache* cache = fn_extra_cache(fcinfo);
+    FilterBackend* filter = lookup_filter(cache, table_oid, column_name,
+                                            get_fn_expr_argtype(fcinfo->flinfo, 2));
+    if (!filter && cache->partitions.num_partitions > 0) {
+        PG_RETURN_BOOL(probe_partition_filters(&cache->partitions, value, NULL));
     }
-    
-    // If bloom filter says might contain, verify with actual query
-    char* col_name = text_to_cstring(column_name);
-    char* table_name = get_rel_name(table_oid);
-    
-    // Connect to SPI
-    if (SPI_connect() != SPI_OK_CONNECT) {
+    if (!filter) {
+        PG_RETURN_BOOL(true); // If no filter, assume might contain
+    }
+
+    BloomKey key;
+    bloom_key_from_datum(&cache->key_type, value, &key);
+    bool might_contain = filter->mightContain(key.data, key.length);
+    bloom_key_release(&key);
+    bloom_count_lookups(cache->counters, 1, !might_contain);
+
+    PG_RETURN_BOOL(might_contain);
+}
+
+// Call site cache of octo_bloom_might_contain over a composite key, kept
+// like FilterCallCache. The definition's epoch guards part_types
+typedef struct CompositeCallCache {
+    bool valid;
+    Oid table_oid;
+    ArrayType* keys;  // As last passed
+    int16_t attnum;  // 0: no composite filter over the keys
+    uint64_t generation;
+    uint64_t epoch;
+    FilterBackend* filter;
+    BloomFilterCounters* counters;
+    int num_parts;
+    BloomKeyType part_types[OCTO_BLOOM_MAX_KEY_PARTS];  // Of the filter's parts
+    Oid value_types[OCTO_BLOOM_MAX_KEY_PARTS];  // Of the values last passed
+    BloomKeyType probe_types[OCTO_BLOOM_MAX_KEY_PARTS];  // For hashing those
+} CompositeCallCache;
+
+static FilterBackend* lookup_composite_filter(FunctionCallInfo fcinfo, Oid table_oid,
+                                              ArrayType* keys) {
+    CompositeCallCache* cache = (CompositeCallCache*)fcinfo->flinfo->fn_extra;
+    if (!cache) {
+        cache = (CompositeCallCache*)MemoryContextAllocZero(fcinfo->flinfo->fn_mcxt,
+                                                            sizeof(CompositeCallCache));
+        fcinfo->flinfo->fn_extra = cache;
+    }
+
+    if (cache->valid && cache->table_oid == table_oid && VARSIZE(cache->keys) == VARSIZE(keys) &&
+        memcmp(cache->keys, keys, VARSIZE(keys)) == 0) {
+        if (cache->attnum != InvalidAttrNumber) {
+            apply_deferred_adds(table_oid, cache->attnum);
+        }
+        if (cache->generation == get_bloom_registry_generation() &&
+            cache->epoch == composite_key_epoch()) {
+            return cache->filter;
+        }
+    }
+
+    uint64_t epoch = composite_key_epoch();
+    Relation rel = table_open(table_oid, AccessShareLock);
+    int16_t attnum = find_composite_key(rel, keys);
+    table_close(rel, AccessShareLock);
+
+    FilterBackend* filter = nullptr;
+    uint64_t generation = get_bloom_registry_generation();
+    const CompositeKey* key = NULL;
+    if (attnum != InvalidAttrNumber) {
+        apply_deferred_adds(table_oid, attnum);
+        generation = get_bloom_registry_generation();
+        filter = get_bloom_filter(table_oid, attnum, NULL);
+        key = get_composite_key(table_oid, attnum);
+    }
+    // An out-of-date definition's filter is not maintained
+    if (!key || (filter && filter->getMemoryUsage() == 0)) {
+        filter = nullptr;
+    }
+
+    if (cache->keys) {
+        pfree(cache->keys);
+    }
+    cache->keys = (ArrayType*)MemoryContextAlloc(fcinfo->flinfo->fn_mcxt, VARSIZE(keys));
+    memcpy(cache->keys, keys, VARSIZE(keys));
+    cache->valid = true;
+    cache->table_oid = table_oid;
+    cache->attnum = attnum;
+    cache->generation = generation;
+    cache->epoch = epoch;
+    cache->filter = filter;
+    cache->counters = filter ? get_bloom_filter_counters(table_oid, attnum) : NULL;
+    cache->num_parts = key ? key->num_parts : 0;
+    for (int i = 0; i < cache->num_parts; ++i) {
+        cache->part_types[i] = key->part_types[i];
+        cache->value_types[i] = InvalidOid;
+    }
+    return filter;
+}
+
+// The values a composite probe passes from argument first on: each one, or
+// the fields of a single row, or the elements of an array passed VARIADIC.
+// Returns how many, or -1 if one is null
+static int composite_probe_values(FunctionCallInfo fcinfo, int first, Datum* values,
+                                  Oid* types) {
+    int count = PG_NARGS() - first;
+
+    if (get_fn_expr_variadic(fcinfo->flinfo)) {
+        ArrayType* array = PG_GETARG_ARRAYTYPE_P(first);
+        Oid elem_type = ARR_ELEMTYPE(array);
+        int16 elem_len;
+        bool elem_byval;
+        char elem_align;
+        Datum* elems;
+        bool* nulls;
+        get_typlenbyvalalign(elem_type, &elem_len, &elem_byval, &elem_align);
+        deconstruct_array(array, elem_type, elem_len, elem_byval, elem_align, &elems, &nulls,
+                          &count);
+        if (count > OCTO_BLOOM_MAX_KEY_PARTS) {
+            return count;
+        }
+        for (int i = 0; i < count; ++i) {
+            if (nulls[i]) {
+                return -1;
+            }
+            values[i] = elems[i];
+            types[i] = elem_type;
+        }
+        return count;
+    }
+
+    Oid first_type = get_fn_expr_argtype(fcinfo->flinfo, first);
+    if (count == 1 && type_is_rowtype(first_type)) {
+        HeapTupleHeader row = PG_GETARG_HEAPTUPLEHEADER(first);
+        TupleDesc tupdesc = lookup_rowtype_tupdesc(HeapTupleHeaderGetTypeId(row),
+                                                   HeapTupleHeaderGetTypMod(row));
+        HeapTupleData tuple;
+        tuple.t_len = HeapTupleHeaderGetDatumLength(row);
+        ItemPointerSetInvalid(&tuple.t_self);
+        tuple.t_tableOid = InvalidOid;
+        tuple.t_data = row;
+
+        count = 0;
+        bool complete = true;
+        for (int i = 0; i < tupdesc->natts && complete; ++i) {
+            Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
+            if (attr->attisdropped) {
+                continue;
+            }
+            if (count == OCTO_BLOOM_MAX_KEY_PARTS) {
+                count++;
+                break;
+            }
+            bool isnull;
+            values[count] = heap_getattr(&tuple, i + 1, tupdesc, &isnull);
+            types[count] = attr->atttypid;
+            complete = !isnull;
+            count++;
+        }
+        ReleaseTupleDesc(tupdesc);
+        return complete ? count : -1;
+    }
+
+    for (int i = 0; i < count && i < OCTO_BLOOM_MAX_KEY_PARTS; ++i) {
+        if (PG_ARGISNULL(first + i)) {
+            return -1;
+        }
+        values[i] = PG_GETARG_DATUM(first + i);
+        types[i] = get_fn_expr_argtype(fcinfo->flinfo, first + i);
+    }
+    return count;
+}
+
+// octo_bloom_might_contain(table, keys, VARIADIC "any"): the key's parts in
+// order, or one row holding them. Null if a part is null
+Datum octo_bloom_might_contain_composite(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    ArrayType* keys = PG_GETARG_ARRAYTYPE_P(1);
+
+    Datum values[OCTO_BLOOM_MAX_KEY_PARTS];
+    Oid types[OCTO_BLOOM_MAX_KEY_PARTS];
+    int count = composite_probe_values(fcinfo, 2, values, types);
+    if (count < 0) {
+        PG_RETURN_NULL();
+    }
+
+    FilterBackend* filter = lookup_composite_filter(fcinfo, table_oid, keys);
+    if (!filter) {
+        PG_RETURN_BOOL(true); // If no filter, assume might contain
+    }
+    CompositeCallCache* cache = (CompositeCallCache*)fcinfo->flinfo->fn_extra;
+    if (count != cache->num_parts) {
         ereport(ERROR,
-                (errcode(ERRCODE_INTERNAL_ERROR),
-                 errmsg("SPI_connect failed")));
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("the filter key has %d parts, but %d values were given",
+                        cache->num_parts, count)));
     }
-    
+
+    // The key is hashed as the trigger hashed the row's, one part at a time
+    uint64_t digest = bloom_key_digest_start();
+    for (int i = 0; i < count; ++i) {
+        Datum value = values[i];
+        Oid type = types[i];
+        // Untyped literals are read as the part's type
+        if (type == UNKNOWNOID) {
+            Oid input;
+            Oid ioparam;
+            getTypeInputInfo(cache->part_types[i].typid, &input, &ioparam);
+            type = cache->part_types[i].typid;
+            value = OidInputFunctionCall(input, DatumGetCString(value), ioparam, -1);
+        }
+        if (cache->value_types[i] != type) {
+            bloom_key_type_for_probe(type, &cache->part_types[i], &cache->probe_types[i]);
+            cache->value_types[i] = type;
+        }
+        digest = bloom_key_digest_fold(digest, &cache->probe_types[i], value);
+    }
+
+    BloomKey key;
+    bloom_key_from_digest(digest, &key);
+    bool might_contain = filter->mightContain(key.data, key.length);
+    bloom_count_lookups(cache->counters, 1, !might_contain);
+
+    PG_RETURN_BOOL(might_contain);
+}
+
+// Probe every non-null element of an array against the filter in one batch,
+// or against the leaves' filters of a partitioned table. Null elements are
+// reported through nulls; elements are left deconstructed in *elems for
+// callers that return them.
+static bool* probe_array(FilterBackend* filter, const FilterCallCache* cache,
+                         ArrayType* values, Datum** elems, bool** nulls, int* count) {
+    Oid elem_type = ARR_ELEMTYPE(values);
+    int16 elem_len;
+    bool elem_byval;
+    char elem_align;
+
+    get_typlenbyvalalign(elem_type, &elem_len, &elem_byval, &elem_align);
+    deconstruct_array(values, elem_type, elem_len, elem_byval, elem_align,
+                      elems, nulls, count);
+
+    int n = *count;
+    bool* results = (bool*)palloc(sizeof(bool) * Max(n, 1));
+
+    if (!filter && cache->partitions.num_partitions > 0) {
+        for (int i = 0; i < n; ++i) {
+            results[i] = !(*nulls)[i] &&
+                         probe_partition_filters(&cache->partitions, (*elems)[i], NULL);
+        }
+        return results;
+    }
+    if (!filter) {
+        for (int i = 0; i < n; ++i) {
+            results[i] = true; // If no filter, assume might contain
+        }
+        return results;
+    }
+    const BloomKeyType* key_type = &cache->key_type;
+
+    const void** keys = (const void**)palloc(sizeof(void*) * Max(n, 1));
+    size_t* lengths = (size_t*)palloc(sizeof(size_t) * Max(n, 1));
+    bool* batch_results = (bool*)palloc(sizeof(bool) * Max(n, 1));
+    BloomKey* batch_keys = (BloomKey*)palloc(sizeof(BloomKey) * Max(n, 1));
+    int batch_count = 0;
+
+    // Key bytes of every non-null element, mostly pointing into the array
+    for (int i = 0; i < n; ++i) {
+        if ((*nulls)[i]) {
+            continue;
+        }
+        BloomKey* key = &batch_keys[batch_count];
+        bloom_key_from_datum(key_type, (*elems)[i], key);
+        keys[batch_count] = key->data;
+        lengths[batch_count] = key->length;
+        batch_count++;
+    }
+
+    filter->mightContainBatch(keys, lengths, batch_count, batch_results);
+
+    int negatives = 0;
+    for (int i = 0; i < batch_count; ++i) {
+        negatives += !batch_results[i];
+    }
+    bloom_count_lookups(cache->counters, batch_count, negatives);
+
+    for (int i = 0; i < batch_count; ++i) {
+        bloom_key_release(&batch_keys[i]);
+    }
+    pfree(batch_keys);
+
+    for (int i = 0, j = 0; i < n; ++i) {
+        results[i] = (*nulls)[i] ? false : batch_results[j++];
+    }
+
+    pfree(keys);
+    pfree(lengths);
+    pfree(batch_results);
+    return results;
+}
+
+Datum octo_bloom_might_contain_array(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_PP(1);
+    ArrayType* values = PG_GETARG_ARRAYTYPE_P(2);
+
+    FilterCallCache* cache = fn_extra_cache(fcinfo);
+    FilterBackend* filter = lookup_filter(cache, table_oid, column_name, ARR_ELEMTYPE(values));
+
+    Datum* elems;
+    bool* nulls;
+    int count;
+    bool* results = probe_array(filter, cache, values, &elems, &nulls, &count);
+
+    // Same shape as the input; null elements stay null
+    Datum* result_datums = (Datum*)palloc(sizeof(Datum) * Max(count, 1));
+    for (int i = 0; i < count; ++i) {
+        result_datums[i] = BoolGetDatum(results[i]);
+    }
+
+    int ndims = ARR_NDIM(values);
+    int dims[MAXDIM];
+    int lbs[MAXDIM];
+    memcpy(dims, ARR_DIMS(values), sizeof(int) * ndims);
+    memcpy(lbs, ARR_LBOUND(values), sizeof(int) * ndims);
+
+    ArrayType* result = construct_md_array(result_datums, nulls, ndims, dims, lbs,
+                                           BOOLOID, 1, true, TYPALIGN_CHAR);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+typedef struct MightContainSetState {
+    Datum* elems;
+    bool* nulls;
+    bool* results;
+} MightContainSetState;
+
+Datum octo_bloom_might_contain_set(PG_FUNCTION_ARGS) {
+    FuncCallContext* funcctx;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context "
+                            "that cannot accept type record")));
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        Oid table_oid = PG_GETARG_OID(0);
+        text* column_name = PG_GETARG_TEXT_PP(1);
+        ArrayType* values = PG_GETARG_ARRAYTYPE_P(2);
+
+        // Resolve the filter and probe everything once, then stream the rows.
+        // fn_extra belongs to the SRF machinery here, so the cache is one-shot.
+        FilterCallCache* cache = (FilterCallCache*)palloc0(sizeof(FilterCallCache));
+        FilterBackend* filter = lookup_filter(cache, table_oid, column_name, ARR_ELEMTYPE(values));
+
+        MightContainSetState* state = (MightContainSetState*)palloc(sizeof(MightContainSetState));
+        int count;
+        state->results = probe_array(filter, cache, values,
+                                     &state->elems, &state->nulls, &count);
+        funcctx->max_calls = count;
+        funcctx->user_fctx = state;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    MightContainSetState* state = (MightContainSetState*)funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        uint64 i = funcctx->call_cntr;
+        Datum values[2];
+        bool isnull[2];
+
+        values[0] = state->elems[i];
+        isnull[0] = state->nulls[i];
+        values[1] = BoolGetDatum(state->results[i]);
+        isnull[1] = state->nulls[i];
+
+        HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+// Whether any element of an array might be present: the planner's runtime
+// check on IN lists (planner_hook.cpp)
+Datum octo_bloom_might_contain_any(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_PP(1);
+    ArrayType* values = PG_GETARG_ARRAYTYPE_P(2);
+
+    FilterCallCache* cache = fn_extra_cache(fcinfo);
+    FilterBackend* filter = lookup_filter(cache, table_oid, column_name, ARR_ELEMTYPE(values));
+
+    Datum* elems;
+    bool* nulls;
+    int count;
+    bool* results = probe_array(filter, cache, values, &elems, &nulls, &count);
+
+    bool any = false;
+    for (int i = 0; i < count && !any; ++i) {
+        any = results[i];
+    }
+    PG_RETURN_BOOL(any);
+}
+
+// The non-null elements of an array that might be present, as a
+// one-dimensional array: the planner puts it in front of index scans on IN
+// lists, so keys the filter rules out are never looked up
+Datum octo_bloom_filter_values(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_PP(1);
+    ArrayType* values = PG_GETARG_ARRAYTYPE_P(2);
+    Oid elem_type = ARR_ELEMTYPE(values);
+
+    FilterCallCache* cache = fn_extra_cache(fcinfo);
+    FilterBackend* filter = lookup_filter(cache, table_oid, column_name, elem_type);
+
+    Datum* elems;
+    bool* nulls;
+    int count;
+    bool* results = probe_array(filter, cache, values, &elems, &nulls, &count);
+
+    int kept = 0;
+    for (int i = 0; i < count; ++i) {
+        if (results[i]) {
+            elems[kept++] = elems[i];
+        }
+    }
+
+    int16 elem_len;
+    bool elem_byval;
+    char elem_align;
+    get_typlenbyvalalign(elem_type, &elem_len, &elem_byval, &elem_align);
+    ArrayType* result = kept > 0 ? construct_array(elems, kept, elem_type, elem_len, elem_byval,
+                                                   elem_align)
+                                 : construct_empty_array(elem_type);
+    PG_RETURN_ARRAYTYPE_P(result);
+}
+
+// Per-backend cache of verification plans for octo_bloom_exists, kept with
+// SPI_keepplan. Entries are marked stale by relcache invalidation (renames,
+// drops, ALTER TABLE) and re-prepared on next use rather than freed inside
+// the callback, which can run while the plan is executing.
+typedef struct ExistsPlanKey {
+    Oid table_oid;
+    int16_t attnum;
+    Oid value_type;
+} ExistsPlanKey;
+
+typedef struct ExistsPlanEntry {
+    ExistsPlanKey key;
+    SPIPlanPtr plan;
+    bool valid;
+} ExistsPlanEntry;
+
+static HTAB* exists_plan_cache = NULL;
+
+static void exists_plan_cache_invalidate(Datum arg, Oid relid) {
+    HASH_SEQ_STATUS status;
+    ExistsPlanEntry* entry;
+
+    hash_seq_init(&status, exists_plan_cache);
+    while ((entry = (ExistsPlanEntry*)hash_seq_search(&status)) != NULL) {
+        if (relid == InvalidOid || entry->key.table_oid == relid) {
+            entry->valid = false;
+        }
+    }
+}
+
+// Must be called inside an SPI connection
+static SPIPlanPtr get_exists_plan(Oid table_oid, int16_t attnum, Oid value_type) {
+    if (!exists_plan_cache) {
+        HASHCTL info;
+        memset(&info, 0, sizeof(info));
+        info.keysize = sizeof(ExistsPlanKey);
+        info.entrysize = sizeof(ExistsPlanEntry);
+        exists_plan_cache = hash_create("octo_bloom exists plans", 16, &info,
+                                        HASH_ELEM | HASH_BLOBS);
+        CacheRegisterRelcacheCallback(exists_plan_cache_invalidate, (Datum)0);
+    }
+
+    ExistsPlanKey key;
+    memset(&key, 0, sizeof(key));
+    key.table_oid = table_oid;
+    key.attnum = attnum;
+    key.value_type = value_type;
+
+    bool found;
+    ExistsPlanEntry* entry = (ExistsPlanEntry*)hash_search(exists_plan_cache, &key,
+                                                           HASH_ENTER, &found);
+    if (found && entry->valid) {
+        return entry->plan;
+    }
+    if (found && entry->plan) {
+        SPI_freeplan(entry->plan);
+    }
+    entry->plan = NULL;
+    entry->valid = false;
+
+    char* table_name = get_rel_name(table_oid);
+    char* schema_name = get_namespace_name(get_rel_namespace(table_oid));
+    char* col_name = get_attname(table_oid, attnum, false);
+
     StringInfoData query;
     initStringInfo(&query);
     appendStringInfo(&query, "SELECT 1 FROM %s WHERE %s = $1 LIMIT 1",
-                     quote_identifier(table_name),
+                     quote_qualified_identifier(schema_name, table_name),
                      quote_identifier(col_name));
-    
+
     Oid param_types[1] = {value_type};
-    Datum param_values[1] = {value};
-    
     SPIPlanPtr plan = SPI_prepare(query.data, 1, param_types);
     if (plan == NULL) {
-        SPI_finish();
         ereport(ERROR,
                 (errcode(ERRCODE_INTERNAL_ERROR),
-                 errmsg("SPI_prepare failed")));
+                 errmsg("SPI_prepare failed: %s", SPI_result_code_string(SPI_result))));
+    }
+    if (SPI_keepplan(plan) != 0) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_keepplan failed")));
+    }
+    pfree(query.data);
+
+    entry->plan = plan;
+    entry->valid = true;
+    return plan;
+}
+
+// A positive the table was asked about, and whether it had the value
+static void count_exists(BloomFilterCounters* counters, bool confirmed) {
+    if (counters) {
+        bloom_counter_add(confirmed ? &counters->exists_confirmed : &counters->exists_false, 1);
+    }
+}
+
+Datum octo_bloom_exists(PG_FUNCTION_ARGS) {
+    if (PG_ARGISNULL(0) || PG_ARGISNULL(1)) {
+        PG_RETURN_NULL();
+    }
+    if (PG_ARGISNULL(2)) {
+        PG_RETURN_BOOL(false); // NULL never equals a stored value
+    }
+
+    Oid table_oid = PG_GETARG_OID(0);
+    Datum value = PG_GETARG_DATUM(2);
+    Oid value_type = get_fn_expr_argtype(fcinfo->flinfo, 2);
+
+    FilterCallCache* cache = fn_extra_cache(fcinfo);
+    FilterBackend* filter = lookup_filter(cache, table_oid, PG_GETARG_TEXT_PP(1), value_type);
+    const PartitionFilterSet* partitions = &cache->partitions;
+
+    // First check with bloom filter; for a partitioned table, each leaf's
+    bool* candidates = NULL;
+    if (!filter && partitions->num_partitions > 0) {
+        candidates = (bool*)palloc(sizeof(bool) * partitions->num_partitions);
+        if (!probe_partition_filters(partitions, value, candidates)) {
+            PG_RETURN_BOOL(false);
+        }
+    } else if (filter) {
+        BloomKey key;
+        bloom_key_from_datum(&cache->key_type, value, &key);
+        bool might_contain = filter->mightContain(key.data, key.length);
+        bloom_key_release(&key);
+        bloom_count_lookups(cache->counters, 1, !might_contain);
+        if (!might_contain) {
+            PG_RETURN_BOOL(false);
+        }
     }
     
+    // Connect to SPI
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+    
+    Datum param_values[1] = {value};
     bool exists = false;
-    int ret = SPI_execute_plan(plan, param_values, NULL, true, 0);
-    if (ret == SPI_OK_SELECT && SPI_processed > 0) {
-        exists = true;
+    if (candidates) {
+        // Verify against the leaves that might hold the value, not the parent
+        for (int i = 0; i < partitions->num_partitions && !exists; ++i) {
+            if (!candidates[i]) {
+                continue;
+            }
+            const PartitionFilter* p = &partitions->partitions[i];
+            SPIPlanPtr plan = get_exists_plan(p->table_oid, p->attnum, value_type);
+            int ret = SPI_execute_plan(plan, param_values, NULL, true, 1);
+            exists = ret == SPI_OK_SELECT && SPI_processed > 0;
+            count_exists(p->counters, exists);
+        }
+    } else {
+        // If bloom filter says might contain, verify with actual query
+        SPIPlanPtr plan = get_exists_plan(table_oid, cache->attnum, value_type);
+        int ret = SPI_execute_plan(plan, param_values, NULL, true, 1);
+        exists = ret == SPI_OK_SELECT && SPI_processed > 0;
+        count_exists(cache->counters, exists);
     }
     
-    SPI_freeplan(plan);
-    pfree(query.data);
     SPI_finish();
     
     PG_RETURN_BOOL(exists);
 }
 
-// Other function implementations would follow similar patterns...
+Datum octo_bloom_disable(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_P(1);
 
-void _PG_init(void) {
-    // Extension initialization - shared memory will be initialized on first use
+    char* col_name = text_to_cstring(column_name);
+    int16_t attnum = get_attnum(table_oid, col_name);
+
+    if (attnum == InvalidAttrNumber) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_COLUMN),
+                 errmsg("column \"%s\" does not exist", col_name)));
+    }
+
+    if (get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE) {
+        disable_partitioned_filter(table_oid, col_name,
+                                   get_func_namespace(fcinfo->flinfo->fn_oid));
+    }
+    unregister_bloom_filter(table_oid, attnum);
+
+    PG_RETURN_VOID();
+}
+
+Datum octo_bloom_disable_composite(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    ArrayType* keys = PG_GETARG_ARRAYTYPE_P(1);
+
+    Relation rel = table_open(table_oid, AccessShareLock);
+    int16_t attnum = find_composite_key(rel, keys);
+    table_close(rel, AccessShareLock);
+
+    if (attnum == InvalidAttrNumber) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                 errmsg("no composite bloom filter on those keys of \"%s\"",
+                        get_rel_name(table_oid))));
+    }
+
+    forget_composite_key(table_oid, attnum);
+    unregister_bloom_filter(table_oid, attnum);
+
+    PG_RETURN_VOID();
 }
 
-void _PG_fini(void) {
-    // Cleanup code if needed
+Datum octo_bloom_replicate(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_P(1);
+
+    char* col_name = text_to_cstring(column_name);
+    int16_t attnum = get_attnum(table_oid, col_name);
+
+    if (attnum == InvalidAttrNumber) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_COLUMN),
+                 errmsg("column \"%s\" does not exist", col_name)));
+    }
+
+    if (get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE) {
+        Oid* leaves;
+        int16_t* attnums;
+        int count = get_partition_leaves(table_oid, col_name, &leaves, &attnums);
+        for (int i = 0; i < count; ++i) {
+            if (get_bloom_filter(leaves[i], attnums[i], NULL)) {
+                replicate_bloom_filter(leaves[i], attnums[i]);
+            }
+        }
+        PG_RETURN_VOID();
+    }
+    replicate_bloom_filter(table_oid, attnum);
+
+    PG_RETURN_VOID();
+}
+
+Datum octo_bloom_copy_to_nodes(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    text* column_name = PG_GETARG_TEXT_P(1);
+    bool enabled = PG_GETARG_BOOL(2);
+
+    char* col_name = text_to_cstring(column_name);
+    int16_t attnum = get_attnum(table_oid, col_name);
+
+    if (attnum == InvalidAttrNumber) {
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_COLUMN),
+                 errmsg("column \"%s\" does not exist", col_name)));
+    }
+
+    if (get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE) {
+        Oid* leaves;
+        int16_t* attnums;
+        int count = get_partition_leaves(table_oid, col_name, &leaves, &attnums);
+        for (int i = 0; i < count; ++i) {
+            if (get_bloom_filter(leaves[i], attnums[i], NULL)) {
+                set_bloom_filter_node_copies(leaves[i], attnums[i], enabled);
+            }
+        }
+        PG_RETURN_VOID();
+    }
+    set_bloom_filter_node_copies(table_oid, attnum, enabled);
+
+    PG_RETURN_VOID();
+}
+
+// Words of a Bloom filter's array octo_bloom_status popcounts at most:
+// 128kB, in runs spread over the array, whatever its size
+#define OCTO_BLOOM_STATUS_SAMPLE_WORDS (16 * 1024)
+
+// The filter_type octo_bloom_init was given for params
+static const char* filter_type_name(const BloomFilterParams& params) {
+    switch (params.kind) {
+        case FilterKind::Cuckoo:
+            return "cuckoo";
+        case FilterKind::Scalable:
+            return "scalable";
+        case FilterKind::Bloom:
+            break;
+    }
+    switch (params.layout) {
+        case BloomLayout::Blocked:
+            return "blocked";
+        case BloomLayout::Counting:
+            return "counting";
+        case BloomLayout::Standard:
+            break;
+    }
+    return "standard";
+}
+
+#define FILTER_STATUS_COLUMNS 24
+
+// One row per filter of this database, for the octo_bloom_status view
+Datum octo_bloom_status(PG_FUNCTION_ARGS) {
+    FuncCallContext* funcctx;
+
+    if (SRF_IS_FIRSTCALL()) {
+        funcctx = SRF_FIRSTCALL_INIT();
+        MemoryContext oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);
+
+        TupleDesc tupdesc;
+        if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("function returning record called in context "
+                            "that cannot accept type record")));
+        }
+        funcctx->tuple_desc = BlessTupleDesc(tupdesc);
+
+        BloomFilterStatus* rows;
+        funcctx->max_calls = get_bloom_filter_status(&rows);
+        funcctx->user_fctx = rows;
+
+        MemoryContextSwitchTo(oldcontext);
+    }
+
+    funcctx = SRF_PERCALL_SETUP();
+    BloomFilterStatus* rows = (BloomFilterStatus*)funcctx->user_fctx;
+
+    if (funcctx->call_cntr < funcctx->max_calls) {
+        const BloomFilterStatus* row = &rows[funcctx->call_cntr];
+        const BloomFilterParams& params = row->params;
+        Datum values[FILTER_STATUS_COLUMNS];
+        bool isnull[FILTER_STATUS_COLUMNS];
+        memset(isnull, 0, sizeof(isnull));
+
+        values[0] = ObjectIdGetDatum(row->table_oid);
+        values[1] = Int16GetDatum(row->attnum);
+        values[2] = CStringGetTextDatum(filter_type_name(params));
+        values[3] = Int32GetDatum(row->num_stages);
+        values[4] = BoolGetDatum(row->resizing);
+        values[5] = Int64GetDatum((int64)row->bytes);
+        // Stages of a scalable filter each have their own
+        values[6] = Int32GetDatum((int32)params.num_hashes);
+        isnull[6] = params.kind != FilterKind::Bloom;
+        values[7] = Int64GetDatum((int64)params.expected_count);
+        values[8] = Float8GetDatum(params.false_positive_rate);
+        values[9] = Int64GetDatum((int64)row->count);
+
+        // Read from the storage now, without locks; a filter dropped since
+        // the registry was read has nothing to show
+        FilterBackend* filter = get_bloom_filter(row->table_oid, row->attnum, NULL);
+        if (filter) {
+            FilterFillEstimate fill = filter->estimateFill(OCTO_BLOOM_STATUS_SAMPLE_WORDS);
+            values[10] = Float8GetDatum(fill.saturation);
+            values[11] = Int64GetDatum((int64)fill.cardinality);
+            values[12] = Float8GetDatum(fill.false_positive_rate);
+        } else {
+            isnull[10] = isnull[11] = isnull[12] = true;
+        }
+
+        values[13] = Int64GetDatum((int64)row->lookups);
+        values[14] = Int64GetDatum((int64)row->negatives);
+        values[15] = Int64GetDatum((int64)row->exists_confirmed);
+        values[16] = Int64GetDatum((int64)row->exists_false);
+        values[17] = Int64GetDatum((int64)row->adds);
+        values[18] = Int64GetDatum((int64)row->removes);
+        for (int i = 13; i <= 18; ++i) {
+            isnull[i] = !row->has_counters;
+        }
+
+        values[19] = Int64GetDatum((int64)row->rebuilds);
+        values[20] = TimestampTzGetDatum(row->last_rebuild);
+        values[21] = Float8GetDatum(row->last_rebuild_ms);
+        values[22] = Float8GetDatum(row->total_rebuild_ms);
+        isnull[20] = isnull[21] = row->rebuilds == 0;
+        values[23] = Int32GetDatum(row->node_copies);
+
+        HeapTuple tuple = heap_form_tuple(funcctx->tuple_desc, values, isnull);
+        SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(tuple));
+    }
+
+    SRF_RETURN_DONE(funcctx);
+}
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+static void octo_bloom_shmem_startup(void) {
+    if (prev_shmem_startup_hook) {
+        prev_shmem_startup_hook();
+    }
+    init_shared_memory();
+}
+
+#if PG_VERSION_NUM >= 150000
+static shmem_request_hook_type prev_shmem_request_hook = NULL;
+
+static void octo_bloom_shmem_request(void) {
+    if (prev_shmem_request_hook) {
+        prev_shmem_request_hook();
+    }
+    request_shared_resources();
+}
+#endif
+
+void _PG_init(void) {
+    // When preloaded, shared memory is reserved and set up at startup;
+    // otherwise it is attached lazily on first use
+
+    // Choose the blocked-layout probe kernel for this CPU
+    bloom_select_block_kernel();
+    elog(DEBUG1, "octo_bloom: using %s block probe kernel", bloom_block_kernel->name);
+
+    DefineCustomIntVariable("octo_bloom.max_filters",
+                            "Maximum number of bloom filters across all databases.",
+                            NULL,
+                            &octo_bloom_max_filters,
+                            64, 1, 65536,
+                            PGC_POSTMASTER,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("octo_bloom.shared_memory_mb",
+                            "Shared memory available for bloom filter bit arrays.",
+                            NULL,
+                            &octo_bloom_shared_memory_mb,
+                            1024, 1, INT_MAX / 2,
+                            PGC_POSTMASTER,
+                            GUC_UNIT_MB,
+                            NULL, NULL, NULL);
+
+    DefineCustomEnumVariable("octo_bloom.hash_algorithm",
+                             "Key hash used by newly created bloom filters.",
+                             "Existing filters keep the hash they were created with.",
+                             &octo_bloom_hash_algorithm,
+                             static_cast<int>(BloomHash::Wy128),
+                             hash_algorithm_options,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomEnumVariable("octo_bloom.index_reduction",
+                             "How newly created bloom filters map hashes to bit indexes.",
+                             "pow2 rounds the filter size up to a power of two; "
+                             "pg_hash_fnv filters always use modulo.",
+                             &octo_bloom_index_reduction,
+                             static_cast<int>(BloomReduction::FastRange),
+                             index_reduction_options,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("octo_bloom.defer_maintenance",
+                             "Apply trigger changes to bloom filters when the transaction commits.",
+                             "Keys of rows that roll back then never reach a filter.",
+                             &octo_bloom_defer_maintenance,
+                             true,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomIntVariable("octo_bloom.max_deferred_keys",
+                            "Most keys a transaction defers before applying its adds early.",
+                            "Deferred removes past the limit are dropped, leaving their keys "
+                            "in the filter until it is rebuilt.",
+                            &octo_bloom_max_deferred_keys,
+                            1000000, 1, 100000000,
+                            PGC_USERSET,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("octo_bloom.maintenance_worker",
+                             "Start a background worker that resizes and compacts bloom filters.",
+                             NULL,
+                             &octo_bloom_maintenance_worker,
+                             true,
+                             PGC_POSTMASTER,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomIntVariable("octo_bloom.node_copy_refresh_ms",
+                            "Time between the maintenance launcher's refreshes of NUMA node copies.",
+                            "Node copies written behind aren't probed until refreshed.",
+                            &octo_bloom_node_copy_refresh_ms,
+                            1000, 10, 3600 * 1000,
+                            PGC_SIGHUP,
+                            GUC_UNIT_MS,
+                            NULL, NULL, NULL);
+
+    DefineCustomIntVariable("octo_bloom.maintenance_naptime",
+                            "Time between the maintenance worker's checks of every filter.",
+                            "Filters past octo_bloom.resize_threshold or "
+                            "octo_bloom.compact_stages are seen to as soon as a "
+                            "transaction adding to them commits.",
+                            &octo_bloom_maintenance_naptime,
+                            300, 1, INT_MAX / 1000,
+                            PGC_SIGHUP,
+                            GUC_UNIT_S,
+                            NULL, NULL, NULL);
+
+    DefineCustomRealVariable("octo_bloom.resize_threshold",
+                             "Keys held, as a fraction of expected_count, at which a filter is resized.",
+                             "0 disables resizing on the key count.",
+                             &octo_bloom_resize_threshold,
+                             1.0, 0.0, 100.0,
+                             PGC_SIGHUP,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomRealVariable("octo_bloom.saturation_threshold",
+                             "Fraction of bits set at which a bloom filter is resized.",
+                             "Checked every octo_bloom.maintenance_naptime; 0 disables it.",
+                             &octo_bloom_saturation_threshold,
+                             0.6, 0.0, 1.0,
+                             PGC_SIGHUP,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomIntVariable("octo_bloom.compact_stages",
+                            "Stages at which a scalable filter is compacted into one.",
+                            "0 disables compaction by the maintenance worker.",
+                            &octo_bloom_compact_stages,
+                            4, 0, OCTO_BLOOM_MAX_STAGES,
+                            PGC_SIGHUP,
+                            0,
+                            NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("octo_bloom.snapshots",
+                             "Keep bloom filter snapshots on disk and load them at startup.",
+                             "Written after checkpoints and at shutdown; a filter changed since "
+                             "its snapshot was written has to be rebuilt after a crash.",
+                             &octo_bloom_snapshots,
+                             true,
+                             PGC_SIGHUP,
+                             0,
+                             NULL, NULL, NULL);
+
+    DefineCustomBoolVariable("octo_bloom.wal_log",
+                             "Log bloom filter changes to WAL for standbys.",
+                             "Standbys must preload octo_bloom to replay them, and set this "
+                             "too unless octo_bloom.wal_resource_manager is on, as a "
+                             "background worker replays them.",
+                             &octo_bloom_wal_log,
+                             false,
+                             PGC_POSTMASTER,
+                             0,
+                             NULL, NULL, NULL);
+
+#if PG_VERSION_NUM >= 150000
+    DefineCustomBoolVariable("octo_bloom.wal_resource_manager",
+                             "Log bloom filter changes as custom WAL resource manager records.",
+                             "They are replayed by the startup process, crash recovery "
+                             "included, rather than read back by a worker. Uses "
+                             "RM_EXPERIMENTAL_ID, so for development only, and must stay on "
+                             "while WAL written with it may be replayed.",
+                             &octo_bloom_wal_resource_manager,
+                             false,
+                             PGC_POSTMASTER,
+                             0,
+                             NULL, NULL, NULL);
+#endif
+
+    DefineCustomBoolVariable("octo_bloom.planner_pruning",
+                             "Let plans check bloom filters to skip scans and join rows.",
+                             "Only for filters that hold every row of their column, i.e. "
+                             "rebuilt after octo_bloom_init and maintained by triggers. "
+                             "Counting and cuckoo filters are never used.",
+                             &octo_bloom_planner_pruning,
+                             false,
+                             PGC_USERSET,
+                             0,
+                             NULL, NULL, NULL);
+
+#if PG_VERSION_NUM >= 150000
+    MarkGUCPrefixReserved("octo_bloom");
+#else
+    EmitWarningsOnPlaceholders("octo_bloom");
+#endif
+
+    install_planner_hook();
+
+    // Shared memory, the named LWLock tranche and the maintenance
+    // launcher can only be requested while preloading
+    if (!process_shared_preload_libraries_in_progress) {
+        return;
+    }
+
+    prev_shmem_startup_hook = shmem_startup_hook;
+    shmem_startup_hook = octo_bloom_shmem_startup;
+
+#if PG_VERSION_NUM >= 150000
+    prev_shmem_request_hook = shmem_request_hook;
+    shmem_request_hook = octo_bloom_shmem_request;
+#else
+    request_shared_resources();
+#endif
+
+    register_filter_wal();
+
+    if (octo_bloom_maintenance_worker) {
+        register_maintenance_worker();
+    }
 }
 
 } // extern "C"
\ No newline at end of file
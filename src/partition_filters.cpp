@@ -0,0 +1,560 @@
+#include "partition_filters.hpp"
+#include "composite_key.hpp"
+#include "filter_build.hpp"
+#include "trigger_manager.hpp"
+
+extern "C" {
+#include <access/htup_details.h>
+#include <access/xact.h>
+#include <catalog/namespace.h>
+#include <catalog/pg_class.h>
+#include <catalog/pg_inherits.h>
+#include <commands/event_trigger.h>
+#include <nodes/parsenodes.h>
+#include <utils/memutils.h>
+}
+
+// Leaves whose cache misses are kept in flight while probing another
+#define PARTITION_PREFETCH_DISTANCE 8
+
+extern "C" {
+
+int get_partition_leaves(Oid table_oid, const char* column_name, Oid** leaves,
+                         int16_t** attnums) {
+    List* inheritors = find_all_inheritors(table_oid, AccessShareLock, NULL);
+    Oid* leaf_oids = (Oid*)palloc(sizeof(Oid) * Max(list_length(inheritors), 1));
+    int16_t* leaf_attnums = (int16_t*)palloc(sizeof(int16_t) * Max(list_length(inheritors), 1));
+    int count = 0;
+
+    ListCell* lc;
+    foreach (lc, inheritors) {
+        Oid relid = lfirst_oid(lc);
+        char relkind = get_rel_relkind(relid);
+        if (relkind != RELKIND_RELATION && relkind != RELKIND_FOREIGN_TABLE) {
+            continue;
+        }
+        // Partitions have every column of the parent, not always at its attnum
+        int16_t attnum = get_attnum(relid, column_name);
+        if (attnum == InvalidAttrNumber) {
+            continue;
+        }
+        leaf_oids[count] = relid;
+        leaf_attnums[count] = attnum;
+        count++;
+    }
+    list_free(inheritors);
+
+    *leaves = leaf_oids;
+    *attnums = leaf_attnums;
+    return count;
+}
+
+static bool same_key_type(const BloomKeyType* a, const BloomKeyType* b) {
+    return a->typid == b->typid && a->typlen == b->typlen && a->collation == b->collation &&
+           a->kind == b->kind;
+}
+
+void resolve_partition_filters(Oid table_oid, const char* column_name, Oid value_type,
+                               MemoryContext mcxt, PartitionFilterSet* set,
+                               uint64_t* generation) {
+    Oid* leaves;
+    int16_t* attnums;
+    int count = get_partition_leaves(table_oid, column_name, &leaves, &attnums);
+
+    set->num_partitions = count;
+    set->partitions = (PartitionFilter*)MemoryContextAlloc(
+        mcxt, sizeof(PartitionFilter) * Max(count, 1));
+    set->h1 = (uint64_t*)MemoryContextAlloc(mcxt, sizeof(uint64_t) * Max(count, 1));
+    set->h2 = (uint64_t*)MemoryContextAlloc(mcxt, sizeof(uint64_t) * Max(count, 1));
+
+    // Applying deferred keys can grow a filter, so the generation is read
+    // after, and the views taken under it
+    for (int i = 0; i < count; ++i) {
+        apply_deferred_adds(leaves[i], attnums[i]);
+    }
+    *generation = get_bloom_registry_generation();
+
+    for (int i = 0; i < count; ++i) {
+        PartitionFilter* p = &set->partitions[i];
+        p->table_oid = leaves[i];
+        p->attnum = attnums[i];
+        p->hash_source = i;
+
+        BloomKeyType column_key_type;
+        p->filter = get_bloom_filter(p->table_oid, p->attnum, &column_key_type);
+        if (p->filter && p->filter->getMemoryUsage() == 0) {
+            p->filter = nullptr;
+        }
+        p->counters = nullptr;
+        if (!p->filter) {
+            continue;
+        }
+        p->counters = get_bloom_filter_counters(p->table_oid, p->attnum);
+        bloom_key_type_for_probe(value_type, &column_key_type, &p->key_type);
+
+        // Partitions usually share a template, so one hash serves them all
+        BloomHash hash = p->filter->getParams().hash;
+        for (int j = 0; j < i; ++j) {
+            const PartitionFilter* other = &set->partitions[j];
+            if (other->filter && other->hash_source == j &&
+                other->filter->getParams().hash == hash &&
+                same_key_type(&other->key_type, &p->key_type)) {
+                p->hash_source = j;
+                break;
+            }
+        }
+    }
+
+    pfree(leaves);
+    pfree(attnums);
+}
+
+void apply_partition_deferred_adds(const PartitionFilterSet* set) {
+    for (int i = 0; i < set->num_partitions; ++i) {
+        apply_deferred_adds(set->partitions[i].table_oid, set->partitions[i].attnum);
+    }
+}
+
+bool probe_partition_filters(const PartitionFilterSet* set, Datum value, bool* might) {
+    int n = set->num_partitions;
+    uint64_t* h1 = set->h1;
+    uint64_t* h2 = set->h2;
+
+    for (int i = 0; i < n; ++i) {
+        const PartitionFilter* p = &set->partitions[i];
+        if (!p->filter) {
+            continue;
+        }
+        if (p->hash_source == i) {
+            BloomKey key;
+            bloom_key_from_datum(&p->key_type, value, &key);
+            auto hashes = p->filter->doubleHash(key.data, key.length);
+            bloom_key_release(&key);
+            h1[i] = hashes.first;
+            h2[i] = hashes.second;
+        } else {
+            h1[i] = h1[p->hash_source];
+            h2[i] = h2[p->hash_source];
+        }
+    }
+
+    // Software pipeline over the leaves, as the batch probes do over keys
+    for (int i = 0; i < n && i < PARTITION_PREFETCH_DISTANCE; ++i) {
+        if (set->partitions[i].filter) {
+            set->partitions[i].filter->prefetchHashes(h1[i], h2[i]);
+        }
+    }
+    bool any = false;
+    for (int i = 0; i < n; ++i) {
+        int ahead = i + PARTITION_PREFETCH_DISTANCE;
+        if (ahead < n && set->partitions[ahead].filter) {
+            set->partitions[ahead].filter->prefetchHashes(h1[ahead], h2[ahead]);
+        }
+        const PartitionFilter* p = &set->partitions[i];
+        bool result = !p->filter || p->filter->mightContainHashes(h1[i], h2[i]);
+        if (p->filter) {
+            bloom_count_lookups(p->counters, 1, !result);
+        }
+        if (might) {
+            might[i] = result;
+        } else if (result) {
+            return true;
+        }
+        any |= result;
+    }
+    return any;
+}
+
+// A row of octo_bloom_partitioned
+typedef struct PartitionTemplate {
+    char* column_name;
+    int64_t expected_count;
+    double false_positive_rate;
+    char* filter_type;
+} PartitionTemplate;
+
+// Templates recorded on table_oid or any partitioned table above it
+static int load_templates(Oid extension_schema, Oid table_oid, PartitionTemplate** templates) {
+    MemoryContext caller = CurrentMemoryContext;
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query,
+                     "SELECT column_name, expected_count, false_positive_rate, filter_type "
+                     "FROM %s.octo_bloom_partitioned "
+                     "WHERE parent IN (SELECT relid FROM pg_catalog.pg_partition_ancestors($1))",
+                     quote_identifier(get_namespace_name(extension_schema)));
+    Oid arg_types[1] = {REGCLASSOID};
+    Datum args[1] = {ObjectIdGetDatum(table_oid)};
+    if (SPI_execute_with_args(query.data, 1, arg_types, args, NULL, true, 0) != SPI_OK_SELECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not read octo_bloom_partitioned")));
+    }
+
+    int count = (int)SPI_processed;
+    PartitionTemplate* rows = (PartitionTemplate*)MemoryContextAlloc(
+        caller, sizeof(PartitionTemplate) * Max(count, 1));
+    for (int i = 0; i < count; ++i) {
+        HeapTuple tuple = SPI_tuptable->vals[i];
+        TupleDesc tupdesc = SPI_tuptable->tupdesc;
+        bool isnull;
+        rows[i].column_name = MemoryContextStrdup(caller, SPI_getvalue(tuple, tupdesc, 1));
+        rows[i].expected_count = DatumGetInt64(SPI_getbinval(tuple, tupdesc, 2, &isnull));
+        rows[i].false_positive_rate = DatumGetFloat8(SPI_getbinval(tuple, tupdesc, 3, &isnull));
+        rows[i].filter_type = MemoryContextStrdup(caller, SPI_getvalue(tuple, tupdesc, 4));
+    }
+    pfree(query.data);
+    SPI_finish();
+
+    *templates = rows;
+    return count;
+}
+
+void init_partitioned_filter(Oid table_oid, const char* column_name, Oid extension_schema,
+                             int64_t expected_count, double false_positive_rate,
+                             const char* filter_type) {
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query,
+                     "INSERT INTO %s.octo_bloom_partitioned "
+                     "VALUES ($1, $2, $3, $4, $5) ON CONFLICT (parent, column_name) "
+                     "DO UPDATE SET expected_count = EXCLUDED.expected_count, "
+                     "false_positive_rate = EXCLUDED.false_positive_rate, "
+                     "filter_type = EXCLUDED.filter_type",
+                     quote_identifier(get_namespace_name(extension_schema)));
+    Oid arg_types[5] = {REGCLASSOID, TEXTOID, INT8OID, FLOAT8OID, TEXTOID};
+    Datum args[5] = {ObjectIdGetDatum(table_oid), CStringGetTextDatum(column_name),
+                     Int64GetDatum(expected_count), Float8GetDatum(false_positive_rate),
+                     CStringGetTextDatum(filter_type)};
+    if (SPI_execute_with_args(query.data, 5, arg_types, args, NULL, false, 0) !=
+        SPI_OK_INSERT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not record the filter template of \"%s\"",
+                        get_rel_name(table_oid))));
+    }
+    pfree(query.data);
+    SPI_finish();
+
+    // Each leaf gets a filter of the full size: the sizes are per partition
+    Oid* leaves;
+    int16_t* attnums;
+    int count = get_partition_leaves(table_oid, column_name, &leaves, &attnums);
+    for (int i = 0; i < count; ++i) {
+        create_bloom_filter(leaves[i], attnums[i], expected_count, false_positive_rate,
+                            filter_type, NULL);
+    }
+    pfree(leaves);
+    pfree(attnums);
+}
+
+void disable_partitioned_filter(Oid table_oid, const char* column_name, Oid extension_schema) {
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query,
+                     "DELETE FROM %s.octo_bloom_partitioned WHERE parent = $1 AND column_name = $2",
+                     quote_identifier(get_namespace_name(extension_schema)));
+    Oid arg_types[2] = {REGCLASSOID, TEXTOID};
+    Datum args[2] = {ObjectIdGetDatum(table_oid), CStringGetTextDatum(column_name)};
+    // A template left behind would give new partitions the filter again
+    if (SPI_execute_with_args(query.data, 2, arg_types, args, NULL, false, 0) !=
+        SPI_OK_DELETE) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not remove the filter template of \"%s\"",
+                        get_rel_name(table_oid))));
+    }
+    pfree(query.data);
+    SPI_finish();
+
+    Oid* leaves;
+    int16_t* attnums;
+    int count = get_partition_leaves(table_oid, column_name, &leaves, &attnums);
+    for (int i = 0; i < count; ++i) {
+        unregister_bloom_filter(leaves[i], attnums[i]);
+    }
+    pfree(leaves);
+    pfree(attnums);
+}
+
+// Give the leaves at and under table_oid the filters their ancestors'
+// templates call for, filled from their rows if populate is set. Leaves
+// that have a filter already keep it
+static void create_partition_filters(Oid extension_schema, Oid table_oid, bool populate) {
+    PartitionTemplate* templates;
+    int num_templates = load_templates(extension_schema, table_oid, &templates);
+
+    for (int t = 0; t < num_templates; ++t) {
+        const PartitionTemplate* tmpl = &templates[t];
+        Oid* leaves;
+        int16_t* attnums;
+        int count = get_partition_leaves(table_oid, tmpl->column_name, &leaves, &attnums);
+        for (int i = 0; i < count; ++i) {
+            if (get_bloom_filter(leaves[i], attnums[i], NULL)) {
+                continue;
+            }
+            create_bloom_filter(leaves[i], attnums[i], tmpl->expected_count,
+                                tmpl->false_positive_rate, tmpl->filter_type, NULL);
+            if (populate) {
+                rebuild_bloom_filter(leaves[i], attnums[i], -1);
+            }
+        }
+        pfree(leaves);
+        pfree(attnums);
+    }
+}
+
+// A partition detached from parent loses the triggers cloned onto it, so
+// the filters its templates made would go stale: they are dropped
+static void drop_detached_filters(Oid extension_schema, Oid parent, Oid table_oid) {
+    PartitionTemplate* templates;
+    int num_templates = load_templates(extension_schema, parent, &templates);
+
+    for (int t = 0; t < num_templates; ++t) {
+        Oid* leaves;
+        int16_t* attnums;
+        int count = get_partition_leaves(table_oid, templates[t].column_name, &leaves, &attnums);
+        for (int i = 0; i < count; ++i) {
+            drop_bloom_filters_at_commit(leaves[i], attnums[i]);
+        }
+        pfree(leaves);
+        pfree(attnums);
+    }
+}
+
+static void rename_template_column(Oid extension_schema, Oid table_oid, const char* old_name,
+                                   const char* new_name) {
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+    StringInfoData query;
+    initStringInfo(&query);
+    appendStringInfo(&query,
+                     "UPDATE %s.octo_bloom_partitioned SET column_name = $3 "
+                     "WHERE parent = $1 AND column_name = $2",
+                     quote_identifier(get_namespace_name(extension_schema)));
+    Oid arg_types[3] = {REGCLASSOID, TEXTOID, TEXTOID};
+    Datum args[3] = {ObjectIdGetDatum(table_oid), CStringGetTextDatum(old_name),
+                     CStringGetTextDatum(new_name)};
+    if (SPI_execute_with_args(query.data, 3, arg_types, args, NULL, false, 0) !=
+        SPI_OK_UPDATE) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("could not rename the filter template column of \"%s\"",
+                        get_rel_name(table_oid))));
+    }
+    pfree(query.data);
+    SPI_finish();
+}
+
+// Filters to drop at commit. Entries are appended in order, so those of a
+// rolled-back subtransaction are a suffix of the list
+typedef struct PendingDrop {
+    Oid table_oid;
+    int16_t attnum;
+    int nest_level;
+} PendingDrop;
+
+// In TopTransactionContext, so it goes away with the transaction
+static PendingDrop* pending_drops = NULL;
+static int num_pending_drops = 0;
+static int max_pending_drops = 0;
+static bool pending_callbacks_registered = false;
+
+static void apply_pending_drops() {
+    int16_t* attnums = NULL;
+    for (int i = 0; i < num_pending_drops; ++i) {
+        const PendingDrop* drop = &pending_drops[i];
+        if (drop->attnum != 0) {
+            unregister_bloom_filter(drop->table_oid, drop->attnum);
+            continue;
+        }
+        if (!attnums) {
+            attnums = (int16_t*)palloc(sizeof(int16_t) * MaxHeapAttributeNumber);
+        }
+        uint64_t generation;
+        int count = get_bloom_filter_columns(drop->table_oid, attnums, MaxHeapAttributeNumber,
+                                             &generation);
+        for (int c = 0; c < count; ++c) {
+            unregister_bloom_filter(drop->table_oid, attnums[c]);
+        }
+    }
+    if (attnums) {
+        pfree(attnums);
+    }
+}
+
+static void pending_drops_xact_callback(XactEvent event, void* arg) {
+    if (!pending_drops) {
+        return;
+    }
+    switch (event) {
+    case XACT_EVENT_PRE_COMMIT:
+    case XACT_EVENT_PRE_PREPARE:
+        // Freeing the storage is constant time: no rows are read
+        apply_pending_drops();
+        num_pending_drops = 0;
+        break;
+    case XACT_EVENT_COMMIT:
+    case XACT_EVENT_PARALLEL_COMMIT:
+    case XACT_EVENT_ABORT:
+    case XACT_EVENT_PARALLEL_ABORT:
+    case XACT_EVENT_PREPARE:
+        pending_drops = NULL;
+        num_pending_drops = 0;
+        max_pending_drops = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+static void pending_drops_subxact_callback(SubXactEvent event, SubTransactionId subid,
+                                           SubTransactionId parent_subid, void* arg) {
+    if (!pending_drops ||
+        (event != SUBXACT_EVENT_ABORT_SUB && event != SUBXACT_EVENT_COMMIT_SUB)) {
+        return;
+    }
+    int nest_level = GetCurrentTransactionNestLevel();
+    if (event == SUBXACT_EVENT_ABORT_SUB) {
+        while (num_pending_drops > 0 &&
+               pending_drops[num_pending_drops - 1].nest_level >= nest_level) {
+            num_pending_drops--;
+        }
+        return;
+    }
+    for (int i = num_pending_drops - 1;
+         i >= 0 && pending_drops[i].nest_level >= nest_level; --i) {
+        pending_drops[i].nest_level = nest_level - 1;
+    }
+}
+
+void drop_bloom_filters_at_commit(Oid table_oid, int16_t attnum) {
+    if (!pending_callbacks_registered) {
+        RegisterXactCallback(pending_drops_xact_callback, NULL);
+        RegisterSubXactCallback(pending_drops_subxact_callback, NULL);
+        pending_callbacks_registered = true;
+    }
+    if (num_pending_drops == max_pending_drops) {
+        int capacity = Max(max_pending_drops * 2, 16);
+        pending_drops = pending_drops
+                            ? (PendingDrop*)repalloc(pending_drops, sizeof(PendingDrop) * capacity)
+                            : (PendingDrop*)MemoryContextAlloc(TopTransactionContext,
+                                                               sizeof(PendingDrop) * capacity);
+        max_pending_drops = capacity;
+    }
+    PendingDrop* drop = &pending_drops[num_pending_drops++];
+    drop->table_oid = table_oid;
+    drop->attnum = attnum;
+    drop->nest_level = GetCurrentTransactionNestLevel();
+}
+
+// Composite keys read with the old type can't be evaluated any more: their
+// filters go, on the table and on every inheritor the change recursed to
+static void drop_retyped_composite_keys(Oid table_oid, const char* column_name) {
+    List* tables = find_all_inheritors(table_oid, NoLock, NULL);
+    ListCell* lc;
+    foreach (lc, tables) {
+        Oid relid = lfirst_oid(lc);
+        int16_t attnum = get_attnum(relid, column_name);
+        if (attnum != InvalidAttrNumber) {
+            drop_composite_keys(relid, attnum);
+        }
+    }
+    list_free(tables);
+}
+
+// ddl_command_end event trigger on CREATE TABLE and ALTER TABLE: new and
+// attached partitions get the filters of their parents' templates, and
+// detached ones lose them. Retyping a column drops the composite filters
+// that read it
+Datum octo_bloom_partition_ddl(PG_FUNCTION_ARGS) {
+    if (!CALLED_AS_EVENT_TRIGGER(fcinfo)) {
+        ereport(ERROR,
+                (errcode(ERRCODE_E_R_I_E_TRIGGER_PROTOCOL_VIOLATED),
+                 errmsg("octo_bloom_partition_ddl must be called as an event trigger")));
+    }
+    EventTriggerData* trigdata = (EventTriggerData*)fcinfo->context;
+    // The template table lives in the schema this function was created in
+    Oid schema = get_func_namespace(fcinfo->flinfo->fn_oid);
+    Node* parsetree = trigdata->parsetree;
+
+    if (IsA(parsetree, CreateStmt)) {
+        CreateStmt* stmt = (CreateStmt*)parsetree;
+        if (stmt->partbound) {
+            // A new partition is empty: its filters need no filling
+            create_partition_filters(schema, RangeVarGetRelid(stmt->relation, NoLock, false),
+                                     false);
+        }
+    } else if (IsA(parsetree, AlterTableStmt)) {
+        AlterTableStmt* stmt = (AlterTableStmt*)parsetree;
+        ListCell* lc;
+        foreach (lc, stmt->cmds) {
+            AlterTableCmd* cmd = (AlterTableCmd*)lfirst(lc);
+            if (cmd->subtype == AT_AlterColumnType) {
+                Oid table_oid = RangeVarGetRelid(stmt->relation, NoLock, true);
+                if (OidIsValid(table_oid)) {
+                    drop_retyped_composite_keys(table_oid, cmd->name);
+                }
+                continue;
+            }
+            if (cmd->subtype != AT_AttachPartition && cmd->subtype != AT_DetachPartition) {
+                continue;
+            }
+            PartitionCmd* partcmd = (PartitionCmd*)cmd->def;
+            Oid partition = RangeVarGetRelid(partcmd->name, NoLock, true);
+            if (!OidIsValid(partition)) {
+                continue;
+            }
+            if (cmd->subtype == AT_AttachPartition) {
+                create_partition_filters(schema, partition, true);
+            } else {
+                drop_detached_filters(schema, RangeVarGetRelid(stmt->relation, NoLock, false),
+                                      partition);
+            }
+        }
+    } else if (IsA(parsetree, RenameStmt)) {
+        RenameStmt* stmt = (RenameStmt*)parsetree;
+        if (stmt->renameType == OBJECT_COLUMN && stmt->relation) {
+            Oid table_oid = RangeVarGetRelid(stmt->relation, NoLock, true);
+            if (OidIsValid(table_oid) && get_rel_relkind(table_oid) == RELKIND_PARTITIONED_TABLE) {
+                rename_template_column(schema, table_oid, stmt->subname, stmt->newname);
+            }
+        }
+    }
+
+    PG_RETURN_NULL();
+}
+
+// From the sql_drop event trigger: the filters of a dropped table (attnum
+// 0) or column go at commit, without reading anything
+Datum octo_bloom_drop_filters(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    int16_t attnum = PG_GETARG_INT16(1);
+
+    drop_bloom_filters_at_commit(table_oid, attnum);
+    // Composite filters that read a dropped column go too
+    drop_composite_keys(table_oid, attnum);
+
+    PG_RETURN_VOID();
+}
+
+} // extern "C"
@@ -0,0 +1,67 @@
+#ifndef OCTO_BLOOM_PARTITION_FILTERS_HPP
+#define OCTO_BLOOM_PARTITION_FILTERS_HPP
+
+#include "shared_memory.hpp"
+
+// Partitioned tables. Keys live in the filters of the leaf partitions,
+// where the row triggers cloned from the parent put them; octo_bloom_init
+// on the parent records a template in octo_bloom_partitioned, from which
+// the event triggers create the filter of every partition created or
+// attached later. A probe against the parent tests each leaf's filter.
+
+// A leaf's filter for one probe value type
+typedef struct PartitionFilter {
+    Oid table_oid;
+    int16_t attnum;
+    FilterBackend* filter;  // nullptr: no usable filter, the leaf might hold anything
+    BloomFilterCounters* counters;  // The filter's, for this backend
+    BloomKeyType key_type;  // For hashing probe values
+    int hash_source;  // Earlier leaf whose hashes this one's equal, or its own index
+} PartitionFilter;
+
+typedef struct PartitionFilterSet {
+    int num_partitions;
+    PartitionFilter* partitions;
+    uint64_t* h1;  // Scratch for a probe, one per partition
+    uint64_t* h2;
+} PartitionFilterSet;
+
+extern "C" {
+// Leaf partitions of a partitioned table and their attnums for a column.
+// Returns how many
+int get_partition_leaves(Oid table_oid, const char* column_name, Oid** leaves,
+                         int16_t** attnums);
+// Resolve the filters of a partitioned table's leaves for probe values of
+// value_type, into memory allocated in mcxt. The views stay valid while the
+// registry generation is the one stored in *generation
+void resolve_partition_filters(Oid table_oid, const char* column_name, Oid value_type,
+                               MemoryContext mcxt, PartitionFilterSet* set,
+                               uint64_t* generation);
+// Apply the keys this transaction's triggers have deferred for the leaves
+void apply_partition_deferred_adds(const PartitionFilterSet* set);
+// Probe value in every leaf, sharing hashes between filters that hash it
+// alike and keeping several leaves' cache misses in flight. Stores whether
+// leaf i might hold it in might[i], unless might is NULL, and returns
+// whether any might
+bool probe_partition_filters(const PartitionFilterSet* set, Datum value, bool* might);
+
+// Record the filter template for a column of a partitioned table and give
+// every current leaf an empty filter, as octo_bloom_init does for a table
+void init_partitioned_filter(Oid table_oid, const char* column_name, Oid extension_schema,
+                             int64_t expected_count, double false_positive_rate,
+                             const char* filter_type);
+// Forget the template and drop the leaves' filters, as octo_bloom_disable
+void disable_partitioned_filter(Oid table_oid, const char* column_name, Oid extension_schema);
+// Drop a column's filter at commit (attnum 0: every column of the table),
+// so a rolled-back DROP or DETACH leaves it in place
+void drop_bloom_filters_at_commit(Oid table_oid, int16_t attnum);
+
+// Register an empty filter on a table column (octo_bloom.cpp), whose keys
+// are hashed as key_type says or, if that is NULL, as the column's type
+// calls for. ERRORs on invalid arguments
+void create_bloom_filter(Oid table_oid, int16_t attnum, int64_t expected_count,
+                         double false_positive_rate, const char* filter_type,
+                         const BloomKeyType* key_type);
+}
+
+#endif // OCTO_BLOOM_PARTITION_FILTERS_HPP
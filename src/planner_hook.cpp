@@ -0,0 +1,624 @@
+#include "planner_hook.hpp"
+#include "datum_key.hpp"
+
+extern "C" {
+#include <access/genam.h>
+#include <access/htup_details.h>
+#include <access/stratnum.h>
+#include <access/table.h>
+#include <catalog/indexing.h>
+#include <catalog/pg_am.h>
+#include <catalog/pg_collation.h>
+#include <catalog/pg_extension.h>
+#include <commands/defrem.h>
+#include <commands/extension.h>
+#include <nodes/makefuncs.h>
+#include <nodes/nodeFuncs.h>
+#include <nodes/plannodes.h>
+#include <optimizer/optimizer.h>
+#include <optimizer/planner.h>
+#include <parser/parse_func.h>
+#include <parser/parsetree.h>
+#include <utils/fmgroids.h>
+#include <utils/syscache.h>
+}
+
+// With octo_bloom.planner_pruning on, plans of read-only queries check the
+// registered filters themselves, so queries written without
+// octo_bloom_might_contain still skip work on keys a filter rules out. The
+// standard planner runs first; its finished plan is then rewritten:
+//
+// - A scan with a qual column = value, where value doesn't depend on the
+//   scanned row (a constant, a bind parameter, or a nested loop's outer
+//   value), gets a Result above it whose one-time qual probes the
+//   column's filter. When the probe says no the scan never starts, and
+//   under a nested loop it is skipped for that outer row. column IN (...)
+//   works the same way through octo_bloom_might_contain_any.
+// - The array of an index qual column = ANY (array) is narrowed through
+//   octo_bloom_filter_values, so the index is only searched for the keys
+//   that might be there.
+// - A hash join whose inner side reads a filtered column checks the outer
+//   rows' keys against that filter in the scan that produces them, so rows
+//   that can't join are dropped before any join below sees them.
+//
+// A filter is only trusted with what it can't get wrong: it must never
+// forget keys (counting and cuckoo filters drop deleted keys at commit,
+// while older snapshots still see the rows), probe values must hash the
+// way the column's do, and the comparison must be the column type's B-tree
+// equality under a collation that doesn't equate values of different
+// bytes. Whether a filter holds every row it should, i.e. was rebuilt
+// after octo_bloom_init and is kept up to date by triggers, can't be told
+// from here, which is why the setting is off by default.
+//
+// Nothing below a Gather is touched: parallel workers don't see the keys
+// this backend's triggers have deferred, and the probe functions aren't
+// parallel safe.
+
+// Most rows a hash join may keep, relative to its outer input, for its
+// outer keys to be checked against the inner filter. A join that keeps
+// most of them would only pay for the probes
+#define JOIN_FILTER_MAX_SELECTIVITY 0.5
+
+extern "C" {
+
+bool octo_bloom_planner_pruning = false;
+
+static planner_hook_type prev_planner_hook = NULL;
+
+// The SQL functions plans call, looked up in the extension's schema on the
+// first plan and again after any change to pg_proc
+typedef struct ProbeFunctions {
+    bool valid;
+    bool installed;  // Every function exists in this database
+    Oid might_contain;
+    Oid might_contain_any;
+    Oid filter_values;
+} ProbeFunctions;
+
+static ProbeFunctions probe_functions;
+static bool probe_callback_registered = false;
+
+static void invalidate_probe_functions(Datum arg, int cacheid, uint32 hashvalue) {
+    probe_functions.valid = false;
+}
+
+// pg_extension has no syscache
+Oid octo_bloom_schema() {
+    Oid extension_oid = get_extension_oid("octo_bloom", true);
+    if (!OidIsValid(extension_oid)) {
+        return InvalidOid;
+    }
+    Relation rel = table_open(ExtensionRelationId, AccessShareLock);
+
+    ScanKeyData key;
+    ScanKeyInit(&key, Anum_pg_extension_oid, BTEqualStrategyNumber, F_OIDEQ,
+                ObjectIdGetDatum(extension_oid));
+    SysScanDesc scan = systable_beginscan(rel, ExtensionOidIndexId, true, NULL, 1, &key);
+    HeapTuple tuple = systable_getnext(scan);
+    Oid schema = HeapTupleIsValid(tuple) ? ((Form_pg_extension)GETSTRUCT(tuple))->extnamespace
+                                         : InvalidOid;
+    systable_endscan(scan);
+
+    table_close(rel, AccessShareLock);
+    return schema;
+}
+
+static Oid lookup_probe_function(char* schema, const char* name, Oid values_type) {
+    Oid arg_types[3] = {REGCLASSOID, TEXTOID, values_type};
+    List* names = lappend(lappend(NIL, makeString(schema)), makeString(pstrdup(name)));
+    return LookupFuncName(names, 3, arg_types, true);
+}
+
+static bool load_probe_functions() {
+    if (!probe_callback_registered) {
+        CacheRegisterSyscacheCallback(PROCOID, invalidate_probe_functions, (Datum)0);
+        probe_callback_registered = true;
+    }
+    if (probe_functions.valid) {
+        return probe_functions.installed;
+    }
+
+    // Marked valid first, so an invalidation during the lookups isn't lost
+    probe_functions.valid = true;
+    probe_functions.installed = false;
+
+    Oid schema = octo_bloom_schema();
+    char* schema_name = OidIsValid(schema) ? get_namespace_name(schema) : NULL;
+    if (schema_name) {
+        probe_functions.might_contain =
+            lookup_probe_function(schema_name, "octo_bloom_might_contain", ANYELEMENTOID);
+        probe_functions.might_contain_any =
+            lookup_probe_function(schema_name, "octo_bloom_might_contain_any", ANYARRAYOID);
+        probe_functions.filter_values =
+            lookup_probe_function(schema_name, "octo_bloom_filter_values", ANYARRAYOID);
+        probe_functions.installed = OidIsValid(probe_functions.might_contain) &&
+                                    OidIsValid(probe_functions.might_contain_any) &&
+                                    OidIsValid(probe_functions.filter_values);
+    }
+    return probe_functions.installed;
+}
+
+// Whether a column's filter can rule out rows for which column opno value
+// fails, value being of value_type
+static bool usable_filter(Oid relid, AttrNumber attnum, Oid opno, Oid inputcollid,
+                          Oid value_type) {
+    BloomKeyType key_type;
+    FilterBackend* filter = get_bloom_filter(relid, attnum, &key_type);
+    if (!filter || filter->supportsRemove()) {
+        return false;
+    }
+    if (!bloom_key_probe_compatible(value_type, &key_type)) {
+        return false;
+    }
+
+    // Values equal under the query's collation must hash alike
+    if (OidIsValid(inputcollid) && inputcollid != key_type.collation &&
+        !get_collation_isdeterministic(inputcollid)) {
+        return false;
+    }
+
+    // Equality of the column type's default B-tree family, which includes
+    // the cross-type integer comparisons
+    Oid opclass = GetDefaultOpClass(key_type.typid, BTREE_AM_OID);
+    return OidIsValid(opclass) &&
+           get_op_opfamily_strategy(opno, get_opclass_family(opclass)) == BTEqualStrategyNumber;
+}
+
+// The scan a qual belongs to. Quals of an index-only scan refer to index
+// columns, which indextlist maps to the table's
+typedef struct ScanColumns {
+    Index scanrelid;
+    Oid relid;
+    List* indextlist;
+} ScanColumns;
+
+// Column of the scanned table that an operand is, or InvalidAttrNumber
+static AttrNumber scan_column(Node* node, const ScanColumns* scan) {
+    while (node && IsA(node, RelabelType)) {
+        node = (Node*)((RelabelType*)node)->arg;
+    }
+    if (!node || !IsA(node, Var)) {
+        return InvalidAttrNumber;
+    }
+
+    Var* var = (Var*)node;
+    if (var->varno == INDEX_VAR) {
+        if (var->varattno < 1 || var->varattno > list_length(scan->indextlist)) {
+            return InvalidAttrNumber;
+        }
+        Expr* column = ((TargetEntry*)list_nth(scan->indextlist, var->varattno - 1))->expr;
+        if (!IsA(column, Var)) {
+            return InvalidAttrNumber;
+        }
+        var = (Var*)column;
+    }
+    if ((Index)var->varno != scan->scanrelid || var->varlevelsup != 0 || var->varattno <= 0) {
+        return InvalidAttrNumber;
+    }
+    return var->varattno;
+}
+
+// Same for every row the scan returns
+static bool scan_invariant(Node* node) {
+    return !contain_var_clause(node) && !contain_volatile_functions(node) &&
+           !contain_subplans(node);
+}
+
+// What a qual says a filter can check: column = value, or with is_array
+// column = ANY (value)
+typedef struct FilterProbe {
+    AttrNumber attnum;
+    Expr* value;
+    bool is_array;
+} FilterProbe;
+
+static bool match_probe(Node* clause, const ScanColumns* scan, FilterProbe* probe) {
+    Oid opno;
+    Oid inputcollid;
+    Oid value_type;
+
+    if (IsA(clause, OpExpr) && list_length(((OpExpr*)clause)->args) == 2) {
+        OpExpr* op = (OpExpr*)clause;
+        probe->attnum = scan_column((Node*)linitial(op->args), scan);
+        probe->value = (Expr*)lsecond(op->args);
+        if (probe->attnum == InvalidAttrNumber) {
+            probe->attnum = scan_column((Node*)lsecond(op->args), scan);
+            probe->value = (Expr*)linitial(op->args);
+        }
+        probe->is_array = false;
+        opno = op->opno;
+        inputcollid = op->inputcollid;
+        value_type = exprType((Node*)probe->value);
+    } else if (IsA(clause, ScalarArrayOpExpr)) {
+        ScalarArrayOpExpr* op = (ScalarArrayOpExpr*)clause;
+        if (!op->useOr || list_length(op->args) != 2) {
+            return false;
+        }
+        probe->attnum = scan_column((Node*)linitial(op->args), scan);
+        probe->value = (Expr*)lsecond(op->args);
+        probe->is_array = true;
+        opno = op->opno;
+        inputcollid = op->inputcollid;
+        value_type = get_element_type(exprType((Node*)probe->value));
+    } else {
+        return false;
+    }
+
+    return probe->attnum != InvalidAttrNumber && OidIsValid(value_type) &&
+           scan_invariant((Node*)probe->value) &&
+           usable_filter(scan->relid, probe->attnum, opno, inputcollid, value_type);
+}
+
+// funcid(relid, column name, value)
+static Expr* make_probe_call(Oid funcid, Oid result_type, Oid result_collation, Oid relid,
+                             AttrNumber attnum, Expr* value) {
+    char* column = get_attname(relid, attnum, false);
+    Const* table = makeConst(REGCLASSOID, -1, InvalidOid, sizeof(Oid), ObjectIdGetDatum(relid),
+                             false, true);
+    Const* name = makeConst(TEXTOID, -1, DEFAULT_COLLATION_OID, -1,
+                            PointerGetDatum(cstring_to_text(column)), false, false);
+    List* args = lappend(lappend(lappend(NIL, table), name), copyObject(value));
+    return (Expr*)makeFuncExpr(funcid, result_type, args, result_collation, InvalidOid,
+                               COERCE_EXPLICIT_CALL);
+}
+
+typedef struct PruneContext {
+    PlannedStmt* stmt;
+    int last_plan_node_id;  // -1 until first needed
+} PruneContext;
+
+static int max_plan_node_id(Plan* plan);
+
+static int max_plan_node_id_list(List* plans) {
+    int max_id = -1;
+    ListCell* lc;
+    foreach (lc, plans) {
+        max_id = Max(max_id, max_plan_node_id((Plan*)lfirst(lc)));
+    }
+    return max_id;
+}
+
+static int max_plan_node_id(Plan* plan) {
+    if (!plan) {
+        return -1;
+    }
+    int max_id = Max(plan->plan_node_id,
+                     Max(max_plan_node_id(plan->lefttree), max_plan_node_id(plan->righttree)));
+    switch (nodeTag(plan)) {
+        case T_Append:
+            return Max(max_id, max_plan_node_id_list(((Append*)plan)->appendplans));
+        case T_MergeAppend:
+            return Max(max_id, max_plan_node_id_list(((MergeAppend*)plan)->mergeplans));
+        case T_BitmapAnd:
+            return Max(max_id, max_plan_node_id_list(((BitmapAnd*)plan)->bitmapplans));
+        case T_BitmapOr:
+            return Max(max_id, max_plan_node_id_list(((BitmapOr*)plan)->bitmapplans));
+        case T_SubqueryScan:
+            return Max(max_id, max_plan_node_id(((SubqueryScan*)plan)->subplan));
+        case T_CustomScan:
+            return Max(max_id, max_plan_node_id_list(((CustomScan*)plan)->custom_plans));
+        default:
+            return max_id;
+    }
+}
+
+// Result node above scan that returns its rows unchanged, as long as the
+// one-time checks hold
+static Plan* make_gate(Plan* scan, List* checks, PruneContext* context) {
+    if (context->last_plan_node_id < 0) {
+        context->last_plan_node_id = Max(max_plan_node_id(context->stmt->planTree),
+                                         max_plan_node_id_list(context->stmt->subplans));
+    }
+
+    Result* result = makeNode(Result);
+    Plan* plan = &result->plan;
+    plan->startup_cost = scan->startup_cost;
+    plan->total_cost = scan->total_cost;
+    plan->plan_rows = scan->plan_rows;
+    plan->plan_width = scan->plan_width;
+    plan->parallel_aware = false;
+    plan->parallel_safe = false;
+    plan->plan_node_id = ++context->last_plan_node_id;
+    // The checks use the scan's parameters, so rescans must reach the
+    // Result whenever they reach the scan
+    plan->extParam = bms_copy(scan->extParam);
+    plan->allParam = bms_copy(scan->allParam);
+    plan->lefttree = scan;
+    result->resconstantqual = (Node*)checks;
+
+    ListCell* lc;
+    foreach (lc, scan->targetlist) {
+        TargetEntry* entry = (TargetEntry*)lfirst(lc);
+        Var* var = makeVarFromTargetEntry(OUTER_VAR, entry);
+        var->varnosyn = 0;
+        var->varattnosyn = 0;
+        TargetEntry* pass = flatCopyTargetEntry(entry);
+        pass->expr = (Expr*)var;
+        plan->targetlist = lappend(plan->targetlist, pass);
+    }
+    return plan;
+}
+
+// One-time checks for the quals that compare a filtered column to a value
+// fixed for the scan, added to checks. Arrays are skipped unless arrays
+static List* probe_checks(List* quals, const ScanColumns* scan, bool arrays, List* checks) {
+    ListCell* lc;
+    foreach (lc, quals) {
+        FilterProbe probe;
+        if (!match_probe((Node*)lfirst(lc), scan, &probe) || (probe.is_array && !arrays)) {
+            continue;
+        }
+        Oid funcid = probe.is_array ? probe_functions.might_contain_any
+                                    : probe_functions.might_contain;
+        checks = lappend(checks, make_probe_call(funcid, BOOLOID, InvalidOid, scan->relid,
+                                                 probe.attnum, probe.value));
+    }
+    return checks;
+}
+
+// Index quals column = ANY (array) search only the keys their filter
+// doesn't rule out; checks of the other index quals are added to checks.
+// table_quals are the index quals over the table's columns, in the same
+// order (the same list for an index-only scan)
+static List* narrow_index_quals(List* index_quals, List* table_quals, const ScanColumns* scan,
+                                List* checks) {
+    ListCell* index_lc;
+    ListCell* table_lc;
+    forboth (index_lc, index_quals, table_lc, table_quals) {
+        FilterProbe probe;
+        if (!match_probe((Node*)lfirst(table_lc), scan, &probe)) {
+            continue;
+        }
+        if (!probe.is_array) {
+            checks = lappend(checks, make_probe_call(probe_functions.might_contain, BOOLOID,
+                                                     InvalidOid, scan->relid, probe.attnum,
+                                                     probe.value));
+            continue;
+        }
+        ScalarArrayOpExpr* index_qual = (ScalarArrayOpExpr*)lfirst(index_lc);
+        if (!IsA(index_qual, ScalarArrayOpExpr)) {
+            continue;
+        }
+        Expr* array = (Expr*)lsecond(index_qual->args);
+        lsecond(index_qual->args) = make_probe_call(probe_functions.filter_values,
+                                                    exprType((Node*)array),
+                                                    exprCollation((Node*)array), scan->relid,
+                                                    probe.attnum, array);
+    }
+    return checks;
+}
+
+static bool scan_of_table(Scan* scan, PruneContext* context, ScanColumns* columns) {
+    RangeTblEntry* rte = rt_fetch(scan->scanrelid, context->stmt->rtable);
+    if (rte->rtekind != RTE_RELATION) {
+        return false;
+    }
+    columns->scanrelid = scan->scanrelid;
+    columns->relid = rte->relid;
+    columns->indextlist = IsA(scan, IndexOnlyScan) ? ((IndexOnlyScan*)scan)->indextlist : NIL;
+    return true;
+}
+
+static Plan* prune_scan(Scan* scan, PruneContext* context) {
+    ScanColumns columns;
+    if (!scan_of_table(scan, context, &columns)) {
+        return &scan->plan;
+    }
+
+    List* checks = NIL;
+    switch (nodeTag(scan)) {
+        case T_IndexScan: {
+            IndexScan* index_scan = (IndexScan*)scan;
+            checks = narrow_index_quals(index_scan->indexqual, index_scan->indexqualorig,
+                                        &columns, checks);
+            break;
+        }
+        case T_IndexOnlyScan: {
+            IndexOnlyScan* index_scan = (IndexOnlyScan*)scan;
+            checks = narrow_index_quals(index_scan->indexqual, index_scan->indexqual, &columns,
+                                        checks);
+            break;
+        }
+        case T_BitmapIndexScan: {
+            // Its Bitmap Heap Scan gates on the rest
+            BitmapIndexScan* index_scan = (BitmapIndexScan*)scan;
+            narrow_index_quals(index_scan->indexqual, index_scan->indexqualorig, &columns, NIL);
+            return &scan->plan;
+        }
+        case T_BitmapHeapScan:
+            // Arrays in these have been narrowed in the index scans below
+            checks = probe_checks(((BitmapHeapScan*)scan)->bitmapqualorig, &columns, false,
+                                  checks);
+            break;
+        default:
+            break;
+    }
+    checks = probe_checks(scan->plan.qual, &columns, true, checks);
+
+    return checks != NIL ? make_gate(&scan->plan, checks, context) : &scan->plan;
+}
+
+// The scan producing output column resno of plan, following Vars down
+// through joins and nodes that pass their input's rows on unchanged. *expr
+// is the column in the scan's target list
+static Scan* trace_column(Plan* plan, AttrNumber resno, Expr** expr) {
+    while (plan) {
+        TargetEntry* entry = get_tle_by_resno(plan->targetlist, resno);
+        if (!entry) {
+            return NULL;
+        }
+        switch (nodeTag(plan)) {
+            case T_SeqScan:
+            case T_IndexScan:
+            case T_IndexOnlyScan:
+            case T_BitmapHeapScan:
+                *expr = entry->expr;
+                return (Scan*)plan;
+            default:
+                break;
+        }
+
+        if (!IsA(entry->expr, Var)) {
+            return NULL;
+        }
+        Var* var = (Var*)entry->expr;
+        switch (nodeTag(plan)) {
+            case T_NestLoop:
+            case T_MergeJoin:
+            case T_HashJoin:
+                plan = var->varno == OUTER_VAR   ? outerPlan(plan)
+                       : var->varno == INNER_VAR ? innerPlan(plan)
+                                                 : NULL;
+                break;
+            case T_Hash:
+            case T_Sort:
+            case T_IncrementalSort:
+            case T_Material:
+            case T_Memoize:
+            case T_Result:
+                plan = var->varno == OUTER_VAR ? outerPlan(plan) : NULL;
+                break;
+            default:
+                return NULL;
+        }
+        resno = var->varattno;
+    }
+    return NULL;
+}
+
+// Rows of the outer side of a hash join that can't match any row of the
+// inner table are dropped where their key is read. Only joins that drop
+// unmatched outer rows qualify
+static void push_join_filter(HashJoin* join, PruneContext* context) {
+    JoinType type = join->join.jointype;
+    if (type != JOIN_INNER && type != JOIN_SEMI && type != JOIN_RIGHT) {
+        return;
+    }
+    Plan* outer = outerPlan(join);
+    if (join->join.plan.plan_rows >= outer->plan_rows * JOIN_FILTER_MAX_SELECTIVITY) {
+        return;
+    }
+
+    ListCell* lc;
+    foreach (lc, join->hashclauses) {
+        // The outer operand is always on the left
+        OpExpr* clause = (OpExpr*)lfirst(lc);
+        if (!IsA(clause, OpExpr) || list_length(clause->args) != 2 ||
+            !IsA(linitial(clause->args), Var) || !IsA(lsecond(clause->args), Var)) {
+            continue;
+        }
+        Var* outer_var = (Var*)linitial(clause->args);
+        Var* inner_var = (Var*)lsecond(clause->args);
+        if (outer_var->varno != OUTER_VAR || inner_var->varno != INNER_VAR) {
+            continue;
+        }
+
+        Expr* inner_expr;
+        Expr* outer_expr;
+        Scan* inner_scan = trace_column(innerPlan(join), inner_var->varattno, &inner_expr);
+        Scan* outer_scan = trace_column(outer, outer_var->varattno, &outer_expr);
+        ScanColumns columns;
+        if (!inner_scan || !outer_scan || !scan_of_table(inner_scan, context, &columns) ||
+            contain_volatile_functions((Node*)outer_expr) ||
+            contain_subplans((Node*)outer_expr)) {
+            continue;
+        }
+
+        AttrNumber attnum = scan_column((Node*)inner_expr, &columns);
+        if (attnum == InvalidAttrNumber ||
+            !usable_filter(columns.relid, attnum, clause->opno, clause->inputcollid,
+                           exprType((Node*)outer_expr))) {
+            continue;
+        }
+        outer_scan->plan.qual = lappend(outer_scan->plan.qual,
+                                        make_probe_call(probe_functions.might_contain, BOOLOID,
+                                                        InvalidOid, columns.relid, attnum,
+                                                        outer_expr));
+    }
+}
+
+static Plan* prune_plan(Plan* plan, PruneContext* context);
+
+static void prune_plan_list(List* plans, PruneContext* context) {
+    ListCell* lc;
+    foreach (lc, plans) {
+        lfirst(lc) = prune_plan((Plan*)lfirst(lc), context);
+    }
+}
+
+// Returns the plan to put in place of plan
+static Plan* prune_plan(Plan* plan, PruneContext* context) {
+    if (!plan) {
+        return NULL;
+    }
+
+    switch (nodeTag(plan)) {
+        case T_Gather:
+        case T_GatherMerge:
+            return plan;
+        case T_Append:
+            prune_plan_list(((Append*)plan)->appendplans, context);
+            break;
+        case T_MergeAppend:
+            prune_plan_list(((MergeAppend*)plan)->mergeplans, context);
+            break;
+        case T_BitmapAnd:
+            prune_plan_list(((BitmapAnd*)plan)->bitmapplans, context);
+            break;
+        case T_BitmapOr:
+            prune_plan_list(((BitmapOr*)plan)->bitmapplans, context);
+            break;
+        case T_SubqueryScan:
+            ((SubqueryScan*)plan)->subplan = prune_plan(((SubqueryScan*)plan)->subplan, context);
+            break;
+        case T_CustomScan:
+            prune_plan_list(((CustomScan*)plan)->custom_plans, context);
+            break;
+        default:
+            break;
+    }
+    plan->lefttree = prune_plan(plan->lefttree, context);
+    plan->righttree = prune_plan(plan->righttree, context);
+
+    switch (nodeTag(plan)) {
+        case T_SeqScan:
+        case T_IndexScan:
+        case T_IndexOnlyScan:
+        case T_BitmapIndexScan:
+        case T_BitmapHeapScan:
+            return prune_scan((Scan*)plan, context);
+        case T_HashJoin:
+            // Its inputs are done, so the filter goes below any gate
+            push_join_filter((HashJoin*)plan, context);
+            return plan;
+        default:
+            return plan;
+    }
+}
+
+static PlannedStmt* octo_bloom_planner(Query* parse, const char* query_string,
+                                       int cursor_options, ParamListInfo bound_params) {
+    PlannedStmt* stmt = prev_planner_hook
+                            ? prev_planner_hook(parse, query_string, cursor_options, bound_params)
+                            : standard_planner(parse, query_string, cursor_options, bound_params);
+
+    // Plain reads only: rows a modifying plan reads are rows it changes
+    if (!octo_bloom_planner_pruning || stmt->commandType != CMD_SELECT ||
+        stmt->hasModifyingCTE || !load_probe_functions()) {
+        return stmt;
+    }
+
+    PruneContext context;
+    context.stmt = stmt;
+    context.last_plan_node_id = -1;
+    stmt->planTree = prune_plan(stmt->planTree, &context);
+    prune_plan_list(stmt->subplans, &context);
+    return stmt;
+}
+
+void install_planner_hook() {
+    prev_planner_hook = planner_hook;
+    planner_hook = octo_bloom_planner;
+}
+
+} // extern "C"
@@ -0,0 +1,20 @@
+#ifndef OCTO_BLOOM_PLANNER_HOOK_HPP
+#define OCTO_BLOOM_PLANNER_HOOK_HPP
+
+#include "shared_memory.hpp"
+
+// GUC, defined in _PG_init
+extern "C" {
+extern bool octo_bloom_planner_pruning;
+}
+
+extern "C" {
+// Chain the planner hook that puts filter checks into plans
+// (octo_bloom.planner_pruning); from _PG_init
+void install_planner_hook();
+// Schema the extension was created in, or InvalidOid if it isn't installed
+// in the current database
+Oid octo_bloom_schema();
+}
+
+#endif // OCTO_BLOOM_PLANNER_HOOK_HPP
@@ -0,0 +1,230 @@
+#include "scalable_filter.hpp"
+#include <algorithm>
+#include <new>
+
+extern "C" {
+#include <postgres.h>
+#include <utils/palloc.h>
+}
+
+ScalableFilter::ScalableFilter(const BloomFilterParams& params,
+                               const BloomFilterParams* stage_params,
+                               void* const* stages, int num_stages)
+    : params_(params), num_stages_(num_stages) {
+    Assert(num_stages >= 1 && num_stages <= OCTO_BLOOM_STAGE_SLOTS);
+    for (int i = 0; i < num_stages_; ++i) {
+        uint8_t* base = static_cast<uint8_t*>(stages[i]);
+        counts_[i] = reinterpret_cast<uint64_t*>(base);
+        stages_[i] = new (palloc(sizeof(OctoBloomFilter)))
+            OctoBloomFilter(stage_params[i], base + kStageHeaderBytes);
+    }
+}
+
+ScalableFilter::~ScalableFilter() {
+    for (int i = 0; i < num_stages_; ++i) {
+        stages_[i]->~OctoBloomFilter();
+        pfree(stages_[i]);
+    }
+}
+
+BloomFilterParams ScalableFilter::computeParams(uint64_t expected_count,
+                                                double false_positive_rate,
+                                                BloomHash hash,
+                                                BloomReduction reduction) {
+    BloomFilterParams params = {};
+    params.kind = FilterKind::Scalable;
+    params.layout = BloomLayout::Standard;
+    params.hash = hash;
+    params.reduction = reduction;
+    params.expected_count = std::max<uint64_t>(expected_count, 1);
+    params.false_positive_rate = false_positive_rate;
+
+    // Describe the first stage, so the chain reads like the filter it starts as
+    BloomFilterParams first = firstStageParams(params, params.expected_count);
+    params.reduction = first.reduction;
+    params.num_hashes = first.num_hashes;
+    params.bit_array_size = first.bit_array_size;
+    return params;
+}
+
+BloomFilterParams ScalableFilter::firstStageParams(const BloomFilterParams& params,
+                                                   uint64_t capacity) {
+    // Stage i gets P * (1 - r) * r^i, which sums to P over any number of stages
+    return OctoBloomFilter::computeParams(std::max<uint64_t>(capacity, 1),
+                                          params.false_positive_rate * (1.0 - kTightening),
+                                          params.layout, params.hash, params.reduction);
+}
+
+BloomFilterParams ScalableFilter::nextStageParams(const BloomFilterParams& previous) {
+    return OctoBloomFilter::computeParams(previous.expected_count * kGrowth,
+                                          previous.false_positive_rate * kTightening,
+                                          previous.layout, previous.hash, previous.reduction);
+}
+
+size_t ScalableFilter::stageStorageSize(const BloomFilterParams& stage) {
+    return kStageHeaderBytes + OctoBloomFilter::storageSize(stage);
+}
+
+void ScalableFilter::add(const void* data, size_t length) {
+    newest()->add(data, length);
+    __atomic_fetch_add(counts_[num_stages_ - 1], 1, __ATOMIC_RELAXED);
+}
+
+bool ScalableFilter::mightContain(const void* data, size_t length) const {
+    // Every stage hashes alike, so one hash serves them all
+    auto hashes = doubleHash(data, length);
+    return mightContainHashes(hashes.first, hashes.second);
+}
+
+bool ScalableFilter::mightContainHashes(uint64_t h1, uint64_t h2) const {
+    for (int i = num_stages_ - 1; i >= 0; --i) {
+        if (stages_[i]->mightContainHashes(h1, h2)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void ScalableFilter::prefetchHashes(uint64_t h1, uint64_t h2) const {
+    for (int i = 0; i < num_stages_; ++i) {
+        stages_[i]->prefetch(h1, h2);
+    }
+}
+
+void ScalableFilter::mightContainBatch(const void* const* data, const size_t* lengths,
+                                       size_t count, bool* results) const {
+    constexpr size_t kBatch = OctoBloomFilter::kProbeBatch;
+    constexpr size_t kDistance = OctoBloomFilter::kPrefetchDistance;
+    uint64_t h1[kBatch];
+    uint64_t h2[kBatch];
+    uint32_t pending[kBatch];  // Keys no stage has matched yet
+
+    for (size_t base = 0; base < count; base += kBatch) {
+        size_t n = std::min(count - base, kBatch);
+        size_t num_pending = n;
+        for (size_t i = 0; i < n; ++i) {
+            auto hashes = doubleHash(data[base + i], lengths[base + i]);
+            h1[i] = hashes.first;
+            h2[i] = hashes.second;
+            results[base + i] = false;
+            pending[i] = static_cast<uint32_t>(i);
+        }
+
+        // Newest stage first: it is the largest and holds the most keys.
+        // Each pass pipelines its prefetches like OctoBloomFilter's batch
+        for (int s = num_stages_ - 1; s >= 0 && num_pending > 0; --s) {
+            const OctoBloomFilter* stage = stages_[s];
+            size_t warmup = std::min(num_pending, kDistance);
+            for (size_t j = 0; j < warmup; ++j) {
+                stage->prefetch(h1[pending[j]], h2[pending[j]]);
+            }
+            size_t still_pending = 0;
+            for (size_t j = 0; j < num_pending; ++j) {
+                if (j + kDistance < num_pending) {
+                    uint32_t ahead = pending[j + kDistance];
+                    stage->prefetch(h1[ahead], h2[ahead]);
+                }
+                uint32_t i = pending[j];
+                if (stage->mightContainHashes(h1[i], h2[i])) {
+                    results[base + i] = true;
+                } else {
+                    pending[still_pending++] = i;
+                }
+            }
+            num_pending = still_pending;
+        }
+    }
+}
+
+std::pair<uint64_t, uint64_t> ScalableFilter::doubleHash(const void* data, size_t length) const {
+    return stages_[0]->doubleHash(data, length);
+}
+
+void ScalableFilter::addHashesUnshared(uint64_t h1, uint64_t h2) {
+    newest()->addHashesUnshared(h1, h2);
+    ++*counts_[num_stages_ - 1];
+}
+
+void ScalableFilter::addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) {
+    // The whole batch goes to the newest stage, which may overshoot its
+    // capacity by up to one batch before the caller grows the chain
+    newest()->addHashBatch(h1, h2, count);
+    __atomic_fetch_add(counts_[num_stages_ - 1], count, __ATOMIC_RELAXED);
+}
+
+void ScalableFilter::clear() {
+    for (int i = 0; i < num_stages_; ++i) {
+        stages_[i]->clear();
+        __atomic_store_n(counts_[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+bool ScalableFilter::isCompatible(const FilterBackend& other) const {
+    for (int i = num_stages_ - 1; i >= 0; --i) {
+        if (stages_[i]->isCompatible(other)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ScalableFilter::mergeFrom(const FilterBackend& other) {
+    for (int i = num_stages_ - 1; i >= 0; --i) {
+        if (stages_[i]->isCompatible(other)) {
+            return stages_[i]->mergeFrom(other);
+        }
+    }
+    return false;
+}
+
+size_t ScalableFilter::getMemoryUsage() const {
+    size_t bytes = 0;
+    for (int i = 0; i < num_stages_; ++i) {
+        bytes += stages_[i]->getMemoryUsage();
+    }
+    return bytes;
+}
+
+double ScalableFilter::getEffectiveFalsePositiveRate() const {
+    // Each stage at its capacity; a probe misses only if every stage does
+    double miss = 1.0;
+    for (int i = 0; i < num_stages_; ++i) {
+        miss *= 1.0 - stages_[i]->getEffectiveFalsePositiveRate();
+    }
+    return 1.0 - miss;
+}
+
+double ScalableFilter::getSaturation() const {
+    return newest()->getSaturation();
+}
+
+FilterFillEstimate ScalableFilter::estimateFill(size_t sample_words) const {
+    FilterFillEstimate estimate;
+    estimate.cardinality = 0;
+    double miss = 1.0;
+    for (int i = 0; i < num_stages_; ++i) {
+        FilterFillEstimate stage = stages_[i]->estimateFill(sample_words);
+        estimate.cardinality += stage.cardinality;
+        miss *= 1.0 - stage.false_positive_rate;
+        estimate.saturation = stage.saturation;  // The newest stage's
+    }
+    estimate.false_positive_rate = 1.0 - miss;
+    return estimate;
+}
+
+bool ScalableFilter::needsGrowth() const {
+    return __atomic_load_n(counts_[num_stages_ - 1], __ATOMIC_RELAXED) >=
+           newest()->getExpectedCount();
+}
+
+uint64_t ScalableFilter::getCount() const {
+    uint64_t count = 0;
+    for (int i = 0; i < num_stages_; ++i) {
+        count += __atomic_load_n(counts_[i], __ATOMIC_RELAXED);
+    }
+    return count;
+}
+
+void ScalableFilter::addStageCount(int stage, uint64_t count) {
+    __atomic_fetch_add(counts_[stage], count, __ATOMIC_RELAXED);
+}
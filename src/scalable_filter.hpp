@@ -0,0 +1,83 @@
+#ifndef OCTO_BLOOM_SCALABLE_FILTER_HPP
+#define OCTO_BLOOM_SCALABLE_FILTER_HPP
+
+#include <cstdint>
+#include <cstddef>
+
+#include "bloom_filter.hpp"
+#include "filter_backend.hpp"
+
+// Scalable Bloom filter (Almeida et al.): a chain of standard filters. New
+// keys go to the newest stage; once it holds its expected_count the
+// registry appends a stage kGrowth times larger with a kTightening times
+// lower rate, so the rates of all stages sum to less than the chain's
+// target however far it grows. A key might be present if any stage says so.
+//
+// Each stage's storage starts with a small header holding the number of
+// keys added to it, so a stage knows when it is full without the registry.
+class ScalableFilter final : public FilterBackend {
+public:
+    static constexpr size_t kStageHeaderBytes = 64;
+    static constexpr uint64_t kGrowth = 2;
+    static constexpr double kTightening = 0.85;  // Almeida et al. suggest 0.8 to 0.9
+    static constexpr double kCompactionHeadroom = 1.25;  // Capacity per key held when compacted
+
+    // View over stages oldest first, each of stageStorageSize(stage_params[i])
+    ScalableFilter(const BloomFilterParams& params, const BloomFilterParams* stage_params,
+                   void* const* stages, int num_stages);
+    ~ScalableFilter() override;
+
+    ScalableFilter(const ScalableFilter&) = delete;
+    ScalableFilter& operator=(const ScalableFilter&) = delete;
+
+    // Chain parameters; the chain starts with firstStageParams(params, expected_count)
+    static BloomFilterParams computeParams(uint64_t expected_count, double false_positive_rate,
+                                           BloomHash hash, BloomReduction reduction);
+    // A stage that starts a chain afresh, e.g. when compacting it
+    static BloomFilterParams firstStageParams(const BloomFilterParams& params, uint64_t capacity);
+    static BloomFilterParams nextStageParams(const BloomFilterParams& previous);
+    static size_t stageStorageSize(const BloomFilterParams& stage);
+
+    void add(const void* data, size_t length) override;
+    bool mightContain(const void* data, size_t length) const override;
+    void mightContainBatch(const void* const* data, const size_t* lengths,
+                           size_t count, bool* results) const override;
+
+    bool supportsRemove() const override { return false; }
+    void remove(const void* data, size_t length) override {}
+
+    std::pair<uint64_t, uint64_t> doubleHash(const void* data, size_t length) const override;
+    void addHashesUnshared(uint64_t h1, uint64_t h2) override;
+    void addHashBatch(const uint64_t* h1, const uint64_t* h2, size_t count) override;
+    void removeHashes(uint64_t h1, uint64_t h2) override {}
+    bool mightContainHashes(uint64_t h1, uint64_t h2) const override;
+    void prefetchHashes(uint64_t h1, uint64_t h2) const override;
+
+    void clear() override;
+    // Compatible with any of its stages; merges go to the newest such stage
+    bool isCompatible(const FilterBackend& other) const override;
+    bool mergeFrom(const FilterBackend& other) override;
+
+    BloomFilterParams getParams() const override { return params_; }
+    size_t getMemoryUsage() const override;
+    double getEffectiveFalsePositiveRate() const override;
+    double getSaturation() const override;  // Of the newest stage, which takes the adds
+    // Keys summed over the stages; a probe is false positive if any stage's is
+    FilterFillEstimate estimateFill(size_t sample_words) const override;
+    bool needsGrowth() const override;
+    int getNumStages() const override { return num_stages_; }
+
+    uint64_t getCount() const;
+    // Count keys merged into a stage in bulk, which add() didn't see
+    void addStageCount(int stage, uint64_t count);
+
+private:
+    BloomFilterParams params_;
+    int num_stages_;
+    OctoBloomFilter* stages_[OCTO_BLOOM_STAGE_SLOTS];
+    uint64_t* counts_[OCTO_BLOOM_STAGE_SLOTS];  // In each stage's header
+
+    OctoBloomFilter* newest() const { return stages_[num_stages_ - 1]; }
+};
+
+#endif // OCTO_BLOOM_SCALABLE_FILTER_HPP
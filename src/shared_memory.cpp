@@ -1,14 +1,99 @@
 #include "shared_memory.hpp"
+#include "background_worker.hpp"
+#include "filter_snapshot.hpp"
+#include "filter_wal.hpp"
+#include "memory_placement.hpp"
+#include "scalable_filter.hpp"
 #include <cstring>
 
+extern "C" {
+#include <access/transam.h>
+#include <miscadmin.h>
+#include <storage/lock.h>
+#include <storage/procarray.h>
+#if PG_VERSION_NUM < 170000
+#include <storage/backendid.h>
+#endif
+#include <utils/memutils.h>
+#include <utils/timestamp.h>
+}
+
 extern "C" {
 
 // Global shared state pointer
 BloomSharedState* bloom_shared_state = nullptr;
+HTAB* bloom_registry = nullptr;
+
+int octo_bloom_max_filters = 64;
+int octo_bloom_shared_memory_mb = 1024;
+
+// Set when _PG_init ran from shared_preload_libraries and asked for the tranche
+static bool named_tranche_requested = false;
+
+// This backend's mapping of the DSA area holding the filter bits
+static dsa_area* bloom_area = nullptr;
+
+// Backend-local filter objects pointing into the DSA area, one per filter
+// this backend has used. A view is rebuilt when the registry entry's
+// generation no longer matches the one it was built for.
+typedef struct BloomLocalView {
+    BloomRegistryKey key;
+    uint64_t generation;
+    FilterBackend* filter;  // NULL until first built
+    BloomFilterCounters* counters;  // This backend's slot, if the filter has counters
+    BloomRegistryEntry* shared;  // The registry entry, for its node copies' writes count
+} BloomLocalView;
+
+static HTAB* local_views = nullptr;
+
+// Called while shared_preload_libraries is being processed (from the
+// shmem_request_hook on PostgreSQL 15+). Everything is reserved up front:
+// the registry for octo_bloom.max_filters entries and a filter area of
+// octo_bloom.shared_memory_mb, so running out is an ordinary capacity
+// error rather than a failed shared memory allocation.
+void request_shared_resources() {
+    RequestAddinShmemSpace(calculate_shared_memory_size(octo_bloom_max_filters,
+                                                        bloom_area_size()));
+    RequestNamedLWLockTranche(OCTO_BLOOM_TRANCHE_NAME, OCTO_BLOOM_NUM_LOCKS);
+    named_tranche_requested = true;
+}
+
+Size bloom_area_size() {
+    return (Size)octo_bloom_shared_memory_mb * 1024 * 1024;
+}
+
+static void init_locks() {
+    LWLock* locks[OCTO_BLOOM_NUM_LOCKS];
+
+    if (named_tranche_requested) {
+        LWLockPadded* tranche = GetNamedLWLockTranche(OCTO_BLOOM_TRANCHE_NAME);
+        for (int i = 0; i < OCTO_BLOOM_NUM_LOCKS; ++i) {
+            locks[i] = &tranche[i].lock;
+        }
+    } else {
+        // Loaded on demand: use locks embedded in our own struct
+        bloom_shared_state->tranche_id = LWLockNewTrancheId();
+        for (int i = 0; i < OCTO_BLOOM_NUM_LOCKS; ++i) {
+            LWLockInitialize(&bloom_shared_state->fallback_locks[i].lock,
+                             bloom_shared_state->tranche_id);
+            locks[i] = &bloom_shared_state->fallback_locks[i].lock;
+        }
+    }
+
+    bloom_shared_state->registry_lock = locks[0];
+    for (int i = 0; i < OCTO_BLOOM_LOCK_STRIPES; ++i) {
+        bloom_shared_state->stripe_locks[i] = locks[i + 1];
+    }
+}
 
+// Runs from shmem_startup_hook when preloaded, otherwise on first use in
+// each backend: the struct is created by the first caller and attached to
+// by the rest, and each gets its own handle on the registry.
 void init_shared_memory() {
     bool found;
-    Size size = calculate_shared_memory_size(10, 64 * 1024); // 10 filters, 64KB each
+    Size size = sizeof(BloomSharedState);
+
+    LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
 
     bloom_shared_state = (BloomSharedState*)ShmemInitStruct("octo_bloom_shared_state",
                                                           size, &found);
@@ -17,131 +102,2007 @@ void init_shared_memory() {
         // Initialize shared memory
         memset(bloom_shared_state, 0, size);
 
+        init_locks();
+        bloom_shared_state->total_memory = calculate_shared_memory_size(
+            octo_bloom_max_filters, named_tranche_requested ? bloom_area_size() : 0);
+        bloom_shared_state->max_filters = octo_bloom_max_filters;
+        bloom_shared_state->dsa_tranche_id = LWLockNewTrancheId();
+        bloom_shared_state->area_created = false;
+        bloom_shared_state->retired_more = InvalidDsaPointer;
+        pg_atomic_init_u64(&bloom_shared_state->generation, 1);
+        for (int i = 0; i < OCTO_BLOOM_MAX_BUILDS; ++i) {
+            pg_atomic_init_u64(&bloom_shared_state->builds[i].tuples_done, 0);
+            pg_atomic_init_u32(&bloom_shared_state->builds[i].participants_done, 0);
+        }
+
+        if (named_tranche_requested) {
+            Size area_size = bloom_area_size();
+            bool area_found;
+            void* place = ShmemInitStruct("octo_bloom_area", area_size, &area_found);
+
+            // Capped at its reserved size so it never grows into DSM segments
+            dsa_area* area = dsa_create_in_place(place, area_size,
+                                                 bloom_shared_state->dsa_tranche_id, NULL);
+            dsa_set_size_limit(area, area_size);
+            dsa_pin(area);
+            dsa_detach(area);
+            // Before any filter touches it; backends forked later inherit it
+            bloom_advise_huge_pages(place, area_size);
+
+            bloom_shared_state->area_place = place;
+            bloom_shared_state->area_size = area_size;
+        }
+    }
+
+    HASHCTL info;
+    memset(&info, 0, sizeof(info));
+    info.keysize = sizeof(BloomRegistryKey);
+    info.entrysize = sizeof(BloomRegistryEntry);
+
+    bloom_registry = ShmemInitHash("octo_bloom_registry",
+                                   bloom_shared_state->max_filters,
+                                   bloom_shared_state->max_filters,
+                                   &info,
+                                   HASH_ELEM | HASH_BLOBS);
+
+    LWLockRelease(AddinShmemInitLock);
+
+    if (!named_tranche_requested) {
+        LWLockRegisterTranche(bloom_shared_state->tranche_id, OCTO_BLOOM_TRANCHE_NAME);
+    }
+    LWLockRegisterTranche(bloom_shared_state->dsa_tranche_id, "octo_bloom_dsa");
+}
+
+// Attach in backends that haven't yet
+void ensure_shared_memory() {
+    if (!bloom_shared_state) {
+        init_shared_memory();
+    }
+}
+
+// Map the DSA area in this backend, creating it on first use. Must be
+// called with the registry lock held exclusively if create is set.
+static dsa_area* attach_area(bool create) {
+    if (bloom_area) {
+        return bloom_area;
+    }
+
+    MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+    if (bloom_shared_state->area_place) {
+        bloom_area = dsa_attach_in_place(bloom_shared_state->area_place, NULL);
+    } else if (bloom_shared_state->area_created) {
+        bloom_area = dsa_attach(bloom_shared_state->area_handle);
+    } else if (create) {
+        bloom_area = dsa_create(bloom_shared_state->dsa_tranche_id);
+        dsa_set_size_limit(bloom_area, bloom_area_size());
+        // Keep the area alive without any backend attached
+        dsa_pin(bloom_area);
+        bloom_shared_state->area_handle = dsa_get_handle(bloom_area);
+        bloom_shared_state->area_created = true;
+    }
+
+    if (bloom_area) {
+        // Keep the mapping for the life of this backend
+        dsa_pin_mapping(bloom_area);
+    }
+
+    MemoryContextSwitchTo(oldcontext);
+    return bloom_area;
+}
+
+dsa_area* attach_bloom_area(bool create) {
+    return attach_area(create);
+}
+
+static void make_key(BloomRegistryKey* key, Oid table_oid, int16_t attnum) {
+    // Zero padding bytes, the key is hashed and compared as a blob
+    memset(key, 0, sizeof(*key));
+    key->dboid = MyDatabaseId;
+    key->table_oid = table_oid;
+    key->attnum = attnum;
+}
+
+// Structural lock for a filter, chosen by hashing its registry key
+static LWLock* stripe_lock_for(const BloomRegistryKey* key) {
+    uint32 hash = tag_hash(key, sizeof(BloomRegistryKey));
+    return bloom_shared_state->stripe_locks[hash % OCTO_BLOOM_LOCK_STRIPES];
+}
+
+// This backend's slot in every filter's counters, or -1 if it has none
+static int counter_slot() {
+#if PG_VERSION_NUM >= 170000
+    return MyProcNumber < MaxBackends ? MyProcNumber : -1;
+#else
+    return MyBackendId != InvalidBackendId ? MyBackendId - 1 : -1;
+#endif
+}
+
+static Size memory_limit() {
+    return bloom_shared_state->area_place ? bloom_shared_state->area_size
+                                          : bloom_area_size();
+}
+
+static Size stage_bytes(const BloomRegistryEntry* entry, int stage) {
+    if (entry->params.kind == FilterKind::Scalable) {
+        return ScalableFilter::stageStorageSize(entry->stage_params[stage]);
+    }
+    return filter_storage_size(entry->params);
+}
+
+Size bloom_stage_bytes(const BloomRegistryEntry* entry, int stage) {
+    return stage_bytes(entry, stage);
+}
+
+// Local filter object over the shared bits described by the given entry
+// copy; shared is the registry entry itself, whose counts node copies are
+// checked against
+static FilterBackend* get_local_view(const BloomRegistryEntry* entry, BloomRegistryEntry* shared) {
+    if (!local_views) {
         HASHCTL info;
         memset(&info, 0, sizeof(info));
-        info.keysize = sizeof(Oid) + sizeof(int16_t);
-        info.entrysize = sizeof(BloomRegistryEntry);
-        info.hash = tag_hash;
+        info.keysize = sizeof(BloomRegistryKey);
+        info.entrysize = sizeof(BloomLocalView);
+        local_views = hash_create("octo_bloom local views", 16, &info,
+                                  HASH_ELEM | HASH_BLOBS);
+    }
 
-        bloom_shared_state->bloom_registry = ShmemInitHash("octo_bloom_registry",
-                                                         10, 10,
-                                                         &info,
-                                                         HASH_ELEM | HASH_FUNCTION);
+    bool found;
+    BloomLocalView* view = (BloomLocalView*)hash_search(local_views, &entry->key,
+                                                        HASH_ENTER, &found);
+    if (!found) {
+        view->filter = nullptr;
+        view->counters = nullptr;
+        view->generation = 0;
+    }
+    view->shared = shared;
+
+    // The filter may have been replaced by one of another kind
+    if (view->generation != entry->generation || !view->filter) {
+        if (view->filter) {
+            filter_destroy(view->filter);
+        }
+        dsa_area* area = attach_area(false);
+        void* stages[OCTO_BLOOM_STAGE_SLOTS];
+        for (int i = 0; i < entry->num_stages; ++i) {
+            stages[i] = dsa_get_address(area, entry->stage_bits[i]);
+            // DSM segments are mapped per backend, each needing the advice
+            if (!bloom_shared_state->area_place) {
+                bloom_advise_huge_pages(stages[i], stage_bytes(entry, i));
+            }
+        }
+        MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+        view->filter = filter_create_chain_view(entry->params, entry->stage_params,
+                                                stages, entry->num_stages);
+        if (DsaPointerIsValid(entry->resize_bits)) {
+            FilterBackend* next = filter_create_view(entry->resize_params,
+                                                     dsa_get_address(area, entry->resize_bits));
+            view->filter = filter_create_resizing_view(view->filter, next);
+        }
+        // The node is the one this backend runs on now; the view is made
+        // again whenever the filter changes, if not when we migrate
+        int node = bloom_current_numa_node();
+        if (entry->num_node_copies > 0 && entry->node_copy_source == entry->stage_bits[0] &&
+            DsaPointerIsValid(entry->node_copy_bits[node])) {
+            FilterBackend* copy = filter_create_view(
+                entry->params, dsa_get_address(area, entry->node_copy_bits[node]));
+            view->filter = filter_create_node_copy_view(view->filter, copy, &shared->writes,
+                                                        &shared->node_copy_synced[node]);
+        }
+        MemoryContextSwitchTo(oldcontext);
 
-        // bloom_shared_state->registry_lock = LWLockAssign(); // TODO: Implement proper locking
-        bloom_shared_state->total_memory = size;
-        bloom_shared_state->max_filters = 10;
+        int slot = counter_slot();
+        view->counters = nullptr;
+        if (DsaPointerIsValid(entry->counters) && slot >= 0 && slot < entry->counter_slots) {
+            BloomFilterCounterSlot* slots =
+                (BloomFilterCounterSlot*)dsa_get_address(area, entry->counters);
+            view->counters = &slots[slot].counters;
+        }
+        view->generation = entry->generation;
     }
+
+    return view->filter;
 }
 
-OctoBloomFilter* get_bloom_filter(Oid table_oid, int16_t attnum) {
-    if (!bloom_shared_state) {
+FilterBackend* get_bloom_filter(Oid table_oid, int16_t attnum, BloomKeyType* key_type) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+
+    // Copy what the view needs; the entry can change once the lock is released
+    BloomRegistryEntry snapshot;
+    bool usable = entry && entry->is_valid && DsaPointerIsValid(entry->bits);
+    if (usable) {
+        snapshot = *entry;
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    if (!usable) {
         return nullptr;
     }
 
-    // LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED); // TODO: Implement proper locking
+    if (key_type) {
+        *key_type = snapshot.key_type;
+    }
+    return get_local_view(&snapshot, entry);
+}
 
-    // Create hash key
-    char key[sizeof(Oid) + sizeof(int16_t)];
-    memcpy(key, &table_oid, sizeof(Oid));
-    memcpy(key + sizeof(Oid), &attnum, sizeof(int16_t));
+// Remove the entry's snapshot file. Entry lock held exclusively
+static void drop_snapshot(BloomRegistryEntry* entry) {
+    if (entry->snapshot_live) {
+        remove_filter_snapshot(&entry->key);
+        entry->snapshot_live = false;
+    }
+}
 
-    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
-        bloom_shared_state->bloom_registry, key, HASH_FIND, NULL);
+// Keys are going into the filter that its snapshot may lack. The file must
+// be gone before they commit, so a restart never loads a filter missing
+// committed keys; the snapshot writer sees the bump and discards a file it
+// copied before it. Node copies are put out of step too, for the changes
+// made to the storage other than through a view. Registry lock held
+static void mark_filter_changed(BloomRegistryEntry* entry) {
+    // Only filters with copies count: the count is one more shared line to write
+    if (entry->copy_to_nodes || entry->num_node_copies > 0) {
+        pg_atomic_fetch_add_u64(&entry->writes, 1);
+    }
+    LWLockAcquire(entry->lock, LW_SHARED);
+    pg_atomic_fetch_add_u64(&entry->changes, 1);
+    bool live = entry->snapshot_live;
+    LWLockRelease(entry->lock);
 
-    // LWLockRelease(bloom_shared_state->registry_lock); // TODO: Implement proper locking
+    if (live) {
+        LWLockAcquire(entry->lock, LW_EXCLUSIVE);
+        drop_snapshot(entry);
+        LWLockRelease(entry->lock);
+    }
+}
 
-    if (entry && entry->is_valid) {
-        return entry->filter;
+// Move the entry's applied_lsn up to a change ending at lsn
+static void advance_applied_lsn(BloomRegistryEntry* entry, XLogRecPtr lsn) {
+    uint64 seen = pg_atomic_read_u64(&entry->applied_lsn);
+    while (seen < lsn && !pg_atomic_compare_exchange_u64(&entry->applied_lsn, &seen, lsn)) {
     }
+}
 
-    return nullptr;
+// Log a change to the entry's filter if changes are logged, which never
+// happens in recovery. Registry lock held
+static void log_change(BloomRegistryEntry* entry, BloomWalType type, const void* body,
+                       size_t body_size) {
+    if (filter_wal_enabled()) {
+        advance_applied_lsn(entry, log_filter_change(type, &entry->key, body, body_size,
+                                                     NULL, 0, NULL, 0));
+    }
 }
 
-bool register_bloom_filter(Oid table_oid, int16_t attnum,
-                          uint64_t expected_count, double false_positive_rate) {
-    if (!bloom_shared_state) {
-        // Try to initialize shared memory if it's not already done
-        init_shared_memory();
-        if (!bloom_shared_state) {
-            return false;
+static void log_stage_change(BloomRegistryEntry* entry, BloomWalType type, int stage,
+                             const BloomFilterParams* params) {
+    BloomWalStage body;
+    memset(&body, 0, sizeof(body));
+    body.stage = stage;
+    if (params) {
+        body.params = *params;
+    }
+    log_change(entry, type, &body, sizeof(body));
+}
+
+static void log_count_change(BloomRegistryEntry* entry, BloomWalType type, uint64_t count) {
+    BloomWalCount body;
+    memset(&body, 0, sizeof(body));
+    body.count = count;
+    log_change(entry, type, &body, sizeof(body));
+}
+
+// Log the entry's layout, which a standby creates empty storage for
+static void log_create(BloomRegistryEntry* entry, bool complete) {
+    BloomWalCreate body;
+    memset(&body, 0, sizeof(body));
+    body.params = entry->params;
+    body.key_type = entry->key_type;
+    body.num_stages = entry->num_stages;
+    body.complete = complete;
+    memcpy(body.stage_params, entry->stage_params, entry->num_stages * sizeof(BloomFilterParams));
+    log_change(entry, BLOOM_WAL_CREATE, &body, sizeof(body));
+}
+
+// Filter storage, advised onto huge pages before anything touches it and
+// then zeroed if asked. Storage that is filled at once is left unzeroed
+static dsa_pointer allocate_bits(dsa_area* area, Size bytes, bool zero) {
+    dsa_pointer bits = dsa_allocate_extended(area, bytes, DSA_ALLOC_HUGE | DSA_ALLOC_NO_OOM);
+    if (DsaPointerIsValid(bits)) {
+        void* address = dsa_get_address(area, bits);
+        bloom_advise_huge_pages(address, bytes);
+        if (zero) {
+            memset(address, 0, bytes);
         }
     }
+    return bits;
+}
+
+// The i-th retired storage. Registry lock held
+static BloomRetiredStorage* retired_slot(dsa_area* area, int i) {
+    if (i < OCTO_BLOOM_MAX_RETIRED) {
+        return &bloom_shared_state->retired[i];
+    }
+    BloomRetiredStorage* more =
+        (BloomRetiredStorage*)dsa_get_address(area, bloom_shared_state->retired_more);
+    return &more[i - OCTO_BLOOM_MAX_RETIRED];
+}
+
+// Room for one more retired storage, doubling the array in the area when
+// it is full. Registry lock held exclusively
+static bool reserve_retired_slot(dsa_area* area) {
+    int more = bloom_shared_state->num_retired - OCTO_BLOOM_MAX_RETIRED;
+    if (more < bloom_shared_state->retired_more_capacity) {
+        return true;
+    }
+    int capacity = Max(OCTO_BLOOM_MAX_RETIRED, 2 * bloom_shared_state->retired_more_capacity);
+    dsa_pointer grown = dsa_allocate_extended(area, capacity * sizeof(BloomRetiredStorage),
+                                              DSA_ALLOC_NO_OOM);
+    if (!DsaPointerIsValid(grown)) {
+        return false;
+    }
+    if (DsaPointerIsValid(bloom_shared_state->retired_more)) {
+        memcpy(dsa_get_address(area, grown),
+               dsa_get_address(area, bloom_shared_state->retired_more),
+               more * sizeof(BloomRetiredStorage));
+        dsa_free(area, bloom_shared_state->retired_more);
+    }
+    bloom_shared_state->retired_more = grown;
+    bloom_shared_state->retired_more_capacity = capacity;
+    return true;
+}
+
+// Hand storage unlinked from the registry to reclaim_retired_storage. It
+// stays in used_memory until freed. Registry lock held exclusively
+static void retire_storage(dsa_area* area, dsa_pointer bits, Size bytes) {
+    if (bloom_shared_state->num_retired >= OCTO_BLOOM_MAX_RETIRED &&
+        !reserve_retired_slot(area)) {
+        // A reader may still hold a view of it, so it can't be freed;
+        // it stays allocated, and counted, until the server restarts
+        ereport(LOG,
+                (errmsg("octo_bloom: could not record retired filter storage, leaking "
+                        "%zu bytes", bytes),
+                 errhint("Increase octo_bloom.shared_memory_mb.")));
+        return;
+    }
+    BloomRetiredStorage* retired = retired_slot(area, bloom_shared_state->num_retired++);
+    retired->bits = bits;
+    retired->bytes = bytes;
+    retired->seq = ++bloom_shared_state->retire_seq;
+    retired->next_xid = XidFromFullTransactionId(ReadNextFullTransactionId());
+}
 
-    // LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE); // TODO: Implement proper locking
+// Give a new filter zeroed counters and no rebuilds, or no counters if
+// there is no room for them. Registry lock held exclusively
+static void make_counters(dsa_area* area, BloomRegistryEntry* entry) {
+    Size bytes = (Size)MaxBackends * sizeof(BloomFilterCounterSlot);
 
-    // Create hash key
-    char key[sizeof(Oid) + sizeof(int16_t)];
-    memcpy(key, &table_oid, sizeof(Oid));
-    memcpy(key + sizeof(Oid), &attnum, sizeof(int16_t));
+    entry->counters = InvalidDsaPointer;
+    entry->counter_slots = 0;
+    entry->rebuilds = 0;
+    entry->last_rebuild = 0;
+    entry->last_rebuild_ms = 0;
+    entry->total_rebuild_ms = 0;
+
+    if (bloom_shared_state->used_memory + bytes > memory_limit()) {
+        return;
+    }
+    dsa_pointer counters = dsa_allocate_extended(area, bytes, DSA_ALLOC_NO_OOM | DSA_ALLOC_ZERO);
+    if (!DsaPointerIsValid(counters)) {
+        return;
+    }
+    BloomFilterCounterSlot* slots = (BloomFilterCounterSlot*)dsa_get_address(area, counters);
+    for (int i = 0; i < MaxBackends; ++i) {
+        BloomFilterCounters* c = &slots[i].counters;
+        pg_atomic_init_u64(&c->lookups, 0);
+        pg_atomic_init_u64(&c->negatives, 0);
+        pg_atomic_init_u64(&c->exists_confirmed, 0);
+        pg_atomic_init_u64(&c->exists_false, 0);
+        pg_atomic_init_u64(&c->adds, 0);
+        pg_atomic_init_u64(&c->removes, 0);
+    }
+    entry->counters = counters;
+    entry->counter_slots = MaxBackends;
+    bloom_shared_state->used_memory += bytes;
+}
+
+// A new entry has no node copies and hasn't asked for any. Registry lock
+// held exclusively
+static void init_node_copies(BloomRegistryEntry* entry) {
+    entry->copy_to_nodes = false;
+    entry->num_node_copies = 0;
+    entry->node_copy_source = InvalidDsaPointer;
+    entry->node_copy_bytes = 0;
+    pg_atomic_init_u64(&entry->writes, 1);
+    for (int i = 0; i < OCTO_BLOOM_MAX_NUMA_NODES; ++i) {
+        entry->node_copy_bits[i] = InvalidDsaPointer;
+        pg_atomic_init_u64(&entry->node_copy_synced[i], 0);
+    }
+}
+
+// Retire an entry's node copies. Views made before see the generation
+// move, which the caller bumps. Registry lock held exclusively
+static void drop_node_copies(dsa_area* area, BloomRegistryEntry* entry) {
+    for (int i = 0; i < OCTO_BLOOM_MAX_NUMA_NODES; ++i) {
+        pg_atomic_write_u64(&entry->node_copy_synced[i], 0);
+        if (DsaPointerIsValid(entry->node_copy_bits[i])) {
+            retire_storage(area, entry->node_copy_bits[i], entry->node_copy_bytes);
+            entry->bytes -= entry->node_copy_bytes;
+            entry->node_copy_bits[i] = InvalidDsaPointer;
+        }
+    }
+    entry->num_node_copies = 0;
+    entry->node_copy_source = InvalidDsaPointer;
+}
+
+// Retire every stage of an entry's filter, any resize in progress and its
+// counters. Registry lock held exclusively
+static void free_filter_storage(dsa_area* area, BloomRegistryEntry* entry) {
+    drop_node_copies(area, entry);
+    for (int i = 0; i < entry->num_stages; ++i) {
+        if (DsaPointerIsValid(entry->stage_bits[i])) {
+            retire_storage(area, entry->stage_bits[i], stage_bytes(entry, i));
+        }
+    }
+    if (DsaPointerIsValid(entry->resize_bits)) {
+        retire_storage(area, entry->resize_bits, filter_storage_size(entry->resize_params));
+    }
+    if (DsaPointerIsValid(entry->counters)) {
+        retire_storage(area, entry->counters,
+                       (Size)entry->counter_slots * sizeof(BloomFilterCounterSlot));
+    }
+    entry->num_stages = 0;
+    entry->bits = InvalidDsaPointer;
+    entry->resize_bits = InvalidDsaPointer;
+    entry->counters = InvalidDsaPointer;
+    entry->bytes = 0;
+}
+
+bool register_bloom_filter(Oid table_oid, int16_t attnum, const BloomFilterParams* filter_params,
+                          const BloomKeyType* key_type) {
+    ensure_shared_memory();
+
+    BloomFilterParams params = *filter_params;
+    Size bytes = filter_storage_size(params);
+    BloomFilterParams first_stage = params;
+    if (params.kind == FilterKind::Scalable) {
+        first_stage = ScalableFilter::firstStageParams(params, params.expected_count);
+    }
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    // A snapshot file left from before a restart describes an older filter
+    remove_filter_snapshot(&key);
+
+    // Make what room we can without waiting
+    if (bloom_shared_state->num_retired > 0) {
+        reclaim_retired_storage(false);
+    }
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    dsa_area* area = attach_area(true);
 
-    bool found;
     BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
-        bloom_shared_state->bloom_registry, key, HASH_ENTER, &found);
+        bloom_registry, &key, HASH_FIND, NULL);
 
-    if (found) {
+    if (!entry && hash_get_num_entries(bloom_registry) >= bloom_shared_state->max_filters) {
+        ereport(ERROR,
+                (errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+                 errmsg("too many bloom filters"),
+                 errdetail("At most %d filters can be registered.",
+                           bloom_shared_state->max_filters),
+                 errhint("Increase octo_bloom.max_filters.")));
+    }
+
+    // A replaced filter's storage is retired, not freed: readers may still
+    // be using it, so for now both count against the limit
+    Size limit = memory_limit();
+    if (bloom_shared_state->used_memory + bytes > limit) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("not enough bloom filter memory for %zu bytes", bytes),
+                 errdetail("%zu of %zu bytes are in use.",
+                           bloom_shared_state->used_memory, limit),
+                 errhint("Increase octo_bloom.shared_memory_mb.")));
+    }
+
+    // Zeroed bits are an empty filter
+    dsa_pointer bits = allocate_bits(area, bytes, true);
+    if (!DsaPointerIsValid(bits)) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return false;
+    }
+
+    if (entry) {
         // Filter already exists, update it instead
-        if (entry->filter) {
-            entry->filter->~OctoBloomFilter();
-            pfree(entry->filter);
-        }
-        entry->filter = (OctoBloomFilter*)palloc(sizeof(OctoBloomFilter));
-        new (entry->filter) OctoBloomFilter(expected_count, false_positive_rate);
-        entry->expected_count = expected_count;
-        entry->false_positive_rate = false_positive_rate;
-        entry->current_count = 0;
-        entry->is_valid = true;
-        // LWLockRelease(bloom_shared_state->registry_lock); // TODO: Implement proper locking
-        return true;
+        LWLockAcquire(entry->lock, LW_EXCLUSIVE);
+        drop_snapshot(entry);
+        free_filter_storage(area, entry);
+    } else {
+        // Initialize new entry
+        entry = (BloomRegistryEntry*)hash_search(bloom_registry, &key, HASH_ENTER, NULL);
+        entry->lock = stripe_lock_for(&key);
+        pg_atomic_init_u64(&entry->current_count, 0);
+        pg_atomic_init_u64(&entry->changes, 0);
+        pg_atomic_init_u64(&entry->applied_lsn, InvalidXLogRecPtr);
+        entry->snapshot_live = false;
+        init_node_copies(entry);
+        LWLockAcquire(entry->lock, LW_EXCLUSIVE);
     }
 
-    // Initialize new entry
-    entry->table_oid = table_oid;
-    entry->attnum = attnum;
-    entry->expected_count = expected_count;
-    entry->false_positive_rate = false_positive_rate;
-    entry->current_count = 0;
+    entry->params = params;
+    entry->key_type = *key_type;
+    entry->bits = bits;
+    entry->bytes = bytes;
+    entry->num_stages = 1;
+    entry->stage_bits[0] = bits;
+    entry->stage_params[0] = first_stage;
+    entry->resize_bits = InvalidDsaPointer;
+    pg_atomic_write_u64(&entry->current_count, 0);
     entry->is_valid = true;
-    // entry->lock = LWLockAssign(); // TODO: Implement proper locking
-
-    // Create the bloom filter using PostgreSQL memory management
-    entry->filter = (OctoBloomFilter*)palloc(sizeof(OctoBloomFilter));
-    new (entry->filter) OctoBloomFilter(expected_count, false_positive_rate);
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+    entry->maintained_generation = 0;
+    bloom_shared_state->used_memory += bytes;
+    make_counters(area, entry);
+    log_create(entry, true);
 
-    // LWLockRelease(bloom_shared_state->registry_lock); // TODO: Implement proper locking
+    LWLockRelease(entry->lock);
+    LWLockRelease(bloom_shared_state->registry_lock);
     return true;
 }
 
+// Unlink an entry and retire its storage. Registry lock held exclusively
+static void remove_entry(BloomRegistryEntry* entry) {
+    BloomRegistryKey key = entry->key;
+    LWLockAcquire(entry->lock, LW_EXCLUSIVE);
+    drop_snapshot(entry);
+    free_filter_storage(attach_area(false), entry);
+    LWLockRelease(entry->lock);
+    hash_search(bloom_registry, &key, HASH_REMOVE, NULL);
+    pg_atomic_fetch_add_u64(&bloom_shared_state->generation, 1);
+}
+
 void unregister_bloom_filter(Oid table_oid, int16_t attnum) {
-    if (!bloom_shared_state) {
-        return;
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+
+    if (entry) {
+        log_change(entry, BLOOM_WAL_DROP, NULL, 0);
+        remove_entry(entry);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+BloomFilterCounters* get_bloom_filter_counters(Oid table_oid, int16_t attnum) {
+    if (!local_views) {
+        return nullptr;
+    }
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+    BloomLocalView* view = (BloomLocalView*)hash_search(local_views, &key, HASH_FIND, NULL);
+    return view ? view->counters : nullptr;
+}
+
+void note_bloom_filter_rebuilt(Oid table_oid, int16_t attnum, TimestampTz start) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+    TimestampTz now = GetCurrentTimestamp();
+    double ms = (double)(now - start) / 1000.0;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    if (entry) {
+        LWLockAcquire(entry->lock, LW_EXCLUSIVE);
+        entry->rebuilds++;
+        entry->last_rebuild = now;
+        entry->last_rebuild_ms = ms;
+        entry->total_rebuild_ms += ms;
+        LWLockRelease(entry->lock);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+int get_bloom_filter_status(BloomFilterStatus** rows) {
+    ensure_shared_memory();
+
+    BloomFilterStatus* status_rows = (BloomFilterStatus*)palloc0(
+        sizeof(BloomFilterStatus) * bloom_shared_state->max_filters);
+    int count = 0;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+
+    dsa_area* area = attach_area(false);
+    HASH_SEQ_STATUS status;
+    BloomRegistryEntry* entry;
+    hash_seq_init(&status, bloom_registry);
+    while ((entry = (BloomRegistryEntry*)hash_seq_search(&status)) != NULL) {
+        if (entry->key.dboid != MyDatabaseId || !entry->is_valid ||
+            count >= bloom_shared_state->max_filters) {
+            continue;
+        }
+        BloomFilterStatus* row = &status_rows[count++];
+        row->table_oid = entry->key.table_oid;
+        row->attnum = entry->key.attnum;
+        row->params = entry->params;
+        row->num_stages = entry->num_stages;
+        row->resizing = DsaPointerIsValid(entry->resize_bits);
+        row->bytes = entry->bytes;
+        row->node_copies = entry->num_node_copies;
+        row->count = pg_atomic_read_u64(&entry->current_count);
+
+        // Slots are read as their backends write them, so the sums are
+        // only as consistent as a glance at running counters can be
+        row->has_counters = area && DsaPointerIsValid(entry->counters);
+        if (row->has_counters) {
+            BloomFilterCounterSlot* slots =
+                (BloomFilterCounterSlot*)dsa_get_address(area, entry->counters);
+            for (int i = 0; i < entry->counter_slots; ++i) {
+                BloomFilterCounters* c = &slots[i].counters;
+                row->lookups += pg_atomic_read_u64(&c->lookups);
+                row->negatives += pg_atomic_read_u64(&c->negatives);
+                row->exists_confirmed += pg_atomic_read_u64(&c->exists_confirmed);
+                row->exists_false += pg_atomic_read_u64(&c->exists_false);
+                row->adds += pg_atomic_read_u64(&c->adds);
+                row->removes += pg_atomic_read_u64(&c->removes);
+            }
+        }
+
+        LWLockAcquire(entry->lock, LW_SHARED);
+        row->rebuilds = entry->rebuilds;
+        row->last_rebuild = entry->last_rebuild;
+        row->last_rebuild_ms = entry->last_rebuild_ms;
+        row->total_rebuild_ms = entry->total_rebuild_ms;
+        LWLockRelease(entry->lock);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    *rows = status_rows;
+    return count;
+}
+
+int get_bloom_filter_columns(Oid table_oid, int16_t* attnums, int max_columns,
+                             uint64_t* generation) {
+    ensure_shared_memory();
+
+    int count = 0;
+
+    // The registry holds at most max_filters entries, and callers cache
+    // the result until the generation moves, so a full pass is cheap
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    HASH_SEQ_STATUS status;
+    BloomRegistryEntry* entry;
+    hash_seq_init(&status, bloom_registry);
+    while ((entry = (BloomRegistryEntry*)hash_seq_search(&status)) != NULL) {
+        if (entry->key.dboid != MyDatabaseId || entry->key.table_oid != table_oid ||
+            !entry->is_valid || count >= max_columns) {
+            continue;
+        }
+        // Insertion sort; tables have few filters
+        int i = count++;
+        while (i > 0 && attnums[i - 1] > entry->key.attnum) {
+            attnums[i] = attnums[i - 1];
+            i--;
+        }
+        attnums[i] = entry->key.attnum;
+    }
+    // Every change to the registry bumps the generation under this lock
+    *generation = pg_atomic_read_u64(&bloom_shared_state->generation);
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    return count;
+}
+
+void set_bloom_filter_count(Oid table_oid, int16_t attnum, uint64_t count) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    if (entry) {
+        // Called once a rebuild has filled the filter
+        mark_filter_changed(entry);
+        pg_atomic_write_u64(&entry->current_count, count);
+        log_count_change(entry, BLOOM_WAL_COUNT, count);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+uint64_t get_bloom_filter_count(Oid table_oid, int16_t attnum) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+    uint64_t count = 0;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    if (entry) {
+        count = pg_atomic_read_u64(&entry->current_count);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return count;
+}
+
+void note_bloom_filter_adds(Oid table_oid, int16_t attnum, uint64_t count) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+    Latch* latch = NULL;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    if (entry && entry->is_valid) {
+        mark_filter_changed(entry);
+        pg_atomic_fetch_add_u64(&entry->current_count, count);
+        // Once per generation: the worker marks what it has taken up
+        if (entry->maintained_generation != entry->generation &&
+            bloom_maintenance_due(entry) != BLOOM_MAINTAIN_NONE) {
+            latch = bloom_shared_state->maintenance_latch;
+        }
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    // A latch left behind by an exited launcher is still valid memory
+    if (latch) {
+        SetLatch(latch);
     }
+}
+
+void note_bloom_filter_changed(Oid table_oid, int16_t attnum) {
+    ensure_shared_memory();
 
-    // LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE); // TODO: Implement proper locking
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
 
-    // Create hash key
-    char key[sizeof(Oid) + sizeof(int16_t)];
-    memcpy(key, &table_oid, sizeof(Oid));
-    memcpy(key + sizeof(Oid), &attnum, sizeof(int16_t));
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
 
     BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
-        bloom_shared_state->bloom_registry, key, HASH_REMOVE, NULL);
+        bloom_registry, &key, HASH_FIND, NULL);
+    if (entry) {
+        mark_filter_changed(entry);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+static void apply_hashes(FilterBackend* filter, const uint64_t* h1, const uint64_t* h2,
+                         int count, bool remove) {
+    if (remove) {
+        for (int i = 0; i < count; ++i) {
+            filter->removeHashes(h1[i], h2[i]);
+        }
+    } else {
+        filter->addHashBatch(h1, h2, count);
+    }
+}
 
-    if (entry && entry->filter) {
-        entry->filter->~OctoBloomFilter(); // Call destructor
-        pfree(entry->filter);
-        entry->filter = nullptr;
+// Count adds applied to a filter in its writes, for node copies: a view
+// made before the filter had any doesn't count its own. Removes leave a
+// copy holding only false positives. Filters that want no copies, nearly
+// all of them, skip the count and its contended cache line
+static void note_view_writes(Oid table_oid, int16_t attnum, bool remove) {
+    if (remove || !local_views) {
+        return;
+    }
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+    BloomLocalView* view = (BloomLocalView*)hash_search(local_views, &key, HASH_FIND, NULL);
+    if (!view) {
+        return;
     }
+    // The adds must be visible before the flag is read: copies are asked
+    // for before they are made, and made before they are first refreshed
+    pg_memory_barrier();
+    volatile BloomRegistryEntry* shared = view->shared;
+    if (shared->copy_to_nodes || shared->num_node_copies > 0) {
+        pg_atomic_fetch_add_u64(&view->shared->writes, 1);
+    }
+}
 
-    // LWLockRelease(bloom_shared_state->registry_lock); // TODO: Implement proper locking
+// Whether filter is this backend's view of the entry's current storage.
+// Registry lock held
+static bool view_is_current(const BloomRegistryEntry* entry, const FilterBackend* filter) {
+    if (!local_views) {
+        return false;
+    }
+    BloomLocalView* view = (BloomLocalView*)hash_search(local_views, &entry->key,
+                                                        HASH_FIND, NULL);
+    return view && view->filter == filter && view->generation == entry->generation;
 }
 
-Size calculate_shared_memory_size(int max_filters, Size filter_memory) {
-    Size registry_size = hash_estimate_size(max_filters, sizeof(BloomRegistryEntry));
-    Size state_size = sizeof(BloomSharedState);
-    Size total_filter_memory = max_filters * filter_memory;
+void apply_bloom_filter_hashes(Oid table_oid, int16_t attnum, FilterBackend* filter,
+                               const uint64_t* h1, const uint64_t* h2, int count, bool remove) {
+    if (count == 0 || (remove && !filter->supportsRemove())) {
+        return;
+    }
+    BloomFilterCounters* counters = get_bloom_filter_counters(table_oid, attnum);
+    if (counters) {
+        bloom_counter_add(remove ? &counters->removes : &counters->adds, count);
+    }
+    if (!filter_wal_enabled()) {
+        apply_hashes(filter, h1, h2, count, remove);
+        note_view_writes(table_oid, attnum, remove);
+        return;
+    }
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    // An add through an older view is logged all the same: the standby's
+    // filter holding a key the primary's lacks is only a false positive. A
+    // remove isn't, as the key may be the current filter's own
+    if (!entry || !entry->is_valid || (remove && !view_is_current(entry, filter))) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        apply_hashes(filter, h1, h2, count, remove);
+        note_view_writes(table_oid, attnum, remove);
+        return;
+    }
+
+    // A snapshot copied meanwhile may or may not have the keys gone, so
+    // replay after it can't tell whether to remove them again
+    if (remove) {
+        mark_filter_changed(entry);
+    }
+
+    // Applied and logged in the same order, against images taken under the
+    // lock in exclusive mode
+    LWLockAcquire(entry->lock, LW_SHARED);
+    for (int i = 0; i < count; i += OCTO_BLOOM_WAL_MAX_HASHES) {
+        int n = Min(count - i, OCTO_BLOOM_WAL_MAX_HASHES);
+        apply_hashes(filter, h1 + i, h2 + i, n, remove);
+
+        BloomWalHashes body;
+        body.count = n;
+        XLogRecPtr lsn = log_filter_change(remove ? BLOOM_WAL_REMOVE : BLOOM_WAL_ADD, &key,
+                                           &body, sizeof(body), h1 + i, n * sizeof(uint64_t),
+                                           h2 + i, n * sizeof(uint64_t));
+        advance_applied_lsn(entry, lsn);
+    }
+    LWLockRelease(entry->lock);
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    note_view_writes(table_oid, attnum, remove);
+}
+
+// Counting and cuckoo images overwrite on replay, so they must be logged
+// whole with no change in between. The bit layouts' are ORed in
+static bool image_overwrites(const BloomFilterParams& params) {
+    return params.kind == FilterKind::Cuckoo || params.layout == BloomLayout::Counting;
+}
+
+// The image slot of an entry's storage, and its size. InvalidDsaPointer is
+// the first stage. Registry lock held
+static bool find_image_slot(const BloomRegistryEntry* entry, dsa_pointer* storage, int* slot,
+                            Size* bytes) {
+    if (!DsaPointerIsValid(*storage)) {
+        *storage = entry->stage_bits[0];
+    }
+    if (DsaPointerIsValid(entry->resize_bits) && entry->resize_bits == *storage) {
+        *slot = OCTO_BLOOM_WAL_RESIZE_SLOT;
+        *bytes = filter_storage_size(entry->resize_params);
+        return true;
+    }
+    for (int i = 0; i < entry->num_stages; ++i) {
+        if (entry->stage_bits[i] == *storage) {
+            *slot = i;
+            *bytes = stage_bytes(entry, i);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void log_image_chunk(BloomRegistryEntry* entry, dsa_pointer storage, int slot,
+                            uint64_t offset, Size length) {
+    BloomWalImage body;
+    memset(&body, 0, sizeof(body));
+    body.slot = slot;
+    body.length = length;
+    body.offset = offset;
+    const char* base = (const char*)dsa_get_address(attach_area(false), storage);
+    advance_applied_lsn(entry, log_filter_change(BLOOM_WAL_IMAGE, &entry->key, &body,
+                                                 sizeof(body), base + offset, length,
+                                                 NULL, 0));
+}
+
+void log_bloom_filter_image(Oid table_oid, int16_t attnum, dsa_pointer storage, Size bytes) {
+    if (!filter_wal_enabled()) {
+        return;
+    }
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+    int slot;
+    Size size;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    if (!entry || !find_image_slot(entry, &storage, &slot, &size)) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return;
+    }
+    if (bytes == 0 || bytes > size) {
+        bytes = size;
+    }
+
+    if (image_overwrites(entry->params)) {
+        LWLockAcquire(entry->lock, LW_EXCLUSIVE);
+        for (Size offset = 0; offset < bytes; offset += OCTO_BLOOM_WAL_IMAGE_CHUNK) {
+            log_image_chunk(entry, storage, slot, offset,
+                            Min(bytes - offset, (Size)OCTO_BLOOM_WAL_IMAGE_CHUNK));
+        }
+        LWLockRelease(entry->lock);
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return;
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    // A chunk at a time under the lock, so the storage can't be freed under
+    // us; its slot is looked up again as stages may be dropped meanwhile
+    for (Size offset = 0; offset < bytes; offset += OCTO_BLOOM_WAL_IMAGE_CHUNK) {
+        CHECK_FOR_INTERRUPTS();
+        LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+        entry = (BloomRegistryEntry*)hash_search(bloom_registry, &key, HASH_FIND, NULL);
+        bool found = entry && find_image_slot(entry, &storage, &slot, &size);
+        if (found) {
+            log_image_chunk(entry, storage, slot, offset,
+                            Min(bytes - offset, (Size)OCTO_BLOOM_WAL_IMAGE_CHUNK));
+        }
+        LWLockRelease(bloom_shared_state->registry_lock);
+        if (!found) {
+            return;
+        }
+    }
+}
+
+void replicate_bloom_filter(Oid table_oid, int16_t attnum) {
+    ensure_shared_memory();
+
+    if (!filter_wal_enabled()) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter changes are not being logged"),
+                 errhint("Preload octo_bloom and turn on octo_bloom.wal_log on the primary.")));
+    }
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    if (!entry || !entry->is_valid) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_UNDEFINED_OBJECT),
+                 errmsg("no bloom filter on column %d of \"%s\"", attnum,
+                        get_rel_name(table_oid))));
+    }
+    if (DsaPointerIsValid(entry->resize_bits)) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter is being resized"),
+                 errhint("Replicate it once the resize is done.")));
+    }
+
+    // Standbys create it empty and don't use it until every stage is in.
+    // Changes from now on reach them in order between the images
+    int num_stages = entry->num_stages;
+    dsa_pointer stages[OCTO_BLOOM_STAGE_SLOTS];
+    memcpy(stages, entry->stage_bits, num_stages * sizeof(dsa_pointer));
+    log_create(entry, false);
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    for (int i = 0; i < num_stages; ++i) {
+        log_bloom_filter_image(table_oid, attnum, stages[i], 0);
+    }
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    entry = (BloomRegistryEntry*)hash_search(bloom_registry, &key, HASH_FIND, NULL);
+    if (entry) {
+        log_count_change(entry, BLOOM_WAL_READY, pg_atomic_read_u64(&entry->current_count));
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+// Allocate and link a new newest stage. Registry lock held exclusively;
+// returns InvalidDsaPointer if the memory limit or the area is exhausted
+static dsa_pointer append_stage(BloomRegistryEntry* entry, const BloomFilterParams* stage) {
+    Size bytes = ScalableFilter::stageStorageSize(*stage);
+    if (bloom_shared_state->used_memory + bytes > memory_limit()) {
+        return InvalidDsaPointer;
+    }
+
+    // Zeroed storage is an empty stage with a count of 0
+    dsa_pointer bits = allocate_bits(attach_area(false), bytes, true);
+    if (!DsaPointerIsValid(bits)) {
+        return InvalidDsaPointer;
+    }
+
+    entry->stage_bits[entry->num_stages] = bits;
+    entry->stage_params[entry->num_stages] = *stage;
+    entry->num_stages++;
+    entry->bytes += bytes;
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+    bloom_shared_state->used_memory += bytes;
+    return bits;
+}
+
+// Retire every stage before keep. Registry lock held exclusively
+static void drop_stages(BloomRegistryEntry* entry, int keep) {
+    dsa_area* area = attach_area(false);
+    for (int i = 0; i < keep; ++i) {
+        Size bytes = stage_bytes(entry, i);
+        retire_storage(area, entry->stage_bits[i], bytes);
+        entry->bytes -= bytes;
+    }
+    int remaining = entry->num_stages - keep;
+    memmove(entry->stage_bits, entry->stage_bits + keep, remaining * sizeof(dsa_pointer));
+    memmove(entry->stage_params, entry->stage_params + keep,
+            remaining * sizeof(BloomFilterParams));
+    entry->num_stages = remaining;
+    entry->bits = entry->stage_bits[0];
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+}
+
+bool grow_bloom_filter(Oid table_oid, int16_t attnum, int seen_stages) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+
+    bool grown;
+    if (!entry || !entry->is_valid || entry->params.kind != FilterKind::Scalable) {
+        grown = false;
+    } else if (entry->num_stages != seen_stages) {
+        // Another backend grew or compacted the chain first
+        grown = true;
+    } else if (entry->num_stages >= OCTO_BLOOM_MAX_STAGES) {
+        grown = false;
+    } else {
+        BloomFilterParams next = ScalableFilter::nextStageParams(
+            entry->stage_params[entry->num_stages - 1]);
+        grown = DsaPointerIsValid(append_stage(entry, &next));
+        if (grown) {
+            log_stage_change(entry, BLOOM_WAL_APPEND_STAGE, entry->num_stages - 1, &next);
+        }
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return grown;
+}
+
+dsa_pointer append_bloom_filter_stage(Oid table_oid, int16_t attnum,
+                                      const BloomFilterParams* stage) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    if (!entry || !entry->is_valid || entry->params.kind != FilterKind::Scalable) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("no scalable bloom filter for this column")));
+    }
+    if (entry->num_stages >= OCTO_BLOOM_STAGE_SLOTS) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter is already being compacted")));
+    }
+
+    Size bytes = ScalableFilter::stageStorageSize(*stage);
+    dsa_pointer bits = append_stage(entry, stage);
+    if (!DsaPointerIsValid(bits)) {
+        Size used = bloom_shared_state->used_memory;
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("not enough bloom filter memory for %zu bytes", bytes),
+                 errdetail("%zu of %zu bytes are in use.", used, memory_limit()),
+                 errhint("Increase octo_bloom.shared_memory_mb.")));
+    }
+    log_stage_change(entry, BLOOM_WAL_APPEND_STAGE, entry->num_stages - 1, stage);
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return bits;
+}
+
+bool drop_bloom_filter_stages_before(Oid table_oid, int16_t attnum, dsa_pointer stage) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+
+    // The stage is gone if the filter was replaced in the meantime
+    int keep = -1;
+    for (int i = 0; entry && i < entry->num_stages; ++i) {
+        if (entry->stage_bits[i] == stage) {
+            keep = i;
+            break;
+        }
+    }
+
+    if (keep > 0) {
+        drop_stages(entry, keep);
+        log_stage_change(entry, BLOOM_WAL_DROP_STAGES, keep, NULL);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return keep >= 0;
+}
+
+// Allocate and link empty storage for a resize to params. Registry lock
+// held exclusively; returns InvalidDsaPointer if the memory limit or the
+// area is exhausted
+static dsa_pointer begin_resize(BloomRegistryEntry* entry, const BloomFilterParams* params) {
+    Size bytes = filter_storage_size(*params);
+    if (bloom_shared_state->used_memory + bytes > memory_limit()) {
+        return InvalidDsaPointer;
+    }
+    dsa_pointer bits = allocate_bits(attach_area(false), bytes, true);
+    if (!DsaPointerIsValid(bits)) {
+        return InvalidDsaPointer;
+    }
+
+    entry->resize_bits = bits;
+    entry->resize_params = *params;
+    entry->bytes += bytes;
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+    bloom_shared_state->used_memory += bytes;
+    return bits;
+}
+
+// Swap the filled resize storage in for the stages. Registry lock held
+// exclusively
+static void finish_resize(BloomRegistryEntry* entry, uint64_t count) {
+    // Readers move to the new storage as they see the generation change
+    dsa_area* area = attach_area(false);
+    drop_node_copies(area, entry);
+    for (int i = 0; i < entry->num_stages; ++i) {
+        retire_storage(area, entry->stage_bits[i], stage_bytes(entry, i));
+    }
+    entry->params = entry->resize_params;
+    entry->bits = entry->resize_bits;
+    entry->bytes = filter_storage_size(entry->params);
+    entry->num_stages = 1;
+    entry->stage_bits[0] = entry->resize_bits;
+    entry->stage_params[0] = entry->params;
+    entry->resize_bits = InvalidDsaPointer;
+    pg_atomic_write_u64(&entry->current_count, count);
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+}
+
+// Registry lock held exclusively
+static void cancel_resize(BloomRegistryEntry* entry) {
+    Size bytes = filter_storage_size(entry->resize_params);
+    retire_storage(attach_area(false), entry->resize_bits, bytes);
+    entry->bytes -= bytes;
+    entry->resize_bits = InvalidDsaPointer;
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+}
+
+dsa_pointer begin_bloom_filter_resize(Oid table_oid, int16_t attnum,
+                                      const BloomFilterParams* params, void** storage) {
+    ensure_shared_memory();
+
+    Size bytes = filter_storage_size(*params);
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    // Scalable filters are compacted instead; both sides must hash alike
+    if (!entry || !entry->is_valid || entry->params.kind == FilterKind::Scalable ||
+        entry->params.kind != params->kind || entry->params.hash != params->hash) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("no bloom filter of this kind to resize on this column")));
+    }
+    if (DsaPointerIsValid(entry->resize_bits)) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("bloom filter is already being resized")));
+    }
+
+    dsa_pointer bits = begin_resize(entry, params);
+    if (!DsaPointerIsValid(bits)) {
+        Size used = bloom_shared_state->used_memory;
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OUT_OF_MEMORY),
+                 errmsg("not enough bloom filter memory for %zu bytes", bytes),
+                 errdetail("%zu of %zu bytes are in use.", used, memory_limit()),
+                 errhint("Increase octo_bloom.shared_memory_mb.")));
+    }
+
+    log_stage_change(entry, BLOOM_WAL_RESIZE_BEGIN, 0, params);
+    *storage = dsa_get_address(attach_area(false), bits);
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return bits;
+}
+
+bool finish_bloom_filter_resize(Oid table_oid, int16_t attnum, dsa_pointer bits, uint64_t count) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    bool swapped = entry && entry->is_valid && entry->resize_bits == bits;
+
+    if (swapped) {
+        finish_resize(entry, count);
+        log_count_change(entry, BLOOM_WAL_RESIZE_FINISH, count);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return swapped;
+}
+
+bool cancel_bloom_filter_resize(Oid table_oid, int16_t attnum, dsa_pointer bits) {
+    ensure_shared_memory();
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    bool found = entry && entry->resize_bits == bits;
+
+    if (found) {
+        cancel_resize(entry);
+        log_change(entry, BLOOM_WAL_RESIZE_CANCEL, NULL, 0);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return found;
+}
+
+int reclaim_retired_storage(bool wait) {
+    ensure_shared_memory();
+
+    if (bloom_shared_state->num_retired == 0) {
+        return 0;
+    }
+
+    uint64_t waited_seq = 0;
+    if (wait) {
+        LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+        waited_seq = bloom_shared_state->retire_seq;
+        LWLockRelease(bloom_shared_state->registry_lock);
+
+        // A view of anything retired so far was taken by a transaction
+        // that is either running now or gone
+        int count;
+        VirtualTransactionId* vxids = GetCurrentVirtualXIDs(InvalidTransactionId, false, true,
+                                                            0, &count);
+        for (int i = 0; i < count; ++i) {
+            CHECK_FOR_INTERRUPTS();
+            VirtualXactLock(vxids[i], true);
+        }
+        pfree(vxids);
+    }
+
+    // Every transaction older than the horizon is gone, and every snapshot
+    // held now was taken after next_xid was handed out for anything older
+    TransactionId horizon = GetOldestNonRemovableTransactionId(NULL);
+    int freed = 0;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    dsa_area* area = attach_area(false);
+    int kept = 0;
+    for (int i = 0; i < bloom_shared_state->num_retired; ++i) {
+        BloomRetiredStorage* retired = retired_slot(area, i);
+        if (retired->seq <= waited_seq || TransactionIdPrecedes(retired->next_xid, horizon)) {
+            dsa_free(area, retired->bits);
+            bloom_shared_state->used_memory -= retired->bytes;
+            freed++;
+        } else {
+            *retired_slot(area, kept++) = *retired;
+        }
+    }
+    bloom_shared_state->num_retired = kept;
+    if (kept <= OCTO_BLOOM_MAX_RETIRED && DsaPointerIsValid(bloom_shared_state->retired_more)) {
+        dsa_free(area, bloom_shared_state->retired_more);
+        bloom_shared_state->retired_more = InvalidDsaPointer;
+        bloom_shared_state->retired_more_capacity = 0;
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return freed;
+}
+
+dsa_pointer allocate_bloom_storage(Size bytes) {
+    ensure_shared_memory();
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    dsa_pointer bits = InvalidDsaPointer;
+    if (bloom_shared_state->used_memory + bytes <= memory_limit()) {
+        bits = allocate_bits(attach_area(true), bytes, false);
+    }
+    if (DsaPointerIsValid(bits)) {
+        bloom_shared_state->used_memory += bytes;
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return bits;
+}
+
+// Never installed, so no backend has seen it and it can go at once
+void free_bloom_storage(dsa_pointer bits, Size bytes) {
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+    dsa_free(attach_area(false), bits);
+    bloom_shared_state->used_memory -= bytes;
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+bool install_bloom_filter(const BloomRegistryKey* key, const BloomFilterParams* params,
+                          const BloomKeyType* key_type, int num_stages,
+                          const BloomFilterParams* stage_params, const dsa_pointer* stage_bits,
+                          uint64_t count, XLogRecPtr applied_lsn) {
+    ensure_shared_memory();
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    // A filter created since startup is newer than any snapshot
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, key, HASH_FIND, NULL);
+    if (entry || hash_get_num_entries(bloom_registry) >= bloom_shared_state->max_filters) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return false;
+    }
+
+    entry = (BloomRegistryEntry*)hash_search(bloom_registry, key, HASH_ENTER, NULL);
+    entry->lock = stripe_lock_for(key);
+    entry->params = *params;
+    entry->key_type = *key_type;
+    entry->num_stages = num_stages;
+    entry->bytes = 0;
+    for (int i = 0; i < num_stages; ++i) {
+        entry->stage_bits[i] = stage_bits[i];
+        entry->stage_params[i] = stage_params[i];
+        entry->bytes += stage_bytes(entry, i);
+    }
+    entry->bits = entry->stage_bits[0];
+    entry->resize_bits = InvalidDsaPointer;
+    pg_atomic_init_u64(&entry->current_count, count);
+    pg_atomic_init_u64(&entry->changes, 0);
+    pg_atomic_init_u64(&entry->applied_lsn, applied_lsn);
+    init_node_copies(entry);
+    entry->is_valid = true;
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+    entry->maintained_generation = 0;
+    // The file it came from still matches it
+    entry->snapshot_live = true;
+    entry->snapshot_generation = entry->generation;
+    make_counters(attach_area(false), entry);
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+    return true;
+}
+
+// The entry under key, if a change ending at end_lsn is news to it.
+// Registry lock held
+static BloomRegistryEntry* find_replica(const BloomRegistryKey* key, XLogRecPtr end_lsn) {
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, key, HASH_FIND, NULL);
+    if (!entry || end_lsn <= pg_atomic_read_u64(&entry->applied_lsn)) {
+        return NULL;
+    }
+    return entry;
+}
+
+// A change that can't be replayed leaves the filter out of step with the
+// primary's: drop it, so probes here fall back to true. Registry lock held
+// exclusively
+static void drop_replica(BloomRegistryEntry* entry, const char* reason) {
+    ereport(LOG,
+            (errmsg("octo_bloom: dropping bloom filter on column %d of table %u: %s",
+                    entry->key.attnum, entry->key.table_oid, reason)));
+    remove_entry(entry);
+}
+
+// OR an image into storage a word at a time, as adds set bits
+static void or_bytes(char* dest, const char* src, Size length) {
+    Size i = 0;
+    for (; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, src + i, sizeof(word));
+        if (word != 0) {
+            __atomic_fetch_or((uint64_t*)(dest + i), word, __ATOMIC_RELAXED);
+        }
+    }
+    for (; i < length; ++i) {
+        if (src[i] != 0) {
+            __atomic_fetch_or((uint8_t*)(dest + i), (uint8_t)src[i], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void redo_bloom_filter_create(const BloomRegistryKey* key, XLogRecPtr end_lsn,
+                              const BloomWalCreate* create) {
+    ensure_shared_memory();
+
+    if (bloom_shared_state->num_retired > 0) {
+        reclaim_retired_storage(false);
+    }
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    dsa_area* area = attach_area(true);
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, key, HASH_FIND, NULL);
+    if (entry && end_lsn <= pg_atomic_read_u64(&entry->applied_lsn)) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return;
+    }
+
+    // Laid out as on the primary, so later changes find the same stages
+    BloomRegistryEntry layout;
+    memset(&layout, 0, sizeof(layout));
+    layout.params = create->params;
+    layout.num_stages = create->num_stages;
+    memcpy(layout.stage_params, create->stage_params, sizeof(layout.stage_params));
+    Size bytes = 0;
+    for (int i = 0; i < layout.num_stages; ++i) {
+        bytes += stage_bytes(&layout, i);
+    }
+
+    const char* failure = NULL;
+    if (!entry && hash_get_num_entries(bloom_registry) >= bloom_shared_state->max_filters) {
+        failure = "octo_bloom.max_filters is too low";
+    } else if (bloom_shared_state->used_memory + bytes > memory_limit()) {
+        failure = "octo_bloom.shared_memory_mb is too low";
+    }
+    int allocated = 0;
+    while (!failure && allocated < layout.num_stages) {
+        dsa_pointer bits = allocate_bits(area, stage_bytes(&layout, allocated), true);
+        if (!DsaPointerIsValid(bits)) {
+            failure = "octo_bloom.shared_memory_mb is too low";
+            break;
+        }
+        layout.stage_bits[allocated++] = bits;
+    }
+    if (failure) {
+        for (int i = 0; i < allocated; ++i) {
+            dsa_free(area, layout.stage_bits[i]);
+        }
+        ereport(LOG,
+                (errmsg("octo_bloom: could not replay bloom filter on column %d of table %u: %s",
+                        key->attnum, key->table_oid, failure)));
+        // The filter it replaces is out of date too
+        if (entry) {
+            remove_entry(entry);
+        }
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return;
+    }
+
+    if (entry) {
+        LWLockAcquire(entry->lock, LW_EXCLUSIVE);
+        drop_snapshot(entry);
+        free_filter_storage(area, entry);
+    } else {
+        entry = (BloomRegistryEntry*)hash_search(bloom_registry, key, HASH_ENTER, NULL);
+        entry->lock = stripe_lock_for(key);
+        pg_atomic_init_u64(&entry->current_count, 0);
+        pg_atomic_init_u64(&entry->changes, 0);
+        pg_atomic_init_u64(&entry->applied_lsn, InvalidXLogRecPtr);
+        entry->snapshot_live = false;
+        init_node_copies(entry);
+        LWLockAcquire(entry->lock, LW_EXCLUSIVE);
+    }
+
+    entry->params = create->params;
+    entry->key_type = create->key_type;
+    entry->num_stages = layout.num_stages;
+    memcpy(entry->stage_bits, layout.stage_bits, sizeof(entry->stage_bits));
+    memcpy(entry->stage_params, layout.stage_params, sizeof(entry->stage_params));
+    entry->bits = entry->stage_bits[0];
+    entry->bytes = bytes;
+    entry->resize_bits = InvalidDsaPointer;
+    pg_atomic_write_u64(&entry->current_count, 0);
+    pg_atomic_write_u64(&entry->applied_lsn, end_lsn);
+    entry->is_valid = create->complete != 0;
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+    entry->maintained_generation = 0;
+    bloom_shared_state->used_memory += bytes;
+    make_counters(area, entry);
+
+    LWLockRelease(entry->lock);
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+void redo_bloom_filter_drop(const BloomRegistryKey* key, XLogRecPtr end_lsn) {
+    ensure_shared_memory();
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+    BloomRegistryEntry* entry = find_replica(key, end_lsn);
+    if (entry) {
+        remove_entry(entry);
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+void redo_bloom_filter_hashes(const BloomRegistryKey* key, XLogRecPtr end_lsn,
+                              const uint64_t* h1, const uint64_t* h2, int count, bool remove) {
+    ensure_shared_memory();
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    BloomRegistryEntry* entry = find_replica(key, end_lsn);
+    if (entry) {
+        mark_filter_changed(entry);
+        apply_hashes(get_local_view(entry, entry), h1, h2, count, remove);
+        if (!remove) {
+            pg_atomic_fetch_add_u64(&entry->current_count, count);
+        }
+        advance_applied_lsn(entry, end_lsn);
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+void redo_bloom_filter_stage(const BloomRegistryKey* key, XLogRecPtr end_lsn, BloomWalType type,
+                             const BloomWalStage* stage) {
+    ensure_shared_memory();
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = find_replica(key, end_lsn);
+    if (!entry) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return;
+    }
+
+    const char* failure = NULL;
+    if (type == BLOOM_WAL_APPEND_STAGE) {
+        if (entry->params.kind != FilterKind::Scalable || stage->stage != entry->num_stages ||
+            entry->num_stages >= OCTO_BLOOM_STAGE_SLOTS) {
+            failure = "its stages differ from the primary's";
+        } else if (!DsaPointerIsValid(append_stage(entry, &stage->params))) {
+            failure = "octo_bloom.shared_memory_mb is too low";
+        }
+    } else if (type == BLOOM_WAL_DROP_STAGES) {
+        if (stage->stage <= 0 || stage->stage >= entry->num_stages) {
+            failure = "its stages differ from the primary's";
+        } else {
+            drop_stages(entry, stage->stage);
+        }
+    } else if (DsaPointerIsValid(entry->resize_bits)) {
+        failure = "it is already being resized";
+    } else if (!DsaPointerIsValid(begin_resize(entry, &stage->params))) {
+        failure = "octo_bloom.shared_memory_mb is too low";
+    }
+
+    if (failure) {
+        drop_replica(entry, failure);
+    } else {
+        advance_applied_lsn(entry, end_lsn);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    if (bloom_shared_state->num_retired > 0) {
+        reclaim_retired_storage(false);
+    }
+}
+
+void redo_bloom_filter_resize_end(const BloomRegistryKey* key, XLogRecPtr end_lsn, bool finish,
+                                  uint64_t count) {
+    ensure_shared_memory();
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = find_replica(key, end_lsn);
+    if (entry && !DsaPointerIsValid(entry->resize_bits)) {
+        drop_replica(entry, "it is not being resized");
+    } else if (entry) {
+        if (finish) {
+            finish_resize(entry, count);
+        } else {
+            cancel_resize(entry);
+        }
+        advance_applied_lsn(entry, end_lsn);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    if (bloom_shared_state->num_retired > 0) {
+        reclaim_retired_storage(false);
+    }
+}
+
+void redo_bloom_filter_image(const BloomRegistryKey* key, XLogRecPtr end_lsn,
+                             const BloomWalImage* image, const char* data) {
+    ensure_shared_memory();
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = find_replica(key, end_lsn);
+    if (!entry) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return;
+    }
+
+    int slot = image->slot;
+    Size size = 0;
+    if (slot == OCTO_BLOOM_WAL_RESIZE_SLOT && DsaPointerIsValid(entry->resize_bits)) {
+        size = filter_storage_size(entry->resize_params);
+    } else if (slot >= 0 && slot < entry->num_stages) {
+        size = stage_bytes(entry, slot);
+    }
+    bool valid = size > 0 && image->offset <= size && image->length <= size - image->offset;
+
+    // Probes on a cuckoo filter can't see its buckets half overwritten:
+    // its image is put together beside it, as a resize to the same size,
+    // and swapped in with the last chunk. The primary logged it whole, so
+    // no other change to the filter comes in between
+    bool staged = valid && entry->params.kind == FilterKind::Cuckoo &&
+                  slot != OCTO_BLOOM_WAL_RESIZE_SLOT;
+    if (staged && image->offset == 0) {
+        valid = !DsaPointerIsValid(entry->resize_bits) &&
+                DsaPointerIsValid(begin_resize(entry, &entry->params));
+    } else if (staged) {
+        valid = DsaPointerIsValid(entry->resize_bits);
+    }
+    if (!valid) {
+        drop_replica(entry, "its image can't be applied");
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return;
+    }
+
+    mark_filter_changed(entry);
+    dsa_pointer storage = slot == OCTO_BLOOM_WAL_RESIZE_SLOT || staged ? entry->resize_bits
+                                                                       : entry->stage_bits[slot];
+    char* dest = (char*)dsa_get_address(attach_area(false), storage) + image->offset;
+    if (image_overwrites(entry->params)) {
+        memcpy(dest, data, image->length);
+    } else {
+        // A scalable stage's header holds its key count, taken as it is
+        Size header = 0;
+        if (entry->params.kind == FilterKind::Scalable &&
+            image->offset < ScalableFilter::kStageHeaderBytes) {
+            header = Min((Size)image->length,
+                         (Size)(ScalableFilter::kStageHeaderBytes - image->offset));
+        }
+        memcpy(dest, data, header);
+        or_bytes(dest + header, data + header, image->length - header);
+    }
+    if (staged && image->offset + image->length == size) {
+        finish_resize(entry, pg_atomic_read_u64(&entry->current_count));
+    }
+    advance_applied_lsn(entry, end_lsn);
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    if (bloom_shared_state->num_retired > 0) {
+        reclaim_retired_storage(false);
+    }
+}
+
+void redo_bloom_filter_count(const BloomRegistryKey* key, XLogRecPtr end_lsn, uint64_t count,
+                             bool ready) {
+    ensure_shared_memory();
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = find_replica(key, end_lsn);
+    if (entry) {
+        pg_atomic_write_u64(&entry->current_count, count);
+        if (ready && !entry->is_valid) {
+            entry->is_valid = true;
+            entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+        }
+        advance_applied_lsn(entry, end_lsn);
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+uint64_t get_bloom_registry_generation() {
+    ensure_shared_memory();
+    return pg_atomic_read_u64(&bloom_shared_state->generation);
+}
+
+void set_bloom_filter_node_copies(Oid table_oid, int16_t attnum, bool enabled) {
+    ensure_shared_memory();
+
+    if (enabled && bloom_numa_nodes(NULL) < 2) {
+        ereport(ERROR,
+                (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                 errmsg("this host has a single NUMA node"),
+                 errdetail("Node copies only help where memory is split between nodes.")));
+    }
+
+    BloomRegistryKey key;
+    make_key(&key, table_oid, attnum);
+    Latch* latch = NULL;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &key, HASH_FIND, NULL);
+    // Cuckoo relocations and scalable chains can't be copied a chunk at a
+    // time without losing keys in between
+    if (!entry || !entry->is_valid || entry->params.kind != FilterKind::Bloom) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("no bloom filter of the standard, blocked or counting type on "
+                        "column %d of \"%s\"", attnum, get_rel_name(table_oid))));
+    }
+
+    entry->copy_to_nodes = enabled;
+    if (!enabled && entry->num_node_copies > 0) {
+        drop_node_copies(attach_area(false), entry);
+        entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+    }
+    latch = bloom_shared_state->maintenance_latch;
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    if (!enabled) {
+        return;
+    }
+    if (!latch) {
+        ereport(WARNING,
+                (errmsg("the octo_bloom maintenance launcher is not running"),
+                 errdetail("Node copies are made and kept in step by the launcher; until "
+                           "it runs, probes read the filter itself."),
+                 errhint("Preload octo_bloom and turn on octo_bloom.maintenance_worker.")));
+        return;
+    }
+    SetLatch(latch);
+}
+
+// Copies are refreshed this much at a time under the registry lock, so a
+// filter replaced or dropped meanwhile can't be freed under the copy
+#define NODE_COPY_CHUNK ((Size)64 * 1024 * 1024)
+
+typedef struct NodeCopyTask {
+    BloomRegistryKey key;
+    int node;
+    dsa_pointer copy;
+} NodeCopyTask;
+
+// Allocate a copy of the entry's filter on each online node. Not zeroed:
+// the first refresh faults the pages in, on the node the range prefers.
+// Returns false, with none made, past the memory limit. Registry lock held
+// exclusively
+static bool make_node_copies(dsa_area* area, BloomRegistryEntry* entry) {
+    uint32_t online;
+    int num_nodes = bloom_numa_nodes(&online);
+    Size bytes = filter_storage_size(entry->params);
+    int count = 0;
+    for (int i = 0; i < num_nodes; ++i) {
+        count += (online >> i) & 1;
+    }
+    if (bloom_shared_state->used_memory + count * bytes > memory_limit()) {
+        return false;
+    }
+
+    dsa_pointer copies[OCTO_BLOOM_MAX_NUMA_NODES];
+    for (int i = 0; i < OCTO_BLOOM_MAX_NUMA_NODES; ++i) {
+        copies[i] = InvalidDsaPointer;
+        if (i >= num_nodes || !((online >> i) & 1)) {
+            continue;
+        }
+        copies[i] = allocate_bits(area, bytes, false);
+        if (!DsaPointerIsValid(copies[i])) {
+            // No view has seen them, so they can go at once
+            for (int j = 0; j < i; ++j) {
+                if (DsaPointerIsValid(copies[j])) {
+                    dsa_free(area, copies[j]);
+                }
+            }
+            return false;
+        }
+        bloom_prefer_numa_node(dsa_get_address(area, copies[i]), bytes, i);
+    }
+
+    for (int i = 0; i < OCTO_BLOOM_MAX_NUMA_NODES; ++i) {
+        entry->node_copy_bits[i] = copies[i];
+        pg_atomic_write_u64(&entry->node_copy_synced[i], 0);
+    }
+    entry->num_node_copies = count;
+    entry->node_copy_source = entry->stage_bits[0];
+    entry->node_copy_bytes = bytes;
+    entry->bytes += count * bytes;
+    bloom_shared_state->used_memory += count * bytes;
+    // Views pick up their node's copy; it is in step once first refreshed
+    entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+    return true;
+}
+
+// Whether copy is still the task's node copy of the entry's filter.
+// Registry lock held
+static bool node_copy_current(const BloomRegistryEntry* entry, const NodeCopyTask* task) {
+    return entry && entry->is_valid && entry->num_node_copies > 0 &&
+           entry->node_copy_source == entry->stage_bits[0] &&
+           entry->node_copy_bits[task->node] == task->copy;
+}
+
+// Copy the filter over a node copy, which is out of step meanwhile so
+// probes read the filter. Writes made during the copy may or may not be
+// in it, so it is in step at the writes count read before it started
+static void refresh_node_copy(dsa_area* area, const NodeCopyTask* task) {
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    BloomRegistryEntry* entry = (BloomRegistryEntry*)hash_search(
+        bloom_registry, &task->key, HASH_FIND, NULL);
+    if (!node_copy_current(entry, task)) {
+        LWLockRelease(bloom_shared_state->registry_lock);
+        return;
+    }
+    uint64 writes = pg_atomic_read_u64(&entry->writes);
+    pg_atomic_write_u64(&entry->node_copy_synced[task->node], 0);
+    pg_memory_barrier();
+    // The bits, from each side's own 64-byte boundary: the slack around
+    // them differs between allocations
+    Size length = entry->node_copy_bytes - (OctoBloomFilter::kBlockBytes - 1);
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    for (Size offset = 0; offset < length; offset += NODE_COPY_CHUNK) {
+        LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+        entry = (BloomRegistryEntry*)hash_search(bloom_registry, &task->key, HASH_FIND, NULL);
+        if (!node_copy_current(entry, task)) {
+            LWLockRelease(bloom_shared_state->registry_lock);
+            return;
+        }
+        const char* source = (const char*)TYPEALIGN(
+            OctoBloomFilter::kBlockBytes, dsa_get_address(area, entry->stage_bits[0]));
+        char* copy = (char*)TYPEALIGN(OctoBloomFilter::kBlockBytes,
+                                      dsa_get_address(area, task->copy));
+        memcpy(copy + offset, source + offset, Min(NODE_COPY_CHUNK, length - offset));
+        LWLockRelease(bloom_shared_state->registry_lock);
+    }
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_SHARED);
+    entry = (BloomRegistryEntry*)hash_search(bloom_registry, &task->key, HASH_FIND, NULL);
+    if (node_copy_current(entry, task)) {
+        pg_write_barrier();
+        pg_atomic_write_u64(&entry->node_copy_synced[task->node], writes);
+    }
+    LWLockRelease(bloom_shared_state->registry_lock);
+}
+
+bool refresh_node_copies() {
+    ensure_shared_memory();
+
+    NodeCopyTask* tasks = (NodeCopyTask*)palloc(sizeof(NodeCopyTask) *
+                                                bloom_shared_state->max_filters *
+                                                OCTO_BLOOM_MAX_NUMA_NODES);
+    int count = 0;
+    bool wanted = false;
+
+    LWLockAcquire(bloom_shared_state->registry_lock, LW_EXCLUSIVE);
+
+    // No area yet means no filters either
+    dsa_area* area = attach_area(false);
+    HASH_SEQ_STATUS status;
+    BloomRegistryEntry* entry;
+    hash_seq_init(&status, bloom_registry);
+    while ((entry = (BloomRegistryEntry*)hash_seq_search(&status)) != NULL) {
+        bool copy = area && entry->is_valid && entry->copy_to_nodes &&
+                    entry->params.kind == FilterKind::Bloom;
+        // A resize that finished, or a replacement, left them copying old storage
+        if (entry->num_node_copies > 0 &&
+            (!copy || entry->node_copy_source != entry->stage_bits[0])) {
+            drop_node_copies(area, entry);
+            entry->generation = pg_atomic_add_fetch_u64(&bloom_shared_state->generation, 1);
+        }
+        if (!copy) {
+            continue;
+        }
+        if (entry->num_node_copies == 0 && !make_node_copies(area, entry)) {
+            entry->copy_to_nodes = false;
+            ereport(LOG,
+                    (errmsg("octo_bloom: not enough bloom filter memory for node copies of "
+                            "column %d of table %u", entry->key.attnum, entry->key.table_oid),
+                     errhint("Increase octo_bloom.shared_memory_mb.")));
+            continue;
+        }
+        wanted = true;
+        uint64 writes = pg_atomic_read_u64(&entry->writes);
+        for (int i = 0; i < OCTO_BLOOM_MAX_NUMA_NODES; ++i) {
+            if (DsaPointerIsValid(entry->node_copy_bits[i]) &&
+                pg_atomic_read_u64(&entry->node_copy_synced[i]) != writes) {
+                tasks[count].key = entry->key;
+                tasks[count].node = i;
+                tasks[count].copy = entry->node_copy_bits[i];
+                count++;
+            }
+        }
+    }
+
+    LWLockRelease(bloom_shared_state->registry_lock);
+
+    // Every write since the last refresh goes over in one copy
+    for (int i = 0; i < count; ++i) {
+        refresh_node_copy(area, &tasks[i]);
+    }
+
+    pfree(tasks);
+    return wanted;
+}
 
-    return state_size + registry_size + total_filter_memory;
+// Main shared memory needed: the state struct, the registry and, when the
+// filter area is created in place, its area_size bytes
+Size calculate_shared_memory_size(int max_filters, Size area_size) {
+    Size size = MAXALIGN(sizeof(BloomSharedState));
+    size = add_size(size, hash_estimate_size(max_filters, sizeof(BloomRegistryEntry)));
+    size = add_size(size, MAXALIGN(area_size));
+    return size;
 }
 
 } // extern "C"
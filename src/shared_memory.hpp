@@ -4,9 +4,15 @@
 extern "C" {
 #include <postgres.h>
 #include <fmgr.h>
+#include <access/xlogdefs.h>
+#include <datatype/timestamp.h>
+#include <port/atomics.h>
+#include <storage/latch.h>
 #include <storage/lwlock.h>
 #include <storage/shmem.h>
+#include <utils/dsa.h>
 #include <utils/hsearch.h>
+#include <utils/inval.h>
 #include <utils/builtins.h>
 #include <utils/lsyscache.h>
 #include <utils/rel.h>
@@ -17,40 +23,295 @@ extern "C" {
 #include <utils/elog.h>
 }
 
-#include "bloom_filter.hpp"
+#include "filter_backend.hpp"
+#include "datum_key.hpp"
 
-typedef struct BloomRegistryEntry {
+// Named LWLock tranche: lock 0 protects the registry, the rest are striped
+// over filters and serialize structural changes (replace, clear, rebuild).
+// Bit-array reads and adds never take them.
+#define OCTO_BLOOM_TRANCHE_NAME "octo_bloom"
+#define OCTO_BLOOM_LOCK_STRIPES 16
+#define OCTO_BLOOM_NUM_LOCKS (1 + OCTO_BLOOM_LOCK_STRIPES)
+
+// Most NUMA nodes a filter keeps copies on (memory_placement.hpp)
+#define OCTO_BLOOM_MAX_NUMA_NODES 8
+
+// Activity counters of a filter. Each backend has a slot of its own in
+// every filter's array, padded to a cache line, and is the only writer of
+// it: counting on the hot paths takes no lock and shares no cache line.
+// Readers add the slots up (octo_bloom_status)
+typedef struct BloomFilterCounters {
+    pg_atomic_uint64 lookups;
+    pg_atomic_uint64 negatives;  // Lookups the filter ruled out
+    pg_atomic_uint64 exists_confirmed;  // octo_bloom_exists positives the table confirmed
+    pg_atomic_uint64 exists_false;  // And those it didn't: false positives
+    pg_atomic_uint64 adds;  // Keys added by triggers
+    pg_atomic_uint64 removes;
+} BloomFilterCounters;
+
+typedef union BloomFilterCounterSlot {
+    BloomFilterCounters counters;
+    char pad[PG_CACHE_LINE_SIZE];
+} BloomFilterCounterSlot;
+
+// Single writer, so a plain load and store rather than a locked add
+static inline void bloom_counter_add(pg_atomic_uint64* counter, uint64 n) {
+    pg_atomic_write_u64(counter, pg_atomic_read_u64(counter) + n);
+}
+
+// Count probes of a filter, of which negatives were ruled out. counters
+// may be NULL, when the filter has none for this backend
+static inline void bloom_count_lookups(BloomFilterCounters* counters, uint64 lookups,
+                                       uint64 negatives) {
+    if (counters) {
+        bloom_counter_add(&counters->lookups, lookups);
+        bloom_counter_add(&counters->negatives, negatives);
+    }
+}
+
+// Filters are per database: table OIDs are only unique within one
+typedef struct BloomRegistryKey {
+    Oid dboid;
     Oid table_oid;
     int16_t attnum;
-    OctoBloomFilter* filter;
+} BloomRegistryKey;
+
+typedef struct BloomRegistryEntry {
+    BloomRegistryKey key;
+    BloomFilterParams params;
+    BloomKeyType key_type;  // How column values are hashed
+    dsa_pointer bits;  // Filter storage in the shared DSA area
+    Size bytes;  // Size of all of the filter's allocations
+    // Scalable filters grow by appending stages; every other kind has one,
+    // and stage_bits[0] is always bits
+    int num_stages;
+    dsa_pointer stage_bits[OCTO_BLOOM_STAGE_SLOTS];
+    BloomFilterParams stage_params[OCTO_BLOOM_STAGE_SLOTS];
+    // Online resize in progress: storage being filled to replace the
+    // stages, which takes every add meanwhile. Its bytes count in bytes
+    dsa_pointer resize_bits;
+    BloomFilterParams resize_params;
+    uint64_t generation;  // Registry generation when bits was installed
+    uint64_t maintained_generation;  // When the maintenance worker last took it up
     LWLock* lock;
-    uint64_t expected_count;
-    double false_positive_rate;
-    uint64_t current_count;
+    pg_atomic_uint64 current_count;  // Keys added, as of the last commit or rebuild
+    // Bumped whenever keys go in that a snapshot taken earlier may lack
+    pg_atomic_uint64 changes;
+    // End of the last logged change made to the filter or replayed into it
+    pg_atomic_uint64 applied_lsn;
+    // The snapshot file holds every key committed to the filter, as it was
+    // at snapshot_generation. Protected by lock
+    bool snapshot_live;
+    uint64_t snapshot_generation;
+    // A BloomFilterCounterSlot per backend, or InvalidDsaPointer if there
+    // was no memory for them. Made afresh with the filter, kept by rebuilds
+    dsa_pointer counters;
+    int counter_slots;
+    // Rebuilds and resizes since the filter was created. Protected by lock
+    uint64_t rebuilds;
+    TimestampTz last_rebuild;  // When the last one finished, 0 if none has
+    double last_rebuild_ms;
+    double total_rebuild_ms;
+    // Copies of a Bloom filter's bits, one per NUMA node, that backends on
+    // the node probe while no write has been made since the copy. The
+    // maintenance launcher makes and refreshes them while copy_to_nodes is
+    // set (octo_bloom_copy_to_nodes). Protected by the registry lock
+    bool copy_to_nodes;
+    int num_node_copies;  // 0 until made for the current stage_bits[0]
+    dsa_pointer node_copy_source;  // The stage_bits[0] they copy
+    Size node_copy_bytes;  // Of each; all of them count in bytes
+    dsa_pointer node_copy_bits[OCTO_BLOOM_MAX_NUMA_NODES];  // Invalid for offline nodes
+    // Bumped after every change to the bits, and the value each copy was
+    // taken at. A copy is in step while they match; 0 is never in step
+    pg_atomic_uint64 writes;
+    pg_atomic_uint64 node_copy_synced[OCTO_BLOOM_MAX_NUMA_NODES];
     bool is_valid;
 } BloomRegistryEntry;
 
+// A registry entry as octo_bloom_status reports it, its counters summed
+typedef struct BloomFilterStatus {
+    Oid table_oid;
+    int16_t attnum;
+    BloomFilterParams params;
+    int num_stages;
+    bool resizing;
+    Size bytes;
+    uint64_t count;  // current_count
+    bool has_counters;
+    uint64_t lookups;
+    uint64_t negatives;
+    uint64_t exists_confirmed;
+    uint64_t exists_false;
+    uint64_t adds;
+    uint64_t removes;
+    uint64_t rebuilds;
+    TimestampTz last_rebuild;
+    double last_rebuild_ms;
+    double total_rebuild_ms;
+    int node_copies;
+} BloomFilterStatus;
+
+// Storage unlinked from the registry is freed only once no backend can
+// still be reading it through a view taken before it was unlinked. This
+// many are recorded in the shared state; more go in an array in the area
+#define OCTO_BLOOM_MAX_RETIRED 128
+
+typedef struct BloomRetiredStorage {
+    dsa_pointer bits;
+    Size bytes;
+    uint64_t seq;  // Order of retirement
+    TransactionId next_xid;  // Next transaction ID when it was retired
+} BloomRetiredStorage;
+
+// Progress of octo_bloom_rebuild calls, one slot per running build
+#define OCTO_BLOOM_MAX_BUILDS 16
+
+typedef enum BloomBuildPhase {
+    BLOOM_BUILD_INITIALIZING = 0,
+    BLOOM_BUILD_SCANNING,
+    BLOOM_BUILD_SCANNING_INDEX,
+    BLOOM_BUILD_WAITING_FOR_WORKERS,
+} BloomBuildPhase;
+
+typedef struct BloomBuildProgress {
+    int pid;  // Leader's pid, 0 when the slot is free
+    Oid dboid;
+    Oid table_oid;
+    int16_t attnum;
+    Oid index_oid;  // Index being read, InvalidOid for a heap scan
+    BloomBuildPhase phase;
+    int workers_planned;
+    int workers_launched;
+    double tuples_total;  // Estimate from pg_class.reltuples
+    pg_atomic_uint64 tuples_done;  // Heap tuples or index entries scanned so far
+    pg_atomic_uint32 participants_done;  // Participants whose bits are merged
+} BloomBuildProgress;
+
 typedef struct BloomSharedState {
-    HTAB* bloom_registry;
     LWLock* registry_lock;
     Size total_memory;
-    Size used_memory;
+    Size used_memory;  // Bytes of filter bits allocated in the DSA area
     int max_filters;
+    LWLock* stripe_locks[OCTO_BLOOM_LOCK_STRIPES];
+    int tranche_id;
+    // Used when the library was not preloaded and the named tranche is missing
+    LWLockPadded fallback_locks[OCTO_BLOOM_NUM_LOCKS];
+    pg_atomic_uint64 generation;  // Bumped whenever a filter is added, replaced or removed
+    int dsa_tranche_id;
+    bool area_created;  // area_handle is set; protected by registry_lock
+    dsa_handle area_handle;
+    // Preloaded: the area was created in place in main shared memory at
+    // startup and is attached through this address instead of a handle
+    void* area_place;
+    Size area_size;
+    BloomBuildProgress builds[OCTO_BLOOM_MAX_BUILDS];  // Protected by registry_lock
+    // The maintenance launcher's latch, NULL while it isn't running.
+    // Written only by the launcher; others read it under registry_lock
+    Latch* maintenance_latch;
+    // Protected by registry_lock
+    int num_retired;
+    uint64_t retire_seq;
+    BloomRetiredStorage retired[OCTO_BLOOM_MAX_RETIRED];
+    dsa_pointer retired_more;  // Those past OCTO_BLOOM_MAX_RETIRED, or invalid
+    int retired_more_capacity;
+    // Set once the snapshots are loaded, once per shared memory lifetime.
+    // Written only by the launcher, or before it starts by recovery
+    // (filter_wal.cpp)
+    bool snapshots_loaded;
 } BloomSharedState;
 
 // Global shared state pointer
 extern "C" {
 extern BloomSharedState* bloom_shared_state;
+extern HTAB* bloom_registry;  // This backend's handle on the shared registry
+}
+
+// GUCs, defined in _PG_init
+extern "C" {
+extern int octo_bloom_max_filters;
+extern int octo_bloom_shared_memory_mb;
 }
 
 // Function prototypes
 extern "C" {
+void request_shared_resources();
 void init_shared_memory();
-OctoBloomFilter* get_bloom_filter(Oid table_oid, int16_t attnum);
-bool register_bloom_filter(Oid table_oid, int16_t attnum,
-                          uint64_t expected_count, double false_positive_rate);
+void ensure_shared_memory();
+Size bloom_area_size();
+// key_type, if not null, receives the column's key type
+FilterBackend* get_bloom_filter(Oid table_oid, int16_t attnum, BloomKeyType* key_type);
+bool register_bloom_filter(Oid table_oid, int16_t attnum, const BloomFilterParams* params,
+                          const BloomKeyType* key_type);
+// This backend's counters for a filter get_bloom_filter gave it a view of,
+// or NULL if it has none. Valid while the registry generation is unchanged
+BloomFilterCounters* get_bloom_filter_counters(Oid table_oid, int16_t attnum);
+// A rebuild or resize that started at start has filled the filter
+void note_bloom_filter_rebuilt(Oid table_oid, int16_t attnum, TimestampTz start);
+// The filters of this database, palloc'd. Returns how many
+int get_bloom_filter_status(BloomFilterStatus** rows);
 void unregister_bloom_filter(Oid table_oid, int16_t attnum);
-Size calculate_shared_memory_size(int max_filters, Size filter_memory);
+// Attnums of a table's filters in this database, at most max_columns of
+// them in attnum order, and the registry generation they are current for
+int get_bloom_filter_columns(Oid table_oid, int16_t* attnums, int max_columns,
+                             uint64_t* generation);
+void set_bloom_filter_count(Oid table_oid, int16_t attnum, uint64_t count);
+uint64_t get_bloom_filter_count(Oid table_oid, int16_t attnum);
+// Count keys a committing transaction added, waking the maintenance
+// worker if the filter is now due for it
+void note_bloom_filter_adds(Oid table_oid, int16_t attnum, uint64_t count);
+// Keys are about to go into the filter outside of a commit, e.g. from a
+// rebuild: its snapshot can no longer be trusted
+void note_bloom_filter_changed(Oid table_oid, int16_t attnum);
+// Add or remove hashed keys through filter, this backend's view of the
+// column's filter, logging them for standbys if changes are logged
+void apply_bloom_filter_hashes(Oid table_oid, int16_t attnum, FilterBackend* filter,
+                               const uint64_t* h1, const uint64_t* h2, int count, bool remove);
+// Log the first bytes (all if 0) of storage a rebuild has filled: a stage,
+// the resize in progress, or with InvalidDsaPointer the first stage
+void log_bloom_filter_image(Oid table_oid, int16_t attnum, dsa_pointer storage, Size bytes);
+// Log the whole filter, for standbys that started after it was created
+void replicate_bloom_filter(Oid table_oid, int16_t attnum);
+// Scalable filters: append the next stage once the newest one is full.
+// seen_stages is the caller's view of the chain, so racing callers add one
+// stage between them. Returns false if no stage could be added.
+bool grow_bloom_filter(Oid table_oid, int16_t attnum, int seen_stages);
+// Compaction of a scalable filter: append a stage of the given parameters,
+// then drop every stage older than it once it holds all their keys. The
+// drop returns false if the stage is gone, the filter having been replaced
+dsa_pointer append_bloom_filter_stage(Oid table_oid, int16_t attnum,
+                                      const BloomFilterParams* stage);
+bool drop_bloom_filter_stages_before(Oid table_oid, int16_t attnum, dsa_pointer stage);
+// Online resize: install storage for params beside the filter's, and route
+// adds to both from then on; *storage is its address in this backend.
+// Finishing swaps it in for the old storage once filled, cancelling drops
+// it; both return false if the filter was replaced in the meantime
+dsa_pointer begin_bloom_filter_resize(Oid table_oid, int16_t attnum,
+                                      const BloomFilterParams* params, void** storage);
+bool finish_bloom_filter_resize(Oid table_oid, int16_t attnum, dsa_pointer bits, uint64_t count);
+bool cancel_bloom_filter_resize(Oid table_oid, int16_t attnum, dsa_pointer bits);
+// Free retired storage no transaction can still be reading. With wait set,
+// first wait for every running transaction, which needs a transaction of
+// our own. Returns how many allocations were freed
+int reclaim_retired_storage(bool wait);
+uint64_t get_bloom_registry_generation();
+// Keep per-NUMA-node copies of a Bloom filter, or stop and free them.
+// ERRORs if the column has no Bloom filter or the host a single node
+void set_bloom_filter_node_copies(Oid table_oid, int16_t attnum, bool enabled);
+// The maintenance launcher's part: make the copies asked for and recopy
+// those writes have left behind. Returns whether any filter has copies
+bool refresh_node_copies();
+// Snapshot loading (filter_snapshot.cpp) installs filters by hand: storage
+// is allocated and counted, filled, then installed under key, or freed if
+// that fails. Allocation returns InvalidDsaPointer past the memory limit
+dsa_area* attach_bloom_area(bool create);
+dsa_pointer allocate_bloom_storage(Size bytes);
+void free_bloom_storage(dsa_pointer bits, Size bytes);
+bool install_bloom_filter(const BloomRegistryKey* key, const BloomFilterParams* params,
+                          const BloomKeyType* key_type, int num_stages,
+                          const BloomFilterParams* stage_params, const dsa_pointer* stage_bits,
+                          uint64_t count, XLogRecPtr applied_lsn);
+Size bloom_stage_bytes(const BloomRegistryEntry* entry, int stage);
+Size calculate_shared_memory_size(int max_filters, Size area_size);
 }
 
 #endif // OCTO_BLOOM_SHARED_MEMORY_HPP
\ No newline at end of file
@@ -1,36 +1,767 @@
-#include "shared_memory.hpp"
-#include "bloom_filter.hpp"
+#include "trigger_manager.hpp"
+#include "composite_key.hpp"
+#include "filter_backend.hpp"
 
 extern "C" {
+#include <access/xact.h>
+#include <catalog/pg_class.h>
+#include <executor/executor.h>
+#include <utils/datum.h>
+#include <utils/memutils.h>
+#include <utils/tuplestore.h>
+}
+
+extern "C" {
+
+bool octo_bloom_defer_maintenance = true;
+int octo_bloom_max_deferred_keys = 1000000;
+
+// Registry generation when a scalable filter last failed to grow. This
+// backend doesn't retry until the registry changes, so a full filter
+// doesn't put every insert through the exclusive registry lock
+static uint64_t grow_failed_generation = 0;
+static bool warned_full = false;
+
+// Append a stage to a scalable filter whose newest stage is full. Returns
+// true if the chain changed, so the caller's view is out of date. A filter
+// that can't grow keeps taking keys at a rising false positive rate; the
+// insert itself never fails over it.
+static bool grow_if_full(FilterBackend* filter, Oid table_oid, int16 attnum) {
+    if (!filter->needsGrowth() || get_bloom_registry_generation() == grow_failed_generation) {
+        return false;
+    }
+    uint64_t generation = get_bloom_registry_generation();
+    if (grow_bloom_filter(table_oid, attnum, filter->getNumStages())) {
+        return true;
+    }
+    grow_failed_generation = generation;
+    if (!warned_full) {
+        warned_full = true;
+        ereport(WARNING,
+                (errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+                 errmsg("scalable bloom filter on \"%s\" column %d can't grow",
+                        get_rel_name(table_oid), attnum),
+                 errdetail("Its newest stage is full and no stage could be added."),
+                 errhint("Compact it with octo_bloom_rebuild or increase "
+                         "octo_bloom.shared_memory_mb.")));
+    }
+    return false;
+}
+
+// Deferred maintenance (octo_bloom.defer_maintenance). Triggers hash keys
+// as usual but hold them per filter until the transaction commits, so keys
+// of rows that roll back never reach the shared filter and a transaction's
+// adds go in as a few pipelined batches. They are applied at pre-commit,
+// before the rows become visible to anyone else: a committed row is never
+// missing from its filter.
+//
+// Each key remembers the subtransaction nesting level that queued it. Keys
+// are appended in order, so levels never decrease along a list and the
+// keys of a rolled-back subtransaction are a suffix of it.
+#define DEFERRED_APPLY_BATCH 256
+
+typedef struct DeferredKeys {
+    uint64_t* h1;
+    uint64_t* h2;
+    int* nest_level;
+    int count;
+    int capacity;
+} DeferredKeys;
+
+typedef struct DeferredFilterKey {
+    Oid table_oid;
+    int16 attnum;
+} DeferredFilterKey;
+
+typedef struct DeferredFilter {
+    DeferredFilterKey key;
+    BloomHash hash;  // Of the filter the keys were hashed for
+    DeferredKeys adds;
+    DeferredKeys removes;
+    uint64_t added;  // Keys put in the filter, counted in the registry at commit
+} DeferredFilter;
+
+// In TopTransactionContext, so it goes away with the transaction
+static HTAB* deferred_filters = NULL;
+static int64 deferred_adds = 0;
+static int64 deferred_removes = 0;
+static bool deferred_callbacks_registered = false;
+
+static void deferred_push(DeferredKeys* keys, uint64_t h1, uint64_t h2, int nest_level) {
+    if (keys->count == keys->capacity) {
+        int capacity = Max(keys->capacity * 2, DEFERRED_APPLY_BATCH);
+        if (keys->capacity == 0) {
+            keys->h1 = (uint64_t*)MemoryContextAllocHuge(TopTransactionContext,
+                                                         sizeof(uint64_t) * capacity);
+            keys->h2 = (uint64_t*)MemoryContextAllocHuge(TopTransactionContext,
+                                                         sizeof(uint64_t) * capacity);
+            keys->nest_level = (int*)MemoryContextAllocHuge(TopTransactionContext,
+                                                            sizeof(int) * capacity);
+        } else {
+            keys->h1 = (uint64_t*)repalloc_huge(keys->h1, sizeof(uint64_t) * capacity);
+            keys->h2 = (uint64_t*)repalloc_huge(keys->h2, sizeof(uint64_t) * capacity);
+            keys->nest_level = (int*)repalloc_huge(keys->nest_level, sizeof(int) * capacity);
+        }
+        keys->capacity = capacity;
+    }
+    keys->h1[keys->count] = h1;
+    keys->h2[keys->count] = h2;
+    keys->nest_level[keys->count] = nest_level;
+    keys->count++;
+}
+
+// Forget the keys queued at nest_level or deeper. Returns how many
+static int deferred_truncate(DeferredKeys* keys, int nest_level) {
+    int count = keys->count;
+    while (count > 0 && keys->nest_level[count - 1] >= nest_level) {
+        count--;
+    }
+    int dropped = keys->count - count;
+    keys->count = count;
+    return dropped;
+}
+
+// A committed subtransaction's keys now belong to its parent
+static void deferred_reparent(DeferredKeys* keys, int nest_level) {
+    for (int i = keys->count - 1; i >= 0 && keys->nest_level[i] >= nest_level; --i) {
+        keys->nest_level[i] = nest_level - 1;
+    }
+}
+
+// The filter deferred keys were hashed for, or NULL if it is gone or was
+// replaced by one that hashes keys differently
+static FilterBackend* deferred_target(const DeferredFilter* df, bool warn) {
+    FilterBackend* filter = get_bloom_filter(df->key.table_oid, df->key.attnum, NULL);
+    if (filter && filter->getParams().hash != df->hash) {
+        if (warn) {
+            ereport(WARNING,
+                    (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                     errmsg("bloom filter on \"%s\" column %d was replaced during the transaction",
+                            get_rel_name(df->key.table_oid), df->key.attnum),
+                     errdetail("Keys of rows this transaction added were not applied to it."),
+                     errhint("Rebuild it with octo_bloom_rebuild.")));
+        }
+        return NULL;
+    }
+    return filter;
+}
+
+static void apply_adds(DeferredFilter* df) {
+    DeferredKeys* keys = &df->adds;
+    if (keys->count == 0) {
+        return;
+    }
+    FilterBackend* filter = deferred_target(df, true);
+    for (int i = 0; filter && i < keys->count; i += DEFERRED_APPLY_BATCH) {
+        int n = Min(keys->count - i, DEFERRED_APPLY_BATCH);
+        apply_bloom_filter_hashes(df->key.table_oid, df->key.attnum, filter, keys->h1 + i,
+                                  keys->h2 + i, n, false);
+        df->added += n;
+        if (grow_if_full(filter, df->key.table_oid, df->key.attnum)) {
+            filter = get_bloom_filter(df->key.table_oid, df->key.attnum, NULL);
+        }
+    }
+    deferred_adds -= keys->count;
+    keys->count = 0;
+}
+
+static void apply_removes(DeferredFilter* df) {
+    DeferredKeys* keys = &df->removes;
+    if (keys->count == 0) {
+        return;
+    }
+    // A replacement filter never held these keys; leaving them is safe
+    FilterBackend* filter = deferred_target(df, false);
+    if (filter) {
+        apply_bloom_filter_hashes(df->key.table_oid, df->key.attnum, filter, keys->h1, keys->h2,
+                                  keys->count, true);
+    }
+    deferred_removes -= keys->count;
+    keys->count = 0;
+}
+
+static void apply_all_adds() {
+    HASH_SEQ_STATUS status;
+    DeferredFilter* df;
+    hash_seq_init(&status, deferred_filters);
+    while ((df = (DeferredFilter*)hash_seq_search(&status)) != NULL) {
+        apply_adds(df);
+    }
+}
+
+// Add this transaction's keys to the registry's counts, which wakes the
+// maintenance worker for filters that have outgrown their size
+static void note_all_adds() {
+    HASH_SEQ_STATUS status;
+    DeferredFilter* df;
+    hash_seq_init(&status, deferred_filters);
+    while ((df = (DeferredFilter*)hash_seq_search(&status)) != NULL) {
+        if (df->added > 0) {
+            note_bloom_filter_adds(df->key.table_oid, df->key.attnum, df->added);
+            df->added = 0;
+        }
+    }
+}
+
+static void deferred_xact_callback(XactEvent event, void* arg) {
+    if (!deferred_filters) {
+        return;
+    }
+    switch (event) {
+    case XACT_EVENT_PRE_COMMIT: {
+        // Adds first, so a key this transaction added and removed again
+        // nets out in a counting filter
+        apply_all_adds();
+        HASH_SEQ_STATUS status;
+        DeferredFilter* df;
+        hash_seq_init(&status, deferred_filters);
+        while ((df = (DeferredFilter*)hash_seq_search(&status)) != NULL) {
+            apply_removes(df);
+        }
+        note_all_adds();
+        break;
+    }
+    case XACT_EVENT_PRE_PREPARE:
+        // A prepared transaction can still roll back, and its adds must be
+        // in before COMMIT PREPARED makes its rows visible. Its removes are
+        // dropped; the keys stay until the filter is rebuilt
+        apply_all_adds();
+        note_all_adds();
+        break;
+    case XACT_EVENT_COMMIT:
+    case XACT_EVENT_PARALLEL_COMMIT:
+    case XACT_EVENT_ABORT:
+    case XACT_EVENT_PARALLEL_ABORT:
+    case XACT_EVENT_PREPARE:
+        // The memory goes with TopTransactionContext
+        deferred_filters = NULL;
+        deferred_adds = 0;
+        deferred_removes = 0;
+        break;
+    default:
+        break;
+    }
+}
+
+static void deferred_subxact_callback(SubXactEvent event, SubTransactionId subid,
+                                      SubTransactionId parent_subid, void* arg) {
+    if (!deferred_filters ||
+        (event != SUBXACT_EVENT_ABORT_SUB && event != SUBXACT_EVENT_COMMIT_SUB)) {
+        return;
+    }
+    int nest_level = GetCurrentTransactionNestLevel();
+    HASH_SEQ_STATUS status;
+    DeferredFilter* df;
+    hash_seq_init(&status, deferred_filters);
+    while ((df = (DeferredFilter*)hash_seq_search(&status)) != NULL) {
+        if (event == SUBXACT_EVENT_ABORT_SUB) {
+            deferred_adds -= deferred_truncate(&df->adds, nest_level);
+            deferred_removes -= deferred_truncate(&df->removes, nest_level);
+        } else {
+            deferred_reparent(&df->adds, nest_level);
+            deferred_reparent(&df->removes, nest_level);
+        }
+    }
+}
+
+static DeferredFilter* deferred_filter_for(Oid table_oid, int16 attnum,
+                                           const FilterBackend* filter) {
+    if (!deferred_callbacks_registered) {
+        RegisterXactCallback(deferred_xact_callback, NULL);
+        RegisterSubXactCallback(deferred_subxact_callback, NULL);
+        deferred_callbacks_registered = true;
+    }
+    if (!deferred_filters) {
+        HASHCTL ctl;
+        memset(&ctl, 0, sizeof(ctl));
+        ctl.keysize = sizeof(DeferredFilterKey);
+        ctl.entrysize = sizeof(DeferredFilter);
+        ctl.hcxt = TopTransactionContext;
+        deferred_filters = hash_create("octo_bloom deferred keys", 16, &ctl,
+                                       HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+    }
+
+    DeferredFilterKey key;
+    memset(&key, 0, sizeof(key));
+    key.table_oid = table_oid;
+    key.attnum = attnum;
+    bool found;
+    DeferredFilter* df = (DeferredFilter*)hash_search(deferred_filters, &key, HASH_ENTER, &found);
+    BloomHash hash = filter->getParams().hash;
+    if (!found) {
+        memset(&df->adds, 0, sizeof(df->adds));
+        memset(&df->removes, 0, sizeof(df->removes));
+        df->added = 0;
+    } else if (df->hash != hash) {
+        // Queued for a filter that has since been replaced
+        deferred_adds -= df->adds.count;
+        deferred_removes -= df->removes.count;
+        df->adds.count = 0;
+        df->removes.count = 0;
+        df->added = 0;
+    }
+    df->hash = hash;
+    return df;
+}
+
+// Queue doubleHash() results for a column's filter until commit
+static void defer_hashes(Oid table_oid, int16 attnum, const FilterBackend* filter,
+                         const uint64_t* h1, const uint64_t* h2, int count, bool remove) {
+    if (count == 0) {
+        return;
+    }
+    DeferredFilter* df = deferred_filter_for(table_oid, attnum, filter);
+    int nest_level = GetCurrentTransactionNestLevel();
+
+    if (remove) {
+        // Removing a key before commit would lose it if the transaction
+        // rolled back, so past the limit removes are dropped instead and
+        // their keys stay in the filter until it is rebuilt
+        for (int i = 0; i < count && deferred_removes < octo_bloom_max_deferred_keys; ++i) {
+            deferred_push(&df->removes, h1[i], h2[i], nest_level);
+            deferred_removes++;
+        }
+        return;
+    }
+
+    for (int i = 0; i < count; ++i) {
+        deferred_push(&df->adds, h1[i], h2[i], nest_level);
+    }
+    deferred_adds += count;
+    // Past the limit adds are applied early: a rollback then leaves false
+    // positives behind, never false negatives
+    if (deferred_adds > octo_bloom_max_deferred_keys) {
+        apply_all_adds();
+    }
+}
+
+// Keys added without deferral still count towards the filter's size
+static void count_added(Oid table_oid, int16 attnum, const FilterBackend* filter, int count) {
+    if (count > 0) {
+        deferred_filter_for(table_oid, attnum, filter)->added += count;
+    }
+}
+
+void apply_deferred_adds(Oid table_oid, int16_t attnum) {
+    if (!deferred_filters) {
+        return;
+    }
+    DeferredFilterKey key;
+    memset(&key, 0, sizeof(key));
+    key.table_oid = table_oid;
+    key.attnum = attnum;
+    DeferredFilter* df = (DeferredFilter*)hash_search(deferred_filters, &key, HASH_FIND, NULL);
+    if (df) {
+        apply_adds(df);
+    }
+}
+
+static void add_key(FilterBackend* filter, Oid table_oid, int16 attnum, const BloomKey* key) {
+    auto hashes = filter->doubleHash(key->data, key->length);
+    if (octo_bloom_defer_maintenance) {
+        defer_hashes(table_oid, attnum, filter, &hashes.first, &hashes.second, 1, false);
+        return;
+    }
+    apply_bloom_filter_hashes(table_oid, attnum, filter, &hashes.first, &hashes.second, 1, false);
+    count_added(table_oid, attnum, filter, 1);
+    grow_if_full(filter, table_oid, attnum);
+}
+
+static void remove_key(FilterBackend* filter, Oid table_oid, int16 attnum, const BloomKey* key) {
+    auto hashes = filter->doubleHash(key->data, key->length);
+    if (octo_bloom_defer_maintenance) {
+        defer_hashes(table_oid, attnum, filter, &hashes.first, &hashes.second, 1, true);
+        return;
+    }
+    apply_bloom_filter_hashes(table_oid, attnum, filter, &hashes.first, &hashes.second, 1, true);
+}
+
+// Filtered columns of a trigger's table, cached in the trigger's fn_extra
+// so a row only costs work for the columns that have filters. The filter
+// views stay valid while the registry generation is unchanged, and the
+// composite key states while the definitions they came from are.
+typedef struct TriggerColumn {
+    int16 attnum;
+    FilterBackend* filter;
+    BloomKeyType key_type;
+    CompositeKeyState* composite;  // Evaluates a composite filter's key
+} TriggerColumn;
+
+typedef struct TriggerColumnMap {
+    Oid table_oid;
+    uint64_t generation;
+    uint64_t composite_epoch;
+    int num_columns;
+    TriggerColumn columns[FLEXIBLE_ARRAY_MEMBER];
+} TriggerColumnMap;
+
+static TriggerColumnMap* trigger_column_map(FunctionCallInfo fcinfo, Relation rel) {
+    TriggerColumnMap* map = (TriggerColumnMap*)fcinfo->flinfo->fn_extra;
+    Oid table_oid = RelationGetRelid(rel);
+    if (map && map->table_oid == table_oid &&
+        map->generation == get_bloom_registry_generation() &&
+        map->composite_epoch == composite_key_epoch()) {
+        return map;
+    }
+
+    TupleDesc tupdesc = RelationGetDescr(rel);
+    // Composite filters come on top of the columns': room for every filter
+    int max_columns = octo_bloom_max_filters;
+    int16_t* attnums = (int16_t*)palloc(sizeof(int16_t) * Max(max_columns, 1));
+    uint64_t composite_epoch = composite_key_epoch();
+    uint64_t generation;
+    int count = get_bloom_filter_columns(table_oid, attnums, max_columns, &generation);
+
+    if (map) {
+        pfree(map);
+    }
+    map = (TriggerColumnMap*)MemoryContextAlloc(fcinfo->flinfo->fn_mcxt,
+                                                offsetof(TriggerColumnMap, columns) +
+                                                sizeof(TriggerColumn) * Max(count, 1));
+    map->table_oid = table_oid;
+    map->generation = generation;
+    map->composite_epoch = composite_epoch;
+    map->num_columns = 0;
+    for (int i = 0; i < count; ++i) {
+        TriggerColumn* col = &map->columns[map->num_columns];
+        col->composite = NULL;
+        if (bloom_attnum_is_composite(attnums[i])) {
+            // Rows go unkeyed while the definition is out of date
+            const CompositeKey* key = get_composite_key(table_oid, attnums[i]);
+            if (!key) {
+                continue;
+            }
+            MemoryContext old = MemoryContextSwitchTo(fcinfo->flinfo->fn_mcxt);
+            col->composite = composite_key_begin(key, tupdesc);
+            MemoryContextSwitchTo(old);
+        } else if (attnums[i] < 1 || attnums[i] > tupdesc->natts ||
+                   TupleDescAttr(tupdesc, attnums[i] - 1)->attisdropped) {
+            continue;
+        }
+        col->attnum = attnums[i];
+        col->filter = get_bloom_filter(table_oid, col->attnum, &col->key_type);
+        if (col->filter) {
+            map->num_columns++;
+        }
+    }
+    fcinfo->flinfo->fn_extra = map;
+    pfree(attnums);
+
+    // A filter replaced since the list was taken is picked up next time
+    return map;
+}
+
+// Statement-level triggers read the statement's rows from its transition
+// tables (REFERENCING NEW TABLE / OLD TABLE). Filtered columns are resolved
+// once per statement, and keys are hashed as rows are read and applied in
+// batches, adds before removes.
+#define TRANSITION_BATCH 256
+
+typedef struct TransitionColumn {
+    int16 attnum;
+    FilterBackend* filter;
+    BloomKeyType key_type;
+    CompositeKeyState* composite;
+    int num_adds;
+    int num_removes;
+    uint64_t add_h1[TRANSITION_BATCH];
+    uint64_t add_h2[TRANSITION_BATCH];
+    uint64_t remove_h1[TRANSITION_BATCH];
+    uint64_t remove_h2[TRANSITION_BATCH];
+} TransitionColumn;
+
+// Columns of rel with filters, only those that can remove keys if
+// removable_only is set. Returns how many were stored in *columns
+static int resolve_transition_columns(FunctionCallInfo fcinfo, Relation rel,
+                                      bool removable_only, TransitionColumn** columns) {
+    TriggerColumnMap* map = trigger_column_map(fcinfo, rel);
+
+    // Batches are large; allocate them for filtered columns only
+    TransitionColumn* cols = (TransitionColumn*)palloc(sizeof(TransitionColumn) *
+                                                       Max(map->num_columns, 1));
+    int count = 0;
+    for (int i = 0; i < map->num_columns; ++i) {
+        const TriggerColumn* source = &map->columns[i];
+        if (removable_only && !source->filter->supportsRemove()) {
+            continue;
+        }
+        TransitionColumn* col = &cols[count++];
+        col->attnum = source->attnum;
+        col->filter = source->filter;
+        col->key_type = source->key_type;
+        col->composite = source->composite;
+        col->num_adds = 0;
+        col->num_removes = 0;
+    }
+
+    *columns = cols;
+    return count;
+}
+
+static void flush_transition_column(Oid table_oid, TransitionColumn* col) {
+    if (!col->filter) {
+        col->num_adds = 0;
+        col->num_removes = 0;
+        return;
+    }
+    if (octo_bloom_defer_maintenance) {
+        defer_hashes(table_oid, col->attnum, col->filter, col->add_h1, col->add_h2,
+                     col->num_adds, false);
+        defer_hashes(table_oid, col->attnum, col->filter, col->remove_h1, col->remove_h2,
+                     col->num_removes, true);
+        col->num_adds = 0;
+        col->num_removes = 0;
+        return;
+    }
+    if (col->num_adds > 0) {
+        apply_bloom_filter_hashes(table_oid, col->attnum, col->filter, col->add_h1, col->add_h2,
+                                  col->num_adds, false);
+        count_added(table_oid, col->attnum, col->filter, col->num_adds);
+        col->num_adds = 0;
+        if (grow_if_full(col->filter, table_oid, col->attnum)) {
+            col->filter = get_bloom_filter(table_oid, col->attnum, NULL);
+        }
+    }
+    if (col->filter) {
+        apply_bloom_filter_hashes(table_oid, col->attnum, col->filter, col->remove_h1,
+                                  col->remove_h2, col->num_removes, true);
+    }
+    col->num_removes = 0;
+}
+
+static std::pair<uint64_t, uint64_t> transition_hashes(const TransitionColumn* col,
+                                                      Datum value) {
+    BloomKey key;
+    bloom_key_from_datum(&col->key_type, value, &key);
+    auto hashes = col->filter->doubleHash(key.data, key.length);
+    bloom_key_release(&key);
+    return hashes;
+}
+
+static void queue_transition_hashes(Oid table_oid, TransitionColumn* col,
+                                    std::pair<uint64_t, uint64_t> hashes, bool remove) {
+    if (remove) {
+        col->remove_h1[col->num_removes] = hashes.first;
+        col->remove_h2[col->num_removes] = hashes.second;
+        col->num_removes++;
+    } else {
+        col->add_h1[col->num_adds] = hashes.first;
+        col->add_h2[col->num_adds] = hashes.second;
+        col->num_adds++;
+    }
+    if (col->num_adds == TRANSITION_BATCH || col->num_removes == TRANSITION_BATCH) {
+        flush_transition_column(table_oid, col);
+    }
+}
+
+// Hashes of a row's key for col, false if it has none
+static bool transition_row_hashes(const TransitionColumn* col, TupleTableSlot* slot,
+                                  std::pair<uint64_t, uint64_t>* hashes) {
+    if (col->composite) {
+        BloomKey key;
+        if (!composite_key_from_slot(col->composite, slot, &key)) {
+            return false;
+        }
+        *hashes = col->filter->doubleHash(key.data, key.length);
+        return true;
+    }
+    bool isnull;
+    Datum value = slot_getattr(slot, col->attnum, &isnull);
+    if (isnull) {
+        return false;
+    }
+    *hashes = transition_hashes(col, value);
+    return true;
+}
+
+static void queue_transition_row(Oid table_oid, TransitionColumn* col, TupleTableSlot* slot,
+                                 bool remove) {
+    std::pair<uint64_t, uint64_t> hashes;
+    // The filter can disappear if it is replaced while its chain grows
+    if (col->filter && transition_row_hashes(col, slot, &hashes)) {
+        queue_transition_hashes(table_oid, col, hashes, remove);
+    }
+}
+
+// Read a transition table from the start with a read pointer of our own,
+// as a scan of the table in another trigger's query would
+static TupleTableSlot* begin_transition_scan(Relation rel, Tuplestorestate* rows) {
+    int readptr = tuplestore_alloc_read_pointer(rows, EXEC_FLAG_REWIND);
+    tuplestore_select_read_pointer(rows, readptr);
+    tuplestore_rescan(rows);
+    return MakeSingleTupleTableSlot(RelationGetDescr(rel), &TTSOpsMinimalTuple);
+}
+
+static void require_transition_table(TriggerData* trigdata, Tuplestorestate* rows,
+                                     const char* clause) {
+    if (!rows) {
+        ereport(ERROR,
+                (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+                 errmsg("statement-level trigger \"%s\" needs REFERENCING %s",
+                        trigdata->tg_trigger->tgname, clause),
+                 errhint("Create the triggers with octo_bloom_attach_triggers().")));
+    }
+}
+
+// AFTER INSERT ... FOR EACH STATEMENT: add every new row's keys
+static void insert_statement(FunctionCallInfo fcinfo, TriggerData* trigdata) {
+    require_transition_table(trigdata, trigdata->tg_newtable, "NEW TABLE");
+
+    Relation rel = trigdata->tg_relation;
+    Oid table_oid = RelationGetRelid(rel);
+    TransitionColumn* cols;
+    int ncols = resolve_transition_columns(fcinfo, rel, false, &cols);
+
+    if (ncols > 0) {
+        TupleTableSlot* slot = begin_transition_scan(rel, trigdata->tg_newtable);
+        while (tuplestore_gettupleslot(trigdata->tg_newtable, true, false, slot)) {
+            for (int c = 0; c < ncols; ++c) {
+                queue_transition_row(table_oid, &cols[c], slot, false);
+            }
+        }
+        for (int c = 0; c < ncols; ++c) {
+            flush_transition_column(table_oid, &cols[c]);
+        }
+        ExecDropSingleTupleTableSlot(slot);
+    }
+    pfree(cols);
+}
+
+// AFTER UPDATE ... FOR EACH STATEMENT. The old and new transition tables
+// hold each row's versions in the same order, so they are read in step and
+// handled like the row trigger handles a pair of tuples
+static void update_statement(FunctionCallInfo fcinfo, TriggerData* trigdata) {
+    require_transition_table(trigdata, trigdata->tg_oldtable, "OLD TABLE");
+    require_transition_table(trigdata, trigdata->tg_newtable, "NEW TABLE");
+
+    Relation rel = trigdata->tg_relation;
+    Oid table_oid = RelationGetRelid(rel);
+    TransitionColumn* cols;
+    int ncols = resolve_transition_columns(fcinfo, rel, false, &cols);
+
+    if (ncols > 0) {
+        TupleTableSlot* old_slot = begin_transition_scan(rel, trigdata->tg_oldtable);
+        TupleTableSlot* new_slot = begin_transition_scan(rel, trigdata->tg_newtable);
+        while (tuplestore_gettupleslot(trigdata->tg_newtable, true, false, new_slot)) {
+            bool have_old = tuplestore_gettupleslot(trigdata->tg_oldtable, true, false, old_slot);
+            for (int c = 0; c < ncols; ++c) {
+                TransitionColumn* col = &cols[c];
+                if (!col->filter) {
+                    continue;
+                }
+                bool new_isnull;
+                bool old_isnull = true;
+                std::pair<uint64_t, uint64_t> old_hashes;
+                std::pair<uint64_t, uint64_t> new_hashes;
+                if (col->composite) {
+                    old_isnull = !have_old || !transition_row_hashes(col, old_slot, &old_hashes);
+                    new_isnull = !transition_row_hashes(col, new_slot, &new_hashes);
+                } else {
+                    Datum new_value = slot_getattr(new_slot, col->attnum, &new_isnull);
+                    Datum old_value = have_old ? slot_getattr(old_slot, col->attnum, &old_isnull)
+                                               : (Datum)0;
+                    if (old_isnull && new_isnull) {
+                        continue;
+                    }
+                    if (!old_isnull && !new_isnull) {
+                        Form_pg_attribute attr = TupleDescAttr(RelationGetDescr(rel),
+                                                               col->attnum - 1);
+                        if (datumIsEqual(old_value, new_value, attr->attbyval, attr->attlen)) {
+                            continue;
+                        }
+                    }
+                    if (!old_isnull) {
+                        old_hashes = transition_hashes(col, old_value);
+                    }
+                    if (!new_isnull) {
+                        new_hashes = transition_hashes(col, new_value);
+                    }
+                }
+
+                // Values that differ in bytes can still be the same key
+                if (!old_isnull && !new_isnull && old_hashes == new_hashes) {
+                    continue;
+                }
+                if (!old_isnull && col->filter->supportsRemove()) {
+                    queue_transition_hashes(table_oid, col, old_hashes, true);
+                }
+                if (!new_isnull) {
+                    queue_transition_hashes(table_oid, col, new_hashes, false);
+                }
+            }
+        }
+        for (int c = 0; c < ncols; ++c) {
+            flush_transition_column(table_oid, &cols[c]);
+        }
+        ExecDropSingleTupleTableSlot(new_slot);
+        ExecDropSingleTupleTableSlot(old_slot);
+    }
+    pfree(cols);
+}
+
+// AFTER DELETE ... FOR EACH STATEMENT: remove keys from filters that can
+static void delete_statement(FunctionCallInfo fcinfo, TriggerData* trigdata) {
+    require_transition_table(trigdata, trigdata->tg_oldtable, "OLD TABLE");
+
+    Relation rel = trigdata->tg_relation;
+    Oid table_oid = RelationGetRelid(rel);
+    TransitionColumn* cols;
+    int ncols = resolve_transition_columns(fcinfo, rel, true, &cols);
+
+    if (ncols > 0) {
+        TupleTableSlot* slot = begin_transition_scan(rel, trigdata->tg_oldtable);
+        while (tuplestore_gettupleslot(trigdata->tg_oldtable, true, false, slot)) {
+            for (int c = 0; c < ncols; ++c) {
+                queue_transition_row(table_oid, &cols[c], slot, true);
+            }
+        }
+        for (int c = 0; c < ncols; ++c) {
+            flush_transition_column(table_oid, &cols[c]);
+        }
+        ExecDropSingleTupleTableSlot(slot);
+    }
+    pfree(cols);
+}
+
+// Key of a row for a filtered column, false if it has none
+static bool tuple_key(const TriggerColumn* col, HeapTuple tuple, TupleDesc tupdesc,
+                      BloomKey* key) {
+    if (col->composite) {
+        return composite_key_from_tuple(col->composite, tuple, key);
+    }
+    bool isnull;
+    Datum value = heap_getattr(tuple, col->attnum, tupdesc, &isnull);
+    if (isnull) {
+        return false;
+    }
+    bloom_key_from_datum(&col->key_type, value, key);
+    return true;
+}
 
 Datum octo_bloom_insert_trigger(PG_FUNCTION_ARGS) {
     TriggerData* trigdata = (TriggerData*) fcinfo->context;
     
-    if (!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event) || 
-        !TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+    if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
         !TRIGGER_FIRED_BY_INSERT(trigdata->tg_event)) {
         PG_RETURN_NULL();
     }
+    if (TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event)) {
+        insert_statement(fcinfo, trigdata);
+        PG_RETURN_NULL();
+    }
     
     TupleDesc tupdesc = trigdata->tg_relation->rd_att;
-    HeapTuple newtuple = trigdata->tg_newtuple;
-    
-    // Get bloom filter for this table and column
+    HeapTuple newtuple = trigdata->tg_trigtuple;
     Oid table_oid = trigdata->tg_relation->rd_id;
+    TriggerColumnMap* map = trigger_column_map(fcinfo, trigdata->tg_relation);
     
     // For each column that has a bloom filter, add the value
-    for (int i = 0; i < tupdesc->natts; ++i) {
-        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-        
-        OctoBloomFilter* filter = get_bloom_filter(table_oid, attr->attnum);
-        if (filter && !attr->attisdropped) {
-            bool isnull;
-            Datum value = heap_getattr(newtuple, i + 1, tupdesc, &isnull);
-            
-            if (!isnull) {
-                text* value_text = DatumGetTextP(value);
-                filter->add(VARDATA(value_text), VARSIZE(value_text) - VARHDRSZ);
-            }
+    for (int c = 0; c < map->num_columns; ++c) {
+        const TriggerColumn* col = &map->columns[c];
+        BloomKey key;
+        if (tuple_key(col, newtuple, tupdesc, &key)) {
+            add_key(col->filter, table_oid, col->attnum, &key);
+            bloom_key_release(&key);
         }
     }
     
@@ -40,43 +771,217 @@ Datum octo_bloom_insert_trigger(PG_FUNCTION_ARGS) {
 Datum octo_bloom_update_trigger(PG_FUNCTION_ARGS) {
     TriggerData* trigdata = (TriggerData*) fcinfo->context;
     
-    if (!TRIGGER_FIRED_FOR_ROW(trigdata->tg_event) || 
-        !TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+    if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
         !TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event)) {
         PG_RETURN_NULL();
     }
+    if (TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event)) {
+        update_statement(fcinfo, trigdata);
+        PG_RETURN_NULL();
+    }
     
     TupleDesc tupdesc = trigdata->tg_relation->rd_att;
     HeapTuple oldtuple = trigdata->tg_trigtuple;
     HeapTuple newtuple = trigdata->tg_newtuple;
-    
     Oid table_oid = trigdata->tg_relation->rd_id;
+    TriggerColumnMap* map = trigger_column_map(fcinfo, trigdata->tg_relation);
     
     // For each column that has a bloom filter
-    for (int i = 0; i < tupdesc->natts; ++i) {
-        Form_pg_attribute attr = TupleDescAttr(tupdesc, i);
-        
-        OctoBloomFilter* filter = get_bloom_filter(table_oid, attr->attnum);
-        if (filter && !attr->attisdropped) {
-            bool old_isnull, new_isnull;
-            Datum old_value = heap_getattr(oldtuple, i + 1, tupdesc, &old_isnull);
-            Datum new_value = heap_getattr(newtuple, i + 1, tupdesc, &new_isnull);
-            
-            // Remove old value if it exists
+    for (int c = 0; c < map->num_columns; ++c) {
+        const TriggerColumn* col = &map->columns[c];
+        FilterBackend* filter = col->filter;
+        bool old_isnull, new_isnull;
+        BloomKey old_key;
+        BloomKey new_key;
+        if (col->composite) {
+            old_isnull = !composite_key_from_tuple(col->composite, oldtuple, &old_key);
+            new_isnull = !composite_key_from_tuple(col->composite, newtuple, &new_key);
+        } else {
+            Datum old_value = heap_getattr(oldtuple, col->attnum, tupdesc, &old_isnull);
+            Datum new_value = heap_getattr(newtuple, col->attnum, tupdesc, &new_isnull);
+
+            // Most updates leave filtered columns alone: skip a value that is
+            // bitwise the same before hashing anything
+            if (old_isnull && new_isnull) {
+                continue;
+            }
+            if (!old_isnull && !new_isnull) {
+                Form_pg_attribute attr = TupleDescAttr(tupdesc, col->attnum - 1);
+                if (datumIsEqual(old_value, new_value, attr->attbyval, attr->attlen)) {
+                    continue;
+                }
+            }
+
             if (!old_isnull) {
-                text* old_value_text = DatumGetTextP(old_value);
-                filter->remove(VARDATA(old_value_text), VARSIZE(old_value_text) - VARHDRSZ);
+                bloom_key_from_datum(&col->key_type, old_value, &old_key);
             }
-            
-            // Add new value
             if (!new_isnull) {
-                text* new_value_text = DatumGetTextP(new_value);
-                filter->add(VARDATA(new_value_text), VARSIZE(new_value_text) - VARHDRSZ);
+                bloom_key_from_datum(&col->key_type, new_value, &new_key);
             }
         }
+
+        // Values that differ in bytes can still be the same key
+        bool unchanged = !old_isnull && !new_isnull &&
+                         old_key.length == new_key.length &&
+                         memcmp(old_key.data, new_key.data, old_key.length) == 0;
+        if (!unchanged) {
+            // Only filters that support removal can forget the old value
+            if (!old_isnull && filter->supportsRemove()) {
+                remove_key(filter, table_oid, col->attnum, &old_key);
+            }
+            if (!new_isnull) {
+                add_key(filter, table_oid, col->attnum, &new_key);
+            }
+        }
+
+        if (!old_isnull) {
+            bloom_key_release(&old_key);
+        }
+        if (!new_isnull) {
+            bloom_key_release(&new_key);
+        }
     }
     
     PG_RETURN_POINTER(newtuple);
 }
 
+Datum octo_bloom_delete_trigger(PG_FUNCTION_ARGS) {
+    TriggerData* trigdata = (TriggerData*) fcinfo->context;
+    
+    if (!TRIGGER_FIRED_AFTER(trigdata->tg_event) ||
+        !TRIGGER_FIRED_BY_DELETE(trigdata->tg_event)) {
+        PG_RETURN_NULL();
+    }
+    if (TRIGGER_FIRED_FOR_STATEMENT(trigdata->tg_event)) {
+        delete_statement(fcinfo, trigdata);
+        PG_RETURN_NULL();
+    }
+    
+    TupleDesc tupdesc = trigdata->tg_relation->rd_att;
+    HeapTuple oldtuple = trigdata->tg_trigtuple;
+    Oid table_oid = trigdata->tg_relation->rd_id;
+    TriggerColumnMap* map = trigger_column_map(fcinfo, trigdata->tg_relation);
+    
+    // Only filters that support removal can drop a value; others keep it
+    // until rebuilt
+    for (int c = 0; c < map->num_columns; ++c) {
+        const TriggerColumn* col = &map->columns[c];
+        if (!col->filter->supportsRemove()) {
+            continue;
+        }
+        BloomKey key;
+        if (tuple_key(col, oldtuple, tupdesc, &key)) {
+            remove_key(col->filter, table_oid, col->attnum, &key);
+            bloom_key_release(&key);
+        }
+    }
+    
+    PG_RETURN_POINTER(oldtuple);
+}
+
+// Create (or recreate) the insert, update and delete triggers that keep a
+// table's filters current. mode is 'row', 'statement' or 'auto': statement
+// triggers with transition tables wherever PostgreSQL allows them, which
+// is everywhere but foreign tables, and row triggers on partitioned tables.
+// Those are cloned onto every partition, present and future, and fire with
+// the partition's rows for its own filters. A partition always gets row
+// triggers: its statement triggers don't fire for rows routed through the
+// parent. Returns the mode used.
+Datum octo_bloom_attach_triggers(PG_FUNCTION_ARGS) {
+    Oid table_oid = PG_GETARG_OID(0);
+    char* mode = text_to_cstring(PG_GETARG_TEXT_PP(1));
+
+    char relkind = get_rel_relkind(table_oid);
+    if (relkind != RELKIND_RELATION && relkind != RELKIND_PARTITIONED_TABLE &&
+        relkind != RELKIND_FOREIGN_TABLE) {
+        ereport(ERROR,
+                (errcode(ERRCODE_WRONG_OBJECT_TYPE),
+                 errmsg("\"%s\" is not a table", get_rel_name(table_oid))));
+    }
+
+    bool partition = get_rel_relispartition(table_oid);
+    bool statement;
+    if (pg_strcasecmp(mode, "auto") == 0) {
+        statement = relkind == RELKIND_RELATION && !partition;
+    } else if (pg_strcasecmp(mode, "statement") == 0) {
+        // A statement trigger would see the parent, not the leaf each row went to
+        if (relkind == RELKIND_PARTITIONED_TABLE) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("statement-level filter triggers are not supported on partitioned table \"%s\"",
+                            get_rel_name(table_oid)),
+                     errhint("Use mode \"row\" or \"auto\".")));
+        }
+        // One on a partition wouldn't fire for rows inserted through the parent
+        if (partition) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+                     errmsg("statement-level filter triggers are not supported on partition \"%s\"",
+                            get_rel_name(table_oid)),
+                     errhint("Use mode \"row\" or \"auto\".")));
+        }
+        statement = true;
+    } else if (pg_strcasecmp(mode, "row") == 0) {
+        statement = false;
+    } else {
+        ereport(ERROR,
+                (errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+                 errmsg("unknown trigger mode \"%s\"", mode),
+                 errhint("Valid modes are \"auto\", \"statement\" and \"row\".")));
+    }
+
+    const char* table = quote_qualified_identifier(
+        get_namespace_name(get_rel_namespace(table_oid)), get_rel_name(table_oid));
+    // The trigger functions live in the schema this function was created in
+    const char* schema = quote_identifier(
+        get_namespace_name(get_func_namespace(fcinfo->flinfo->fn_oid)));
+
+    static const struct {
+        const char* name;
+        const char* event;
+        const char* transition;
+        const char* function;
+    } triggers[] = {
+        {"octo_bloom_insert", "INSERT", "NEW TABLE AS octo_bloom_new", "octo_bloom_insert_trigger"},
+        {"octo_bloom_update", "UPDATE",
+         "OLD TABLE AS octo_bloom_old NEW TABLE AS octo_bloom_new", "octo_bloom_update_trigger"},
+        {"octo_bloom_delete", "DELETE", "OLD TABLE AS octo_bloom_old", "octo_bloom_delete_trigger"},
+    };
+
+    if (SPI_connect() != SPI_OK_CONNECT) {
+        ereport(ERROR,
+                (errcode(ERRCODE_INTERNAL_ERROR),
+                 errmsg("SPI_connect failed")));
+    }
+    for (const auto& trigger : triggers) {
+        StringInfoData sql;
+        initStringInfo(&sql);
+        appendStringInfo(&sql, "DROP TRIGGER IF EXISTS %s ON %s", trigger.name, table);
+        if (SPI_execute(sql.data, false, 0) != SPI_OK_UTILITY) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INTERNAL_ERROR),
+                     errmsg("could not drop trigger \"%s\"", trigger.name)));
+        }
+
+        resetStringInfo(&sql);
+        appendStringInfo(&sql, "CREATE TRIGGER %s AFTER %s ON %s ", trigger.name,
+                         trigger.event, table);
+        if (statement) {
+            appendStringInfo(&sql, "REFERENCING %s FOR EACH STATEMENT ", trigger.transition);
+        } else {
+            appendStringInfoString(&sql, "FOR EACH ROW ");
+        }
+        appendStringInfo(&sql, "EXECUTE FUNCTION %s.%s()", schema, trigger.function);
+        if (SPI_execute(sql.data, false, 0) != SPI_OK_UTILITY) {
+            ereport(ERROR,
+                    (errcode(ERRCODE_INTERNAL_ERROR),
+                     errmsg("could not create trigger \"%s\"", trigger.name)));
+        }
+        pfree(sql.data);
+    }
+    SPI_finish();
+
+    PG_RETURN_TEXT_P(cstring_to_text(statement ? "statement" : "row"));
+}
+
 } // extern "C"
\ No newline at end of file
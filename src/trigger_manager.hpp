@@ -0,0 +1,18 @@
+#ifndef OCTO_BLOOM_TRIGGER_MANAGER_HPP
+#define OCTO_BLOOM_TRIGGER_MANAGER_HPP
+
+#include "shared_memory.hpp"
+
+// GUCs, defined in _PG_init
+extern "C" {
+extern bool octo_bloom_defer_maintenance;
+extern int octo_bloom_max_deferred_keys;
+}
+
+extern "C" {
+// Apply the keys this transaction's triggers have deferred for a column,
+// so a probe in the same transaction sees the rows it inserted
+void apply_deferred_adds(Oid table_oid, int16_t attnum);
+}
+
+#endif // OCTO_BLOOM_TRIGGER_MANAGER_HPP